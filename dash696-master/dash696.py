@@ -46,6 +46,7 @@ class Tcp_Tag:
     RASPICAM_BLOB_YUV =              24
     RASPICAM_FREEZE_EXPOSURE =       25
     RASPICAM_CROSSHAIRS =            26
+    RASPICAM_BLOB_UV_REGION =        27
 
 class Tcp_Params():
     """Camera Parameters"""
@@ -93,7 +94,7 @@ class Tcp_Params():
 
 
     def save(self):
-        data = struct.pack('!10i56x3i4x4diffi296x4?6B2x4f2i28x', self.sharpness, self.contrast, self.brightness,
+        data = struct.pack('!10i56x3i4x4diffi296x4?6B2x4f2i556x', self.sharpness, self.contrast, self.brightness,
                 self.saturation, self.ISO, self.videoStabilisation,
                 self.exposureCompensation, self.exposureMode, self.exposureMeterMode, self.awbMode,
                 self.rotation, self.hflip, self.vflip,
@@ -120,7 +121,7 @@ class Tcp_Params():
             self.test_img_enable, self.yuv_write, self.jpg_write, self.detect_yuv, \
             self.blob_y_min, self.blob_u_min, self.blob_v_min, self.blob_y_max, self.blob_u_max, self.blob_v_max, \
             self.analog_gain_target, self.analog_gain_tol, self.digital_gain_target, self.digital_gain_tol, \
-            self.crosshairs_x, self.crosshairs_y = struct.unpack('!10i56x3i4x4diffi296x4?6B2x4f2i28x', data)
+            self.crosshairs_x, self.crosshairs_y = struct.unpack('!10i56x3i4x4diffi296x4?6B2x4f2i556x', data)
             return True
         except:
             return False
@@ -197,10 +198,10 @@ class Tcp_Comms():
                 self.tcp_params.blob_v_min, self.tcp_params.blob_y_max, self.tcp_params.blob_u_max, \
                 self.tcp_params.blob_v_max, self.tcp_params.analog_gain_target, self.tcp_params.analog_gain_tol, \
                 self.tcp_params.digital_gain_target, self.tcp_params.digital_gain_tol, self.tcp_params.crosshairs_x, \
-                self.tcp_params.crosshairs_y = struct.unpack('!10i56x3i4x4diffi296x4?6B2x4f2i28x', data)
+                self.tcp_params.crosshairs_y = struct.unpack('!10i56x3i4x4diffi296x4?6B2x4f2i556x', data)
 
     def send_tcp_params(self):
-        data = struct.pack('!10i56x3i4x4diffi296x4?6B2x4f2i28x', self.tcp_params.sharpness, self.tcp_params.contrast,
+        data = struct.pack('!10i56x3i4x4diffi296x4?6B2x4f2i556x', self.tcp_params.sharpness, self.tcp_params.contrast,
                            self.tcp_params.brightness, self.tcp_params.saturation, self.tcp_params.ISO,
                            self.tcp_params.videoStabilisation, self.tcp_params.exposureCompensation,
                            self.tcp_params.exposureMode, self.tcp_params.exposureMeterMode, self.tcp_params.awbMode,
@@ -373,8 +374,34 @@ class Tcp_Comms():
     def send_jpg_write_enable(self, value):
         self._send_int_msg(Tcp_Tag.RASPICAM_JPG_WRITE_ENABLE, 1, value)
 
-    def send_blob_yuv(self, y_min, y_max, u_min, u_max, v_min, v_max):
-        data = struct.pack('!BBBBBBB', Tcp_Tag.RASPICAM_BLOB_YUV, y_min, y_max, u_min, u_max, v_min, v_max)
+    def send_blob_yuv(self, y_min, y_max, u_min, u_max, v_min, v_max, class_no=None, class_count=None):
+        """Set the thresholds of color class class_no (default 0), and optionally the number of classes in use."""
+        if class_no is None:
+            data = struct.pack('!BBBBBBB', Tcp_Tag.RASPICAM_BLOB_YUV, y_min, y_max, u_min, u_max, v_min, v_max)
+        elif class_count is None:
+            data = struct.pack('!BBBBBBBB', Tcp_Tag.RASPICAM_BLOB_YUV, y_min, y_max, u_min, u_max, v_min, v_max,
+                               class_no)
+        else:
+            data = struct.pack('!BBBBBBBBB', Tcp_Tag.RASPICAM_BLOB_YUV, y_min, y_max, u_min, u_max, v_min, v_max,
+                               class_no, class_count)
+        self.sock.send(data)
+
+    def send_blob_uv_polygon(self, class_no, vertices):
+        """Make color class class_no accept the (u, v) values inside the polygon given by a list of (u, v) vertices."""
+        data = struct.pack('!BBBB', Tcp_Tag.RASPICAM_BLOB_UV_REGION, class_no, 1, len(vertices))
+        for (u, v) in vertices:
+            data += struct.pack('!BB', u, v)
+        self.sock.send(data)
+
+    def send_blob_uv_ellipse(self, class_no, center_u, center_v, radius_u, radius_v, angle):
+        """Make color class class_no accept the (u, v) values inside the ellipse, rotated by angle degrees."""
+        data = struct.pack('!BBBB5f', Tcp_Tag.RASPICAM_BLOB_UV_REGION, class_no, 2, 0,
+                           center_u, center_v, radius_u, radius_v, angle)
+        self.sock.send(data)
+
+    def send_blob_uv_box(self, class_no):
+        """Make color class class_no use its U and V thresholds again."""
+        data = struct.pack('!BBBB', Tcp_Tag.RASPICAM_BLOB_UV_REGION, class_no, 0, 0)
         self.sock.send(data)
 
     def send_crosshairs(self, x, y):
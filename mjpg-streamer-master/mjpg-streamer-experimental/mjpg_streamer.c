@@ -121,9 +121,10 @@ static void signal_handler(int sig)
     }
     usleep(1000 * 1000);
 
-    /* close handles of input plugins */
+    /* close handles of input plugins and free their frame rings */
     for(i = 0; i < global.incnt; i++) {
         dlclose(global.in[i].handle);
+        input_frame_ring_free(&global.in[i]);
     }
 
     for(i = 0; i < global.outcnt; i++) {
@@ -306,6 +307,13 @@ int main(int argc, char *argv[])
         global.in[i].context   = NULL;
         global.in[i].buf       = NULL;
         global.in[i].size      = 0;
+        global.in[i].latest    = NULL;
+        global.in[i].frame_seq = 0;
+        global.in[i].frame_published = 0;
+        global.in[i].frame_waiters = 0;
+        global.in[i].db_locks = 0;
+        global.in[i].db_wait_usecs = 0;
+        global.in[i].db_wait_max_usecs = 0;
         global.in[i].plugin = (tmp > 0) ? strndup(input[i], tmp) : strdup(input[i]);
         global.in[i].handle = dlopen(global.in[i].plugin, RTLD_LAZY);
         if(!global.in[i].handle) {
@@ -21,6 +21,14 @@
 *******************************************************************************/
 
 #include <syslog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "../mjpg_streamer.h"
 #define INPUT_PLUGIN_PREFIX " i: "
 #define IPRINT(...) { char _bf[1024] = {0}; snprintf(_bf, sizeof(_bf)-1, __VA_ARGS__); fprintf(stderr, "%s", INPUT_PLUGIN_PREFIX); fprintf(stderr, "%s", _bf); syslog(LOG_INFO, "%s", _bf); }
@@ -49,6 +57,21 @@ struct _input_format {
     char currentResolution;
 };
 
+/* number of frames in the ring of each input, see input_frame_*() below */
+#define INPUT_FRAME_RING 16
+
+/* a reference counted JPG frame, immutable once published */
+typedef struct _input_frame input_frame;
+struct _input_frame {
+    unsigned char *buf;
+    int size;
+    int capacity;
+    struct timeval timestamp;
+    unsigned int seq;   /* numbers the published frames from 1 */
+    int refs;           /* 0: free, the ring holds one while it is the latest */
+    int private_copy;   /* 1: a copy made for one consumer, see input_frame_wait() */
+};
+
 /* structure to store variables/functions for input plugin */
 typedef struct _input input;
 struct _input {
@@ -69,6 +92,11 @@ struct _input {
     pthread_mutex_t db;
     pthread_cond_t  db_update;
 
+    /* contention on db, see input_db_lock() */
+    unsigned long db_locks;
+    unsigned long long db_wait_usecs;
+    unsigned long long db_wait_max_usecs;
+
     /* global JPG frame, this is more or less the "database" */
     unsigned char *buf;
     int size;
@@ -76,6 +104,13 @@ struct _input {
     /* v4l2_buffer timestamp */
     struct timeval timestamp;
 
+    /* ring of frames shared by the output plugins without copying */
+    input_frame frames[INPUT_FRAME_RING];
+    input_frame *latest;        /* swapped atomically on publishing */
+    unsigned int frame_seq;     /* seq of latest, written under db, read atomically */
+    int frame_published;        /* set once the plugin publishes to the ring */
+    int frame_waiters;          /* in input_frame_wait_seq(), see there */
+
     input_format *in_formats;
     int formatCount;
     int currentFormat; // holds the current format number
@@ -87,3 +122,323 @@ struct _input {
     int (*run)(int);
     int (*cmd)(int plugin, unsigned int control_id, unsigned int group, int value, char *value_str);
 };
+
+/* lock db, counting the time spent waiting for it */
+static inline void input_db_lock(input *in)
+{
+    struct timespec start, end;
+    unsigned long long usecs;
+
+    if(pthread_mutex_trylock(&in->db) == 0) {
+        in->db_locks++;
+        return;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&in->db);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    usecs = (end.tv_sec - start.tv_sec) * 1000000LL +
+            (end.tv_nsec - start.tv_nsec) / 1000;
+    in->db_locks++;
+    in->db_wait_usecs += usecs;
+    if(usecs > in->db_wait_max_usecs)
+        in->db_wait_max_usecs = usecs;
+}
+
+/* print the contention on db, counted by input_db_lock() */
+static inline void input_db_print_wait(input *in)
+{
+    pthread_mutex_lock(&in->db);
+    IPRINT("db locked %lu times, waited %llu us in total, %llu us at most\n",
+           in->db_locks, in->db_wait_usecs, in->db_wait_max_usecs);
+    pthread_mutex_unlock(&in->db);
+}
+
+/*
+ * The frame ring
+ *
+ * An input plugin publishes each frame by claiming a free slot, filling it
+ * and publishing it, which atomically makes it the latest frame:
+ *
+ *     input_frame *f = input_frame_claim(in, size);
+ *     ...fill f->buf, f->size and f->timestamp...
+ *     input_frame_publish(in, f);
+ *
+ * Plugins that still fill the global buf and size under db can publish a
+ * copy of them instead, with input_frame_publish_buf().  Better, they fill
+ * a back buffer without holding db, copy it into the ring with
+ * input_frame_claim_copy() and only swap it with buf under db.
+ *
+ * An output plugin takes a reference to a frame, uses it without copying
+ * and without holding db, and releases it:
+ *
+ *     unsigned int seq = 0;
+ *     while(!pglobal->stop) {
+ *         input_frame *f = input_frame_wait(in, seq);
+ *         seq = f->seq;
+ *         ...send f->buf, f->size...
+ *         input_frame_release(f);
+ *     }
+ *
+ * The latest frame works as a mailbox: input_frame_get() takes it at once,
+ * and input_frame_wait() returns at once if it is newer than seq, so a
+ * consumer that was busy gets the frame it missed without waiting for the
+ * next.  Otherwise it sleeps on frame_seq without taking db, and publishing
+ * wakes only the threads waiting for that input, only if there are any.
+ * input_frame_wait_seq() waits the same way without taking a reference.
+ *
+ * A slot is reused only once no reference to it is left, so a consumer
+ * holding a frame for a long time keeps that slot from the producer; with
+ * all slots held, new frames are not published to the ring.
+ *
+ * Input plugins that don't publish to the ring keep working: until a frame
+ * has been published, input_frame_wait() waits for db_update as before and
+ * returns a private copy of the global buffer.
+ */
+
+/* release a reference taken by input_frame_get(), input_frame_wait() or
+   input_frame_claim() */
+static inline void input_frame_release(input_frame *f)
+{
+    if(f->private_copy) {
+        free(f->buf);
+        free(f);
+        return;
+    }
+    __atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL);
+}
+
+/* claim a free slot with room for size bytes, or return NULL if none is
+   free or out of memory; the slot holds one reference, for the producer */
+static inline input_frame *input_frame_claim(input *in, int size)
+{
+    int i;
+    for(i = 0; i < INPUT_FRAME_RING; i++) {
+        input_frame *f = &in->frames[i];
+        int free_refs = 0;
+        if(!__atomic_compare_exchange_n(&f->refs, &free_refs, 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+        if(size > f->capacity) {
+            unsigned char *buf = (unsigned char *)realloc(f->buf, size);
+            if(buf == NULL) {
+                __atomic_store_n(&f->refs, 0, __ATOMIC_RELEASE);
+                return NULL;
+            }
+            f->buf = buf;
+            f->capacity = size;
+        }
+        return f;
+    }
+    return NULL;
+}
+
+/* claim a free slot and copy a frame into it, without holding db; returns
+   NULL if no slot is free, else publish it with input_frame_publish_locked() */
+static inline input_frame *input_frame_claim_copy(input *in, const unsigned char *buf, int size, struct timeval timestamp)
+{
+    input_frame *f = input_frame_claim(in, size);
+    if(f == NULL)
+        return NULL;
+    memcpy(f->buf, buf, size);
+    f->size = size;
+    f->timestamp = timestamp;
+    return f;
+}
+
+/* make f, claimed with input_frame_claim(), the latest frame and wake the
+   plugins waiting in input_frame_wait_seq(); db must be held, and the caller
+   broadcasts db_update */
+static inline void input_frame_publish_locked(input *in, input_frame *f)
+{
+    input_frame *old;
+    unsigned int seq = in->frame_seq + 1;
+    f->seq = seq;
+    __atomic_store_n(&in->frame_published, 1, __ATOMIC_RELEASE);
+    /* the producer's reference becomes the ring's */
+    old = __atomic_exchange_n(&in->latest, f, __ATOMIC_ACQ_REL);
+    if(old != NULL)
+        input_frame_release(old);
+    /* the frame is the latest before its seq is, see input_frame_wait() */
+    __atomic_store_n(&in->frame_seq, seq, __ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&in->frame_waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &in->frame_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* make f, claimed with input_frame_claim(), the latest frame and signal
+   the output plugins */
+static inline void input_frame_publish(input *in, input_frame *f)
+{
+    input_db_lock(in);
+    input_frame_publish_locked(in, f);
+    pthread_cond_broadcast(&in->db_update);
+    pthread_mutex_unlock(&in->db);
+}
+
+/* publish a copy of the global buf, size and timestamp; db must be held,
+   and the caller broadcasts db_update; returns -1 if no slot is free */
+static inline int input_frame_publish_buf(input *in)
+{
+    input_frame *f = input_frame_claim_copy(in, in->buf, in->size, in->timestamp);
+    if(f == NULL)
+        return -1;
+    input_frame_publish_locked(in, f);
+    return 0;
+}
+
+/* take a reference to the latest frame, or return NULL if there is none;
+   this never blocks */
+static inline input_frame *input_frame_get(input *in)
+{
+    for(;;) {
+        input_frame *f = __atomic_load_n(&in->latest, __ATOMIC_ACQUIRE);
+        int refs;
+        if(f == NULL)
+            return NULL;
+        /* A slot with no references may be claimed at any moment, so only
+           add to a count that is not 0.  Then make sure the slot is still
+           the latest: if so, it holds a whole frame, and it can't be reused
+           while the reference is held. */
+        refs = __atomic_load_n(&f->refs, __ATOMIC_ACQUIRE);
+        while(refs > 0 &&
+              !__atomic_compare_exchange_n(&f->refs, &refs, refs + 1, 0,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            ;
+        if(refs == 0)
+            continue;
+        if(__atomic_load_n(&in->latest, __ATOMIC_ACQUIRE) == f)
+            return f;
+        input_frame_release(f);
+    }
+}
+
+/* make a private copy of the global buf, size and timestamp, for plugins
+   that don't publish to the ring; db must be held */
+static inline input_frame *input_frame_copy_buf_locked(input *in)
+{
+    input_frame *f = (input_frame *)calloc(1, sizeof(input_frame));
+    if(f == NULL)
+        return NULL;
+    if((f->buf = (unsigned char *)malloc(in->size + 1)) == NULL) {
+        free(f);
+        return NULL;
+    }
+    if(in->buf != NULL)
+        memcpy(f->buf, in->buf, in->size);
+    f->size = in->size;
+    f->capacity = in->size + 1;
+    f->timestamp = in->timestamp;
+    f->private_copy = 1;
+    return f;
+}
+
+/* take a reference to the latest frame without waiting, or a private copy
+   of the global buffer if no frame was published to the ring; returns NULL
+   if out of memory */
+static inline input_frame *input_frame_get_any(input *in)
+{
+    input_frame *f = input_frame_get(in);
+    if(f != NULL)
+        return f;
+    input_db_lock(in);
+    f = input_frame_copy_buf_locked(in);
+    pthread_mutex_unlock(&in->db);
+    return f;
+}
+
+/* unlock db, as cleanup handler of a thread cancelled waiting for
+   db_update */
+static inline void input_db_cleanup(void *arg)
+{
+    pthread_mutex_unlock(&((input *)arg)->db);
+}
+
+/* no longer wait in input_frame_wait_seq(), also when cancelled there */
+static inline void input_frame_unwait(void *arg)
+{
+    __atomic_sub_fetch(&((input *)arg)->frame_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+/* the seq of the latest frame, 0 if none was published; this never blocks */
+static inline unsigned int input_frame_seq(input *in)
+{
+    return __atomic_load_n(&in->frame_seq, __ATOMIC_ACQUIRE);
+}
+
+/* wait until a frame newer than the one numbered seq (0 for any frame) is
+   published, and return the seq of the latest frame; for plugins that don't
+   publish to the ring, wait for the next db_update.  A frame already newer
+   is returned at once.  Waiting takes no lock and wakes only the threads
+   waiting for this input; it is a cancellation point. */
+static inline unsigned int input_frame_wait_seq(input *in, unsigned int seq)
+{
+    unsigned int latest;
+    int type;
+
+    if(!__atomic_load_n(&in->frame_published, __ATOMIC_ACQUIRE)) {
+        input_db_lock(in);
+        pthread_cleanup_push(input_db_cleanup, in);
+        pthread_cond_wait(&in->db_update, &in->db);
+        pthread_cleanup_pop(1);
+        return input_frame_seq(in);
+    }
+
+    /* publishing stores the seq and then looks for waiters, so either it
+       sees this one or the futex sees the new seq */
+    while((latest = __atomic_load_n(&in->frame_seq, __ATOMIC_SEQ_CST)) == seq) {
+        __atomic_add_fetch(&in->frame_waiters, 1, __ATOMIC_SEQ_CST);
+        pthread_cleanup_push(input_frame_unwait, in);
+        /* no lock is held, so the wait may be cancelled anywhere */
+        pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, &type);
+        syscall(SYS_futex, &in->frame_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+        pthread_setcanceltype(type, NULL);
+        pthread_cleanup_pop(1);
+    }
+    return latest;
+}
+
+/* wait for a frame newer than the one numbered seq (0 for any frame), and
+   take a reference to it; returns NULL if out of memory */
+static inline input_frame *input_frame_wait(input *in, unsigned int seq)
+{
+    input_frame *f;
+    int published;
+
+    /* the fast way, without waiting, for a frame that is already there */
+    if(input_frame_seq(in) != seq && (f = input_frame_get(in)) != NULL)
+        return f;
+
+    if(!__atomic_load_n(&in->frame_published, __ATOMIC_ACQUIRE)) {
+        /* compatibility with plugins that only fill the global buffer */
+        input_db_lock(in);
+        pthread_cleanup_push(input_db_cleanup, in);
+        pthread_cond_wait(&in->db_update, &in->db);
+        published = in->frame_published;
+        f = published ? NULL : input_frame_copy_buf_locked(in);
+        pthread_cleanup_pop(1);
+        if(!published)
+            return f;
+    }
+
+    input_frame_wait_seq(in, seq);
+    return input_frame_get(in);
+}
+
+/* wait for the next frame published after the call, as a plain wait for
+   db_update did, and take a reference to it; returns NULL if out of memory */
+static inline input_frame *input_frame_wait_next(input *in)
+{
+    return input_frame_wait(in, input_frame_seq(in));
+}
+
+/* free the buffers of the ring, once no plugin uses it */
+static inline void input_frame_ring_free(input *in)
+{
+    int i;
+    for(i = 0; i < INPUT_FRAME_RING; i++) {
+        free(in->frames[i].buf);
+        in->frames[i].buf = NULL;
+        in->frames[i].capacity = 0;
+        in->frames[i].refs = 0;
+    }
+    in->latest = NULL;
+}
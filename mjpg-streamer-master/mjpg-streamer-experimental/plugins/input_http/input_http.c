@@ -134,6 +134,9 @@ void on_image_received(char * data, int length){
         pglobal->in[plugin_number].size = length;
         memcpy(pglobal->in[plugin_number].buf, data, pglobal->in[plugin_number].size);
 
+        /* share it with the output plugins through the frame ring */
+        input_frame_publish_buf(&pglobal->in[plugin_number]);
+
         /* signal fresh_frame */
         pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
         pthread_mutex_unlock(&pglobal->in[plugin_number].db);
@@ -413,7 +413,13 @@ void *worker_thread(void *arg)
     settings = NULL;
     
     Mat src, dst;
-    vector<uchar> jpeg_buffer;
+    
+    // in->buf points into one buffer while the next picture is encoded into
+    // the other, without holding db
+    vector<uchar> jpeg_buffers[2];
+    int back = 0;
+    struct timeval timestamp;
+    input_frame *frame;
     
     // this exists so that the numpy allocator can assign a custom allocator to
     // the mat, so that it doesn't need to copy the data each time
@@ -427,17 +433,26 @@ void *worker_thread(void *arg)
         // call the filter function
         pctx->filter_process(pctx->filter_ctx, src, dst);
             
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&in->db);
-        
-        // take whatever Mat it returns, and write it to jpeg buffer
-        imencode(".jpg", dst, jpeg_buffer, compression_params);
+        // take whatever Mat it returns, and write it to the back buffer
+        imencode(".jpg", dst, jpeg_buffers[back], compression_params);
+        gettimeofday(&timestamp, NULL);
         
         // TODO: what to do if imencode returns an error?
         
+        /* share it with the output plugins through the frame ring */
+        frame = input_frame_claim_copy(in, &jpeg_buffers[back][0], jpeg_buffers[back].size(), timestamp);
+        
+        /* publish JPG picture, by pointing the global buffer at it */
+        input_db_lock(in);
+        
         // std::vector is guaranteed to be contiguous
-        in->buf = &jpeg_buffer[0];
-        in->size = jpeg_buffer.size();
+        in->buf = &jpeg_buffers[back][0];
+        in->size = jpeg_buffers[back].size();
+        in->timestamp = timestamp;
+        back = 1 - back;
+        
+        if (frame != NULL)
+            input_frame_publish_locked(in, frame);
         
         /* signal fresh_frame */
         pthread_cond_broadcast(&in->db_update);
@@ -458,6 +473,7 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     input * in = (input*)arg;
+    input_db_print_wait(in);
     if (in->context != NULL) {
         context *pctx = (context*)in->context;
         
@@ -264,6 +264,9 @@ void* capture(void* arg)
 						CAMERA_CHECK_GP(res, "gp_file_unref");
 						global->in[plugin_id].size = xsize;
 						DBG("Read %d bytes from camera.\n", global->in[plugin_id].size);
+						/* share it with the output plugins through the frame ring */
+						input_frame_publish_buf(&global->in[plugin_id]);
+
 						pthread_cond_broadcast(&global->in[plugin_id].db_update);
 						pthread_mutex_unlock(&global->in[plugin_id].db);
 						usleep(delay);
@@ -408,6 +408,9 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
       complete = 1;
 
       pData->offset = 0;
+      /* share it with the output plugins through the frame ring */
+      input_frame_publish_buf(&pglobal->in[plugin_number]);
+
       /* signal fresh_frame */
       pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
       pthread_mutex_unlock(&pglobal->in[plugin_number].db);
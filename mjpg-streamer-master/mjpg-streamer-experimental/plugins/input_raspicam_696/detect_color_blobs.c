@@ -47,13 +47,27 @@
  *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#include <stdio.h> /* DEBUG */
+#define _GNU_SOURCE  // for qsort_r()
+#include <stdio.h>
 #include <assert.h>
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
 #include "detect_color_blobs.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DCB_HAVE_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DCB_HAVE_NEON
+#endif
+
 #ifdef DCB_DEBUG
 #define DPRINT(...) fprintf(stderr, __VA_ARGS__)
 #else
@@ -92,7 +106,7 @@ static void stats_add_singleton(Blob_Stats* stats_ptr,
     unsigned short high = col_high - 1;
     if (high > stats_ptr->max_x) stats_ptr->max_x = high;
     if (row < stats_ptr->min_y) stats_ptr->min_y = row;
-    if (row > stats_ptr->min_y) stats_ptr->max_y = row;
+    if (row > stats_ptr->max_y) stats_ptr->max_y = row;
     unsigned long count = col_high - col_low;
     stats_ptr->sum_x += (col_low + col_high - 1) * count / 2;
     stats_ptr->sum_y += row * count;
@@ -127,41 +141,41 @@ typedef struct {
 /* This version is simpler and runs at the same speed, so let't go with this
    one. */
 
-/* Return true if pixel jj within the given uv_row has both u and v values
-   within threshold. */
-static inline bool uv_is_in(int pixels,
-                            const unsigned char uv_row[],
+/* Return true if pixel jj within the given u_row and v_row has both u and v
+   values within threshold. */
+static inline bool uv_is_in(const unsigned char u_row[],
+                            const unsigned char v_row[],
                             unsigned char u_low,
                             unsigned char u_high,
                             unsigned char v_low,
                             unsigned char v_high,
                             int jj) {
     const int uv_offset = jj / 2;
-    unsigned char u = uv_row[uv_offset];
-    unsigned char v = uv_row[(pixels / 4) + uv_offset];
+    unsigned char u = u_row[uv_offset];
+    unsigned char v = v_row[uv_offset];
     return (u >= u_low && u <= u_high && v >= v_low && v <= v_high);
 }
 
 /* Run through a single row of u and v values; for any pixel that is within
    threshold for both u and v, add it to a new uv_run entry. */
-static unsigned int create_uv_run_sequence(const int cols,
-                                           const int rows,
-                                           const unsigned char uv_row[],
+static unsigned int create_uv_run_sequence(const int samples,
+                                           const unsigned char u_row[],
+                                           const unsigned char v_row[],
                                            const unsigned char u_low,
                                            const unsigned char u_high,
                                            const unsigned char v_low,
                                            const unsigned char v_high,
                                            Uv_Run uv_run[]) {
     int uv_run_count = 0;
-    const int pixels = cols * rows;
+    const int cols = 2 * samples;
     int jj = 0;
     while (jj < cols) {
-        if (uv_is_in(pixels, uv_row, u_low, u_high, v_low, v_high, jj)) {
+        if (uv_is_in(u_row, v_row, u_low, u_high, v_low, v_high, jj)) {
             /* Start new run. */
             uv_run[uv_run_count].run_low = jj;
             jj += 2;
             while (jj < cols &&
-                   uv_is_in(pixels, uv_row, u_low, u_high, v_low, v_high, jj)) {
+                   uv_is_in(u_row, v_row, u_low, u_high, v_low, v_high, jj)) {
                 jj += 2;
             }
             /* Stop the run. */
@@ -177,20 +191,19 @@ static unsigned int create_uv_run_sequence(const int cols,
 
 /* Run through a single row of u and v values; for any pixel that is within
    threshold for both u and v, add it to a new uv_run entry. */
-static unsigned int create_uv_run_sequence(const int cols,
-                                           const int rows,
-                                           const unsigned char uv_row[],
+static unsigned int create_uv_run_sequence(const int samples,
+                                           const unsigned char u_row[],
+                                           const unsigned char v_row[],
                                            const unsigned char u_low,
                                            const unsigned char u_high,
                                            const unsigned char v_low,
                                            const unsigned char v_high,
                                            Uv_Run uv_run[]) {
     int uv_run_count = 0;
-    const int pixels = cols * rows;
     int jj = 0;
-    const unsigned char* end_u_ptr = &uv_row[cols / 2];
-    const unsigned char* u_ptr = &uv_row[0];
-    const unsigned char* v_ptr = &uv_row[pixels / 4];
+    const unsigned char* end_u_ptr = &u_row[samples];
+    const unsigned char* u_ptr = &u_row[0];
+    const unsigned char* v_ptr = &v_row[0];
     while (u_ptr < end_u_ptr) {
         if (*u_ptr >= u_low && *u_ptr <= u_high &&
             *v_ptr >= v_low && *v_ptr <= v_high) {
@@ -219,6 +232,279 @@ static unsigned int create_uv_run_sequence(const int cols,
 }
 #endif
 
+/* The vectorized kernels below compare a block of 16 (or 32) U values and the
+   matching V values against the thresholds all at once, and reduce the result
+   to a bitmask with one bit per chroma sample.  Run boundaries are then pulled
+   out of the bitmask with count-trailing-zeros, rather than testing each
+   sample.  The runs produced are exactly those of the SIMPLE2 version above,
+   including the odd run_high (2 * first_out_sample - 1). */
+
+/* Carries the state of a run across blocks of chroma samples. */
+typedef struct {
+    bool in_run;          /// true if the last sample seen was within threshold
+    int uv_run_count;     /// number of used entries within uv_run
+    Uv_Run* uv_run;
+} Uv_Run_Builder;
+
+/* Add the runs described by mask to the builder.  Bit k of mask is set if
+   chroma sample (base + k) is within threshold.  Lanes is the number of
+   samples described by mask (at most 32). */
+static inline void uv_run_builder_add_mask(Uv_Run_Builder* b,
+                                           uint64_t mask,
+                                           int lanes,
+                                           int base) {
+    const uint64_t all = ((uint64_t)1 << lanes) - 1;
+    if (mask == (b->in_run ? all : 0)) return; // no run starts or stops here
+    int pos = 0;
+    while (pos < lanes) {
+        if (b->in_run) {
+            uint64_t out = (~mask & all) >> pos;
+            if (out == 0) break;
+            pos += __builtin_ctzll(out);
+            b->uv_run[b->uv_run_count].run_high = 2 * (base + pos) - 1;
+            ++b->uv_run_count;
+            b->in_run = false;
+        } else {
+            uint64_t in = mask >> pos;
+            if (in == 0) break;
+            pos += __builtin_ctzll(in);
+            b->uv_run[b->uv_run_count].run_low = 2 * (base + pos);
+            b->in_run = true;
+        }
+    }
+}
+
+/* Finish the uv_run sequence: handle chroma samples [first, end) one at a
+   time, then close any run still open. */
+static unsigned int uv_run_builder_finish(Uv_Run_Builder* b,
+                                          const unsigned char u_row[],
+                                          const unsigned char v_row[],
+                                          int first,
+                                          int end,
+                                          unsigned char u_low,
+                                          unsigned char u_high,
+                                          unsigned char v_low,
+                                          unsigned char v_high) {
+    int k;
+    for (k = first; k < end; ++k) {
+        unsigned char u = u_row[k];
+        unsigned char v = v_row[k];
+        bool in = (u >= u_low && u <= u_high && v >= v_low && v <= v_high);
+        uv_run_builder_add_mask(b, in, 1, k);
+    }
+    if (b->in_run) {
+        b->uv_run[b->uv_run_count].run_high = 2 * end - 1;
+        ++b->uv_run_count;
+    }
+    return b->uv_run_count;
+}
+
+#ifdef DCB_HAVE_X86
+__attribute__((target("sse2")))
+static unsigned int create_uv_run_sequence_sse2(const int samples,
+                                                const unsigned char u_row[],
+                                                const unsigned char v_row[],
+                                                const unsigned char u_low,
+                                                const unsigned char u_high,
+                                                const unsigned char v_low,
+                                                const unsigned char v_high,
+                                                Uv_Run uv_run[]) {
+    Uv_Run_Builder b = { false, 0, uv_run };
+    const int end = samples;
+    const __m128i ul = _mm_set1_epi8((char)u_low);
+    const __m128i uh = _mm_set1_epi8((char)u_high);
+    const __m128i vl = _mm_set1_epi8((char)v_low);
+    const __m128i vh = _mm_set1_epi8((char)v_high);
+    int k;
+    for (k = 0; k + 16 <= end; k += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i*)&u_row[k]);
+        __m128i v = _mm_loadu_si128((const __m128i*)&v_row[k]);
+        /* x is within [low, high] iff max(x, low) == x and min(x, high) == x */
+        __m128i in = _mm_and_si128(
+                        _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(u, ul), u),
+                                      _mm_cmpeq_epi8(_mm_min_epu8(u, uh), u)),
+                        _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, vl), v),
+                                      _mm_cmpeq_epi8(_mm_min_epu8(v, vh), v)));
+        uv_run_builder_add_mask(&b, (unsigned int)_mm_movemask_epi8(in), 16, k);
+    }
+    return uv_run_builder_finish(&b, u_row, v_row, k, end,
+                                 u_low, u_high, v_low, v_high);
+}
+
+__attribute__((target("avx2")))
+static unsigned int create_uv_run_sequence_avx2(const int samples,
+                                                const unsigned char u_row[],
+                                                const unsigned char v_row[],
+                                                const unsigned char u_low,
+                                                const unsigned char u_high,
+                                                const unsigned char v_low,
+                                                const unsigned char v_high,
+                                                Uv_Run uv_run[]) {
+    Uv_Run_Builder b = { false, 0, uv_run };
+    const int end = samples;
+    const __m256i ul = _mm256_set1_epi8((char)u_low);
+    const __m256i uh = _mm256_set1_epi8((char)u_high);
+    const __m256i vl = _mm256_set1_epi8((char)v_low);
+    const __m256i vh = _mm256_set1_epi8((char)v_high);
+    int k;
+    for (k = 0; k + 32 <= end; k += 32) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)&u_row[k]);
+        __m256i v = _mm256_loadu_si256((const __m256i*)&v_row[k]);
+        __m256i in = _mm256_and_si256(
+                  _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(u, ul), u),
+                                   _mm256_cmpeq_epi8(_mm256_min_epu8(u, uh), u)),
+                  _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, vl), v),
+                                   _mm256_cmpeq_epi8(_mm256_min_epu8(v, vh), v)));
+        uv_run_builder_add_mask(&b, (unsigned int)_mm256_movemask_epi8(in),
+                                32, k);
+    }
+    return uv_run_builder_finish(&b, u_row, v_row, k, end,
+                                 u_low, u_high, v_low, v_high);
+}
+#endif
+
+#ifdef DCB_HAVE_NEON
+/* NEON has no movemask, so weight each lane with its bit and add the lanes
+   together pairwise.  This works on both ARMv7 (the Pi) and ARMv8. */
+static inline unsigned int neon_movemask(uint8x16_t in) {
+    static const uint8_t weight[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+                                        1, 2, 4, 8, 16, 32, 64, 128 };
+    uint8x16_t bits = vandq_u8(in, vld1q_u8(weight));
+    uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    sum = vpadd_u8(sum, sum);
+    sum = vpadd_u8(sum, sum);
+    return vget_lane_u16(vreinterpret_u16_u8(sum), 0);
+}
+
+static unsigned int create_uv_run_sequence_neon(const int samples,
+                                                const unsigned char u_row[],
+                                                const unsigned char v_row[],
+                                                const unsigned char u_low,
+                                                const unsigned char u_high,
+                                                const unsigned char v_low,
+                                                const unsigned char v_high,
+                                                Uv_Run uv_run[]) {
+    Uv_Run_Builder b = { false, 0, uv_run };
+    const int end = samples;
+    const uint8x16_t ul = vdupq_n_u8(u_low);
+    const uint8x16_t uh = vdupq_n_u8(u_high);
+    const uint8x16_t vl = vdupq_n_u8(v_low);
+    const uint8x16_t vh = vdupq_n_u8(v_high);
+    int k;
+    for (k = 0; k + 16 <= end; k += 16) {
+        uint8x16_t u = vld1q_u8(&u_row[k]);
+        uint8x16_t v = vld1q_u8(&v_row[k]);
+        uint8x16_t in = vandq_u8(vandq_u8(vcgeq_u8(u, ul), vcleq_u8(u, uh)),
+                                 vandq_u8(vcgeq_u8(v, vl), vcleq_u8(v, vh)));
+        uv_run_builder_add_mask(&b, neon_movemask(in), 16, k);
+    }
+    return uv_run_builder_finish(&b, u_row, v_row, k, end,
+                                 u_low, u_high, v_low, v_high);
+}
+#endif
+
+typedef unsigned int (*Uv_Run_Sequence_Fn)(const int samples,
+                                           const unsigned char u_row[],
+                                           const unsigned char v_row[],
+                                           const unsigned char u_low,
+                                           const unsigned char u_high,
+                                           const unsigned char v_low,
+                                           const unsigned char v_high,
+                                           Uv_Run uv_run[]);
+
+/* The kernel in use.  Selected once by kernel_init(), on the first call to
+   any function that needs it, then by detect_color_blobs_set_kernel(). */
+static Uv_Run_Sequence_Fn uv_run_sequence_fn = NULL;
+static Dcb_Kernel uv_run_sequence_kernel = DCB_KERNEL_AUTO;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static bool kernel_is_supported(Dcb_Kernel kernel) {
+    switch (kernel) {
+    case DCB_KERNEL_SCALAR:
+        return true;
+#ifdef DCB_HAVE_X86
+    case DCB_KERNEL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case DCB_KERNEL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#ifdef DCB_HAVE_NEON
+    case DCB_KERNEL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+static Dcb_Kernel select_kernel(Dcb_Kernel kernel) {
+    if (kernel == DCB_KERNEL_AUTO) {
+        if (kernel_is_supported(DCB_KERNEL_AVX2)) {
+            kernel = DCB_KERNEL_AVX2;
+        } else if (kernel_is_supported(DCB_KERNEL_SSE2)) {
+            kernel = DCB_KERNEL_SSE2;
+        } else if (kernel_is_supported(DCB_KERNEL_NEON)) {
+            kernel = DCB_KERNEL_NEON;
+        } else {
+            kernel = DCB_KERNEL_SCALAR;
+        }
+    } else if (!kernel_is_supported(kernel)) {
+        kernel = DCB_KERNEL_SCALAR;
+    }
+    switch (kernel) {
+#ifdef DCB_HAVE_X86
+    case DCB_KERNEL_SSE2:
+        uv_run_sequence_fn = create_uv_run_sequence_sse2;
+        break;
+    case DCB_KERNEL_AVX2:
+        uv_run_sequence_fn = create_uv_run_sequence_avx2;
+        break;
+#endif
+#ifdef DCB_HAVE_NEON
+    case DCB_KERNEL_NEON:
+        uv_run_sequence_fn = create_uv_run_sequence_neon;
+        break;
+#endif
+    default:
+        uv_run_sequence_fn = create_uv_run_sequence;
+        break;
+    }
+    uv_run_sequence_kernel = kernel;
+    return kernel;
+}
+
+static void kernel_init(void) {
+    (void)select_kernel(DCB_KERNEL_AUTO);
+}
+
+/* Pick the fastest UV threshold kernel this CPU supports, unless one was
+   picked already.  The band workers of detect_color_blobs_banded() all get
+   here at once on the first frame, so only one of them may pick it. */
+static inline void kernel_init_once(void) {
+    (void)pthread_once(&kernel_once, kernel_init);
+}
+
+Dcb_Kernel detect_color_blobs_set_kernel(Dcb_Kernel kernel) {
+    kernel_init_once();
+    return select_kernel(kernel);
+}
+
+Dcb_Kernel detect_color_blobs_get_kernel(void) {
+    kernel_init_once();
+    return uv_run_sequence_kernel;
+}
+
+const char* detect_color_blobs_kernel_name(Dcb_Kernel kernel) {
+    switch (kernel) {
+    case DCB_KERNEL_AUTO:   return "auto";
+    case DCB_KERNEL_SCALAR: return "scalar";
+    case DCB_KERNEL_SSE2:   return "sse2";
+    case DCB_KERNEL_AVX2:   return "avx2";
+    case DCB_KERNEL_NEON:   return "neon";
+    }
+    return "unknown";
+}
+
 /**************************************
  ****                              ****
  ****    Operations on Yuv_Runs    ****
@@ -557,7 +843,7 @@ static void yuv_run_union(Blob_List* p,
 static unsigned int detect_yuv_runs_in_row(Blob_List* p,
                                            int cols,
                                            int rows,
-                                           unsigned char y_row[],
+                                           const unsigned char y_row[],
                                            int uv_run_count,
                                            Uv_Run uv_run[],
                                            unsigned char y_low,
@@ -630,18 +916,103 @@ static void yuv_run_row_union(Blob_List* p,
 }
 
 
-void detect_color_blobs(Blob_List* p,
-                        unsigned char y_low,
-                        unsigned char u_low,
-                        unsigned char u_high,
-                        unsigned char v_low,
-                        unsigned char v_high,
-                        bool highlight_detected_pixels,
-                        int cols,
-                        int rows,
-                        unsigned char yuv[]) {
-    /* Allocate memory for intermediate results. */
+/****************************************
+ ****                                ****
+ ****    Per-frame scratch memory    ****
+ ****                                ****
+ ****************************************/
+
+/* Every scratch allocation is rounded up to this many bytes, so that any
+   type may be stored in it. */
+#define SCRATCH_ALIGN 16
+
+static inline size_t scratch_round_up(size_t bytes) {
+    return (bytes + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+}
+
+/* The run arrays needed to scan rows of an image cols pixels wide.
+   First_runs is only used by detect_color_blobs_banded(). */
+typedef struct {
+    Uv_Run* uv_run;
+    Yuv_Run* first_runs;
+    Yuv_Run* yuv_run_a;
+    Yuv_Run* yuv_run_b;
+} Row_Scratch;
+
+static size_t row_scratch_bytes(int cols) {
+    return scratch_round_up(sizeof(Uv_Run) * (cols / 4 + 1)) +
+           3 * scratch_round_up(sizeof(Yuv_Run) * (cols / 2 + 1));
+}
+
+/* Make sure the scratch arena of p can hold the run arrays for an image cols
+   pixels wide, plus BLOB_LIST_USER_SCRATCH_BYTES.  This only touches the heap
+   if cols is wider than any image seen before.  Must only be called while no
+   scratch memory is in use, since the arena may move. */
+static bool blob_list_reserve_cols(Blob_List* p, int cols) {
+    if (cols <= p->max_cols) return true;
+    size_t bytes = row_scratch_bytes(cols) + BLOB_LIST_USER_SCRATCH_BYTES;
+    unsigned char* scratch = (unsigned char*)realloc(p->scratch, bytes);
+    ++p->heap_alloc_count;
+    if (scratch == NULL) return false;
+    p->scratch = scratch;
+    p->scratch_bytes = bytes;
+    p->max_cols = cols;
+    return true;
+}
+
+/* Take the run arrays from the scratch arena.  Blob_list_reserve_cols() must
+   have succeeded first, so this cannot fail. */
+static void row_scratch_alloc(Blob_List* p, int cols, Row_Scratch* rs) {
+    rs->uv_run = (Uv_Run*)blob_list_scratch_alloc(
+                                        p, sizeof(Uv_Run) * (cols / 4 + 1));
+    rs->first_runs = (Yuv_Run*)blob_list_scratch_alloc(
+                                        p, sizeof(Yuv_Run) * (cols / 2 + 1));
+    rs->yuv_run_a = (Yuv_Run*)blob_list_scratch_alloc(
+                                        p, sizeof(Yuv_Run) * (cols / 2 + 1));
+    rs->yuv_run_b = (Yuv_Run*)blob_list_scratch_alloc(
+                                        p, sizeof(Yuv_Run) * (cols / 2 + 1));
+    assert(rs->yuv_run_b != NULL);
+}
+
+void* blob_list_scratch_alloc(Blob_List* p, size_t bytes) {
+    bytes = scratch_round_up(bytes);
+    if (p->scratch_used + bytes > p->scratch_bytes) return NULL;
+    void* ptr = &p->scratch[p->scratch_used];
+    p->scratch_used += bytes;
+    return ptr;
+}
 
+
+/* Detect blobs in rows [row_begin, row_end) of the image, adding them to the
+   Blob_List.  Only every row_step'th row is looked at, and only columns
+   [col_begin, col_end) of it; col_begin must be even.  Rows that are looked
+   at are treated as neighbors.  The runs of row_begin are built in
+   first_runs, and the other rows alternate between yuv_run_a and yuv_run_b.
+   (First_runs may be the same as yuv_run_a.)  Since the runs of the first
+   and last rows are never overwritten, the caller can use them later to
+   union these rows with neighboring rows.  Returns a pointer to the runs of
+   the last row. */
+static Yuv_Run* detect_color_blobs_in_rows(Blob_List* p,
+                                           unsigned char y_low,
+                                           unsigned char u_low,
+                                           unsigned char u_high,
+                                           unsigned char v_low,
+                                           unsigned char v_high,
+                                           bool highlight_detected_pixels,
+                                           int cols,
+                                           int rows,
+                                           unsigned char yuv[],
+                                           int col_begin,
+                                           int col_end,
+                                           int row_begin,
+                                           int row_end,
+                                           int row_step,
+                                           Uv_Run uv_run[],
+                                           Yuv_Run first_runs[],
+                                           int* first_count_ptr,
+                                           Yuv_Run yuv_run_a[],
+                                           Yuv_Run yuv_run_b[],
+                                           int* last_count_ptr) {
     int ii;
 
     /* The uv_run array contains runs in the current row of pixel sequences
@@ -650,50 +1021,58 @@ void detect_color_blobs(Blob_List* p,
        contiguous even/odd row pairs.  Hence, we only need to calculate
        uv_run every other row. */
 
-    const int max_uv_runs_in_row = cols / 4;
-    Uv_Run* uv_run = (Uv_Run*)malloc(sizeof(Uv_Run) * max_uv_runs_in_row);
     int uv_run_count = 0; // number of used entries within uv_run
+    int uv_run_row = -1;  // the chroma row uv_run was built from
+    const int window_cols = col_end - col_begin;
 
     /* The yuv_run0 array contains all Yuv_Runs from the previous row. */
 
-    const int max_yuv_runs_in_row = cols / 2;
-    Yuv_Run* yuv_run0 = (Yuv_Run*)malloc(sizeof(Yuv_Run) * max_yuv_runs_in_row);
+    Yuv_Run* yuv_run0 = NULL;
     int yuv_run0_count = 0; // number of used entries within yuv_run0
 
-    /* All Yuv_Runs from this row. */
-
-    Yuv_Run* yuv_run1 = (Yuv_Run*)malloc(sizeof(Yuv_Run) * max_yuv_runs_in_row);
+    kernel_init_once();
 
-    /* Clear out the Blob_List. */
-
-    blob_list_clear(p);
-
-    for (ii = 0; ii < rows; ++ii) {
+    for (ii = row_begin; ii < row_end; ii += row_step) {
         /* Process row ii of the image. */
 
-        if ((ii & 0x01) == 0) {
-            /* Even row.  Update uv_run. */
+        if (ii / 2 != uv_run_row) {
+            /* First row of a new pair.  Update uv_run. */
 
-            int uv_offset = (ii / 2) * (cols / 2);
+            int uv_offset = (ii / 2) * (cols / 2) + col_begin / 2;
             int pixels = cols * rows;
-            unsigned char* uv_row = &yuv[pixels + uv_offset];
-            uv_run_count = create_uv_run_sequence(cols, rows, uv_row, u_low,
-                                                  u_high, v_low, v_high,
-                                                  uv_run);
+            unsigned char* u_row = &yuv[pixels + uv_offset];
+            uv_run_count = uv_run_sequence_fn((window_cols + 1) / 2, u_row,
+                                              &u_row[pixels / 4], u_low,
+                                              u_high, v_low, v_high, uv_run);
+            uv_run_row = ii / 2;
         }
 
+        /* All Yuv_Runs from this row. */
+
+        Yuv_Run* yuv_run1 = (ii == row_begin) ? first_runs :
+                            (yuv_run0 == yuv_run_a) ? yuv_run_b : yuv_run_a;
+
         /* Detect all YUV blob runs in the row. */
 
-        unsigned char* y_row = &yuv[ii * cols];
-        int yuv_run1_count = detect_yuv_runs_in_row(p, cols, rows, y_row,
-                                                    uv_run_count, uv_run, y_low,
-                                                    yuv_run1);
+        unsigned char* y_row = &yuv[ii * cols + col_begin];
+        int yuv_run1_count = detect_yuv_runs_in_row(p, window_cols, rows,
+                                                    y_row, uv_run_count,
+                                                    uv_run, y_low, yuv_run1);
+        if (col_begin != 0) {
+            int jj;
+            for (jj = 0; jj < yuv_run1_count; ++jj) {
+                yuv_run1[jj].run_low += col_begin;
+                yuv_run1[jj].run_high += col_begin;
+            }
+        }
+        if (ii == row_begin) *first_count_ptr = yuv_run1_count;
 
         /* (optional) Mark detected pixels in the image. */
 
         if (highlight_detected_pixels) {
             int jj;
             int kk = 0;
+            y_row -= col_begin;
             for (jj = 0; jj < yuv_run1_count; ++jj) {
                 /* Supress non-detected pixels. */
                 while (kk < yuv_run1[jj].run_low) {
@@ -718,21 +1097,1156 @@ void detect_color_blobs(Blob_List* p,
         /* If a run contains any 4-neighbors in common with a run from the
            previous row, add it to the Blob_List. */
 
-        yuv_run_row_union(p, ii - 1, yuv_run0_count, yuv_run0,
+        yuv_run_row_union(p, ii - row_step, yuv_run0_count, yuv_run0,
                           ii, yuv_run1_count, yuv_run1);
 
         /* Set up yuv_run0 for next loop. */
 
-        Yuv_Run* swap_tmp = yuv_run0;
         yuv_run0 = yuv_run1;
-        yuv_run1 = swap_tmp;
         yuv_run0_count = yuv_run1_count;
     }
-    free(yuv_run1);
-    free(yuv_run0);
-    free(uv_run);
+    *last_count_ptr = yuv_run0_count;
+    return yuv_run0;
 }
 
+
+void detect_color_blobs(Blob_List* p,
+                        unsigned char y_low,
+                        unsigned char u_low,
+                        unsigned char u_high,
+                        unsigned char v_low,
+                        unsigned char v_high,
+                        bool highlight_detected_pixels,
+                        int cols,
+                        int rows,
+                        unsigned char yuv[]) {
+    Row_Scratch rs;
+    int first_count;
+    int last_count;
+
+    /* Clear out the Blob_List. */
+
+    blob_list_clear(p);
+
+    /* Take memory for intermediate results from the scratch arena.  It is
+       handed back when we are done, so the caller can use it. */
+
+    if (!blob_list_reserve_cols(p, cols)) return;
+    const size_t scratch_mark = p->scratch_used;
+    row_scratch_alloc(p, cols, &rs);
+    (void)detect_color_blobs_in_rows(p, y_low, u_low, u_high, v_low, v_high,
+                                     highlight_detected_pixels, cols, rows,
+                                     yuv, 0, cols, 0, rows, 1,
+                                     rs.uv_run, rs.yuv_run_a,
+                                     &first_count, rs.yuv_run_a, rs.yuv_run_b,
+                                     &last_count);
+    p->scratch_used = scratch_mark;
+}
+
+
+/***************************************
+ ****                               ****
+ ****    Multi-class detection      ****
+ ****                               ****
+ ***************************************/
+
+/* Is (u, v) inside the polygon, or on its boundary?  The crossing number
+   test decides the inside; points exactly on an edge are checked first so
+   that the boundary is always included, as it is for a box. */
+static bool polygon_contains(const Uv_Region* r, int u, int v) {
+    const int n = r->vertex_count;
+    bool inside = false;
+    int i;
+    int j;
+    if (n < 1 || n > MAX_UV_POLYGON_VERTICES) return false;
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        const int ui = r->u[i];
+        const int vi = r->v[i];
+        const int uj = r->u[j];
+        const int vj = r->v[j];
+        if ((uj - ui) * (v - vi) == (vj - vi) * (u - ui) &&
+            u >= (ui < uj ? ui : uj) && u <= (ui < uj ? uj : ui) &&
+            v >= (vi < vj ? vi : vj) && v <= (vi < vj ? vj : vi)) {
+            return true;
+        }
+        if ((vi > v) != (vj > v)) {
+            /* The edge crosses the line V = v.  Toggle if the crossing is
+               to the right of u, i.e.
+               u < ui + (v - vi) * (uj - ui) / (vj - vi). */
+
+            int lhs = (u - ui) * (vj - vi);
+            int rhs = (v - vi) * (uj - ui);
+            if ((vj > vi) ? (lhs < rhs) : (lhs > rhs)) inside = !inside;
+        }
+    }
+    return inside;
+}
+
+/* Is (u, v) inside the ellipse, or on its boundary? */
+static bool ellipse_contains(const Uv_Region* r, int u, int v) {
+    const double radians = r->angle * (M_PI / 180.0);
+    const double c = cos(radians);
+    const double s = sin(radians);
+    const double du = u - r->center_u;
+    const double dv = v - r->center_v;
+    double a;
+    double b;
+    if (r->radius_u <= 0.0f || r->radius_v <= 0.0f) return false;
+    a = (du * c + dv * s) / r->radius_u;
+    b = (dv * c - du * s) / r->radius_v;
+    return a * a + b * b <= 1.0 + 1e-9;
+}
+
+bool uv_region_contains(const Color_Class* k,
+                        const Uv_Region* r,
+                        int u,
+                        int v) {
+    if (r == NULL || r->type == UV_REGION_BOX) {
+        return u >= k->u_low && u <= k->u_high &&
+               v >= k->v_low && v <= k->v_high;
+    } else if (r->type == UV_REGION_POLYGON) {
+        return polygon_contains(r, u, v);
+    } else if (r->type == UV_REGION_ELLIPSE) {
+        return ellipse_contains(r, u, v);
+    }
+    return false;
+}
+
+static unsigned char clamp_to_uchar(double x) {
+    if (x <= 0.0) return 0;
+    if (x >= 255.0) return 255;
+    return (unsigned char)x;
+}
+
+void uv_region_bounding_box(const Uv_Region* r, Color_Class* k) {
+    if (r->type == UV_REGION_POLYGON && r->vertex_count > 0) {
+        int i;
+        k->u_low = k->u_high = r->u[0];
+        k->v_low = k->v_high = r->v[0];
+        for (i = 1; i < r->vertex_count && i < MAX_UV_POLYGON_VERTICES; ++i) {
+            if (r->u[i] < k->u_low) k->u_low = r->u[i];
+            if (r->u[i] > k->u_high) k->u_high = r->u[i];
+            if (r->v[i] < k->v_low) k->v_low = r->v[i];
+            if (r->v[i] > k->v_high) k->v_high = r->v[i];
+        }
+    } else if (r->type == UV_REGION_ELLIPSE) {
+        /* Half widths of the bounding box of the rotated ellipse. */
+
+        const double radians = r->angle * (M_PI / 180.0);
+        const double c = cos(radians);
+        const double s = sin(radians);
+        const double hu = sqrt(r->radius_u * r->radius_u * c * c +
+                               r->radius_v * r->radius_v * s * s);
+        const double hv = sqrt(r->radius_u * r->radius_u * s * s +
+                               r->radius_v * r->radius_v * c * c);
+        k->u_low = clamp_to_uchar(floor(r->center_u - hu));
+        k->u_high = clamp_to_uchar(ceil(r->center_u + hu));
+        k->v_low = clamp_to_uchar(floor(r->center_v - hv));
+        k->v_high = clamp_to_uchar(ceil(r->center_v + hv));
+    }
+}
+
+bool color_class_table_set(Color_Class_Table* t,
+                           int class_count,
+                           const Color_Class color_class[]) {
+    return color_class_table_set_regions(t, class_count, color_class, NULL);
+}
+
+bool color_class_table_set_regions(Color_Class_Table* t,
+                                   int class_count,
+                                   const Color_Class color_class[],
+                                   const Uv_Region uv_region[]) {
+    Uv_Region region[MAX_COLOR_CLASSES];
+    int c;
+    if (class_count < 0) class_count = 0;
+    if (class_count > MAX_COLOR_CLASSES) class_count = MAX_COLOR_CLASSES;
+
+    /* A NULL uv_region means all boxes; make it an array of boxes so both
+       forms compare the same. */
+
+    memset(region, 0, sizeof(region));
+    if (uv_region != NULL) {
+        memcpy(region, uv_region, class_count * sizeof(region[0]));
+    }
+    if (t->class_count == class_count &&
+        memcmp(t->color_class, color_class,
+               class_count * sizeof(color_class[0])) == 0 &&
+        memcmp(t->uv_region, region, class_count * sizeof(region[0])) == 0) {
+        return false;
+    }
+    t->class_count = class_count;
+    memcpy(t->color_class, color_class, class_count * sizeof(color_class[0]));
+    memcpy(t->uv_region, region, class_count * sizeof(region[0]));
+    t->all_boxes = true;
+    memset(t->uv_class_mask, 0, sizeof(t->uv_class_mask));
+    for (c = 0; c < class_count; ++c) {
+        const unsigned char bit = 1 << c;
+        const Uv_Region* r = &region[c];
+        Color_Class k = color_class[c];
+        int u;
+        int v;
+        if (r->type == UV_REGION_BOX) {
+            for (u = k.u_low; u <= k.u_high; ++u) {
+                unsigned char* row = &t->uv_class_mask[u << 8];
+                for (v = k.v_low; v <= k.v_high; ++v) row[v] |= bit;
+            }
+            continue;
+        }
+
+        /* Only the bounding box of the region need be tested. */
+
+        t->all_boxes = false;
+        k.u_low = 255;
+        k.u_high = 0;
+        k.v_low = 255;
+        k.v_high = 0;
+        uv_region_bounding_box(r, &k);
+        for (u = k.u_low; u <= k.u_high; ++u) {
+            unsigned char* row = &t->uv_class_mask[u << 8];
+            for (v = k.v_low; v <= k.v_high; ++v) {
+                if (uv_region_contains(&k, r, u, v)) row[v] |= bit;
+            }
+        }
+    }
+    return true;
+}
+
+/* Parse a line of a color class file; see color_classes_read().  Return
+   true if a class was found, setting *k and *r.  Set *error_ptr if the line
+   is neither a class nor blank. */
+static bool parse_color_class_line(char* line,
+                                   Color_Class* k,
+                                   Uv_Region* r,
+                                   bool* error_ptr) {
+    char type[16];
+    int y_low;
+    int offset;
+    char* hash = strchr(line, '#');
+    *error_ptr = false;
+    if (hash != NULL) *hash = '\0';
+    memset(k, 0, sizeof(*k));
+    memset(r, 0, sizeof(*r));
+    if (sscanf(line, "%15s %d%n", type, &y_low, &offset) != 2) {
+        char dummy[2];
+        *error_ptr = (sscanf(line, "%1s", dummy) == 1);
+        return false;
+    }
+    if (y_low < 0 || y_low > 255) {
+        *error_ptr = true;
+        return false;
+    }
+    k->y_low = y_low;
+    line += offset;
+    if (strcmp(type, "box") == 0) {
+        int ul, uh, vl, vh;
+        r->type = UV_REGION_BOX;
+        if (sscanf(line, "%d %d %d %d", &ul, &uh, &vl, &vh) != 4 ||
+            ul < 0 || ul > 255 || uh < 0 || uh > 255 ||
+            vl < 0 || vl > 255 || vh < 0 || vh > 255) {
+            *error_ptr = true;
+            return false;
+        }
+        k->u_low = ul;
+        k->u_high = uh;
+        k->v_low = vl;
+        k->v_high = vh;
+        return true;
+    } else if (strcmp(type, "polygon") == 0) {
+        int u;
+        int v;
+        r->type = UV_REGION_POLYGON;
+        while (sscanf(line, " %d , %d%n", &u, &v, &offset) == 2) {
+            if (r->vertex_count >= MAX_UV_POLYGON_VERTICES ||
+                u < 0 || u > 255 || v < 0 || v > 255) {
+                *error_ptr = true;
+                return false;
+            }
+            r->u[r->vertex_count] = u;
+            r->v[r->vertex_count] = v;
+            ++r->vertex_count;
+            line += offset;
+        }
+        if (r->vertex_count < 3 || strspn(line, " \t\r\n") != strlen(line)) {
+            *error_ptr = true;
+            return false;
+        }
+    } else if (strcmp(type, "ellipse") == 0) {
+        r->type = UV_REGION_ELLIPSE;
+        if (sscanf(line, "%f %f %f %f %f", &r->center_u, &r->center_v,
+                   &r->radius_u, &r->radius_v, &r->angle) != 5 ||
+            r->radius_u <= 0.0f || r->radius_v <= 0.0f) {
+            *error_ptr = true;
+            return false;
+        }
+    } else {
+        *error_ptr = true;
+        return false;
+    }
+    uv_region_bounding_box(r, k);
+    return true;
+}
+
+int color_classes_read(const char* path,
+                       Color_Class color_class[],
+                       Uv_Region uv_region[]) {
+    char line[256];
+    int line_no = 0;
+    int count = 0;
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "can't open color class file %s\n", path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        Color_Class k;
+        Uv_Region r;
+        bool error_seen;
+        ++line_no;
+        if (!parse_color_class_line(line, &k, &r, &error_seen)) {
+            if (!error_seen) continue;
+            fprintf(stderr, "%s:%d: bad color class\n", path, line_no);
+            count = -1;
+            break;
+        }
+        if (count >= MAX_COLOR_CLASSES) {
+            fprintf(stderr, "%s:%d: more than %d color classes\n",
+                    path, line_no, MAX_COLOR_CLASSES);
+            count = -1;
+            break;
+        }
+        color_class[count] = k;
+        uv_region[count] = r;
+        ++count;
+    }
+    fclose(fp);
+    return count;
+}
+
+/* Start or stop the runs of the classes that chroma sample k is in, m, but
+   the sample before it is not, in, or the other way around.  Returns m. */
+static inline unsigned int class_runs_update(unsigned int in,
+                                             unsigned int m,
+                                             int k,
+                                             Uv_Run* uv_run[],
+                                             int uv_run_count[]) {
+    unsigned int changed = m ^ in;
+    while (changed != 0) {
+        int c = __builtin_ctz(changed);
+        if (m & (1 << c)) {
+            uv_run[c][uv_run_count[c]].run_low = 2 * k;
+        } else {
+            uv_run[c][uv_run_count[c]].run_high = 2 * k - 1;
+            ++uv_run_count[c];
+        }
+        changed &= changed - 1;
+    }
+    return m;
+}
+
+/* Handle chroma samples [first, samples) one lookup at a time, then close
+   the runs of the classes in, still open at the end of the row. */
+static void class_runs_finish(const Color_Class_Table* t,
+                              const unsigned char u_row[],
+                              const unsigned char v_row[],
+                              int first,
+                              int samples,
+                              unsigned int in,
+                              Uv_Run* uv_run[],
+                              int uv_run_count[]) {
+    const unsigned char* mask = t->uv_class_mask;
+    int k;
+    int c;
+    for (k = first; k < samples; ++k) {
+        in = class_runs_update(in, mask[(u_row[k] << 8) | v_row[k]], k,
+                               uv_run, uv_run_count);
+    }
+    while (in != 0) {
+        c = __builtin_ctz(in);
+        uv_run[c][uv_run_count[c]].run_high = 2 * samples - 1;
+        ++uv_run_count[c];
+        in &= in - 1;
+    }
+}
+
+/* Build the uv_run sequence of every class for a single row of u and v
+   values, in one pass.  Each chroma sample costs one table lookup; runs are
+   only started or stopped where the set of classes changes.  The runs of each
+   class are exactly those create_uv_run_sequence() would produce for the
+   thresholds of that class. */
+static void create_class_uv_run_sequences_lut(const Color_Class_Table* t,
+                                              const int cols,
+                                              const int rows,
+                                              const unsigned char uv_row[],
+                                              Uv_Run* uv_run[],
+                                              int uv_run_count[]) {
+    int c;
+    for (c = 0; c < t->class_count; ++c) uv_run_count[c] = 0;
+    class_runs_finish(t, uv_row, &uv_row[(cols * rows) / 4], 0,
+                      (cols + 1) / 2, 0, uv_run, uv_run_count);
+}
+
+/* The vectorized versions below test a block of chroma samples against the
+   boxes of all classes, and OR the bit of each class into a single class
+   mask per sample.  Comparing the masks with those shifted by one sample
+   gives a bitmask of the samples where the set of classes changes, so a
+   block where it does not change is skipped with one test, and the runs of
+   every class are pulled out of the others with class_runs_update(), as for
+   the lookup table.  They must only be used if t->all_boxes.
+
+   U is within [low, high] iff (U - low) saturating-minus (high - low) is 0,
+   all modulo 256, so a sample is in a class iff that is 0 for both U and V,
+   or for their OR.  With the compare against 0 and putting the bit of the
+   class into the mask that is eight operations per class and block, where
+   the single class kernels take eleven, and then a movemask and a check for
+   runs of their own.  A class with an empty range gets no bit at all. */
+
+/* The bit of class c, with thresholds k, in the class mask: 0 if k has an
+   empty range. */
+static inline unsigned char class_bit(const Color_Class* k, int c) {
+    return (k->u_low <= k->u_high && k->v_low <= k->v_high) ? 1 << c : 0;
+}
+
+#ifdef DCB_HAVE_X86
+__attribute__((target("sse2")))
+static void create_class_uv_run_sequences_sse2(const Color_Class_Table* t,
+                                               const int cols,
+                                               const int rows,
+                                               const unsigned char uv_row[],
+                                               Uv_Run* uv_run[],
+                                               int uv_run_count[]) {
+    const unsigned char* u_row = uv_row;
+    const unsigned char* v_row = &uv_row[(cols * rows) / 4];
+    const int samples = (cols + 1) / 2;
+    const int class_count = t->class_count;
+    __m128i ul[MAX_COLOR_CLASSES];
+    __m128i ur[MAX_COLOR_CLASSES]; // u_high - u_low
+    __m128i vl[MAX_COLOR_CLASSES];
+    __m128i vr[MAX_COLOR_CLASSES]; // v_high - v_low
+    __m128i bit[MAX_COLOR_CLASSES];
+    const __m128i zero = _mm_setzero_si128();
+    unsigned char m[16];
+    unsigned int in = 0; // classes with a run open
+    int k;
+    int c;
+    for (c = 0; c < class_count; ++c) {
+        const Color_Class* kc = &t->color_class[c];
+        ul[c] = _mm_set1_epi8((char)kc->u_low);
+        ur[c] = _mm_set1_epi8((char)(kc->u_high - kc->u_low));
+        vl[c] = _mm_set1_epi8((char)kc->v_low);
+        vr[c] = _mm_set1_epi8((char)(kc->v_high - kc->v_low));
+        bit[c] = _mm_set1_epi8((char)class_bit(kc, c));
+        uv_run_count[c] = 0;
+    }
+    for (k = 0; k + 16 <= samples; k += 16) {
+        __m128i u = _mm_loadu_si128((const __m128i*)&u_row[k]);
+        __m128i v = _mm_loadu_si128((const __m128i*)&v_row[k]);
+        __m128i mask = zero;
+        for (c = 0; c < class_count; ++c) {
+            __m128i out_c = _mm_or_si128(
+                    _mm_subs_epu8(_mm_sub_epi8(u, ul[c]), ur[c]),
+                    _mm_subs_epu8(_mm_sub_epi8(v, vl[c]), vr[c]));
+            mask = _mm_or_si128(mask, _mm_and_si128(
+                                        _mm_cmpeq_epi8(out_c, zero), bit[c]));
+        }
+        /* The masks of the block, each moved up by one sample, with the
+           mask of the last sample before the block in front. */
+        __m128i prev = _mm_or_si128(_mm_slli_si128(mask, 1),
+                                    _mm_cvtsi32_si128((int)in));
+        unsigned int changes =
+                ~(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(mask, prev)) &
+                0xffff;
+        if (changes == 0) continue;
+        _mm_storeu_si128((__m128i*)m, mask);
+        while (changes != 0) {
+            int j = __builtin_ctz(changes);
+            in = class_runs_update(in, m[j], k + j, uv_run, uv_run_count);
+            changes &= changes - 1;
+        }
+    }
+    class_runs_finish(t, u_row, v_row, k, samples, in, uv_run, uv_run_count);
+}
+
+__attribute__((target("avx2")))
+static void create_class_uv_run_sequences_avx2(const Color_Class_Table* t,
+                                               const int cols,
+                                               const int rows,
+                                               const unsigned char uv_row[],
+                                               Uv_Run* uv_run[],
+                                               int uv_run_count[]) {
+    const unsigned char* u_row = uv_row;
+    const unsigned char* v_row = &uv_row[(cols * rows) / 4];
+    const int samples = (cols + 1) / 2;
+    const int class_count = t->class_count;
+    __m256i ul[MAX_COLOR_CLASSES];
+    __m256i ur[MAX_COLOR_CLASSES]; // u_high - u_low
+    __m256i vl[MAX_COLOR_CLASSES];
+    __m256i vr[MAX_COLOR_CLASSES]; // v_high - v_low
+    __m256i bit[MAX_COLOR_CLASSES];
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned char m[32];
+    unsigned int in = 0; // classes with a run open
+    int k;
+    int c;
+    for (c = 0; c < class_count; ++c) {
+        const Color_Class* kc = &t->color_class[c];
+        ul[c] = _mm256_set1_epi8((char)kc->u_low);
+        ur[c] = _mm256_set1_epi8((char)(kc->u_high - kc->u_low));
+        vl[c] = _mm256_set1_epi8((char)kc->v_low);
+        vr[c] = _mm256_set1_epi8((char)(kc->v_high - kc->v_low));
+        bit[c] = _mm256_set1_epi8((char)class_bit(kc, c));
+        uv_run_count[c] = 0;
+    }
+    for (k = 0; k + 32 <= samples; k += 32) {
+        __m256i u = _mm256_loadu_si256((const __m256i*)&u_row[k]);
+        __m256i v = _mm256_loadu_si256((const __m256i*)&v_row[k]);
+        __m256i mask = zero;
+        for (c = 0; c < class_count; ++c) {
+            __m256i out_c = _mm256_or_si256(
+                    _mm256_subs_epu8(_mm256_sub_epi8(u, ul[c]), ur[c]),
+                    _mm256_subs_epu8(_mm256_sub_epi8(v, vl[c]), vr[c]));
+            mask = _mm256_or_si256(mask, _mm256_and_si256(
+                                    _mm256_cmpeq_epi8(out_c, zero), bit[c]));
+        }
+        /* As for SSE2.  Alignr only shifts within each 128 bit lane, so the
+           byte moved into each lane comes from the lane below it, or from
+           in for the lowest. */
+        __m256i below = _mm256_permute2x128_si256(
+                                _mm256_set1_epi8((char)in), mask, 0x21);
+        __m256i prev = _mm256_alignr_epi8(mask, below, 15);
+        unsigned int changes = ~(unsigned int)_mm256_movemask_epi8(
+                                        _mm256_cmpeq_epi8(mask, prev));
+        if (changes == 0) continue;
+        _mm256_storeu_si256((__m256i*)m, mask);
+        while (changes != 0) {
+            int j = __builtin_ctz(changes);
+            in = class_runs_update(in, m[j], k + j, uv_run, uv_run_count);
+            changes &= changes - 1;
+        }
+    }
+    class_runs_finish(t, u_row, v_row, k, samples, in, uv_run, uv_run_count);
+}
+#endif
+
+#ifdef DCB_HAVE_NEON
+static void create_class_uv_run_sequences_neon(const Color_Class_Table* t,
+                                               const int cols,
+                                               const int rows,
+                                               const unsigned char uv_row[],
+                                               Uv_Run* uv_run[],
+                                               int uv_run_count[]) {
+    const unsigned char* u_row = uv_row;
+    const unsigned char* v_row = &uv_row[(cols * rows) / 4];
+    const int samples = (cols + 1) / 2;
+    const int class_count = t->class_count;
+    uint8x16_t ul[MAX_COLOR_CLASSES];
+    uint8x16_t ur[MAX_COLOR_CLASSES]; // u_high - u_low
+    uint8x16_t vl[MAX_COLOR_CLASSES];
+    uint8x16_t vr[MAX_COLOR_CLASSES]; // v_high - v_low
+    uint8x16_t bit[MAX_COLOR_CLASSES];
+    const uint8x16_t zero = vdupq_n_u8(0);
+    unsigned char m[16];
+    unsigned int in = 0; // classes with a run open
+    int k;
+    int c;
+    for (c = 0; c < class_count; ++c) {
+        const Color_Class* kc = &t->color_class[c];
+        ul[c] = vdupq_n_u8(kc->u_low);
+        ur[c] = vdupq_n_u8(kc->u_high - kc->u_low);
+        vl[c] = vdupq_n_u8(kc->v_low);
+        vr[c] = vdupq_n_u8(kc->v_high - kc->v_low);
+        bit[c] = vdupq_n_u8(class_bit(kc, c));
+        uv_run_count[c] = 0;
+    }
+    for (k = 0; k + 16 <= samples; k += 16) {
+        uint8x16_t u = vld1q_u8(&u_row[k]);
+        uint8x16_t v = vld1q_u8(&v_row[k]);
+        uint8x16_t mask = zero;
+        for (c = 0; c < class_count; ++c) {
+            uint8x16_t out_c = vorrq_u8(vqsubq_u8(vsubq_u8(u, ul[c]), ur[c]),
+                                        vqsubq_u8(vsubq_u8(v, vl[c]), vr[c]));
+            mask = vorrq_u8(mask, vandq_u8(vceqq_u8(out_c, zero), bit[c]));
+        }
+        /* As for SSE2. */
+        uint8x16_t prev = vextq_u8(vdupq_n_u8(in), mask, 15);
+        unsigned int changes = ~neon_movemask(vceqq_u8(mask, prev)) & 0xffff;
+        if (changes == 0) continue;
+        vst1q_u8(m, mask);
+        while (changes != 0) {
+            int j = __builtin_ctz(changes);
+            in = class_runs_update(in, m[j], k + j, uv_run, uv_run_count);
+            changes &= changes - 1;
+        }
+    }
+    class_runs_finish(t, u_row, v_row, k, samples, in, uv_run, uv_run_count);
+}
+#endif
+
+/* With fewer classes than this, the vector kernels run once per class over
+   the row, which stays in cache after the first class.  The class mask only
+   pays for the work it adds to each block from three classes on. */
+#define CLASS_MASK_MIN_CLASSES 3
+
+/* Build the uv_run sequence of every class for a single row of u and v
+   values.  The vector kernels test the boxes of all classes at once, unless
+   there are only one or two of them; with the scalar kernel, or any non-box
+   region, the lookup table classifies each chroma sample against all
+   classes. */
+static void create_class_uv_run_sequences(const Color_Class_Table* t,
+                                          const int cols,
+                                          const int rows,
+                                          const unsigned char uv_row[],
+                                          Uv_Run* uv_run[],
+                                          int uv_run_count[]) {
+    int c;
+    if (t->all_boxes && uv_run_sequence_kernel != DCB_KERNEL_SCALAR &&
+        t->class_count < CLASS_MASK_MIN_CLASSES) {
+        for (c = 0; c < t->class_count; ++c) {
+            const Color_Class* k = &t->color_class[c];
+            uv_run_count[c] = uv_run_sequence_fn((cols + 1) / 2, uv_row,
+                                                 &uv_row[(cols * rows) / 4],
+                                                 k->u_low, k->u_high,
+                                                 k->v_low, k->v_high,
+                                                 uv_run[c]);
+        }
+        return;
+    }
+    if (t->all_boxes) {
+        switch (uv_run_sequence_kernel) {
+#ifdef DCB_HAVE_X86
+        case DCB_KERNEL_SSE2:
+            create_class_uv_run_sequences_sse2(t, cols, rows, uv_row, uv_run,
+                                               uv_run_count);
+            return;
+        case DCB_KERNEL_AVX2:
+            create_class_uv_run_sequences_avx2(t, cols, rows, uv_row, uv_run,
+                                               uv_run_count);
+            return;
+#endif
+#ifdef DCB_HAVE_NEON
+        case DCB_KERNEL_NEON:
+            create_class_uv_run_sequences_neon(t, cols, rows, uv_row, uv_run,
+                                               uv_run_count);
+            return;
+#endif
+        default:
+            break;
+        }
+    }
+    create_class_uv_run_sequences_lut(t, cols, rows, uv_row, uv_run,
+                                      uv_run_count);
+}
+
+void detect_color_blobs_multi(const Color_Class_Table* t,
+                              Blob_List blob_list[],
+                              int cols,
+                              int rows,
+                              const unsigned char yuv[]) {
+    Row_Scratch rs[MAX_COLOR_CLASSES];
+    size_t scratch_mark[MAX_COLOR_CLASSES];
+    Uv_Run* uv_run[MAX_COLOR_CLASSES];
+    int uv_run_count[MAX_COLOR_CLASSES];
+    Yuv_Run* yuv_run0[MAX_COLOR_CLASSES];
+    int yuv_run0_count[MAX_COLOR_CLASSES];
+    const int class_count = t->class_count;
+    int c;
+    int ii;
+
+    /* Clear out the Blob_Lists, and take run arrays for each class from the
+       scratch arena of its own Blob_List. */
+
+    for (c = 0; c < class_count; ++c) {
+        Blob_List* p = &blob_list[c];
+        blob_list_clear(p);
+        if (!blob_list_reserve_cols(p, cols)) {
+            while (--c >= 0) blob_list[c].scratch_used = scratch_mark[c];
+            return;
+        }
+        scratch_mark[c] = p->scratch_used;
+        row_scratch_alloc(p, cols, &rs[c]);
+        uv_run[c] = rs[c].uv_run;
+        yuv_run0[c] = NULL;
+        yuv_run0_count[c] = 0;
+    }
+
+    kernel_init_once();
+
+    for (ii = 0; ii < rows; ++ii) {
+        /* Process row ii of the image. */
+
+        if ((ii & 0x01) == 0) {
+            /* Even row.  Update uv_run of every class. */
+
+            int uv_offset = (ii / 2) * (cols / 2);
+            int pixels = cols * rows;
+            create_class_uv_run_sequences(t, cols, rows,
+                                          &yuv[pixels + uv_offset],
+                                          uv_run, uv_run_count);
+        }
+
+        const unsigned char* y_row = &yuv[ii * cols];
+        for (c = 0; c < class_count; ++c) {
+            /* Detect all YUV blob runs of class c in the row, then union
+               them with those of the previous row. */
+
+            Blob_List* p = &blob_list[c];
+            Yuv_Run* yuv_run1 = (yuv_run0[c] == rs[c].yuv_run_a) ?
+                                rs[c].yuv_run_b : rs[c].yuv_run_a;
+            int yuv_run1_count = detect_yuv_runs_in_row(
+                                        p, cols, rows, y_row, uv_run_count[c],
+                                        uv_run[c], t->color_class[c].y_low,
+                                        yuv_run1);
+            yuv_run_row_union(p, ii - 1, yuv_run0_count[c], yuv_run0[c],
+                              ii, yuv_run1_count, yuv_run1);
+            yuv_run0[c] = yuv_run1;
+            yuv_run0_count[c] = yuv_run1_count;
+        }
+    }
+    for (c = 0; c < class_count; ++c) {
+        blob_list[c].scratch_used = scratch_mark[c];
+    }
+}
+
+
+/*****************************************
+ ****                                 ****
+ ****    Row-band parallel detection  ****
+ ****                                 ****
+ *****************************************/
+
+/* The image is cut into horizontal bands.  Each band is labeled by its own
+   worker into its own Blob_List.  The band lists are then appended into the
+   caller's Blob_List, and the bands are stitched together by running
+   yuv_run_row_union() over the last row of each band and the first row of the
+   next.  Blobs that cross a band boundary are merged by link(), exactly as if
+   the boundary had been met during a serial scan. */
+
+typedef struct {
+    Blob_List blob_list;
+    int row_begin;
+    int row_end;
+    Row_Scratch rs;           /// run arrays, from the blob_list scratch arena
+    int first_count;          /// number of runs in rs.first_runs
+    Yuv_Run* last_runs;       /// runs of row_end - 1
+    int last_count;
+} Blob_Band;
+
+struct Blob_Bands {
+    int band_count;
+    Blob_Band* band;
+    pthread_t* worker;           /// band_count - 1 threads; caller does band 0
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_start;   /// signals a new frame, or quit
+    pthread_cond_t cond_done;    /// signals all workers finished a frame
+    unsigned int generation;     /// incremented for every frame
+    int pending;                 /// workers still labeling this frame
+    bool quit;
+
+    /* Arguments of the current detect_color_blobs_banded() call. */
+
+    unsigned char y_low;
+    unsigned char u_low;
+    unsigned char u_high;
+    unsigned char v_low;
+    unsigned char v_high;
+    int cols;
+    int rows;
+    unsigned char* yuv;
+};
+
+typedef struct {
+    Blob_Bands* bands;
+    int band_no;
+} Blob_Band_Worker_Args;
+
+static void label_band(Blob_Bands* bands, int band_no) {
+    Blob_Band* b = &bands->band[band_no];
+
+    /* The run arrays stay allocated from the band's scratch arena until the
+       next frame, since the first and last rows are needed for stitching. */
+
+    blob_list_clear(&b->blob_list);
+    row_scratch_alloc(&b->blob_list, bands->cols, &b->rs);
+    b->first_count = 0;
+    b->last_count = 0;
+    b->last_runs = b->rs.first_runs;
+    if (b->row_begin >= b->row_end) return;
+    b->last_runs = detect_color_blobs_in_rows(
+                          &b->blob_list, bands->y_low, bands->u_low,
+                          bands->u_high, bands->v_low, bands->v_high,
+                          false, bands->cols, bands->rows, bands->yuv,
+                          0, bands->cols, b->row_begin, b->row_end, 1,
+                          b->rs.uv_run, b->rs.first_runs, &b->first_count,
+                          b->rs.yuv_run_a, b->rs.yuv_run_b, &b->last_count);
+}
+
+static void* blob_band_worker(void* void_args_ptr) {
+    Blob_Band_Worker_Args* args_ptr = (Blob_Band_Worker_Args*)void_args_ptr;
+    Blob_Bands* bands = args_ptr->bands;
+    int band_no = args_ptr->band_no;
+    unsigned int seen_generation = 0;
+    free(args_ptr);
+    pthread_mutex_lock(&bands->mutex);
+    while (true) {
+        while (!bands->quit && bands->generation == seen_generation) {
+            pthread_cond_wait(&bands->cond_start, &bands->mutex);
+        }
+        if (bands->quit) break;
+        seen_generation = bands->generation;
+        pthread_mutex_unlock(&bands->mutex);
+
+        label_band(bands, band_no);
+
+        pthread_mutex_lock(&bands->mutex);
+        if (--bands->pending == 0) pthread_cond_signal(&bands->cond_done);
+    }
+    pthread_mutex_unlock(&bands->mutex);
+    return NULL;
+}
+
+/* Append all the blobs of src to dst.  Returns false if dst has too little
+   space, in which case dst is left unchanged. */
+static bool blob_list_append(Blob_List* dst, const Blob_List* src) {
+    int ii;
+    if (dst->used_blob_set_count + src->used_blob_set_count - 1 >
+                                                    dst->max_blob_set_count ||
+        dst->used_root_list_count + src->used_root_list_count >
+                                                    dst->max_root_list_count) {
+        return false;
+    }
+
+    /* Src entry 0 is reserved and maps to dst entry 0.  Src entry ii (ii > 0)
+       maps to dst entry ii + set_offset. */
+
+    const Blob_Set_Index set_offset = dst->used_blob_set_count - 1;
+    const Root_List_Index root_offset = dst->used_root_list_count;
+    for (ii = 1; ii < src->used_blob_set_count; ++ii) {
+        Blob_Set_Entry e = src->blob_set[ii];
+        e.parent_index += set_offset;
+        if (e.root_list_index != NOT_A_ROOT_LIST_INDEX) {
+            e.root_list_index += root_offset;
+        }
+        dst->blob_set[ii + set_offset] = e;
+    }
+    for (ii = 0; ii < src->used_root_list_count; ++ii) {
+        Root_Info r = src->root_info[ii];
+        r.set_index += set_offset;
+        dst->root_info[ii + root_offset] = r;
+    }
+    dst->used_blob_set_count += src->used_blob_set_count - 1;
+    dst->used_root_list_count += src->used_root_list_count;
+    return true;
+}
+
+static void offset_run_parents(Yuv_Run run[],
+                               int count,
+                               Blob_Set_Index set_offset) {
+    int ii;
+    for (ii = 0; ii < count; ++ii) {
+        if (run[ii].parent_index != 0) run[ii].parent_index += set_offset;
+    }
+}
+
+Blob_Bands* blob_bands_init(int band_count,
+                            Blob_Set_Index max_runs,
+                            Blob_Set_Index max_blobs,
+                            int max_cols) {
+    int ii;
+    if (band_count < 1) band_count = 1;
+    Blob_Bands* bands = (Blob_Bands*)calloc(1, sizeof(Blob_Bands));
+    if (bands == NULL) return NULL;
+    bands->band = (Blob_Band*)calloc(band_count, sizeof(Blob_Band));
+    bands->worker = (pthread_t*)calloc(band_count, sizeof(pthread_t));
+    if (bands->band == NULL || bands->worker == NULL) {
+        free(bands->band);
+        free(bands->worker);
+        free(bands);
+        return NULL;
+    }
+    for (ii = 0; ii < band_count; ++ii) {
+        bands->band[ii].blob_list = blob_list_init(max_runs, max_blobs,
+                                                   max_cols);
+    }
+    /* Pick the kernel before there are workers to race for it. */
+
+    kernel_init_once();
+    pthread_mutex_init(&bands->mutex, NULL);
+    pthread_cond_init(&bands->cond_start, NULL);
+    pthread_cond_init(&bands->cond_done, NULL);
+    bands->band_count = 1;
+    for (ii = 1; ii < band_count; ++ii) {
+        Blob_Band_Worker_Args* args_ptr =
+               (Blob_Band_Worker_Args*)malloc(sizeof(Blob_Band_Worker_Args));
+        if (args_ptr == NULL) break;
+        args_ptr->bands = bands;
+        args_ptr->band_no = ii;
+        if (pthread_create(&bands->worker[ii], NULL, blob_band_worker,
+                           args_ptr) != 0) {
+            free(args_ptr);
+            break;
+        }
+        ++bands->band_count;
+    }
+    return bands;
+}
+
+void blob_bands_deinit(Blob_Bands* bands) {
+    int ii;
+    if (bands == NULL) return;
+    pthread_mutex_lock(&bands->mutex);
+    bands->quit = true;
+    pthread_cond_broadcast(&bands->cond_start);
+    pthread_mutex_unlock(&bands->mutex);
+    for (ii = 1; ii < bands->band_count; ++ii) {
+        pthread_join(bands->worker[ii], NULL);
+    }
+    for (ii = 0; ii < bands->band_count; ++ii) {
+        blob_list_deinit(&bands->band[ii].blob_list);
+    }
+    pthread_cond_destroy(&bands->cond_done);
+    pthread_cond_destroy(&bands->cond_start);
+    pthread_mutex_destroy(&bands->mutex);
+    free(bands->worker);
+    free(bands->band);
+    free(bands);
+}
+
+int blob_bands_get_count(const Blob_Bands* bands) {
+    return bands->band_count;
+}
+
+void detect_color_blobs_banded(Blob_Bands* bands,
+                               Blob_List* p,
+                               unsigned char y_low,
+                               unsigned char u_low,
+                               unsigned char u_high,
+                               unsigned char v_low,
+                               unsigned char v_high,
+                               bool highlight_detected_pixels,
+                               int cols,
+                               int rows,
+                               unsigned char yuv[]) {
+    int ii;
+
+    /* Every band starts on an even row, so it begins with fresh U and V
+       values, and holds at least two rows.  Highlighting is a debugging aid,
+       so leave that to the serial code. */
+
+    int band_count = bands->band_count;
+    if (band_count > rows / 2) band_count = rows / 2;
+    bool ok = (band_count > 1 && !highlight_detected_pixels);
+    for (ii = 0; ok && ii < band_count; ++ii) {
+        ok = blob_list_reserve_cols(&bands->band[ii].blob_list, cols);
+    }
+    if (!ok) {
+        detect_color_blobs(p, y_low, u_low, u_high, v_low, v_high,
+                           highlight_detected_pixels, cols, rows, yuv);
+        return;
+    }
+    int band_rows = (rows / band_count) & ~1;
+    for (ii = 0; ii < bands->band_count; ++ii) {
+        Blob_Band* b = &bands->band[ii];
+        b->row_begin = (ii < band_count) ? ii * band_rows : rows;
+        b->row_end = (ii < band_count - 1) ? b->row_begin + band_rows : rows;
+    }
+
+    /* Start the workers on bands 1 .. band_count-1, and label band 0 here. */
+
+    pthread_mutex_lock(&bands->mutex);
+    bands->y_low = y_low;
+    bands->u_low = u_low;
+    bands->u_high = u_high;
+    bands->v_low = v_low;
+    bands->v_high = v_high;
+    bands->cols = cols;
+    bands->rows = rows;
+    bands->yuv = yuv;
+    bands->pending = bands->band_count - 1;
+    ++bands->generation;
+    pthread_cond_broadcast(&bands->cond_start);
+    pthread_mutex_unlock(&bands->mutex);
+
+    label_band(bands, 0);
+
+    pthread_mutex_lock(&bands->mutex);
+    while (bands->pending > 0) {
+        pthread_cond_wait(&bands->cond_done, &bands->mutex);
+    }
+    pthread_mutex_unlock(&bands->mutex);
+
+    /* Merge the bands into p. */
+
+    blob_list_clear(p);
+    for (ii = 0; ii < band_count; ++ii) {
+        Blob_Band* b = &bands->band[ii];
+        Blob_Set_Index set_offset = p->used_blob_set_count - 1;
+        if (!blob_list_append(p, &b->blob_list)) {
+            /* Too many blobs for p to hold.  Do it the slow way, so at least
+               the result is the same. */
+
+            detect_color_blobs(p, y_low, u_low, u_high, v_low, v_high,
+                               false, cols, rows, yuv);
+            return;
+        }
+        offset_run_parents(b->rs.first_runs, b->first_count, set_offset);
+        if (b->last_runs != b->rs.first_runs) {
+            offset_run_parents(b->last_runs, b->last_count, set_offset);
+        }
+    }
+
+    /* Stitch each band to the next. */
+
+    for (ii = 1; ii < band_count; ++ii) {
+        Blob_Band* above = &bands->band[ii - 1];
+        Blob_Band* below = &bands->band[ii];
+        yuv_run_row_union(p, above->row_end - 1, above->last_count,
+                          above->last_runs, below->row_begin,
+                          below->first_count, below->rs.first_runs);
+    }
+}
+
+
+
+/*****************************************
+ ****                                 ****
+ ****    Windowed detection           ****
+ ****                                 ****
+ *****************************************/
+
+void detect_color_blobs_window(Blob_List* p,
+                               unsigned char y_low,
+                               unsigned char u_low,
+                               unsigned char u_high,
+                               unsigned char v_low,
+                               unsigned char v_high,
+                               int cols,
+                               int rows,
+                               const unsigned char yuv[],
+                               Blob_Window window,
+                               int row_step) {
+    Row_Scratch rs;
+    int first_count;
+    int last_count;
+    int ii;
+
+    /* Clip the window to the image, and line it up with the 2x2 chroma
+       blocks. */
+
+    int col_begin = (window.x < 0) ? 0 : window.x & ~1;
+    int row_begin = (window.y < 0) ? 0 : window.y & ~1;
+    int col_end = window.x + window.cols;
+    int row_end = window.y + window.rows;
+    if (col_end > cols) col_end = cols;
+    if (row_end > rows) row_end = rows;
+    col_end = (col_end + 1) & ~1;
+    if (col_end > cols) col_end = cols;
+    if (row_step < 1) row_step = 1;
+
+    blob_list_clear(p);
+    if (col_begin >= col_end || row_begin >= row_end) return;
+    if (!blob_list_reserve_cols(p, cols)) return;
+    const size_t scratch_mark = p->scratch_used;
+    row_scratch_alloc(p, cols, &rs);
+    (void)detect_color_blobs_in_rows(p, y_low, u_low, u_high, v_low, v_high,
+                                     false, cols, rows, (unsigned char*)yuv,
+                                     col_begin, col_end, row_begin, row_end,
+                                     row_step, rs.uv_run, rs.yuv_run_a,
+                                     &first_count, rs.yuv_run_a, rs.yuv_run_b,
+                                     &last_count);
+    p->scratch_used = scratch_mark;
+    if (row_step == 1) return;
+
+    /* Each row looked at stands for itself and the row_step - 1 rows below
+       it. */
+
+    const unsigned long skipped_row_sum = row_step * (row_step - 1) / 2;
+    for (ii = 0; ii < p->used_root_list_count; ++ii) {
+        Blob_Stats* stats_ptr = &p->root_info[ii].stats;
+        int max_y = stats_ptr->max_y + row_step - 1;
+        stats_ptr->sum_x *= row_step;
+        stats_ptr->sum_y = stats_ptr->sum_y * row_step +
+                           stats_ptr->count * skipped_row_sum;
+        stats_ptr->count *= row_step;
+        stats_ptr->max_y = (max_y < row_end) ? max_y : row_end - 1;
+    }
+}
+
+void blob_tracker_init(Blob_Tracker* t,
+                       int full_frame_interval,
+                       int row_step,
+                       int margin,
+                       unsigned int min_pixels) {
+    t->full_frame_interval = full_frame_interval;
+    t->row_step = row_step;
+    t->margin = margin;
+    t->min_pixels = min_pixels;
+    t->locked = false;
+    t->frames_since_full = 0;
+    t->window.x = 0;
+    t->window.y = 0;
+    t->window.cols = 0;
+    t->window.rows = 0;
+}
+
+/* Set t->window around all blobs of at least t->min_pixels pixels in p.
+   Return false if there are none. */
+static bool blob_tracker_update(Blob_Tracker* t, const Blob_List* p) {
+    int min_x = INT_MAX;
+    int max_x = -1;
+    int min_y = INT_MAX;
+    int max_y = -1;
+    int ii;
+    for (ii = 0; ii < p->used_root_list_count; ++ii) {
+        const Blob_Stats* stats_ptr = &p->root_info[ii].stats;
+        if (stats_ptr->count < t->min_pixels) continue;
+        if (stats_ptr->min_x < min_x) min_x = stats_ptr->min_x;
+        if (stats_ptr->max_x > max_x) max_x = stats_ptr->max_x;
+        if (stats_ptr->min_y < min_y) min_y = stats_ptr->min_y;
+        if (stats_ptr->max_y > max_y) max_y = stats_ptr->max_y;
+    }
+    if (max_x < 0) return false;
+    const int grow_x = t->margin + (max_x - min_x + 1) / 2;
+    const int grow_y = t->margin + (max_y - min_y + 1) / 2;
+    t->window.x = min_x - grow_x;
+    t->window.y = min_y - grow_y;
+    t->window.cols = max_x - min_x + 1 + 2 * grow_x;
+    t->window.rows = max_y - min_y + 1 + 2 * grow_y;
+    return true;
+}
+
+bool detect_color_blobs_tracked(Blob_Tracker* t,
+                                Blob_Bands* bands,
+                                Blob_List* p,
+                                unsigned char y_low,
+                                unsigned char u_low,
+                                unsigned char u_high,
+                                unsigned char v_low,
+                                unsigned char v_high,
+                                int cols,
+                                int rows,
+                                unsigned char yuv[]) {
+    if (t->locked && t->frames_since_full + 1 < t->full_frame_interval) {
+        ++t->frames_since_full;
+        detect_color_blobs_window(p, y_low, u_low, u_high, v_low, v_high,
+                                  cols, rows, yuv, t->window, t->row_step);
+        t->locked = blob_tracker_update(t, p);
+        if (t->locked) return false;
+    }
+
+    /* Not tracking, time for a full scan, or the target was just lost. */
+
+    t->frames_since_full = 0;
+    if (bands != NULL) {
+        detect_color_blobs_banded(bands, p, y_low, u_low, u_high, v_low,
+                                  v_high, false, cols, rows, yuv);
+    } else {
+        detect_color_blobs(p, y_low, u_low, u_high, v_low, v_high, false,
+                           cols, rows, yuv);
+    }
+    t->locked = blob_tracker_update(t, p);
+    return true;
+}
+
+
 static int compare_counts(const void* void_a_ptr,
                           const void* void_b_ptr,
                           void* void_p) {
@@ -743,9 +2257,44 @@ static int compare_counts(const void* void_a_ptr,
     return b_count - a_count;
 }
 
+/* Stable merge sort into declining count order.  This gives the same order
+   as glibc's qsort_r() (a merge sort), but uses p->sort_scratch instead of
+   allocating a temporary array on every call. */
 void sort_blobs_by_pixel_count(Blob_List* p) {
-    qsort_r(p->root_info, p->used_root_list_count, sizeof(p->root_info[0]),
-            compare_counts, NULL);
+    const int n = p->used_root_list_count;
+    Root_Info* src = p->root_info;
+    Root_Info* dst = p->sort_scratch;
+    int width;
+    if (dst == NULL) {
+        qsort_r(p->root_info, n, sizeof(p->root_info[0]), compare_counts,
+                NULL);
+        return;
+    }
+    for (width = 1; width < n; width *= 2) {
+        int low;
+        for (low = 0; low < n; low += 2 * width) {
+            int mid = (low + width < n) ? low + width : n;
+            int high = (low + 2 * width < n) ? low + 2 * width : n;
+            int ai = low;
+            int bi = mid;
+            int k = low;
+            while (ai < mid && bi < high) {
+                if (compare_counts(&src[bi], &src[ai], NULL) < 0) {
+                    dst[k++] = src[bi++];
+                } else {
+                    dst[k++] = src[ai++];
+                }
+            }
+            while (ai < mid) dst[k++] = src[ai++];
+            while (bi < high) dst[k++] = src[bi++];
+        }
+        Root_Info* swap_tmp = src;
+        src = dst;
+        dst = swap_tmp;
+    }
+    if (src != p->root_info) {
+        memcpy(p->root_info, src, n * sizeof(p->root_info[0]));
+    }
 }
 
 
@@ -869,22 +2418,43 @@ void draw_bounding_boxes(const Blob_List* p,
 }
 
 
-Blob_List blob_list_init(Blob_Set_Index max_runs, Blob_Set_Index max_blobs) {
+Blob_List blob_list_init(Blob_Set_Index max_runs,
+                         Blob_Set_Index max_blobs,
+                         int max_cols) {
     Blob_List bl;
     bl.blob_set = (Blob_Set_Entry*)malloc(
                                      sizeof(Blob_Set_Entry) * (max_runs + 1));
     bl.max_blob_set_count = max_runs + 1;
     bl.root_info = (Root_Info*)malloc(sizeof(Root_Info) * max_blobs);
     bl.max_root_list_count = max_blobs;
-    if (bl.blob_set == NULL || bl.root_info == NULL) {
+    bl.sort_scratch = (Root_Info*)malloc(sizeof(Root_Info) * max_blobs);
+    bl.scratch = NULL;
+    bl.scratch_bytes = 0;
+    bl.scratch_used = 0;
+    bl.max_cols = -1;
+    bl.heap_alloc_count = 0;
+    bl.used_blob_set_count = 0;
+    bl.used_root_list_count = 0;
+    if (bl.blob_set == NULL || bl.root_info == NULL ||
+        bl.sort_scratch == NULL || !blob_list_reserve_cols(&bl, max_cols)) {
         free(bl.blob_set);
         free(bl.root_info);
+        free(bl.sort_scratch);
+        free(bl.scratch);
         bl.blob_set = NULL;
         bl.max_blob_set_count = 0;
         bl.root_info = NULL;
         bl.max_root_list_count = 0;
+        bl.sort_scratch = NULL;
+        bl.scratch = NULL;
+        bl.scratch_bytes = 0;
+        bl.max_cols = -1;
     }
-    blob_list_clear(&bl);
+    bl.heap_alloc_count = 0;
+
+    /* There is no blob_set[0] to set up if the allocation failed. */
+
+    if (bl.blob_set != NULL) blob_list_clear(&bl);
     return bl;
 }
 
@@ -892,12 +2462,15 @@ Blob_List blob_list_init(Blob_Set_Index max_runs, Blob_Set_Index max_blobs) {
 void blob_list_deinit(Blob_List* p) {
     free(p->blob_set);
     free(p->root_info);
+    free(p->sort_scratch);
+    free(p->scratch);
 }
 
 
 void blob_list_clear(Blob_List* p) {
     p->used_blob_set_count = 1;  // index 0 is reserved
     p->used_root_list_count = 0;
+    p->scratch_used = 0;
 
     /* Initialize blob_set[0]. */
 
@@ -60,6 +60,7 @@ extern "C" {
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
  * @brief Index into the blob_set array of a Blob_List.
@@ -154,8 +155,35 @@ typedef struct {
     Root_Info* root_info;
     Blob_Set_Index max_root_list_count;/// number of elements in root_info array
     Blob_Set_Index used_root_list_count; /// used element in root_info array
+
+    /** Temporary space for sort_blobs_by_pixel_count(), with room for
+        max_root_list_count elements. */
+    Root_Info* sort_scratch;
+
+    /** @brief Per-frame scratch memory arena.
+
+       Detect_color_blobs() keeps its run arrays here while it works, so that
+       it never touches the heap once the arena is big enough.  When it is
+       done, the whole arena is available to the caller through
+       blob_list_scratch_alloc() until the next blob_list_clear(). */
+    unsigned char* scratch;
+    size_t scratch_bytes;     /// size of the scratch arena
+    size_t scratch_used;      /// bytes of scratch handed out so far
+    int max_cols;             /// widest image the scratch arena can handle
+    /** The number of times the heap was used after blob_list_init().  This
+        only happens when an image is wider than any seen before.  It should
+        not grow in steady state. */
+    unsigned long heap_alloc_count;
 } Blob_List;
 
+/**
+ * @brief Bytes of scratch memory reserved for the caller in each Blob_List.
+ *
+ * This is in addition to what detect_color_blobs() needs for itself.  It is
+ * enough for an array of a few hundred Blob_Stats.
+ */
+#define BLOB_LIST_USER_SCRATCH_BYTES 16384
+
 
 /**
  * @brief Allocate memory for a Blob_List and initialize it to empty.
@@ -165,9 +193,16 @@ typedef struct {
  *                       image row that are all in the same color blob.
  * @param max_blobs [in] The maximum number of color blobs this Blob_List can
  *                       represent.
- * @return The newly allocated Blob_List.
+ * @param max_cols [in]  The width of the widest image that will be given to
+ *                       detect_color_blobs().  Scratch memory for images this
+ *                       wide is allocated now, so that detect_color_blobs()
+ *                       need not allocate any.
+ * @return The newly allocated Blob_List.  If memory could not be allocated,
+ *         its blob_set is NULL and nothing else is allocated.
  */
-Blob_List blob_list_init(Blob_Set_Index max_runs, Blob_Set_Index max_blobs);
+Blob_List blob_list_init(Blob_Set_Index max_runs,
+                         Blob_Set_Index max_blobs,
+                         int max_cols);
 
 
 /**
@@ -179,6 +214,23 @@ Blob_List blob_list_init(Blob_Set_Index max_runs, Blob_Set_Index max_blobs);
 void blob_list_clear(Blob_List* p);
 
 
+/**
+ * @brief Allocate per-frame scratch memory from the given Blob_List.
+ *
+ * This is a simple bump allocator with no free.  All memory it hands out is
+ * reclaimed by the next blob_list_clear(), which detect_color_blobs() calls
+ * at the start of each frame.  Use it for per-frame work that follows
+ * detect_color_blobs(), to stay off the heap.
+ *
+ * @param p [in,out]  A pointer to a Blob_List, as returned from
+ *                    blob_list_init().
+ * @param bytes [in]  The number of bytes wanted.
+ * @return A pointer to the memory, suitably aligned for any type, or NULL if
+ *         there is not enough scratch memory left.
+ */
+void* blob_list_scratch_alloc(Blob_List* p, size_t bytes);
+
+
 /**
  * @brief Free all memory captured by the given Blob_List.
  *
@@ -250,6 +302,405 @@ void detect_color_blobs(Blob_List* p,
                         int rows,
                         unsigned char yuv[]);
 
+/**
+ * @brief The maximum number of color classes detect_color_blobs_multi() can
+ *        look for at once.
+ */
+#define MAX_COLOR_CLASSES 8
+
+/**
+ * @brief The color thresholds of a single class of target.
+ *
+ * These have the same meaning as the arguments of the same name to
+ * detect_color_blobs().
+ */
+typedef struct {
+    unsigned char y_low;
+    unsigned char u_low;
+    unsigned char u_high;
+    unsigned char v_low;
+    unsigned char v_high;
+} Color_Class;
+
+/**
+ * @brief The kinds of region a Uv_Region can describe.
+ */
+typedef enum {
+    UV_REGION_BOX = 0,        /// the u/v thresholds of the Color_Class
+    UV_REGION_POLYGON = 1,    /// a closed polygon in the U-V plane
+    UV_REGION_ELLIPSE = 2     /// a (possibly rotated) ellipse in the U-V plane
+} Uv_Region_Type;
+
+/**
+ * @brief The maximum number of vertices of a UV_REGION_POLYGON.
+ */
+#define MAX_UV_POLYGON_VERTICES 16
+
+/**
+ * @brief A region of the U-V plane, for colors a box can't describe well.
+ *
+ * A pixel matches the region if its (u, v) is inside it or on its boundary.
+ * Only the fields of the given type are used; the rest should be zero.
+ */
+typedef struct {
+    int type;                                 /// a Uv_Region_Type
+    int vertex_count;                         /// polygon: used vertices
+    unsigned char u[MAX_UV_POLYGON_VERTICES]; /// polygon: vertex u values
+    unsigned char v[MAX_UV_POLYGON_VERTICES]; /// polygon: vertex v values
+    float center_u;                           /// ellipse: center
+    float center_v;
+    float radius_u;                           /// ellipse: radius along the
+    float radius_v;                           ///  u and v axes, before rotation
+    float angle;                              /// ellipse: counterclockwise
+                                              ///  rotation, in degrees
+} Uv_Region;
+
+/**
+ * @brief A set of color classes, ready for detect_color_blobs_multi().
+ *
+ * Bit c of uv_class_mask[(u << 8) | v] is set if the U and V values are
+ * within the region of class c.  This lets each chroma sample be
+ * classified against all classes with a single table lookup.
+ */
+typedef struct {
+    int class_count;                          /// used entries in color_class
+    Color_Class color_class[MAX_COLOR_CLASSES];
+    Uv_Region uv_region[MAX_COLOR_CLASSES];
+    bool all_boxes;                           /// no class has a polygon or
+                                              ///  ellipse region
+    unsigned char uv_class_mask[256 * 256];
+} Color_Class_Table;
+
+/**
+ * @brief Is the given (u, v) inside the region of a color class?
+ *
+ * This is the slow test used to build Color_Class_Table::uv_class_mask.
+ *
+ * @param k [in]      The thresholds of the class.  Only the u/v thresholds
+ *                    are used, and only if r is NULL or a UV_REGION_BOX.
+ * @param r [in]      The region of the class, or NULL for a box.
+ * @param u [in]      U value.
+ * @param v [in]      V value.
+ * @return True if (u, v) is inside the region or on its boundary.
+ */
+bool uv_region_contains(const Color_Class* k,
+                        const Uv_Region* r,
+                        int u,
+                        int v);
+
+/**
+ * @brief Set the u/v thresholds of a Color_Class to the bounding box of the
+ *        given region.
+ *
+ * @param r [in]      The region.  Nothing is done for a UV_REGION_BOX.
+ * @param k [in,out]  The class.  y_low is unchanged.
+ */
+void uv_region_bounding_box(const Uv_Region* r, Color_Class* k);
+
+/**
+ * @brief Set the color classes of a Color_Class_Table.
+ *
+ * Rebuilding the table takes a while, so it is only done if the classes
+ * differ from those already in the table.  It is cheap to call this for
+ * every frame.
+ *
+ * @param t [in,out]          The table to set.  Before the first call,
+ *                            t->class_count should be set to -1.
+ * @param class_count [in]    The number of classes, between 0 and
+ *                            MAX_COLOR_CLASSES.  Extra classes are ignored.
+ * @param color_class [in]    The thresholds for each class.
+ * @return True if the table was rebuilt.
+ */
+bool color_class_table_set(Color_Class_Table* t,
+                           int class_count,
+                           const Color_Class color_class[]);
+
+/**
+ * @brief Set the color classes of a Color_Class_Table, where each class may
+ *        have a polygon or ellipse U-V region instead of a box.
+ *
+ * As for color_class_table_set(), the table is only rebuilt if the classes
+ * or regions have changed.  Once any class has a non-box region,
+ * detect_color_blobs_multi() always classifies by table lookup.
+ *
+ * @param t [in,out]          As for color_class_table_set().
+ * @param class_count [in]    As for color_class_table_set().
+ * @param color_class [in]    As for color_class_table_set().  The u/v
+ *                            thresholds of a class are ignored if it has a
+ *                            non-box region.
+ * @param uv_region [in]      The region of each class, or NULL if every
+ *                            class is a box.
+ * @return True if the table was rebuilt.
+ */
+bool color_class_table_set_regions(Color_Class_Table* t,
+                                   int class_count,
+                                   const Color_Class color_class[],
+                                   const Uv_Region uv_region[]);
+
+/**
+ * @brief Read color classes from a text file.
+ *
+ * Each line of the file describes one class, in order.  Blank lines, and
+ * everything following a '#', are ignored.  Lines are one of:
+ * @code
+ * box      Y_LOW U_LOW U_HIGH V_LOW V_HIGH
+ * polygon  Y_LOW U,V U,V U,V ...
+ * ellipse  Y_LOW CENTER_U CENTER_V RADIUS_U RADIUS_V ANGLE_DEGREES
+ * @endcode
+ * The u/v thresholds of polygon and ellipse classes are set to the bounding
+ * box of the region.
+ *
+ * @param path [in]           The file to read.
+ * @param color_class [out]   Array of MAX_COLOR_CLASSES classes.
+ * @param uv_region [out]     Array of MAX_COLOR_CLASSES regions.
+ * @return The number of classes read, or -1 on error (a message is printed
+ *         to stderr).
+ */
+int color_classes_read(const char* path,
+                       Color_Class color_class[],
+                       Uv_Region uv_region[]);
+
+/**
+ * @brief Detect color blobs of several color classes in one pass over the
+ *        given YUV420 image.
+ *
+ * The result is the same as calling detect_color_blobs() once for each
+ * class, but the chroma planes are only read once.  With the scalar kernel,
+ * or if any class has a non-box region, each chroma sample is classified
+ * against every class by a single lookup in t->uv_class_mask.  Otherwise,
+ * from three classes on, a vector kernel tests each block of chroma samples
+ * against the boxes of all classes in one pass, building a mask of classes
+ * per sample, and the runs of every class are taken from where that mask
+ * changes.  With one or two classes each row is tested once per class.
+ *
+ * Only this chroma step is shared.  Y thresholding and labeling still run
+ * once per class, as each class has its own y_low and Blob_List, but they
+ * only visit the runs of that class, so the same pixels are only visited
+ * twice where classes overlap.  Since labeling usually dominates, this is
+ * only a few percent faster than separate detect_color_blobs() calls: the
+ * chroma step itself is up to about 1.2 times (AVX2) or 1.45 times (SSE2)
+ * faster with eight classes, and no faster with three.  Blobs of class c
+ * are found in blob_list[c].  There is no highlight_detected_pixels option.
+ *
+ * @param t [in]             The color classes to look for.
+ * @param blob_list [in,out] An array of t->class_count Blob_Lists, each as
+ *                           returned from blob_list_init().
+ * @param cols [in]          As for detect_color_blobs().
+ * @param rows [in]          As for detect_color_blobs().
+ * @param yuv [in]           As for detect_color_blobs().
+ */
+void detect_color_blobs_multi(const Color_Class_Table* t,
+                              Blob_List blob_list[],
+                              int cols,
+                              int rows,
+                              const unsigned char yuv[]);
+
+/**
+ * @brief A set of worker threads for detect_color_blobs_banded().
+ *
+ * Each worker owns a Blob_List and scratch space for one horizontal band of
+ * the image.
+ */
+typedef struct Blob_Bands Blob_Bands;
+
+/**
+ * @brief Allocate a Blob_Bands and start its worker threads.
+ *
+ * @param band_count [in] The number of bands to cut each image into.  One
+ *                        band is labeled on the calling thread, so
+ *                        band_count - 1 threads are started.  A good choice
+ *                        is the number of CPU cores.
+ * @param max_runs [in]   As for blob_list_init(), for each band.
+ * @param max_blobs [in]  As for blob_list_init(), for each band.
+ * @param max_cols [in]   As for blob_list_init().
+ * @return The newly allocated Blob_Bands, or NULL if out of memory.
+ */
+Blob_Bands* blob_bands_init(int band_count,
+                            Blob_Set_Index max_runs,
+                            Blob_Set_Index max_blobs,
+                            int max_cols);
+
+/**
+ * @brief Stop the worker threads and free all memory of the given Blob_Bands.
+ */
+void blob_bands_deinit(Blob_Bands* bands);
+
+/**
+ * @brief Return the number of bands actually available.
+ *
+ * This may be less than requested in blob_bands_init() if threads could not
+ * be created.
+ */
+int blob_bands_get_count(const Blob_Bands* bands);
+
+/**
+ * @brief Detect color blobs as detect_color_blobs() does, but cut the image
+ *        into horizontal bands and label each band on its own thread.
+ *
+ * The bands are then stitched together by merging blobs that touch across
+ * each band boundary.  The blobs found are the same as those found by
+ * detect_color_blobs(), though they may appear in a different order within
+ * p->root_info.  If highlight_detected_pixels is true, or the image is too
+ * small to split, this simply calls detect_color_blobs().
+ *
+ * @param bands [in,out] Worker threads, as returned from blob_bands_init().
+ *                       Only one thread may use a Blob_Bands at a time.
+ * See detect_color_blobs() for all other parameters.
+ */
+void detect_color_blobs_banded(Blob_Bands* bands,
+                               Blob_List* p,
+                               unsigned char y_low,
+                               unsigned char u_low,
+                               unsigned char u_high,
+                               unsigned char v_low,
+                               unsigned char v_high,
+                               bool highlight_detected_pixels,
+                               int cols,
+                               int rows,
+                               unsigned char yuv[]);
+
+/**
+ * @brief A rectangle within an image, in pixels.
+ */
+typedef struct {
+    int x;     /// leftmost column
+    int y;     /// top row
+    int cols;  /// width
+    int rows;  /// height
+} Blob_Window;
+
+/**
+ * @brief Detect color blobs as detect_color_blobs() does, but only within
+ *        a window of the image, and optionally only on every row_step'th
+ *        row.
+ *
+ * The window is clipped to the image, and widened by a pixel where needed so
+ * that it starts and ends on a 2x2 chroma block.  Blob coordinates are those
+ * of the whole image.  Rows that are skipped are assumed to look like the
+ * row looked at above them, so with row_step > 1 the count, sums and max_y
+ * of each blob are scaled up to approximate those of a full scan.
+ *
+ * @param window [in]    The part of the image to look at.
+ * @param row_step [in]  Look at one row in every row_step.  1 looks at every
+ *                       row.
+ * See detect_color_blobs() for all other parameters.
+ */
+void detect_color_blobs_window(Blob_List* p,
+                               unsigned char y_low,
+                               unsigned char u_low,
+                               unsigned char u_high,
+                               unsigned char v_low,
+                               unsigned char v_high,
+                               int cols,
+                               int rows,
+                               const unsigned char yuv[],
+                               Blob_Window window,
+                               int row_step);
+
+/**
+ * @brief Tracking state for detect_color_blobs_tracked().
+ *
+ * Once a target has been found, only a window around it is scanned in the
+ * following frames.  The whole image is scanned again every
+ * full_frame_interval frames, and as soon as the target is lost.
+ */
+typedef struct {
+    int full_frame_interval;  /// scan the whole image at least this often
+    int row_step;             /// row decimation within the window
+    int margin;               /// pixels added around the target, plus half
+                              ///  its size, to allow for motion
+    unsigned int min_pixels;  /// smaller blobs are not counted as a target
+    bool locked;              /// a target was found in the last frame
+    int frames_since_full;    /// frames since the whole image was scanned
+    Blob_Window window;       /// where to look in the next frame
+} Blob_Tracker;
+
+/**
+ * @brief Initialize a Blob_Tracker, with no target found.
+ *
+ * @param t [out]                    The tracker to initialize.
+ * @param full_frame_interval [in]   Scan the whole image at least once in
+ *                                   this many frames.  1 always scans it.
+ * @param row_step [in]              Look at one row in every row_step
+ *                                   within the window.
+ * @param margin [in]                Pixels to add on each side of the
+ *                                   target when making the window.
+ * @param min_pixels [in]            The pixel count of the smallest blob
+ *                                   that counts as a target.
+ */
+void blob_tracker_init(Blob_Tracker* t,
+                       int full_frame_interval,
+                       int row_step,
+                       int margin,
+                       unsigned int min_pixels);
+
+/**
+ * @brief Detect color blobs, scanning only a window around the target found
+ *        in the previous frame when possible.
+ *
+ * The window is the bounding box of all blobs of at least t->min_pixels
+ * pixels found in the previous frame, grown by t->margin pixels plus half
+ * its size on each side.  If no such blob is found within the window, the
+ * whole image is scanned straight away, so a lost target costs one extra
+ * scan rather than a missed frame.
+ *
+ * @param t [in,out]      The tracker, as set up by blob_tracker_init().
+ * @param bands [in,out]  Worker threads to use for whole image scans, or
+ *                        NULL to scan on the calling thread.
+ * @return True if the whole image was scanned.
+ * See detect_color_blobs() for all other parameters.
+ */
+bool detect_color_blobs_tracked(Blob_Tracker* t,
+                                Blob_Bands* bands,
+                                Blob_List* p,
+                                unsigned char y_low,
+                                unsigned char u_low,
+                                unsigned char u_high,
+                                unsigned char v_low,
+                                unsigned char v_high,
+                                int cols,
+                                int rows,
+                                unsigned char yuv[]);
+
+/**
+ * @brief The implementations of the UV threshold step of
+ *        detect_color_blobs().
+ *
+ * All kernels produce bit-identical results.  The vectorized kernels simply
+ * test 16 or 32 chroma samples at a time.
+ */
+typedef enum {
+    DCB_KERNEL_AUTO = 0, /// the fastest kernel supported by this CPU
+    DCB_KERNEL_SCALAR,   /// portable C, one chroma sample at a time
+    DCB_KERNEL_SSE2,     /// x86 SSE2, 16 chroma samples at a time
+    DCB_KERNEL_AVX2,     /// x86 AVX2, 32 chroma samples at a time
+    DCB_KERNEL_NEON      /// ARM NEON, 16 chroma samples at a time
+} Dcb_Kernel;
+
+/**
+ * @brief Select the UV threshold kernel used by detect_color_blobs().
+ *
+ * By default, the fastest kernel supported by the CPU is chosen at run time
+ * the first time detect_color_blobs() is called.  This is mostly useful for
+ * testing and benchmarking.  It must not be called while blobs are being
+ * detected on another thread, by detect_color_blobs_banded() say.
+ *
+ * @param kernel [in] The kernel to use.  If the CPU does not support it,
+ *                    DCB_KERNEL_SCALAR is used instead.
+ * @return The kernel actually selected.  Never DCB_KERNEL_AUTO.
+ */
+Dcb_Kernel detect_color_blobs_set_kernel(Dcb_Kernel kernel);
+
+/**
+ * @brief Return the UV threshold kernel used by detect_color_blobs().
+ */
+Dcb_Kernel detect_color_blobs_get_kernel(void);
+
+/**
+ * @brief Return a printable name for the given kernel.
+ */
+const char* detect_color_blobs_kernel_name(Dcb_Kernel kernel);
+
 #if 0
 /**
  * @brief Return statistics on the iTH color blob in the given Blob_List.
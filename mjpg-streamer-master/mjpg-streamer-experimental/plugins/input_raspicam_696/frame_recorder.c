@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2017 by Daniel Clouse.
+ *
+ * This file is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ *
+ *  a) This library is free software; you can redistribute it and/or
+ *     modify it under the terms of the GNU General Public License as
+ *     published by the Free Software Foundation; either version 2 of the
+ *     License, or (at your option) any later version.
+ *
+ *     This library is distributed in the hope that it will be useful, 
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public
+ *     License along with this library; if not, write to the Free
+ *     Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *     MA 02110-1301 USA
+ *
+ * Alternatively,
+ *
+ *  b) Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *     1. Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *     2. Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#define _GNU_SOURCE  // for O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "frame_recorder.h"
+#include "yuv420.h"
+
+// Bytes handed to each write(2).  A multiple of ALIGN_BYTES.
+#define CHUNK_BYTES (1024 * 1024)
+
+// Alignment of buffer address, file offset and length that O_DIRECT needs.
+#define ALIGN_BYTES 4096
+
+struct Frame_Recorder {
+    int fd;
+    bool direct;                 /// fd was opened with O_DIRECT
+    FILE* index_fp;              /// NULL unless write_index was given
+    size_t max_frame_bytes;
+    int slot_count;
+    unsigned char** slot;        /// slot_count buffers of max_frame_bytes
+    size_t* slot_bytes;
+    int64_t* slot_usecs;
+    int* free_slot;              /// stack of slots holding no frame
+    int free_count;
+    int* queue;                  /// ring of slots waiting to be written
+    int queue_head;              /// index in queue of the oldest
+    int queue_count;
+    unsigned char* chunk;        /// CHUNK_BYTES, aligned for O_DIRECT
+    size_t chunk_fill;
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;         /// signals a queued frame, or quit
+    bool quit;
+    bool failed;                 /// a write failed, nothing more is written
+    Frame_Recorder_Stats stats;
+};
+
+/* After a failed write, the file ends at some point inside a frame, and
+   what would be appended after it would no longer start at a frame
+   boundary, so nothing more is written. */
+
+static void write_all(Frame_Recorder* rec,
+                      const unsigned char* buf,
+                      size_t bytes) {
+    while (bytes > 0 && !rec->failed) {
+        ssize_t written = write(rec->fd, buf, bytes);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && rec->direct) {
+                /* The file system took O_DIRECT at open(), but not now.
+                   Go on without it. */
+
+                int flags = fcntl(rec->fd, F_GETFL);
+                if (flags >= 0 &&
+                    fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT) == 0) {
+                    rec->direct = false;
+                    continue;
+                }
+            }
+            pthread_mutex_lock(&rec->mutex);
+            ++rec->stats.write_errors;
+            rec->failed = true;
+            pthread_mutex_unlock(&rec->mutex);
+            return;
+        }
+        buf += written;
+        bytes -= written;
+    }
+}
+
+/* Copy bytes to the chunk, writing it out each time it fills. */
+
+static void append(Frame_Recorder* rec,
+                   const unsigned char* data,
+                   size_t bytes) {
+    while (bytes > 0) {
+        size_t n = CHUNK_BYTES - rec->chunk_fill;
+        if (n > bytes) n = bytes;
+        memcpy(rec->chunk + rec->chunk_fill, data, n);
+        rec->chunk_fill += n;
+        data += n;
+        bytes -= n;
+        if (rec->chunk_fill == CHUNK_BYTES) {
+            write_all(rec, rec->chunk, CHUNK_BYTES);
+            rec->chunk_fill = 0;
+        }
+    }
+}
+
+/* Write the last, partial chunk.  Its length isn't aligned, so O_DIRECT
+   must be turned off first. */
+
+static void flush_chunk(Frame_Recorder* rec) {
+    if (rec->chunk_fill == 0 || rec->failed) return;
+    if (rec->direct) {
+        int flags = fcntl(rec->fd, F_GETFL);
+        if (flags >= 0) (void)fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+        rec->direct = false;
+    }
+    write_all(rec, rec->chunk, rec->chunk_fill);
+    rec->chunk_fill = 0;
+}
+
+static void* frame_recorder_writer(void* void_rec_ptr) {
+    Frame_Recorder* rec = (Frame_Recorder*)void_rec_ptr;
+    for (;;) {
+        pthread_mutex_lock(&rec->mutex);
+        while (rec->queue_count == 0 && !rec->quit) {
+            pthread_cond_wait(&rec->cond, &rec->mutex);
+        }
+        if (rec->queue_count == 0) {
+            pthread_mutex_unlock(&rec->mutex);
+            break;
+        }
+        int s = rec->queue[rec->queue_head];
+        rec->queue_head = (rec->queue_head + 1) % rec->slot_count;
+        --rec->queue_count;
+        pthread_mutex_unlock(&rec->mutex);
+
+        if (!rec->failed) {
+            append(rec, rec->slot[s], rec->slot_bytes[s]);
+            if (rec->index_fp != NULL) {
+                (void)yuv420_index_append(rec->index_fp, rec->slot_usecs[s]);
+            }
+        }
+
+        pthread_mutex_lock(&rec->mutex);
+        if (rec->failed) {
+            ++rec->stats.frames_dropped;
+        } else {
+            ++rec->stats.frames_written;
+            rec->stats.bytes_written += rec->slot_bytes[s];
+        }
+        rec->free_slot[rec->free_count++] = s;
+        pthread_mutex_unlock(&rec->mutex);
+    }
+    return NULL;
+}
+
+static void frame_recorder_free(Frame_Recorder* rec) {
+    int ii;
+    if (rec->fd >= 0) close(rec->fd);
+    if (rec->index_fp != NULL) fclose(rec->index_fp);
+    if (rec->slot != NULL) {
+        for (ii = 0; ii < rec->slot_count; ++ii) free(rec->slot[ii]);
+    }
+    free(rec->slot);
+    free(rec->slot_bytes);
+    free(rec->slot_usecs);
+    free(rec->free_slot);
+    free(rec->queue);
+    free(rec->chunk);
+    free(rec);
+}
+
+Frame_Recorder* frame_recorder_init(const char* filename,
+                                    const void* header,
+                                    size_t header_bytes,
+                                    size_t max_frame_bytes,
+                                    int slot_count,
+                                    bool write_index) {
+    int saved_errno;
+    int ii;
+    if (slot_count < 2) {
+        errno = EINVAL;
+        return NULL;
+    }
+    Frame_Recorder* rec = (Frame_Recorder*)calloc(1, sizeof(Frame_Recorder));
+    if (rec == NULL) return NULL;
+    rec->fd = -1;
+    rec->max_frame_bytes = max_frame_bytes;
+    rec->slot_count = slot_count;
+    rec->slot = (unsigned char**)calloc(slot_count, sizeof(unsigned char*));
+    rec->slot_bytes = (size_t*)calloc(slot_count, sizeof(size_t));
+    rec->slot_usecs = (int64_t*)calloc(slot_count, sizeof(int64_t));
+    rec->free_slot = (int*)calloc(slot_count, sizeof(int));
+    rec->queue = (int*)calloc(slot_count, sizeof(int));
+    if (rec->slot == NULL || rec->slot_bytes == NULL ||
+        rec->slot_usecs == NULL || rec->free_slot == NULL ||
+        rec->queue == NULL ||
+        posix_memalign((void**)&rec->chunk, ALIGN_BYTES, CHUNK_BYTES) != 0) {
+        rec->chunk = NULL;
+        errno = ENOMEM;
+        goto fail;
+    }
+
+    /* Allocate every slot now, so that recording allocates nothing. */
+
+    for (ii = 0; ii < slot_count; ++ii) {
+        rec->slot[ii] = (unsigned char*)malloc(max_frame_bytes);
+        if (rec->slot[ii] == NULL) goto fail;
+        rec->free_slot[rec->free_count++] = ii;
+    }
+
+    /* Bypass the page cache if possible.  Frames are written once and never
+       read back, so caching them only pushes out pages that matter. */
+
+    rec->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    rec->direct = (rec->fd >= 0);
+    if (rec->fd < 0 && errno == EINVAL) {
+        rec->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (rec->fd < 0) goto fail;
+    if (write_index) {
+        rec->index_fp = yuv420_index_open_write(filename);
+        if (rec->index_fp == NULL) goto fail;
+    }
+    append(rec, (const unsigned char*)header, header_bytes);
+    rec->stats.bytes_written = header_bytes;
+
+    pthread_mutex_init(&rec->mutex, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if (pthread_create(&rec->writer, NULL, frame_recorder_writer, rec) != 0) {
+        pthread_cond_destroy(&rec->cond);
+        pthread_mutex_destroy(&rec->mutex);
+        errno = EAGAIN;
+        goto fail;
+    }
+    return rec;
+fail:
+    saved_errno = errno;
+    frame_recorder_free(rec);
+    errno = saved_errno;
+    return NULL;
+}
+
+void frame_recorder_deinit(Frame_Recorder* rec,
+                           Frame_Recorder_Stats* stats_ptr) {
+    if (rec == NULL) return;
+    pthread_mutex_lock(&rec->mutex);
+    rec->quit = true;
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->mutex);
+    pthread_join(rec->writer, NULL);
+    flush_chunk(rec);
+    if (stats_ptr != NULL) *stats_ptr = rec->stats;
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->mutex);
+    frame_recorder_free(rec);
+}
+
+int frame_recorder_write(Frame_Recorder* rec,
+                         const void* frame,
+                         size_t bytes,
+                         int64_t usecs) {
+    int s;
+    pthread_mutex_lock(&rec->mutex);
+    if (rec->failed) {
+        ++rec->stats.frames_dropped;
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+    if (bytes > rec->max_frame_bytes) {
+        ++rec->stats.frames_oversize;
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+    if (rec->free_count > 0) {
+        s = rec->free_slot[--rec->free_count];
+    } else if (rec->queue_count > 0) {
+        /* The disk has fallen behind.  Drop the oldest frame. */
+
+        s = rec->queue[rec->queue_head];
+        rec->queue_head = (rec->queue_head + 1) % rec->slot_count;
+        --rec->queue_count;
+        ++rec->stats.frames_dropped;
+    } else {
+        ++rec->stats.frames_dropped;
+        pthread_mutex_unlock(&rec->mutex);
+        return -1;
+    }
+    pthread_mutex_unlock(&rec->mutex);
+
+    /* The slot belongs to this thread until it is queued, so copy into it
+       without the lock. */
+
+    memcpy(rec->slot[s], frame, bytes);
+    rec->slot_bytes[s] = bytes;
+    rec->slot_usecs[s] = usecs;
+
+    pthread_mutex_lock(&rec->mutex);
+    rec->queue[(rec->queue_head + rec->queue_count) % rec->slot_count] = s;
+    ++rec->queue_count;
+    if (rec->queue_count > rec->stats.max_queued) {
+        rec->stats.max_queued = rec->queue_count;
+    }
+    pthread_cond_signal(&rec->cond);
+    pthread_mutex_unlock(&rec->mutex);
+    return 0;
+}
+
+void frame_recorder_get_stats(Frame_Recorder* rec,
+                              Frame_Recorder_Stats* stats_ptr) {
+    pthread_mutex_lock(&rec->mutex);
+    *stats_ptr = rec->stats;
+    pthread_mutex_unlock(&rec->mutex);
+}
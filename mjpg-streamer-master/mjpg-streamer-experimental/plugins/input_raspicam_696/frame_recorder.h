@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2017 by Daniel Clouse.
+ *
+ * This file is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ *
+ *  a) This library is free software; you can redistribute it and/or
+ *     modify it under the terms of the GNU General Public License as
+ *     published by the Free Software Foundation; either version 2 of the
+ *     License, or (at your option) any later version.
+ *
+ *     This library is distributed in the hope that it will be useful, 
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public
+ *     License along with this library; if not, write to the Free
+ *     Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *     MA 02110-1301 USA
+ *
+ * Alternatively,
+ *
+ *  b) Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *     1. Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *     2. Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+/**
+ * @file
+ *
+ * Record camera frames to a file on a thread of their own.
+ *
+ * Frame_recorder_write() copies a frame into one of a fixed ring of slots
+ * and returns; a writer thread appends the slots to the file in large,
+ * page-aligned writes (with O_DIRECT where the file system allows it).  If
+ * the disk falls behind and the ring fills, the oldest unwritten frame is
+ * dropped, so the caller never waits on the disk.
+ *
+ * A failed write may leave the file ending inside a frame, after which
+ * nothing appended would start at a frame boundary, so nothing more is
+ * written: the frames still queued and all later ones are dropped.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct Frame_Recorder Frame_Recorder;
+
+typedef struct {
+    uint64_t frames_written;
+    uint64_t frames_dropped;   /// dropped because the ring was full, or
+                               /// after a write error
+    uint64_t frames_oversize;  /// dropped because bigger than a slot
+    uint64_t bytes_written;    /// including the file header
+    uint64_t write_errors;     /// failed write(2) calls
+    unsigned int max_queued;   /// most frames ever waiting to be written
+} Frame_Recorder_Stats;
+
+/**
+ * @brief Create or truncate a file, and start a thread to record frames
+ *        to it.
+ *
+ * @param filename [in]        The file to write.
+ * @param header [in]          Bytes to write at the start of the file, such
+ *                             as the "#!YUV420" line of a .yuv file.  May be
+ *                             NULL if header_bytes is 0.
+ * @param header_bytes [in]    The number of bytes in header.
+ * @param max_frame_bytes [in] The size of each slot.  Larger frames are
+ *                             dropped.
+ * @param slot_count [in]      The number of slots.  At least 2.  One is
+ *                             being written at any time, so this many frames
+ *                             less one can wait for the disk before frames
+ *                             are dropped.
+ * @param write_index [in]     If true, also write the timestamp of each
+ *                             frame written to an index file, as
+ *                             yuv420_index_open_write() does.
+ * @return The new Frame_Recorder, or NULL on failure, with errno set.
+ */
+Frame_Recorder* frame_recorder_init(const char* filename,
+                                    const void* header,
+                                    size_t header_bytes,
+                                    size_t max_frame_bytes,
+                                    int slot_count,
+                                    bool write_index);
+
+/**
+ * @brief Write all queued frames, stop the writer thread, close the file,
+ *        and free the Frame_Recorder.
+ *
+ * @param rec [in]         The Frame_Recorder to close.  May be NULL.
+ * @param stats_ptr [out]  If not NULL, returns the final counts.
+ */
+void frame_recorder_deinit(Frame_Recorder* rec,
+                           Frame_Recorder_Stats* stats_ptr);
+
+/**
+ * @brief Queue a frame to be written.
+ *
+ * This copies the frame and returns without waiting for the disk.  Only one
+ * thread at a time may call this for a given Frame_Recorder.
+ *
+ * @param rec [in]    A Frame_Recorder returned by frame_recorder_init().
+ * @param frame [in]  The frame to write.
+ * @param bytes [in]  The number of bytes in frame.
+ * @param usecs [in]  The timestamp of the frame, for the index.
+ * @return Zero if the frame was queued, or -1 if it was dropped, as all
+ *         frames are after a write error.  Queueing a frame may drop the
+ *         oldest queued one instead.
+ */
+int frame_recorder_write(Frame_Recorder* rec,
+                         const void* frame,
+                         size_t bytes,
+                         int64_t usecs);
+
+/**
+ * @brief Return the counts so far.
+ */
+void frame_recorder_get_stats(Frame_Recorder* rec,
+                              Frame_Recorder_Stats* stats_ptr);
+
+#endif
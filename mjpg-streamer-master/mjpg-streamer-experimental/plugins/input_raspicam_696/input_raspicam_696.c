@@ -42,6 +42,7 @@
 #include "mmal/util/mmal_util.h"
 #include "overwrite_tif_tags.h"
 #include "detect_color_blobs.h"
+#include "frame_recorder.h"
 #include "yuv_color_space_image.h"
 #include "udp_comms.h"
 #include "tcp_comms.h"
@@ -86,8 +87,12 @@ typedef struct {
     int vwidth;
     int vheight;
     MMAL_POOL_T* pool_ptr;
-    FILE* yuv_fp;
-    Blob_List blob_list;
+    Frame_Recorder* yuv_recorder;  /// NULL unless -writeyuv was given
+    Frame_Recorder* jpg_recorder;  /// NULL unless -writejpg was given
+    Blob_List blob_list[MAX_COLOR_CLASSES];  /// one per color class
+    Blob_Bands* blob_bands;     /// NULL unless -blobbands was given
+    Blob_Tracker blob_tracker;  /// used only if -blobtrack was given
+    Color_Class_Table color_class_table;     /// the color classes to detect
     pthread_mutex_t bbox_mutex;
 #define MAX_BBOXES 20
     unsigned short bbox_element_count;
@@ -107,10 +112,13 @@ static init_splitter_callback_data(Splitter_Callback_Data* p) {
     p->yuv_meas[2] = 128;
     p->frame_no = UINT_MAX; // encoder throws away 1st frame so we should too
     p->pool_ptr = NULL;
-    p->yuv_fp = NULL;
-#define MAX_RUNS 10000
-#define MAX_BLOBS 1000
-    p->blob_list = blob_list_init(MAX_RUNS, MAX_BLOBS);
+    p->yuv_recorder = NULL;
+    p->jpg_recorder = NULL;
+    // blob_list and blob_bands are allocated by input_init() once the image
+    // width is known.
+    p->blob_bands = NULL;
+    p->blob_tracker.full_frame_interval = 0;  // not tracking
+    p->color_class_table.class_count = -1;
     p->bbox_element_count = 0;
     pthread_mutex_init(&p->bbox_mutex, NULL);
 }
@@ -130,6 +138,12 @@ static int width = -1;
 static int height = -1;
 static int vwidth = -1;
 static int vheight = -1;
+static int blob_track_interval = 0;    // 0: no tracking
+static int blob_track_row_step = 2;
+static int blob_track_margin = 16;
+static int blob_band_count = 1;
+static int blobyuv_option_count = 0;
+static int record_slot_count = 8;
 static int quality = 85;
 static int usestills = 0;
 static int wantPreview = 0;
@@ -289,6 +303,10 @@ int input_init(input_parameter *param, int plugin_no) {
             {"againtol", required_argument, 0, 0},          // 39
             {"dgaintarget", required_argument, 0, 0},       // 40
             {"dgaintol", required_argument, 0, 0},          // 41
+            {"blobbands", required_argument, 0, 0},         // 42
+            {"blobregions", required_argument, 0, 0},       // 43
+            {"blobtrack", required_argument, 0, 0},         // 44
+            {"recordslots", required_argument, 0, 0},       // 45
             {0, 0, 0, 0}
         };
 
@@ -448,12 +466,20 @@ int input_init(input_parameter *param, int plugin_no) {
                 if (opt3 > 255) opt3 = 255;
                 if (opt4 > 255) opt4 = 255;
                 if (opt5 > 255) opt5 = 255;
-                tcp_params_ptr->blob_yuv_min[0] = opt0;
-                tcp_params_ptr->blob_yuv_max[0] = opt1;
-                tcp_params_ptr->blob_yuv_min[1] = opt2;
-                tcp_params_ptr->blob_yuv_max[1] = opt3;
-                tcp_params_ptr->blob_yuv_min[2] = opt4;
-                tcp_params_ptr->blob_yuv_max[2] = opt5;
+
+                // Each -blobyuv option adds another color class.
+
+                unsigned char yuv_min[3] = { opt0, opt2, opt4 };
+                unsigned char yuv_max[3] = { opt1, opt3, opt5 };
+                if (tcp_params_set_blob_class(tcp_params_ptr,
+                                              blobyuv_option_count,
+                                              yuv_min, yuv_max) != 0) {
+                    LOG_ERROR("at most %d -blobyuv options allowed\n",
+                              MAX_COLOR_CLASSES);
+                    help();
+                    return 1;
+                }
+                ++blobyuv_option_count;
                 tcp_params_ptr->detect_yuv = true;
             }
             break;
@@ -500,6 +526,65 @@ int input_init(input_parameter *param, int plugin_no) {
             //dgaintol
             sscanf(optarg, "%f", &tcp_params_ptr->digital_gain_tol);
             break;
+        case 42:
+            //blobbands
+            blob_band_count = atoi(optarg);
+            break;
+        case 43:
+            //blobregions
+            {
+                // Each class in the file adds another color class.
+
+                Color_Class color_class[MAX_COLOR_CLASSES];
+                Uv_Region uv_region[MAX_COLOR_CLASSES];
+                int count = color_classes_read(optarg, color_class, uv_region);
+                int c;
+                if (count < 0) {
+                    LOG_ERROR("can't read color classes from %s\n", optarg);
+                    return 1;
+                }
+                if (blobyuv_option_count + count > MAX_COLOR_CLASSES) {
+                    LOG_ERROR("at most %d color classes allowed\n",
+                              MAX_COLOR_CLASSES);
+                    help();
+                    return 1;
+                }
+                for (c = 0; c < count; ++c) {
+                    const Color_Class* k = &color_class[c];
+                    unsigned char yuv_min[3] = { k->y_low, k->u_low, k->v_low };
+                    unsigned char yuv_max[3] = { 255, k->u_high, k->v_high };
+                    (void)tcp_params_set_blob_region(tcp_params_ptr,
+                                                     blobyuv_option_count,
+                                                     &uv_region[c]);
+                    (void)tcp_params_set_blob_class(tcp_params_ptr,
+                                                    blobyuv_option_count,
+                                                    yuv_min, yuv_max);
+                    ++blobyuv_option_count;
+                }
+                tcp_params_ptr->detect_yuv = true;
+            }
+            break;
+        case 44:
+            //blobtrack
+            blob_track_interval = 0;
+            if (sscanf(optarg, "%d,%d,%d", &blob_track_interval,
+                       &blob_track_row_step, &blob_track_margin) < 1 ||
+                blob_track_interval < 1 || blob_track_row_step < 1 ||
+                blob_track_margin < 0) {
+                LOG_ERROR("bad -blobtrack %s\n", optarg);
+                help();
+                return 1;
+            }
+            break;
+        case 45:
+            //recordslots
+            if (sscanf(optarg, "%d", &record_slot_count) != 1 ||
+                record_slot_count < 2) {
+                LOG_ERROR("bad -recordslots %s\n", optarg);
+                help();
+                return 1;
+            }
+            break;
         default:
             DBG("default case\n");
             help();
@@ -519,6 +604,32 @@ int input_init(input_parameter *param, int plugin_no) {
     splitter_callback_data.vwidth = vwidth;
     splitter_callback_data.vheight = vheight;
 
+    // Allocate all blob detection memory now, so that the splitter callback
+    // need not.
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+#define MIN_PIXELS_PER_BLOB 30
+    for (i = 0; i < MAX_COLOR_CLASSES; ++i) {
+        splitter_callback_data.blob_list[i] = blob_list_init(MAX_RUNS,
+                                                             MAX_BLOBS,
+                                                             width);
+    }
+    if (blob_band_count > 1) {
+        splitter_callback_data.blob_bands = blob_bands_init(blob_band_count,
+                                                            MAX_RUNS,
+                                                            MAX_BLOBS,
+                                                            width);
+        if (splitter_callback_data.blob_bands == NULL) {
+            LOG_ERROR("can't blob_bands_init(%d)\n", blob_band_count);
+        }
+    }
+    if (blob_track_interval > 0) {
+        blob_tracker_init(&splitter_callback_data.blob_tracker,
+                          blob_track_interval, blob_track_row_step,
+                          blob_track_margin, MIN_PIXELS_PER_BLOB);
+    }
+
     pglobal = param->global;
 
     raspicamcontrol_log_parameters(fps, width, height, vwidth, vheight,
@@ -626,38 +737,92 @@ static void splitter_buffer_callback(MMAL_PORT_T *port,
                 cam_y  = rows / 2;
             }
             yuv420_get_pixel(cols, rows, img, cam_x, cam_y, pData->yuv_meas);
-            detect_color_blobs(&pData->blob_list,
-                               pData->tcp_params.blob_yuv_min[0],
-                               pData->tcp_params.blob_yuv_min[1],
-                               pData->tcp_params.blob_yuv_max[1],
-                               pData->tcp_params.blob_yuv_min[2],
-                               pData->tcp_params.blob_yuv_max[2],
-                               false, cols, rows, img);
-#define MIN_PIXELS_PER_BLOB 30
-            (void)blob_list_purge_small_bboxes(&pData->blob_list,
-                                               MIN_PIXELS_PER_BLOB);
-            pthread_mutex_lock(&pData->bbox_mutex);
-            pData->bbox_element_count =
-                copy_best_bounding_boxes(&pData->blob_list, MAX_BBOXES * 4,
-                                         pData->bbox_element);
-            pthread_mutex_unlock(&pData->bbox_mutex);
-            //printf("bbox_element_count= %d\n", pData->bbox_element_count);
-            udp_blob_list.msg_id = ID_UDP_BLOB_LIST;
-            udp_blob_list.filler[0] = 0;
-            udp_blob_list.filler[1] = 0;
-            udp_blob_list.filler[2] = 0;
-            udp_blob_list.blob_count = copy_best_bboxes_to_blob_stats_array(
-                                                       &pData->blob_list,
-                                                       MAX_UDP_BLOBS,
-                                                       &udp_blob_list.blob[0]);
-            (void)udp_comms_send_blobs_to_all(&udp_comms, now, &udp_blob_list);
+
+            /* With more than one color class, or any polygon or ellipse
+               region, all classes are detected in one pass.  Whenever the
+               classes change, the test image is redrawn to show them. */
+
+            Color_Class color_class[MAX_COLOR_CLASSES];
+            Uv_Region uv_region[MAX_COLOR_CLASSES];
+            int class_count = tcp_params_get_color_classes(&pData->tcp_params,
+                                                           color_class,
+                                                           uv_region);
+            if (color_class_table_set_regions(&pData->color_class_table,
+                                              class_count, color_class,
+                                              uv_region)) {
+                yuv_color_space_image(cols, rows, pData->test_img_y_value,
+                                      pData->test_img);
+                yuv_color_space_image_show_classes(cols, rows,
+                                                   &pData->color_class_table,
+                                                   pData->test_img);
+            }
+            if (class_count > 1 || !pData->color_class_table.all_boxes) {
+                detect_color_blobs_multi(&pData->color_class_table,
+                                         pData->blob_list, cols, rows, img);
+            } else if (pData->blob_tracker.full_frame_interval > 0) {
+                (void)detect_color_blobs_tracked(&pData->blob_tracker,
+                                                 pData->blob_bands,
+                                                 &pData->blob_list[0],
+                                                 color_class[0].y_low,
+                                                 color_class[0].u_low,
+                                                 color_class[0].u_high,
+                                                 color_class[0].v_low,
+                                                 color_class[0].v_high,
+                                                 cols, rows, img);
+            } else if (pData->blob_bands != NULL) {
+                detect_color_blobs_banded(pData->blob_bands,
+                                          &pData->blob_list[0],
+                                          color_class[0].y_low,
+                                          color_class[0].u_low,
+                                          color_class[0].u_high,
+                                          color_class[0].v_low,
+                                          color_class[0].v_high,
+                                          false, cols, rows, img);
+            } else {
+                detect_color_blobs(&pData->blob_list[0],
+                                   color_class[0].y_low,
+                                   color_class[0].u_low,
+                                   color_class[0].u_high,
+                                   color_class[0].v_low,
+                                   color_class[0].v_high,
+                                   false, cols, rows, img);
+            }
+
+            /* Send the best blobs of each class in its own message.  Only
+               class 0 bounding boxes are drawn on the video. */
+
+            int c;
+            for (c = 0; c < class_count; ++c) {
+                Blob_List* blob_list_ptr = &pData->blob_list[c];
+                (void)blob_list_purge_small_bboxes(blob_list_ptr,
+                                                   MIN_PIXELS_PER_BLOB);
+                if (c == 0) {
+                    pthread_mutex_lock(&pData->bbox_mutex);
+                    pData->bbox_element_count =
+                        copy_best_bounding_boxes(blob_list_ptr, MAX_BBOXES * 4,
+                                                 pData->bbox_element);
+                    pthread_mutex_unlock(&pData->bbox_mutex);
+                }
+                udp_blob_list.msg_id = ID_UDP_BLOB_LIST;
+                udp_blob_list.blob_class = c;
+                udp_blob_list.filler[0] = 0;
+                udp_blob_list.filler[1] = 0;
+                udp_blob_list.blob_count =
+                    copy_best_bboxes_to_blob_stats_array(blob_list_ptr,
+                                                         MAX_UDP_BLOBS,
+                                                         udp_blob_list.blob);
+                (void)udp_comms_send_blobs_to_all(&udp_comms, now,
+                                                  &udp_blob_list);
+            }
         }
         pthread_mutex_unlock(&pData->tcp_params.params_mutex);
-        mmal_buffer_header_mem_unlock(buffer);
-        if (pData->yuv_fp != NULL) {
-            //fwrite(buffer->data, 1, buffer->length, pData->yuv_fp);
-            fwrite(img, 1, buffer->length, pData->yuv_fp);
+        if (pData->yuv_recorder != NULL && pData->tcp_params.yuv_write) {
+            // Copies the image; the disk is written on another thread.
+            (void)frame_recorder_write(pData->yuv_recorder, img,
+                                       buffer->length,
+                                       get_cam_host_usec(&udp_comms));
         }
+        mmal_buffer_header_mem_unlock(buffer);
     } else {
         LOG_ERROR("Received a camera buffer callback with no state");
     }
@@ -780,6 +945,14 @@ static void encoder_buffer_callback(MMAL_PORT_T *port,
                              MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)) {
             //set frame size
             pglobal->in[plugin_number].size = pData->offset;
+            if (pData->splitter_data_ptr->jpg_recorder != NULL &&
+                pData->splitter_data_ptr->tcp_params.jpg_write) {
+                (void)frame_recorder_write(
+                                   pData->splitter_data_ptr->jpg_recorder,
+                                   pglobal->in[plugin_number].buf,
+                                   pData->offset,
+                                   get_cam_host_usec(&udp_comms));
+            }
 
             //Set frame timestamp
             if(wantTimestamp) {
@@ -792,6 +965,9 @@ static void encoder_buffer_callback(MMAL_PORT_T *port,
 
             pData->offset = 0;
             ++pData->frame_no;
+            /* share it with the output plugins through the frame ring */
+            input_frame_publish_buf(&pglobal->in[plugin_number]);
+
             /* signal fresh_frame */
             pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
             pthread_mutex_unlock(&pglobal->in[plugin_number].db);
@@ -1287,7 +1463,21 @@ void help(void)
 " [-usestills]...........: uses stills mode instead of video mode \n"\
 " [-preview].............: Enable full screen preview\n"\
 " [-timestamp]...........: Get timestamp for each frame\n"
-" [-writeyuv]............: Write to out_WWWW_HHHH.yuv\n"
+" [-writeyuv]............: Write to out.yuv, and the timestamp of each\n"
+"                          image to out.yuv.idx\n"
+" [-writejpg]............: Write to out.mjpg, and the timestamp of each\n"
+"                          image to out.mjpg.idx\n"
+" [-recordslots N].......: Buffer N images (default 8) for -writeyuv and\n"
+"                          -writejpg; if the disk falls behind, drop the\n"
+"                          oldest\n"
+" [-blobyuv Y0,Y1,U0,U1,V0,V1]: Detect blobs of this color; repeat to\n"
+"                          detect up to 8 color classes at once\n"
+" [-blobbands N].........: Detect blobs on N threads, one per image band\n"
+" [-blobregions FILE]....: Detect blobs of the colors (box, polygon or\n"
+"                          ellipse U-V regions) listed in FILE\n"
+" [-blobtrack N[,S[,M]]].: Once a blob is found, look only near it, at\n"
+"                          every S-th row (default 2) within M pixels\n"
+"                          (default 16); look everywhere every N frames\n"
 " \n"\
 " -sh  : Set image sharpness (-100 to 100)\n"\
 " -co  : Set image contrast (-100 to 100)\n"\
@@ -1310,6 +1500,23 @@ void help(void)
 
 }
 
+/******************************************************************************
+  Description.: finish recording, and report how much was written or dropped
+  Input Value.: filename is the file recorded to; rec may be NULL
+  Return Value: -
+ ******************************************************************************/
+static void log_recorder_stats(const char* filename, Frame_Recorder* rec) {
+    Frame_Recorder_Stats stats;
+    if (rec == NULL) return;
+    frame_recorder_deinit(rec, &stats);
+    LOG_STATUS("%s: %llu frames written, %llu dropped (disk too slow), "
+               "%llu dropped (too big), %llu write errors\n", filename,
+               (unsigned long long)stats.frames_written,
+               (unsigned long long)stats.frames_dropped,
+               (unsigned long long)stats.frames_oversize,
+               (unsigned long long)stats.write_errors);
+}
+
 /******************************************************************************
   Description.: setup mmal and callback
   Input Value.: arg is not used
@@ -1766,11 +1973,31 @@ void *worker_thread(void *arg) {
         splitter_callback_port->userdata =
                    (struct MMAL_PORT_USERDATA_T *)&splitter_callback_data;
         if (splitter_callback_data.tcp_params.yuv_write) {
-            char filename[32];
-            snprintf(filename, 32, "out.yuv");
-            splitter_callback_data.yuv_fp = fopen(filename, "wb");
-            fprintf(splitter_callback_data.yuv_fp,
-                    "#!YUV420 %7u,%7u\n", width, height);
+            char header[32];
+            int header_bytes = snprintf(header, 32, "#!YUV420 %7u,%7u\n",
+                                        width, height);
+            splitter_callback_data.yuv_recorder =
+                frame_recorder_init("out.yuv", header, header_bytes,
+                                    width * height * 3 / 2,
+                                    record_slot_count, true);
+            if (splitter_callback_data.yuv_recorder == NULL) {
+                LOG_ERROR("can't record to out.yuv (%s)\n", strerror(errno));
+            }
+        }
+        if (splitter_callback_data.tcp_params.jpg_write) {
+            /* The encoder compresses the YUV420 images of the splitter, and
+               its JPEGs of them are smaller than the images themselves at
+               any quality short of noise at 100, so a slot the size of an
+               image, with room for the headers, holds any frame; bigger
+               ones are counted as frames_oversize. */
+            splitter_callback_data.jpg_recorder =
+                frame_recorder_init("out.mjpg", NULL, 0,
+                                    width * height * 3 / 2 + 2048,
+                                    record_slot_count, true);
+            if (splitter_callback_data.jpg_recorder == NULL) {
+                LOG_ERROR("can't record to out.mjpg (%s)\n",
+                          strerror(errno));
+            }
         }
 
         /* Create the YUV test image. */
@@ -1944,9 +2171,8 @@ void *worker_thread(void *arg) {
     }
 
     vcos_semaphore_delete(&callback_data.complete_semaphore);
-    if (splitter_callback_data.yuv_fp != NULL) {
-        fclose(splitter_callback_data.yuv_fp);
-    }
+    log_recorder_stats("out.yuv", splitter_callback_data.yuv_recorder);
+    log_recorder_stats("out.mjpg", splitter_callback_data.jpg_recorder);
 
     // Close everything MMAL
 
@@ -47,7 +47,6 @@
  *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
-#include "mmal/mmal.h"
 
 /**
  * @brief Overwrite the existing tiff headers with Team 696 bounding box
@@ -125,6 +125,18 @@ static void tcp_params_byte_swap(Tcp_Params* p) {
     p->digital_gain_tol = htonf(p->digital_gain_tol);
     p->crosshairs_x = htonl(p->crosshairs_x);
     p->crosshairs_y = htonl(p->crosshairs_y);
+    p->blob_class_count = htonl(p->blob_class_count);
+    int c;
+    for (c = 0; c < MAX_COLOR_CLASSES; ++c) {
+        Uv_Region* r = &p->blob_uv_region[c];
+        r->type = htonl(r->type);
+        r->vertex_count = htonl(r->vertex_count);
+        r->center_u = htonf(r->center_u);
+        r->center_v = htonf(r->center_v);
+        r->radius_u = htonf(r->radius_u);
+        r->radius_v = htonf(r->radius_v);
+        r->angle = htonf(r->angle);
+    }
 }
 
 static void* connection_thread(void* void_args_ptr) {
@@ -150,6 +162,7 @@ static void* connection_thread(void* void_args_ptr) {
     Raspicam_Char_Msg* char_msg_ptr = (Raspicam_Char_Msg*)mesg;
     Raspicam_Int_Msg* int_msg_ptr = (Raspicam_Int_Msg*)mesg;
     Raspicam_Float_Msg* float_msg_ptr = (Raspicam_Float_Msg*)mesg;
+    Raspicam_Uv_Region_Msg* region_msg_ptr = (Raspicam_Uv_Region_Msg*)mesg;
     bool error_seen = false;
     ssize_t bytes;
     while ((bytes = recv(client_ptr->fd, &mesg, sizeof(mesg), 0)) > 0) {
@@ -400,15 +413,28 @@ static void* connection_thread(void* void_args_ptr) {
             }
             break;
         case RASPICAM_BLOB_YUV:
+            /* c[0..5] are the Y, U and V min/max values.  Optionally, c[6]
+               is the class number (default 0), and c[7] the new number of
+               classes in use. */
             if (bytes < 7) {
                 error_seen = true;
             } else {
-                params_ptr->blob_yuv_min[0] = char_msg_ptr->c[0];
-                params_ptr->blob_yuv_max[0] = char_msg_ptr->c[1];
-                params_ptr->blob_yuv_min[1] = char_msg_ptr->c[2];
-                params_ptr->blob_yuv_max[1] = char_msg_ptr->c[3];
-                params_ptr->blob_yuv_min[2] = char_msg_ptr->c[4];
-                params_ptr->blob_yuv_max[2] = char_msg_ptr->c[5];
+                unsigned char yuv_min[3];
+                unsigned char yuv_max[3];
+                int class_no = (bytes >= 8) ? char_msg_ptr->c[6] : 0;
+                yuv_min[0] = char_msg_ptr->c[0];
+                yuv_max[0] = char_msg_ptr->c[1];
+                yuv_min[1] = char_msg_ptr->c[2];
+                yuv_max[1] = char_msg_ptr->c[3];
+                yuv_min[2] = char_msg_ptr->c[4];
+                yuv_max[2] = char_msg_ptr->c[5];
+                if (tcp_params_set_blob_class(params_ptr, class_no, yuv_min,
+                                              yuv_max) != 0) {
+                    error_seen = true;
+                } else if (bytes >= 9) {
+                    params_ptr->blob_class_count =
+                        int_limit(1, MAX_COLOR_CLASSES, char_msg_ptr->c[7]);
+                }
             }
             break;
         case RASPICAM_FREEZE_EXPOSURE:
@@ -435,6 +461,47 @@ static void* connection_thread(void* void_args_ptr) {
                 params_ptr->crosshairs_y = ntohl(int_msg_ptr->int1);
             }
             break;
+        case RASPICAM_BLOB_UV_REGION:
+            /* A polygon is followed by vertex_count (u, v) pairs, an ellipse
+               by 5 floats.  A box needs nothing more. */
+            if (bytes < 4) {
+                error_seen = true;
+            } else {
+                Uv_Region r;
+                memset(&r, 0, sizeof(r));
+                r.type = region_msg_ptr->region_type;
+                if (r.type == UV_REGION_POLYGON) {
+                    int i;
+                    r.vertex_count = int_limit(0, MAX_UV_POLYGON_VERTICES,
+                                               region_msg_ptr->vertex_count);
+                    if (r.vertex_count < 3 ||
+                        bytes < 4 + 2 * r.vertex_count) {
+                        error_seen = true;
+                    }
+                    for (i = 0; i < r.vertex_count; ++i) {
+                        r.u[i] = region_msg_ptr->region.uv[i][0];
+                        r.v[i] = region_msg_ptr->region.uv[i][1];
+                    }
+                } else if (r.type == UV_REGION_ELLIPSE) {
+                    if (bytes < 4 + 5 * sizeof(float)) {
+                        error_seen = true;
+                    }
+                    r.center_u = ntohf(region_msg_ptr->region.ellipse[0]);
+                    r.center_v = ntohf(region_msg_ptr->region.ellipse[1]);
+                    r.radius_u = ntohf(region_msg_ptr->region.ellipse[2]);
+                    r.radius_v = ntohf(region_msg_ptr->region.ellipse[3]);
+                    r.angle = ntohf(region_msg_ptr->region.ellipse[4]);
+                } else if (r.type != UV_REGION_BOX) {
+                    error_seen = true;
+                }
+                if (!error_seen &&
+                    tcp_params_set_blob_region(params_ptr,
+                                               region_msg_ptr->class_no,
+                                               &r) != 0) {
+                    error_seen = true;
+                }
+            }
+            break;
         default:
             LOG_ERROR("at %.3f, unexpected tcp message tag %d from %s\n",
                       timestamp, mesg[0], client_string);
@@ -605,9 +672,91 @@ int tcp_params_construct(Tcp_Params* params_ptr) {
     params_ptr->digital_gain_tol = 0.1;
     params_ptr->crosshairs_x = 0;
     params_ptr->crosshairs_y = 0;
+    params_ptr->blob_class_count = 1;
+    memset(params_ptr->blob_class_yuv_min, 0,
+           sizeof(params_ptr->blob_class_yuv_min));
+    memset(params_ptr->blob_class_yuv_max, 0,
+           sizeof(params_ptr->blob_class_yuv_max));
+    memset(params_ptr->blob_uv_region, 0,
+           sizeof(params_ptr->blob_uv_region));
     return 0;
 }
 
+int tcp_params_set_blob_class(Tcp_Params* params_ptr,
+                              int class_no,
+                              const unsigned char yuv_min[3],
+                              const unsigned char yuv_max[3]) {
+    unsigned char* min_ptr;
+    unsigned char* max_ptr;
+    if (class_no < 0 || class_no >= MAX_COLOR_CLASSES) return -1;
+    if (class_no == 0) {
+        min_ptr = params_ptr->blob_yuv_min;
+        max_ptr = params_ptr->blob_yuv_max;
+    } else {
+        min_ptr = params_ptr->blob_class_yuv_min[class_no - 1];
+        max_ptr = params_ptr->blob_class_yuv_max[class_no - 1];
+    }
+    if (params_ptr->blob_uv_region[class_no].type == UV_REGION_BOX) {
+        memcpy(min_ptr, yuv_min, 3);
+        memcpy(max_ptr, yuv_max, 3);
+    } else {
+        min_ptr[0] = yuv_min[0];
+        max_ptr[0] = yuv_max[0];
+    }
+    if (class_no >= params_ptr->blob_class_count) {
+        params_ptr->blob_class_count = class_no + 1;
+    }
+    return 0;
+}
+
+int tcp_params_set_blob_region(Tcp_Params* params_ptr,
+                               int class_no,
+                               const Uv_Region* uv_region) {
+    unsigned char* min_ptr;
+    unsigned char* max_ptr;
+    if (class_no < 0 || class_no >= MAX_COLOR_CLASSES) return -1;
+    if (class_no == 0) {
+        min_ptr = params_ptr->blob_yuv_min;
+        max_ptr = params_ptr->blob_yuv_max;
+    } else {
+        min_ptr = params_ptr->blob_class_yuv_min[class_no - 1];
+        max_ptr = params_ptr->blob_class_yuv_max[class_no - 1];
+    }
+    params_ptr->blob_uv_region[class_no] = *uv_region;
+    if (uv_region->type != UV_REGION_BOX) {
+        Color_Class k;
+        uv_region_bounding_box(uv_region, &k);
+        min_ptr[1] = k.u_low;
+        max_ptr[1] = k.u_high;
+        min_ptr[2] = k.v_low;
+        max_ptr[2] = k.v_high;
+    }
+    if (class_no >= params_ptr->blob_class_count) {
+        params_ptr->blob_class_count = class_no + 1;
+    }
+    return 0;
+}
+
+int tcp_params_get_color_classes(const Tcp_Params* params_ptr,
+                                 Color_Class color_class[],
+                                 Uv_Region uv_region[]) {
+    int count = int_limit(1, MAX_COLOR_CLASSES, params_ptr->blob_class_count);
+    int c;
+    for (c = 0; c < count; ++c) {
+        const unsigned char* min_ptr = (c == 0) ?
+                params_ptr->blob_yuv_min : params_ptr->blob_class_yuv_min[c - 1];
+        const unsigned char* max_ptr = (c == 0) ?
+                params_ptr->blob_yuv_max : params_ptr->blob_class_yuv_max[c - 1];
+        color_class[c].y_low = min_ptr[0];
+        color_class[c].u_low = min_ptr[1];
+        color_class[c].u_high = max_ptr[1];
+        color_class[c].v_low = min_ptr[2];
+        color_class[c].v_high = max_ptr[2];
+        uv_region[c] = params_ptr->blob_uv_region[c];
+    }
+    return count;
+}
+
 int tcp_comms_construct(Tcp_Comms* comms_ptr,
                         MMAL_COMPONENT_T* camera_ptr,
                         Tcp_Params* tcp_params_ptr,
@@ -55,6 +55,7 @@
 #include <sys/types.h>
 #include "mmal.h"
 #include "RaspiCamControl.h"
+#include "detect_color_blobs.h"
 
 typedef struct {
     bool is_connected;
@@ -77,6 +78,16 @@ typedef struct {
     float digital_gain_tol;
     int crosshairs_x;
     int crosshairs_y;
+    /** The number of color classes to detect.  Class 0 is given by
+        blob_yuv_min and blob_yuv_max; class c > 0 by blob_class_yuv_min[c-1]
+        and blob_class_yuv_max[c-1].  These extra classes are sent to the GUI,
+        but never taken from it when it connects. */
+    int blob_class_count;
+    unsigned char blob_class_yuv_min[MAX_COLOR_CLASSES - 1][3];
+    unsigned char blob_class_yuv_max[MAX_COLOR_CLASSES - 1][3];
+    /** The U-V region of each color class.  For a non-box region, the U and
+        V thresholds of the class hold the bounding box of the region. */
+    Uv_Region blob_uv_region[MAX_COLOR_CLASSES];
     pthread_mutex_t params_mutex;           /// mutual exclusion lock
 } Tcp_Params;
 
@@ -131,6 +142,7 @@ typedef enum { TEXT_COLOR_RED = 'r',
 #define RASPICAM_BLOB_YUV               24
 #define RASPICAM_FREEZE_EXPOSURE        25
 #define RASPICAM_CROSSHAIRS             26
+#define RASPICAM_BLOB_UV_REGION         27
 
 typedef struct {
     unsigned char tag;
@@ -154,9 +166,67 @@ typedef struct {
     float float3;
 } Raspicam_Float_Msg;
 
+typedef struct {
+    unsigned char tag;
+    unsigned char class_no;
+    unsigned char region_type;           /// a Uv_Region_Type
+    unsigned char vertex_count;          /// UV_REGION_POLYGON only
+    union {
+        unsigned char uv[MAX_UV_POLYGON_VERTICES][2];  /// polygon (u, v)
+        float ellipse[5];    /// center_u, center_v, radius_u, radius_v, angle
+    } region;
+} Raspicam_Uv_Region_Msg;
+
 
 int tcp_params_construct(Tcp_Params* tcp_params_ptr);
 
+/**
+ * @brief Set the YUV thresholds of color class class_no.
+ *
+ * If class_no is not already in use, blob_class_count is increased to
+ * include it.  If the class has a polygon or ellipse region, only the Y
+ * thresholds are changed.
+ *
+ * @param tcp_params_ptr [in,out] The parameters to change.
+ * @param class_no [in]           The class to set, 0 .. MAX_COLOR_CLASSES-1.
+ * @param yuv_min [in]            The minimum Y, U and V values.
+ * @param yuv_max [in]            The maximum Y, U and V values.
+ * @return 0 on success, or -1 if class_no is out of range.
+ */
+int tcp_params_set_blob_class(Tcp_Params* tcp_params_ptr,
+                              int class_no,
+                              const unsigned char yuv_min[3],
+                              const unsigned char yuv_max[3]);
+
+/**
+ * @brief Set the U-V region of color class class_no.
+ *
+ * If class_no is not already in use, blob_class_count is increased to
+ * include it.  For a polygon or ellipse, the U and V thresholds of the class
+ * are set to the bounding box of the region.  A UV_REGION_BOX region makes
+ * the class use its U and V thresholds again.
+ *
+ * @param tcp_params_ptr [in,out] The parameters to change.
+ * @param class_no [in]           The class to set, 0 .. MAX_COLOR_CLASSES-1.
+ * @param uv_region [in]          The region.
+ * @return 0 on success, or -1 if class_no is out of range.
+ */
+int tcp_params_set_blob_region(Tcp_Params* tcp_params_ptr,
+                               int class_no,
+                               const Uv_Region* uv_region);
+
+/**
+ * @brief Copy the color classes to detect out of Tcp_Params.
+ *
+ * @param tcp_params_ptr [in] The parameters to read.
+ * @param color_class [out]   Space for MAX_COLOR_CLASSES classes.
+ * @param uv_region [out]     Space for MAX_COLOR_CLASSES regions.
+ * @return The number of classes copied.
+ */
+int tcp_params_get_color_classes(const Tcp_Params* tcp_params_ptr,
+                                 Color_Class color_class[],
+                                 Uv_Region uv_region[]);
+
 int tcp_comms_construct(Tcp_Comms* comms_ptr,
                         MMAL_COMPONENT_T* camera_ptr,
                         Tcp_Params* tcp_params_ptr,
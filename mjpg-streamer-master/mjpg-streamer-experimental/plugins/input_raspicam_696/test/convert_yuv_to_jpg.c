@@ -9,7 +9,7 @@ static int write_one_image(const char* prefix,
                            int image_no,
                            unsigned int cols,
                            unsigned int rows,
-                           unsigned char yuv[],
+                           const unsigned char yuv[],
                            unsigned char rgb[]) {
     char filename[FILENAME_MAX];
     snprintf(filename, FILENAME_MAX, "%s_%04d.jpg", prefix, image_no);
@@ -40,33 +40,27 @@ int main(int argc, char* argv[]) {
     strncpy(prefix, basename(in_filename), FILENAME_MAX);
     (void)remove_extension(prefix);
 
-    Yuv_File yuv_file = yuv420_open_read(in_filename);
-    if (yuv420_is_null(&yuv_file)) {
+    Yuv_Clip clip;
+    if (yuv420_clip_open(in_filename, 0, &clip) < 0) {
         fprintf(stderr, "can't open %s for reading\n", in_filename);
         return -1;
     }
-    unsigned int cols = yuv420_get_cols(&yuv_file);
-    unsigned int rows = yuv420_get_rows(&yuv_file);
+    unsigned int cols = clip.cols;
+    unsigned int rows = clip.rows;
     printf("cols=%u rows=%u\n", cols, rows);
-    unsigned char* yuv0 = yuv420_malloc(&yuv_file);
-    unsigned char* yuv = yuv420_malloc(&yuv_file);
     unsigned char* rgb = (unsigned char*)malloc(cols * rows * 3);
-    /* Try to read two image. */
-
-    int status = yuv420_read_next(&yuv_file, yuv0);
-    if (status < 0) {
+    if (clip.frame_count == 0) {
         fprintf(stderr, "%s is empty\n", in_filename);
         goto quit;
     }
-    status = yuv420_read_next(&yuv_file, yuv);
 
-    if (status < 0) {
+    if (clip.frame_count == 1) {
         /* There's only one image in the input file.  Write the 0th image.
            The output filename does not contain a number. */
 
         char filename[FILENAME_MAX];
         snprintf(filename, FILENAME_MAX, "%s.jpg", prefix);
-        convert_yuv420_to_rgb(cols, rows, yuv0, rgb);
+        convert_yuv420_to_rgb(cols, rows, yuv420_clip_frame(&clip, 0), rgb);
         if (jpeg_file_write(filename, 80, cols, rows, rgb) < 0) {
             fprintf(stderr, "can't write to %s\n", filename);
         } else {
@@ -75,26 +69,19 @@ int main(int argc, char* argv[]) {
         goto quit;
     }
 
-    /* Write the 0th image. */
-
-    if (write_one_image(prefix, 0, cols, rows, yuv0, rgb) < 0) {
-        goto quit;
-    }
-
-    /* Write the rest of the images. */
+    /* Write all the images. */
 
-    int image_no = 1;
-    do {
-        if (write_one_image(prefix, image_no, cols, rows, yuv, rgb) < 0) {
+    int image_no;
+    for (image_no = 0; image_no < clip.frame_count; ++image_no) {
+        const unsigned char* yuv = yuv420_clip_frame(&clip, image_no);
+        if (yuv == NULL ||
+            write_one_image(prefix, image_no, cols, rows, yuv, rgb) < 0) {
             goto quit;
         }
-        ++image_no;
-    } while (yuv420_read_next(&yuv_file, yuv) >= 0);
+    }
     return_val = 0;
 quit:
-    yuv420_close(&yuv_file);
-    free(yuv0);
-    free(yuv);
+    yuv420_clip_close(&clip);
     free(rgb);
     return return_val;
 }
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "detect_color_blobs.h"
+#include "test_util.h"
+
+/* Check that the per-frame blob detection work in the splitter callback
+   never touches the heap once warmed up.
+
+   usage: detect_color_blobs_alloc
+
+   Malloc() and friends are replaced below, so that every heap call is
+   counted, including those made from inside the C library (qsort_r() for
+   one).  This relies on glibc's __libc_malloc() and friends. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+#define MAX_BBOXES 20
+#define MAX_STATS 40
+#define MIN_PIXELS_PER_BLOB 30
+#define WARM_UP_FRAMES 2
+#define STEADY_FRAMES 20
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static unsigned long heap_call_count = 0;
+
+void* malloc(size_t size) {
+    ++heap_call_count;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    ++heap_call_count;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    ++heap_call_count;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    if (ptr != NULL) ++heap_call_count;
+    __libc_free(ptr);
+}
+
+/* Fill yuv with noise, plus enough rectangles of the color detected below
+   that sorting them needs more than a little temporary space. */
+static void make_busy_frame(unsigned int cols,
+                            unsigned int rows,
+                            unsigned int seed,
+                            unsigned char yuv[]) {
+    unsigned int ii;
+    make_noise_frame(cols, rows, seed, 0, 255, 0, 255, yuv);
+    for (ii = 0; ii < 200; ++ii) {
+        unsigned int x0 = rand() % (cols / 2);
+        unsigned int y0 = rand() % (rows / 2);
+        unsigned int w = 4 + rand() % (cols / 32);
+        unsigned int h = 4 + rand() % (rows / 32);
+        paint_uv_rect(cols, rows, x0, y0, w, h, 100, 180, yuv);
+    }
+}
+
+/* Do everything splitter_buffer_callback() does with a frame. */
+static int process_frame(Blob_List* p,
+                         Blob_Bands* bands,
+                         unsigned int cols,
+                         unsigned int rows,
+                         unsigned char yuv[]) {
+    unsigned short bbox_element[MAX_BBOXES * 4];
+    Blob_Stats* stats;
+    if (bands != NULL) {
+        detect_color_blobs_banded(bands, p, 60, 80, 120, 160, 200, false,
+                                  cols, rows, yuv);
+    } else {
+        detect_color_blobs(p, 60, 80, 120, 160, 200, false, cols, rows, yuv);
+    }
+    (void)blob_list_purge_small_bboxes(p, MIN_PIXELS_PER_BLOB);
+    (void)copy_best_bounding_boxes(p, MAX_BBOXES * 4, bbox_element);
+    stats = (Blob_Stats*)blob_list_scratch_alloc(p,
+                                                 MAX_STATS * sizeof(*stats));
+    if (stats == NULL) {
+        fprintf(stderr, "FAIL: blob_list_scratch_alloc() returned NULL\n");
+        return 1;
+    }
+    (void)copy_best_bboxes_to_blob_stats_array(p, MAX_STATS, stats);
+    return 0;
+}
+
+static int check(const char* name, Blob_List* p, Blob_Bands* bands) {
+    static const unsigned int sizes[][2] = {
+        { 640, 480 }, { 320, 240 }, { 1280, 720 }
+    };
+    int failures = 0;
+    int ii;
+    int frame;
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        unsigned int cols = sizes[ii][0];
+        unsigned int rows = sizes[ii][1];
+        unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+        unsigned long heap_calls;
+        unsigned long heap_allocs;
+        for (frame = 0; frame < WARM_UP_FRAMES; ++frame) {
+            make_busy_frame(cols, rows, frame, yuv);
+            failures += process_frame(p, bands, cols, rows, yuv);
+        }
+        heap_calls = heap_call_count;
+        heap_allocs = p->heap_alloc_count;
+        for (frame = 0; frame < STEADY_FRAMES; ++frame) {
+            make_busy_frame(cols, rows, frame, yuv);
+            failures += process_frame(p, bands, cols, rows, yuv);
+        }
+        heap_calls = heap_call_count - heap_calls;
+        heap_allocs = p->heap_alloc_count - heap_allocs;
+        fprintf(stderr, "%s (%u x %u): %lu heap calls in %d frames\n",
+                name, cols, rows, heap_calls, STEADY_FRAMES);
+        if (heap_calls != 0 || heap_allocs != 0) {
+            fprintf(stderr, "FAIL: %s (%u x %u) heap_calls= %lu "
+                    "heap_alloc_count grew by %lu\n",
+                    name, cols, rows, heap_calls, heap_allocs);
+            ++failures;
+        }
+        free(yuv);
+    }
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    Blob_List bl = blob_list_init(MAX_RUNS, MAX_BLOBS, 640);
+    Blob_Bands* bands = blob_bands_init(4, MAX_RUNS, MAX_BLOBS, 640);
+    if (bands == NULL) {
+        fprintf(stderr, "can't blob_bands_init(4)\n");
+        return -1;
+    }
+    if (bl.heap_alloc_count != 0) {
+        fprintf(stderr, "FAIL: heap_alloc_count= %lu after blob_list_init\n",
+                bl.heap_alloc_count);
+        ++failures;
+    }
+    failures += check("serial", &bl, NULL);
+    failures += check("banded", &bl, bands);
+
+    fprintf(stderr, "%s: %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", failures);
+    blob_bands_deinit(bands);
+    blob_list_deinit(&bl);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Check that detect_color_blobs_banded() finds exactly the same blobs as
+   detect_color_blobs(), for several band counts.
+
+   usage: detect_color_blobs_bands [file.yuv ...]
+
+   Every frame of every given .yuv file is checked.  With no arguments,
+   synthetic frames are used instead. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+#define MAX_BANDS 8
+
+static const unsigned char thresholds[][5] = {
+    /* y_low, u_low, u_high, v_low, v_high */
+    {  60,  80, 120, 160, 200 },
+    {  40,  90, 140,  90, 140 },
+    {  40,   0, 255,   0, 255 },
+};
+#define THRESHOLD_COUNT (sizeof(thresholds) / sizeof(thresholds[0]))
+
+/* Fill yuv with noise, then paint some filled ellipses of the target color
+   (see thresholds[0]) over it.  Many of them will cross band boundaries. */
+static void make_ellipse_frame(unsigned int cols,
+                               unsigned int rows,
+                               unsigned int seed,
+                               unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned char* u = &yuv[pixels];
+    unsigned char* v = &yuv[pixels + pixels / 4];
+    int ii;
+    int x;
+    int y;
+    make_noise_frame(cols, rows, seed, 64, 191, 64, 191, yuv);
+    for (ii = 0; ii < 40; ++ii) {
+        int cx = rand() % cols;
+        int cy = rand() % rows;
+        int rx = 2 + rand() % (cols / 8);
+        int ry = 2 + rand() % (rows / 4);
+        for (y = cy - ry; y <= cy + ry; ++y) {
+            if (y < 0 || y >= rows) continue;
+            for (x = cx - rx; x <= cx + rx; ++x) {
+                if (x < 0 || x >= cols) continue;
+                int dx = x - cx;
+                int dy = y - cy;
+                if (dx * dx * ry * ry + dy * dy * rx * rx > rx * rx * ry * ry) {
+                    continue;
+                }
+                yuv[y * cols + x] = 80 + rand() % 176;
+                u[(y / 2) * (cols / 2) + x / 2] = 100;
+                v[(y / 2) * (cols / 2) + x / 2] = 180;
+            }
+        }
+    }
+}
+
+static int check_frame(const char* name,
+                       unsigned int cols,
+                       unsigned int rows,
+                       unsigned char yuv[],
+                       Blob_List* expected,
+                       Blob_List* actual,
+                       Blob_Bands* bands[],
+                       double elapsed_secs[]) {
+    int failures = 0;
+    int tt;
+    int bb;
+    for (tt = 0; tt < THRESHOLD_COUNT; ++tt) {
+        const unsigned char* t = thresholds[tt];
+        struct timespec start_time;
+        struct timespec end_time;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        detect_color_blobs(expected, t[0], t[1], t[2], t[3], t[4], false,
+                           cols, rows, yuv);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        elapsed_secs[1] += delta_time(&start_time, &end_time);
+        for (bb = 2; bb <= MAX_BANDS; ++bb) {
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            detect_color_blobs_banded(bands[bb], actual, t[0], t[1], t[2],
+                                      t[3], t[4], false, cols, rows, yuv);
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            elapsed_secs[bb] += delta_time(&start_time, &end_time);
+            if (!blob_lists_have_same_blobs(expected, actual)) {
+                fprintf(stderr,
+                        "FAIL: %s (%u x %u) threshold %d bands %d "
+                        "(%d blobs, expected %d)\n",
+                        name, cols, rows, tt, bb, actual->used_root_list_count,
+                        expected->used_root_list_count);
+                ++failures;
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    int frames = 0;
+    double elapsed_secs[MAX_BANDS + 1] = { 0.0 };
+    Blob_Bands* bands[MAX_BANDS + 1];
+    Blob_List expected = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    Blob_List actual = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    int ii;
+
+    for (ii = 2; ii <= MAX_BANDS; ++ii) {
+        bands[ii] = blob_bands_init(ii, MAX_RUNS, MAX_BLOBS, 0);
+        if (bands[ii] == NULL) {
+            fprintf(stderr, "can't blob_bands_init(%d)\n", ii);
+            return -1;
+        }
+    }
+    if (argc < 2) {
+        static const unsigned int sizes[][2] = {
+            { 1280, 720 }, { 640, 480 }, { 320, 240 }, { 64, 18 }, { 32, 6 }
+        };
+        for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            unsigned int cols = sizes[ii][0];
+            unsigned int rows = sizes[ii][1];
+            unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+            make_ellipse_frame(cols, rows, ii + 1, yuv);
+            failures += check_frame("synthetic", cols, rows, yuv,
+                                    &expected, &actual, bands, elapsed_secs);
+            ++frames;
+            free(yuv);
+        }
+    }
+    for (ii = 1; ii < argc; ++ii) {
+        Yuv_File yuv_file = yuv420_open_read(argv[ii]);
+        if (yuv420_is_null(&yuv_file)) {
+            fprintf(stderr, "can't read %s\n", argv[ii]);
+            return -1;
+        }
+        unsigned int cols = yuv420_get_cols(&yuv_file);
+        unsigned int rows = yuv420_get_rows(&yuv_file);
+        unsigned char* yuv = yuv420_malloc(&yuv_file);
+        while (yuv420_read_next(&yuv_file, yuv) >= 0) {
+            failures += check_frame(argv[ii], cols, rows, yuv,
+                                    &expected, &actual, bands, elapsed_secs);
+            ++frames;
+        }
+        yuv420_close(&yuv_file);
+        free(yuv);
+    }
+
+    for (ii = 1; ii <= MAX_BANDS; ++ii) {
+        fprintf(stderr, "bands= %d elapsed_secs= %.6f\n", ii, elapsed_secs[ii]);
+        if (ii > 1) blob_bands_deinit(bands[ii]);
+    }
+    fprintf(stderr, "%s: %d frames, %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", frames, failures);
+    blob_list_deinit(&expected);
+    blob_list_deinit(&actual);
+    return failures == 0 ? 0 : 1;
+}
@@ -5,6 +5,7 @@
 #include <jpeglib.h>
 #include "detect_color_blobs.h"
 #include "yuv420.h"
+#include "test_util.h"
 
 static unsigned char* jpeg_read(const char* filename,
                                 unsigned int* width_ptr,
@@ -127,11 +128,6 @@ static int convert_rgb_to_yuv440(unsigned int width,
     return required_yuv_bytes;
 }
 
-static double delta_time(struct timespec* a_ptr, struct timespec* b_ptr) {
-    return (b_ptr->tv_sec - a_ptr->tv_sec) +
-           (b_ptr->tv_nsec - a_ptr->tv_nsec) / 1000000000.0;
-}
-
 static void dump_root_info_stats(Blob_List* p, int index) {
     const Blob_Stats* s = &p->root_info[index].stats;
     fprintf(stderr,
@@ -197,7 +193,7 @@ int main(int argc, const char* argv[]) {
     clock_gettime(CLOCK_REALTIME, &start_time);
 #define MAX_RUNS 10000
 #define MAX_BLOBS 1000
-    Blob_List bl = blob_list_init(MAX_RUNS, MAX_BLOBS);
+    Blob_List bl = blob_list_init(MAX_RUNS, MAX_BLOBS, cols);
 #ifdef DCB_DEBUG
     bool highlight_detected_pixels = true;
 #else
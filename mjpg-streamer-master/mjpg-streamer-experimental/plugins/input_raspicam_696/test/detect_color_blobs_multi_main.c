@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Check that detect_color_blobs_multi() finds exactly the same blobs for each
+   color class as detect_color_blobs() does, and compare their speed.  The
+   lookup table path (scalar kernel) of detect_color_blobs_multi() is
+   checked, and the vector path of every kernel this CPU supports.
+
+   usage: detect_color_blobs_multi [file.yuv ...]
+
+   Every frame of every given .yuv file is checked.  With no arguments,
+   synthetic frames are used instead. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+
+static const Color_Class classes[] = {
+    /* y_low, u_low, u_high, v_low, v_high */
+    {  60,  80, 120, 160, 200 },
+    {  40, 150, 200,  40,  90 },
+    { 100,  90, 140,  90, 140 },
+    {   0, 110, 170, 150, 210 },  // overlaps class 0
+    {   0,   0, 255,   0, 255 },
+    {  20, 200, 100,   0, 255 },  // empty range
+    { 200,   0,  60,   0,  60 },
+    {  80, 120, 136, 120, 136 },
+};
+#define CLASS_COUNT (sizeof(classes) / sizeof(classes[0]))
+
+/* Fill yuv with noise, then paint blocks of the target colors of the first
+   few classes over it. */
+static void make_class_frame(unsigned int cols,
+                             unsigned int rows,
+                             unsigned int seed,
+                             unsigned char yuv[]) {
+    unsigned int ii;
+    make_noise_frame(cols, rows, seed, 64, 191, 64, 191, yuv);
+    for (ii = 0; ii < 60; ++ii) {
+        const Color_Class* k = &classes[ii % 4];
+        unsigned int x0 = rand() % (cols / 2);
+        unsigned int y0 = rand() % (rows / 2);
+        unsigned int w = 1 + rand() % (cols / 12 + 1);
+        unsigned int h = 1 + rand() % (rows / 12 + 1);
+        paint_uv_rect(cols, rows, x0, y0, w, h,
+                      (k->u_low + k->u_high) / 2, (k->v_low + k->v_high) / 2,
+                      yuv);
+    }
+}
+
+static int check_frame(const char* name,
+                       unsigned int cols,
+                       unsigned int rows,
+                       unsigned char yuv[],
+                       Color_Class_Table* t,
+                       Blob_List expected[],
+                       Blob_List actual[],
+                       double elapsed_secs[][3]) {
+    int failures = 0;
+    int n;
+    int c;
+    for (n = 1; n <= CLASS_COUNT; ++n) {
+        struct timespec start_time;
+        struct timespec end_time;
+        Dcb_Kernel best = detect_color_blobs_set_kernel(DCB_KERNEL_AUTO);
+        Dcb_Kernel kernel;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        for (c = 0; c < n; ++c) {
+            const Color_Class* k = &classes[c];
+            detect_color_blobs(&expected[c], k->y_low, k->u_low, k->u_high,
+                               k->v_low, k->v_high, false, cols, rows, yuv);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        elapsed_secs[n][0] += delta_time(&start_time, &end_time);
+
+        (void)color_class_table_set(t, n, classes);
+        /* Check every kernel this CPU supports, but only time the lookup
+           table and the fastest kernel. */
+        for (kernel = DCB_KERNEL_SCALAR; kernel <= DCB_KERNEL_NEON; ++kernel) {
+            if (detect_color_blobs_set_kernel(kernel) != kernel) continue;
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            detect_color_blobs_multi(t, actual, cols, rows, yuv);
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            if (kernel == DCB_KERNEL_SCALAR) {
+                elapsed_secs[n][1] += delta_time(&start_time, &end_time);
+            } else if (kernel == best) {
+                elapsed_secs[n][2] += delta_time(&start_time, &end_time);
+            }
+            for (c = 0; c < n; ++c) {
+                if (!blob_lists_are_equal(&expected[c], &actual[c])) {
+                    fprintf(stderr, "FAIL: %s (%u x %u) classes %d class %d "
+                            "kernel %s (%d blobs, expected %d)\n",
+                            name, cols, rows, n, c,
+                            detect_color_blobs_kernel_name(kernel),
+                            actual[c].used_root_list_count,
+                            expected[c].used_root_list_count);
+                    ++failures;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    int frames = 0;
+    double elapsed_secs[CLASS_COUNT + 1][3] = { { 0.0 } };
+    static Color_Class_Table table;
+    Blob_List expected[CLASS_COUNT];
+    Blob_List actual[CLASS_COUNT];
+    int ii;
+
+    table.class_count = -1;
+    for (ii = 0; ii < CLASS_COUNT; ++ii) {
+        expected[ii] = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+        actual[ii] = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    }
+    if (!color_class_table_set(&table, CLASS_COUNT, classes) ||
+        color_class_table_set(&table, CLASS_COUNT, classes)) {
+        fprintf(stderr, "FAIL: color_class_table_set() rebuild check\n");
+        ++failures;
+    }
+    if (argc < 2) {
+        static const unsigned int sizes[][2] = {
+            { 1280, 720 }, { 640, 480 }, { 320, 240 }, { 66, 10 }, { 30, 4 }
+        };
+        for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            unsigned int cols = sizes[ii][0];
+            unsigned int rows = sizes[ii][1];
+            unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+            make_class_frame(cols, rows, ii + 1, yuv);
+            failures += check_frame("synthetic", cols, rows, yuv, &table,
+                                    expected, actual, elapsed_secs);
+            ++frames;
+            free(yuv);
+        }
+    }
+    for (ii = 1; ii < argc; ++ii) {
+        Yuv_File yuv_file = yuv420_open_read(argv[ii]);
+        if (yuv420_is_null(&yuv_file)) {
+            fprintf(stderr, "can't read %s\n", argv[ii]);
+            return -1;
+        }
+        unsigned int cols = yuv420_get_cols(&yuv_file);
+        unsigned int rows = yuv420_get_rows(&yuv_file);
+        unsigned char* yuv = yuv420_malloc(&yuv_file);
+        while (yuv420_read_next(&yuv_file, yuv) >= 0) {
+            failures += check_frame(argv[ii], cols, rows, yuv, &table,
+                                    expected, actual, elapsed_secs);
+            ++frames;
+        }
+        yuv420_close(&yuv_file);
+        free(yuv);
+    }
+
+    (void)detect_color_blobs_set_kernel(DCB_KERNEL_AUTO);
+    for (ii = 1; ii <= CLASS_COUNT; ++ii) {
+        fprintf(stderr, "classes= %d separate_secs= %.6f "
+                "multi_lut_secs= %.6f multi_%s_secs= %.6f\n",
+                ii, elapsed_secs[ii][0], elapsed_secs[ii][1],
+                detect_color_blobs_kernel_name(detect_color_blobs_get_kernel()),
+                elapsed_secs[ii][2]);
+    }
+    fprintf(stderr, "%s: %d frames, %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", frames, failures);
+    for (ii = 0; ii < CLASS_COUNT; ++ii) {
+        blob_list_deinit(&expected[ii]);
+        blob_list_deinit(&actual[ii]);
+    }
+    return failures == 0 ? 0 : 1;
+}
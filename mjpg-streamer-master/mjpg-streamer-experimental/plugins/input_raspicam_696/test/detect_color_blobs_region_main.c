@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Check polygon and ellipse U-V regions:
+   - the lookup table of each region matches uv_region_contains() at every
+     (u, v), and a polygon drawn around a box matches the box,
+   - detect_color_blobs_multi() with regions finds the same blobs as
+     detect_color_blobs() does on a copy of the image whose chroma has been
+     classified by uv_region_contains(),
+   - color_classes_read() parses a class file.
+
+   usage: detect_color_blobs_region [file.yuv ...]
+
+   Every frame of every given .yuv file is checked.  With no arguments,
+   synthetic frames are used instead. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+
+static Color_Class classes[] = {
+    /* y_low; the u/v thresholds of non-box classes are set in main() */
+    {  60,  80, 120, 160, 200 },
+    {  40,   0,   0,   0,   0 },
+    { 100,   0,   0,   0,   0 },
+    {   0,   0,   0,   0,   0 },
+    {  20,  90, 140,  90, 140 },
+};
+#define CLASS_COUNT (sizeof(classes) / sizeof(classes[0]))
+
+static Uv_Region regions[CLASS_COUNT] = {
+    { UV_REGION_BOX },
+    /* A concave "L" shape. */
+    { UV_REGION_POLYGON, 6, { 150, 220, 220, 180, 180, 150 },
+                            {  40,  40,  60,  60, 110, 110 } },
+    /* A rotated ellipse. */
+    { UV_REGION_ELLIPSE, 0, { 0 }, { 0 }, 110.0f, 110.0f, 40.0f, 12.0f, 30.0f },
+    /* A triangle that overlaps class 2. */
+    { UV_REGION_POLYGON, 3, { 100, 140, 100 }, { 100, 120, 140 } },
+    { UV_REGION_BOX },
+};
+
+/* Check every entry of the lookup table against uv_region_contains(). */
+static int check_table(const Color_Class_Table* t) {
+    int failures = 0;
+    int c;
+    int u;
+    int v;
+    for (c = 0; c < t->class_count; ++c) {
+        for (u = 0; u < 256; ++u) {
+            for (v = 0; v < 256; ++v) {
+                bool in = (t->uv_class_mask[(u << 8) | v] >> c) & 1;
+                if (in != uv_region_contains(&t->color_class[c],
+                                             &t->uv_region[c], u, v)) {
+                    fprintf(stderr, "FAIL: class %d table wrong at (%d, %d)\n",
+                            c, u, v);
+                    ++failures;
+                    u = 256;
+                    break;
+                }
+            }
+        }
+    }
+    return failures;
+}
+
+/* A polygon around a box, and a polygon with a vertex on an edge, must
+   accept exactly what the box does. */
+static int check_box_polygon(void) {
+    static Color_Class_Table box_table;
+    static Color_Class_Table polygon_table;
+    Color_Class k[2] = { { 0, 30, 90, 60, 200 }, { 0, 7, 7, 9, 250 } };
+    Uv_Region r[2];
+    int c;
+    memset(r, 0, sizeof(r));
+    for (c = 0; c < 2; ++c) {
+        r[c].type = UV_REGION_POLYGON;
+        r[c].vertex_count = 5;
+        r[c].u[0] = k[c].u_low;   r[c].v[0] = k[c].v_low;
+        r[c].u[1] = k[c].u_high;  r[c].v[1] = k[c].v_low;
+        r[c].u[2] = k[c].u_high;  r[c].v[2] = k[c].v_high;
+        r[c].u[3] = k[c].u_low;   r[c].v[3] = k[c].v_high;
+        r[c].u[4] = k[c].u_low;   r[c].v[4] = (k[c].v_low + k[c].v_high) / 2;
+    }
+    box_table.class_count = -1;
+    polygon_table.class_count = -1;
+    (void)color_class_table_set(&box_table, 2, k);
+    (void)color_class_table_set_regions(&polygon_table, 2, k, r);
+    if (!box_table.all_boxes || polygon_table.all_boxes ||
+        memcmp(box_table.uv_class_mask, polygon_table.uv_class_mask,
+               sizeof(box_table.uv_class_mask)) != 0) {
+        fprintf(stderr, "FAIL: polygon around a box differs from the box\n");
+        return 1;
+    }
+    return 0;
+}
+
+/* Spot check the ellipse against points worked out by hand. */
+static int check_ellipse(void) {
+    static const struct { int u; int v; bool in; } points[] = {
+        { 110, 110, true },   // center
+        { 144, 130, true },   // ~39.3 along the rotated major axis
+        { 146, 131, false },  // ~41.6 along it
+        { 104, 120, true },   // ~11.7 along the minor axis
+        { 103, 122, false },  // ~14.1 along it
+        { 150, 110, false },  // on the unrotated major axis end
+    };
+    const Color_Class* k = &classes[2];
+    int failures = 0;
+    int ii;
+    for (ii = 0; ii < sizeof(points) / sizeof(points[0]); ++ii) {
+        if (uv_region_contains(k, &regions[2], points[ii].u, points[ii].v) !=
+            points[ii].in) {
+            fprintf(stderr, "FAIL: ellipse at (%d, %d) should be %s\n",
+                    points[ii].u, points[ii].v,
+                    points[ii].in ? "in" : "out");
+            ++failures;
+        }
+    }
+    return failures;
+}
+
+static int check_read(void) {
+    static const char* text =
+        "# class file\n"
+        "\n"
+        "box 60 80 120 160 200\n"
+        "polygon 40 150,40 220,40 220,60  # trailing comment\n"
+        "ellipse 100 110 110 40 12 30\n";
+    const char* path = "/tmp/detect_color_blobs_region.txt";
+    Color_Class k[MAX_COLOR_CLASSES];
+    Uv_Region r[MAX_COLOR_CLASSES];
+    int failures = 0;
+    int count;
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "can't write %s\n", path);
+        return 1;
+    }
+    fputs(text, fp);
+    fclose(fp);
+    count = color_classes_read(path, k, r);
+    if (count != 3 ||
+        r[0].type != UV_REGION_BOX || k[0].y_low != 60 ||
+        k[0].u_low != 80 || k[0].u_high != 120 ||
+        k[0].v_low != 160 || k[0].v_high != 200 ||
+        r[1].type != UV_REGION_POLYGON || r[1].vertex_count != 3 ||
+        r[1].u[2] != 220 || r[1].v[2] != 60 || k[1].y_low != 40 ||
+        k[1].u_low != 150 || k[1].u_high != 220 ||
+        k[1].v_low != 40 || k[1].v_high != 60 ||
+        r[2].type != UV_REGION_ELLIPSE || r[2].radius_u != 40.0f ||
+        r[2].angle != 30.0f || k[2].y_low != 100) {
+        fprintf(stderr, "FAIL: color_classes_read() got %d classes\n", count);
+        ++failures;
+    }
+
+    fp = fopen(path, "w");
+    fputs("polygon 40 150,40 220,40\n", fp);   // too few vertices
+    fclose(fp);
+    if (color_classes_read(path, k, r) != -1) {
+        fprintf(stderr, "FAIL: color_classes_read() took a bad polygon\n");
+        ++failures;
+    }
+    remove(path);
+    return failures;
+}
+
+/* Fill yuv with noise, then paint blocks with colors from inside and near
+   the edges of each region over it. */
+static void make_region_frame(unsigned int cols,
+                              unsigned int rows,
+                              unsigned int seed,
+                              unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned char* u = &yuv[pixels];
+    unsigned char* v = &yuv[pixels + pixels / 4];
+    unsigned int ii;
+    unsigned int x;
+    unsigned int y;
+    make_noise_frame(cols, rows, seed, 32, 231, 32, 231, yuv);
+    for (ii = 0; ii < 80; ++ii) {
+        const Color_Class* k = &classes[ii % CLASS_COUNT];
+        unsigned int x0 = rand() % (cols / 2);
+        unsigned int y0 = rand() % (rows / 2);
+        unsigned int w = 1 + rand() % (cols / 12 + 1);
+        unsigned int h = 1 + rand() % (rows / 12 + 1);
+        for (y = y0; y < y0 + h && y < rows / 2; ++y) {
+            for (x = x0; x < x0 + w && x < cols / 2; ++x) {
+                u[y * (cols / 2) + x] = k->u_low +
+                                        rand() % (k->u_high - k->u_low + 1);
+                v[y * (cols / 2) + x] = k->v_low +
+                                        rand() % (k->v_high - k->v_low + 1);
+            }
+        }
+    }
+}
+
+static int check_frame(const char* name,
+                       unsigned int cols,
+                       unsigned int rows,
+                       const unsigned char yuv[],
+                       unsigned char classified[],
+                       Color_Class_Table* t,
+                       Blob_List expected[],
+                       Blob_List actual[],
+                       double elapsed_secs[2]) {
+    const unsigned int pixels = cols * rows;
+    int failures = 0;
+    int c;
+    int kk;
+    for (c = 0; c < CLASS_COUNT; ++c) {
+        /* Set the chroma of classified to 200 where it is in the region of
+           class c, or 0 elsewhere; then find the blobs with a box. */
+
+        unsigned int ii;
+        const Color_Class* k = &classes[c];
+        memcpy(classified, yuv, pixels);
+        for (ii = 0; ii < pixels / 4; ++ii) {
+            bool in = uv_region_contains(k, &regions[c], yuv[pixels + ii],
+                                         yuv[pixels + pixels / 4 + ii]);
+            classified[pixels + ii] = in ? 200 : 0;
+            classified[pixels + pixels / 4 + ii] = in ? 200 : 0;
+        }
+        detect_color_blobs(&expected[c], k->y_low, 200, 200, 200, 200, false,
+                           cols, rows, classified);
+    }
+    for (kk = 0; kk < 2; ++kk) {
+        struct timespec start_time;
+        struct timespec end_time;
+        (void)detect_color_blobs_set_kernel(kk == 0 ? DCB_KERNEL_SCALAR :
+                                                      DCB_KERNEL_AUTO);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        detect_color_blobs_multi(t, actual, cols, rows, yuv);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        elapsed_secs[kk] += delta_time(&start_time, &end_time);
+        for (c = 0; c < CLASS_COUNT; ++c) {
+            if (!blob_lists_are_equal(&expected[c], &actual[c])) {
+                fprintf(stderr, "FAIL: %s (%u x %u) class %d kernel %s "
+                        "(%d blobs, expected %d)\n",
+                        name, cols, rows, c,
+                        detect_color_blobs_kernel_name(
+                                            detect_color_blobs_get_kernel()),
+                        actual[c].used_root_list_count,
+                        expected[c].used_root_list_count);
+                ++failures;
+            }
+        }
+    }
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    int frames = 0;
+    double elapsed_secs[2] = { 0.0, 0.0 };
+    static Color_Class_Table table;
+    Blob_List expected[CLASS_COUNT];
+    Blob_List actual[CLASS_COUNT];
+    int ii;
+
+    for (ii = 0; ii < CLASS_COUNT; ++ii) {
+        uv_region_bounding_box(&regions[ii], &classes[ii]);
+        expected[ii] = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+        actual[ii] = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    }
+    table.class_count = -1;
+    if (!color_class_table_set_regions(&table, CLASS_COUNT, classes,
+                                       regions) ||
+        color_class_table_set_regions(&table, CLASS_COUNT, classes,
+                                      regions) ||
+        table.all_boxes) {
+        fprintf(stderr, "FAIL: color_class_table_set_regions() rebuild "
+                "check\n");
+        ++failures;
+    }
+    failures += check_table(&table);
+    failures += check_box_polygon();
+    failures += check_ellipse();
+    failures += check_read();
+
+    if (argc < 2) {
+        static const unsigned int sizes[][2] = {
+            { 1280, 720 }, { 640, 480 }, { 320, 240 }, { 66, 10 }, { 30, 4 }
+        };
+        for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            unsigned int cols = sizes[ii][0];
+            unsigned int rows = sizes[ii][1];
+            unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+            unsigned char* classified =
+                                (unsigned char*)malloc(cols * rows * 3 / 2);
+            make_region_frame(cols, rows, ii + 1, yuv);
+            failures += check_frame("synthetic", cols, rows, yuv, classified,
+                                    &table, expected, actual, elapsed_secs);
+            ++frames;
+            free(classified);
+            free(yuv);
+        }
+    }
+    for (ii = 1; ii < argc; ++ii) {
+        Yuv_File yuv_file = yuv420_open_read(argv[ii]);
+        if (yuv420_is_null(&yuv_file)) {
+            fprintf(stderr, "can't read %s\n", argv[ii]);
+            return -1;
+        }
+        unsigned int cols = yuv420_get_cols(&yuv_file);
+        unsigned int rows = yuv420_get_rows(&yuv_file);
+        unsigned char* yuv = yuv420_malloc(&yuv_file);
+        unsigned char* classified = yuv420_malloc(&yuv_file);
+        while (yuv420_read_next(&yuv_file, yuv) >= 0) {
+            failures += check_frame(argv[ii], cols, rows, yuv, classified,
+                                    &table, expected, actual, elapsed_secs);
+            ++frames;
+        }
+        yuv420_close(&yuv_file);
+        free(classified);
+        free(yuv);
+    }
+
+    fprintf(stderr, "classes= %d multi_lut_secs= %.6f multi_%s_secs= %.6f\n",
+            (int)CLASS_COUNT, elapsed_secs[0],
+            detect_color_blobs_kernel_name(detect_color_blobs_get_kernel()),
+            elapsed_secs[1]);
+    fprintf(stderr, "%s: %d frames, %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", frames, failures);
+    for (ii = 0; ii < CLASS_COUNT; ++ii) {
+        blob_list_deinit(&expected[ii]);
+        blob_list_deinit(&actual[ii]);
+    }
+    return failures == 0 ? 0 : 1;
+}
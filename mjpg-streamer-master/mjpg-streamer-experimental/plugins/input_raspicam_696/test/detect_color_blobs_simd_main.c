@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Check that every vectorized UV threshold kernel produces exactly the same
+   Blob_List as the scalar (SIMPLE2) kernel.
+
+   usage: detect_color_blobs_simd [file.yuv ...]
+
+   Every frame of every given .yuv file is checked against a handful of
+   thresholds.  With no arguments, synthetic frames of assorted sizes are
+   used instead. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+
+static const unsigned char thresholds[][5] = {
+    /* y_low, u_low, u_high, v_low, v_high */
+    {  40,   0, 255,   0, 255 },
+    {  40,  90, 140,  90, 140 },
+    { 100,  60, 110, 150, 220 },
+    {   0, 128, 128, 128, 128 },
+    {   0, 200, 100,   0, 255 }, // empty range
+    { 250,   0, 255,   0, 255 },
+};
+#define THRESHOLD_COUNT (sizeof(thresholds) / sizeof(thresholds[0]))
+
+/* Fill yuv with blocky random blobs so that runs start and stop at every
+   possible position within a SIMD block. */
+static void make_run_frame(unsigned int cols,
+                           unsigned int rows,
+                           unsigned int seed,
+                           unsigned char yuv[]) {
+    unsigned int ii;
+    unsigned int pixels = cols * rows;
+    srand(seed);
+    for (ii = 0; ii < pixels; ++ii) yuv[ii] = rand() % 256;
+    for (ii = 0; ii < pixels / 2; ++ii) {
+        unsigned char val = rand() % 256;
+        unsigned int len = 1 + rand() % 40;
+        while (len-- > 0 && ii < pixels / 2) yuv[pixels + ii++] = val;
+    }
+}
+
+static int check_frame(const char* name,
+                       unsigned int cols,
+                       unsigned int rows,
+                       const unsigned char yuv[],
+                       Blob_List* expected,
+                       Blob_List* actual,
+                       double elapsed_secs[]) {
+    int failures = 0;
+    unsigned int bytes = cols * rows * 3 / 2;
+    unsigned char* img = (unsigned char*)malloc(bytes);
+    int tt;
+    for (tt = 0; tt < THRESHOLD_COUNT; ++tt) {
+        const unsigned char* t = thresholds[tt];
+        struct timespec start_time;
+        struct timespec end_time;
+        memcpy(img, yuv, bytes);
+        detect_color_blobs_set_kernel(DCB_KERNEL_SCALAR);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        detect_color_blobs(expected, t[0], t[1], t[2], t[3], t[4], false,
+                           cols, rows, img);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        elapsed_secs[DCB_KERNEL_SCALAR] += delta_time(&start_time, &end_time);
+
+        Dcb_Kernel kernel;
+        for (kernel = DCB_KERNEL_SSE2; kernel <= DCB_KERNEL_NEON; ++kernel) {
+            if (detect_color_blobs_set_kernel(kernel) != kernel) continue;
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            detect_color_blobs(actual, t[0], t[1], t[2], t[3], t[4], false,
+                               cols, rows, img);
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            elapsed_secs[kernel] += delta_time(&start_time, &end_time);
+            if (!blob_lists_are_equal(expected, actual)) {
+                fprintf(stderr, "FAIL: %s (%u x %u) threshold %d kernel %s\n",
+                        name, cols, rows, tt,
+                        detect_color_blobs_kernel_name(kernel));
+                ++failures;
+            }
+        }
+    }
+    free(img);
+    return failures;
+}
+
+int main(int argc, const char* argv[]) {
+    int failures = 0;
+    int frames = 0;
+    double elapsed_secs[DCB_KERNEL_NEON + 1] = { 0.0 };
+    Blob_List expected = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    Blob_List actual = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    int ii;
+
+    if (argc < 2) {
+        static const unsigned int sizes[][2] = {
+            { 640, 480 }, { 320, 240 }, { 66, 10 }, { 94, 6 }, { 30, 4 }
+        };
+        for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+            unsigned int cols = sizes[ii][0];
+            unsigned int rows = sizes[ii][1];
+            unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+            make_run_frame(cols, rows, ii + 1, yuv);
+            failures += check_frame("synthetic", cols, rows, yuv,
+                                    &expected, &actual, elapsed_secs);
+            ++frames;
+            free(yuv);
+        }
+    }
+    for (ii = 1; ii < argc; ++ii) {
+        Yuv_File yuv_file = yuv420_open_read(argv[ii]);
+        if (yuv420_is_null(&yuv_file)) {
+            fprintf(stderr, "can't read %s\n", argv[ii]);
+            return -1;
+        }
+        unsigned int cols = yuv420_get_cols(&yuv_file);
+        unsigned int rows = yuv420_get_rows(&yuv_file);
+        unsigned char* yuv = yuv420_malloc(&yuv_file);
+        while (yuv420_read_next(&yuv_file, yuv) >= 0) {
+            failures += check_frame(argv[ii], cols, rows, yuv,
+                                    &expected, &actual, elapsed_secs);
+            ++frames;
+        }
+        yuv420_close(&yuv_file);
+        free(yuv);
+    }
+
+    Dcb_Kernel kernel;
+    for (kernel = DCB_KERNEL_SCALAR; kernel <= DCB_KERNEL_NEON; ++kernel) {
+        if (detect_color_blobs_set_kernel(kernel) != kernel) continue;
+        fprintf(stderr, "%-6s elapsed_secs= %.6f\n",
+                detect_color_blobs_kernel_name(kernel), elapsed_secs[kernel]);
+    }
+    fprintf(stderr, "%s: %d frames, %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", frames, failures);
+    blob_list_deinit(&expected);
+    blob_list_deinit(&actual);
+    return failures == 0 ? 0 : 1;
+}
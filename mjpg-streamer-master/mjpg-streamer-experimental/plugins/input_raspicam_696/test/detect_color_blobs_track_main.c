@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "test_util.h"
+
+/* Check windowed and tracked blob detection:
+   - detect_color_blobs_window() finds the same blobs as detect_color_blobs()
+     does on a copy of just the window,
+   - with row_step > 1, a rectangle still gets its true bounding box and
+     pixel count,
+   - detect_color_blobs_tracked() follows a moving target, scans the whole
+     image when it should, and finds the target again after it jumps,
+   and compare the speed of tracking with scanning the whole image.
+
+   usage: detect_color_blobs_track */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+#define Y_LOW 60
+#define U_LOW 80
+#define U_HIGH 120
+#define V_LOW 160
+#define V_HIGH 200
+#define FULL_FRAME_INTERVAL 10
+#define TRACK_FRAMES 200
+#define JUMP_FRAME 105
+
+/* Fill yuv with background noise that is never detected. */
+static void make_background(unsigned int cols,
+                            unsigned int rows,
+                            unsigned int seed,
+                            unsigned char yuv[]) {
+    make_noise_frame(cols, rows, seed, 130, 229, 0, 149, yuv);
+}
+
+/* Paint a detectable rectangle.  X, y, w and h must be even. */
+static void paint_rect(unsigned int cols,
+                       unsigned int rows,
+                       int x,
+                       int y,
+                       int w,
+                       int h,
+                       unsigned char yuv[]) {
+    int ii;
+    int jj;
+    for (ii = y; ii < y + h; ++ii) {
+        for (jj = x; jj < x + w; ++jj) yuv[ii * cols + jj] = 200;
+    }
+    paint_uv_rect(cols, rows, x / 2, y / 2, w / 2, h / 2, 100, 180, yuv);
+}
+
+/* Fill yuv with noise that is sometimes detected, and scattered blobs. */
+static void make_busy_frame(unsigned int cols,
+                            unsigned int rows,
+                            unsigned int seed,
+                            unsigned char yuv[]) {
+    unsigned int ii;
+    make_noise_frame(cols, rows, seed, 70, 129, 150, 209, yuv);
+    for (ii = 0; ii < 40; ++ii) {
+        int w = 2 * (1 + rand() % (cols / 24));
+        int h = 2 * (1 + rand() % (rows / 24));
+        int x = 2 * (rand() % ((cols - w) / 2));
+        int y = 2 * (rand() % ((rows - h) / 2));
+        paint_rect(cols, rows, x, y, w, h, yuv);
+    }
+}
+
+/* Compare detect_color_blobs_window() with detect_color_blobs() on a copy of
+   the window, moved back to image coordinates. */
+static int check_window(Blob_List* expected,
+                        Blob_List* actual,
+                        unsigned int cols,
+                        unsigned int rows,
+                        const unsigned char yuv[],
+                        Blob_Window w) {
+    const unsigned int pixels = cols * rows;
+    const unsigned int w_pixels = w.cols * w.rows;
+    unsigned char* crop = (unsigned char*)malloc(w_pixels * 3 / 2);
+    int ii;
+    for (ii = 0; ii < w.rows; ++ii) {
+        memcpy(&crop[ii * w.cols], &yuv[(w.y + ii) * cols + w.x], w.cols);
+    }
+    for (ii = 0; ii < w.rows / 2; ++ii) {
+        int src = (w.y / 2 + ii) * (cols / 2) + w.x / 2;
+        memcpy(&crop[w_pixels + ii * (w.cols / 2)], &yuv[pixels + src],
+               w.cols / 2);
+        memcpy(&crop[w_pixels + w_pixels / 4 + ii * (w.cols / 2)],
+               &yuv[pixels + pixels / 4 + src], w.cols / 2);
+    }
+    detect_color_blobs(expected, Y_LOW, U_LOW, U_HIGH, V_LOW, V_HIGH, false,
+                       w.cols, w.rows, crop);
+    free(crop);
+    for (ii = 0; ii < expected->used_root_list_count; ++ii) {
+        Blob_Stats* s = &expected->root_info[ii].stats;
+        s->min_x += w.x;
+        s->max_x += w.x;
+        s->min_y += w.y;
+        s->max_y += w.y;
+        s->sum_x += (unsigned long)w.x * s->count;
+        s->sum_y += (unsigned long)w.y * s->count;
+    }
+    detect_color_blobs_window(actual, Y_LOW, U_LOW, U_HIGH, V_LOW, V_HIGH,
+                              cols, rows, yuv, w, 1);
+    if (!blob_lists_are_equal(expected, actual)) {
+        fprintf(stderr, "FAIL: window (%d, %d, %d x %d) of %u x %u: "
+                "%d blobs, expected %d\n", w.x, w.y, w.cols, w.rows,
+                cols, rows, actual->used_root_list_count,
+                expected->used_root_list_count);
+        return 1;
+    }
+    return 0;
+}
+
+/* Return the single blob of at least 30 pixels in p, or NULL. */
+static const Blob_Stats* find_target(const Blob_List* p) {
+    const Blob_Stats* found = NULL;
+    int ii;
+    for (ii = 0; ii < p->used_root_list_count; ++ii) {
+        if (p->root_info[ii].stats.count >= 30) {
+            if (found != NULL) return NULL;
+            found = &p->root_info[ii].stats;
+        }
+    }
+    return found;
+}
+
+/* Check that p holds the same target as the full scan in expected. */
+static int check_target(const char* name,
+                        const Blob_List* expected,
+                        const Blob_List* p,
+                        int frame) {
+    const Blob_Stats* e = find_target(expected);
+    const Blob_Stats* a = find_target(p);
+    if (e == NULL || a == NULL ||
+        e->min_x != a->min_x || e->max_x != a->max_x ||
+        e->min_y != a->min_y || e->max_y != a->max_y ||
+        e->sum_x != a->sum_x || e->sum_y != a->sum_y ||
+        e->count != a->count) {
+        fprintf(stderr, "FAIL: %s: frame %d target not found\n", name, frame);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    static const unsigned int sizes[][2] = {
+        { 1280, 720 }, { 640, 480 }, { 320, 240 }
+    };
+    int failures = 0;
+    Blob_List expected = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    Blob_List actual = blob_list_init(MAX_RUNS, MAX_BLOBS, 0);
+    int ii;
+    int frame;
+
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        unsigned int cols = sizes[ii][0];
+        unsigned int rows = sizes[ii][1];
+        unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
+        Blob_Window whole = { 0, 0, cols, rows };
+        Blob_Window w;
+        Blob_Tracker tracker;
+        int full_scans = 0;
+        int last_full = 0;
+        double full_secs = 0.0;
+        double tracked_secs = 0.0;
+        int kk;
+
+        /* Windows. */
+
+        make_busy_frame(cols, rows, ii + 1, yuv);
+        failures += check_window(&expected, &actual, cols, rows, yuv, whole);
+        for (kk = 0; kk < 20; ++kk) {
+            w.cols = 2 * (1 + rand() % (cols / 2));
+            w.rows = 2 * (1 + rand() % (rows / 2));
+            w.x = 2 * (rand() % ((cols - w.cols) / 2 + 1));
+            w.y = 2 * (rand() % ((rows - w.rows) / 2 + 1));
+            failures += check_window(&expected, &actual, cols, rows, yuv, w);
+        }
+
+        /* Row decimation. */
+
+        make_background(cols, rows, ii + 1, yuv);
+        paint_rect(cols, rows, cols / 4, rows / 4, 40, 24, yuv);
+        w.x = cols / 4 - 20;
+        w.y = rows / 4 - 20;
+        w.cols = 80;
+        w.rows = 64;
+        detect_color_blobs(&expected, Y_LOW, U_LOW, U_HIGH, V_LOW, V_HIGH,
+                           false, cols, rows, yuv);
+        for (kk = 1; kk <= 4; kk *= 2) {
+            detect_color_blobs_window(&actual, Y_LOW, U_LOW, U_HIGH, V_LOW,
+                                      V_HIGH, cols, rows, yuv, w, kk);
+            failures += check_target("row_step", &expected, &actual, kk);
+        }
+
+        /* Track a target moving across the image.  At frame JUMP_FRAME it
+           jumps to the far corner, and must be found again at once. */
+
+        blob_tracker_init(&tracker, FULL_FRAME_INTERVAL, 2, 16, 30);
+        for (frame = 0; frame < TRACK_FRAMES; ++frame) {
+            struct timespec start_time;
+            struct timespec end_time;
+            int x = (cols / 8 + frame) & ~1;
+            int y = (rows / 8 + frame / 2) & ~1;
+            if (frame >= JUMP_FRAME) {
+                x = (cols * 5 / 8 + (frame - JUMP_FRAME) / 2) & ~1;
+                y = (rows * 5 / 8 + (frame - JUMP_FRAME) / 4) & ~1;
+            }
+            make_background(cols, rows, 7, yuv);
+            paint_rect(cols, rows, x, y, 40, 24, yuv);
+
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            detect_color_blobs(&expected, Y_LOW, U_LOW, U_HIGH, V_LOW,
+                               V_HIGH, false, cols, rows, yuv);
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            full_secs += delta_time(&start_time, &end_time);
+
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            bool was_full = detect_color_blobs_tracked(&tracker, NULL,
+                                                       &actual, Y_LOW, U_LOW,
+                                                       U_HIGH, V_LOW, V_HIGH,
+                                                       cols, rows, yuv);
+            clock_gettime(CLOCK_MONOTONIC, &end_time);
+            tracked_secs += delta_time(&start_time, &end_time);
+            if (was_full) ++full_scans;
+
+            failures += check_target("tracked", &expected, &actual, frame);
+            if ((frame - last_full >= FULL_FRAME_INTERVAL ||
+                 frame == 0 || frame == JUMP_FRAME) && !was_full) {
+                fprintf(stderr, "FAIL: frame %d was not a full scan\n", frame);
+                ++failures;
+            }
+            if (was_full) last_full = frame;
+        }
+
+        /* One full scan every FULL_FRAME_INTERVAL frames, plus one when the
+           target jumped. */
+
+        if (full_scans > TRACK_FRAMES / FULL_FRAME_INTERVAL + 1) {
+            fprintf(stderr, "FAIL: %d full scans in %d frames\n",
+                    full_scans, TRACK_FRAMES);
+            ++failures;
+        }
+        fprintf(stderr, "%u x %u: full_secs= %.6f tracked_secs= %.6f "
+                "speedup= %.1f full_scans= %d\n", cols, rows, full_secs,
+                tracked_secs, full_secs / tracked_secs, full_scans);
+        free(yuv);
+    }
+
+    fprintf(stderr, "%s: %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", failures);
+    blob_list_deinit(&expected);
+    blob_list_deinit(&actual);
+    return failures == 0 ? 0 : 1;
+}
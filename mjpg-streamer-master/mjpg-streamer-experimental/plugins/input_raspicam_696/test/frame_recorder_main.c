@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "yuv420.h"
+#include "frame_recorder.h"
+#include "test_util.h"
+
+/* Check that Frame_Recorder writes every frame it is given, in order, when
+   the disk keeps up; that when it doesn't, it drops the oldest frames and
+   counts them; that after a write error it stops, leaving the frames before
+   it whole; and compare the time the caller spends per frame with a plain
+   fwrite().
+
+   usage: frame_recorder [directory]
+
+   Files are written to /tmp, or the given directory (say, on the SD card)
+   and removed afterwards. */
+
+#define COLS 640
+#define ROWS 480
+#define FRAMES 60
+#define BURST_FRAMES 200
+
+static int failures = 0;
+
+static void fail(const char* what, unsigned long long value) {
+    fprintf(stderr, "FAIL: %s %llu\n", what, value);
+    ++failures;
+}
+
+/* Every byte of a frame depends on its frame number. */
+
+static void fill_frame(unsigned char* frame, size_t bytes, unsigned int no) {
+    size_t jj;
+    for (jj = 0; jj < bytes; ++jj) frame[jj] = no * 13 + jj * 7;
+}
+
+static bool frame_matches(const unsigned char* frame,
+                          size_t bytes,
+                          unsigned int no) {
+    size_t jj;
+    for (jj = 0; jj < bytes; ++jj) {
+        if (frame[jj] != (unsigned char)(no * 13 + jj * 7)) return false;
+    }
+    return true;
+}
+
+/* Which frame is this?  The first two bytes give it away, since the test
+   uses fewer than 256 frames. */
+
+static unsigned int frame_number(const unsigned char* frame) {
+    unsigned int no;
+    for (no = 0; no < 256; ++no) {
+        if (frame[0] == (unsigned char)(no * 13) &&
+            frame[1] == (unsigned char)(no * 13 + 7)) return no;
+    }
+    return 256;
+}
+
+static void make_header(char header[26]) {
+    snprintf(header, 26, "#!YUV420 %7u,%7u\n", COLS, ROWS);
+}
+
+static void remove_clip(const char* filename) {
+    char index_filename[FILENAME_MAX];
+    snprintf(index_filename, FILENAME_MAX, "%s.idx", filename);
+    unlink(index_filename);
+    unlink(filename);
+}
+
+/* Record frames with room for all of them, and read them back. */
+
+static void check_all_written(const char* filename, unsigned char* frame) {
+    const size_t frame_bytes = COLS * ROWS * 3 / 2;
+    Frame_Recorder_Stats stats;
+    Yuv_Clip clip;
+    char header[26];
+    unsigned int ii;
+    make_header(header);
+    Frame_Recorder* rec = frame_recorder_init(filename, header, 25,
+                                              frame_bytes, FRAMES + 1, true);
+    if (rec == NULL) {
+        fail("can't frame_recorder_init, errno", errno);
+        return;
+    }
+    for (ii = 0; ii < FRAMES; ++ii) {
+        fill_frame(frame, frame_bytes, ii);
+        if (frame_recorder_write(rec, frame, frame_bytes, 1000 * ii) < 0) {
+            fail("frame_recorder_write dropped frame", ii);
+        }
+    }
+    if (frame_recorder_write(rec, frame, frame_bytes + 1, 0) == 0) {
+        fail("accepted an oversize frame of bytes", frame_bytes + 1);
+    }
+    frame_recorder_deinit(rec, &stats);
+    if (stats.frames_written != FRAMES || stats.frames_dropped != 0 ||
+        stats.frames_oversize != 1 || stats.write_errors != 0 ||
+        stats.bytes_written != 25 + FRAMES * frame_bytes) {
+        fail("wrong stats; frames_written", stats.frames_written);
+    }
+    if (yuv420_clip_open(filename, 0, &clip) < 0) {
+        fail("can't read back the clip, errno", errno);
+        return;
+    }
+    if (clip.cols != COLS || clip.rows != ROWS ||
+        clip.frame_count != FRAMES || clip.usecs_count != FRAMES ||
+        clip.file_bytes != 25 + FRAMES * frame_bytes) {
+        fail("clip read back has frames", clip.frame_count);
+    }
+    for (ii = 0; ii < clip.frame_count; ++ii) {
+        if (!frame_matches(yuv420_clip_frame(&clip, ii), frame_bytes, ii)) {
+            fail("wrong contents in frame", ii);
+        }
+        if (yuv420_clip_get_usecs(&clip, ii) != 1000 * ii) {
+            fail("wrong timestamp of frame", ii);
+        }
+    }
+    yuv420_clip_close(&clip);
+}
+
+/* Let writes fail in the middle of a frame, by limiting the file size, and
+   check that nothing is written after the failure: the file holds the
+   frames before it, and the rest are dropped. */
+
+static void check_write_error(const char* filename, unsigned char* frame) {
+    const size_t frame_bytes = COLS * ROWS * 3 / 2;
+    const rlim_t limit = 25 + 5 * frame_bytes + frame_bytes / 2;
+    struct rlimit saved_limit, rlimit;
+    struct timespec wait = { 0, 10000000 };
+    Frame_Recorder_Stats stats;
+    Yuv_Clip clip;
+    char header[26];
+    unsigned int ii;
+    make_header(header);
+
+    /* Writes beyond the limit fail with EFBIG, instead of a signal. */
+
+    getrlimit(RLIMIT_FSIZE, &saved_limit);
+    rlimit = saved_limit;
+    rlimit.rlim_cur = limit;
+    signal(SIGXFSZ, SIG_IGN);
+    if (setrlimit(RLIMIT_FSIZE, &rlimit) < 0) {
+        fail("can't setrlimit, errno", errno);
+        return;
+    }
+    Frame_Recorder* rec = frame_recorder_init(filename, header, 25,
+                                              frame_bytes, FRAMES + 1, true);
+    if (rec == NULL) {
+        fail("can't frame_recorder_init, errno", errno);
+        setrlimit(RLIMIT_FSIZE, &saved_limit);
+        return;
+    }
+    for (ii = 0; ii < FRAMES; ++ii) {
+        fill_frame(frame, frame_bytes, ii);
+        (void)frame_recorder_write(rec, frame, frame_bytes, 1000 * ii);
+    }
+    for (ii = 0; ii < 500; ++ii) {
+        frame_recorder_get_stats(rec, &stats);
+        if (stats.write_errors != 0) break;
+        nanosleep(&wait, NULL);
+    }
+    if (frame_recorder_write(rec, frame, frame_bytes, 0) == 0) {
+        fail("queued a frame after a write error, write_errors",
+             stats.write_errors);
+    }
+    frame_recorder_deinit(rec, &stats);
+    setrlimit(RLIMIT_FSIZE, &saved_limit);
+    signal(SIGXFSZ, SIG_DFL);
+
+    if (stats.write_errors != 1 ||
+        stats.frames_written + stats.frames_dropped != FRAMES + 1 ||
+        stats.frames_written > FRAMES / 2) {
+        fail("wrong stats after a write error; frames_written",
+             stats.frames_written);
+    }
+    if (yuv420_clip_open(filename, 0, &clip) < 0) {
+        fail("can't read back the clip, errno", errno);
+        return;
+    }
+    if (clip.file_bytes != limit || clip.frame_count != 5) {
+        fail("clip cut by a write error has bytes", clip.file_bytes);
+    }
+    for (ii = 0; ii < clip.frame_count; ++ii) {
+        if (!frame_matches(yuv420_clip_frame(&clip, ii), frame_bytes, ii)) {
+            fail("wrong contents before a write error in frame", ii);
+        }
+    }
+    yuv420_clip_close(&clip);
+}
+
+/* Frames of varying size, such as JPEGs, are simply concatenated.  Wait for
+   each frame to be written before giving the next, so that none are
+   dropped. */
+
+static void check_variable_size(const char* filename, unsigned char* frame) {
+    Frame_Recorder_Stats stats;
+    size_t total_bytes = 0;
+    unsigned int ii;
+    Frame_Recorder* rec = frame_recorder_init(filename, NULL, 0, 100000, 2,
+                                              false);
+    if (rec == NULL) {
+        fail("can't frame_recorder_init, errno", errno);
+        return;
+    }
+    for (ii = 0; ii < 50; ++ii) {
+        size_t bytes = 1 + ii * 1999;
+        fill_frame(frame, bytes, ii);
+        if (frame_recorder_write(rec, frame, bytes, 0) < 0) {
+            fail("frame_recorder_write dropped variable size frame", ii);
+        }
+        total_bytes += bytes;
+        do {
+            usleep(100);
+            frame_recorder_get_stats(rec, &stats);
+        } while (stats.frames_written <= ii);
+    }
+    frame_recorder_deinit(rec, &stats);
+    if (stats.frames_dropped != 0 || stats.bytes_written != total_bytes) {
+        fail("wrong stats; frames_dropped", stats.frames_dropped);
+    }
+    FILE* fp = fopen(filename, "rb");
+    unsigned char* contents = (unsigned char*)malloc(total_bytes + 1);
+    size_t bytes_read = fp == NULL ? 0 : fread(contents, 1, total_bytes + 1,
+                                                fp);
+    if (fp != NULL) fclose(fp);
+    if (bytes_read != total_bytes) {
+        fail("wrong variable size file length", bytes_read);
+    } else {
+        size_t offset = 0;
+        for (ii = 0; ii < 50; ++ii) {
+            size_t bytes = 1 + ii * 1999;
+            if (!frame_matches(contents + offset, bytes, ii)) {
+                fail("wrong contents in variable size frame", ii);
+            }
+            offset += bytes;
+        }
+    }
+    free(contents);
+    unlink(filename);
+}
+
+/* Give a two slot recorder frames as fast as possible, so it must drop some.
+   What is written must be whole frames in order, ending with the last. */
+
+static void check_drop_oldest(const char* filename, unsigned char* frame) {
+    const size_t frame_bytes = COLS * ROWS * 3 / 2;
+    Frame_Recorder_Stats stats;
+    Yuv_Clip clip;
+    char header[26];
+    unsigned int ii;
+    make_header(header);
+    Frame_Recorder* rec = frame_recorder_init(filename, header, 25,
+                                              frame_bytes, 2, true);
+    if (rec == NULL) {
+        fail("can't frame_recorder_init, errno", errno);
+        return;
+    }
+    for (ii = 0; ii < BURST_FRAMES; ++ii) {
+        fill_frame(frame, frame_bytes, ii);
+        (void)frame_recorder_write(rec, frame, frame_bytes, ii);
+    }
+    frame_recorder_deinit(rec, &stats);
+    fprintf(stderr, "burst of %d frames into 2 slots: written= %llu "
+            "dropped= %llu max_queued= %u\n", BURST_FRAMES,
+            (unsigned long long)stats.frames_written,
+            (unsigned long long)stats.frames_dropped, stats.max_queued);
+    if (stats.frames_written + stats.frames_dropped != BURST_FRAMES) {
+        fail("frames lost without being counted; written",
+             stats.frames_written);
+    }
+    if (yuv420_clip_open(filename, 0, &clip) < 0) {
+        fail("can't read back the clip, errno", errno);
+        return;
+    }
+    if (clip.frame_count != stats.frames_written ||
+        clip.usecs_count != stats.frames_written) {
+        fail("clip read back has frames", clip.frame_count);
+    }
+    int last_no = -1;
+    for (ii = 0; ii < clip.frame_count; ++ii) {
+        const unsigned char* yuv = yuv420_clip_frame(&clip, ii);
+        unsigned int no = frame_number(yuv);
+        if ((int)no <= last_no || !frame_matches(yuv, frame_bytes, no) ||
+            yuv420_clip_get_usecs(&clip, ii) != no) {
+            fail("bad frame in drop test at", ii);
+            break;
+        }
+        last_no = no;
+    }
+    if (last_no != BURST_FRAMES - 1) fail("newest frame lost; last", last_no);
+    yuv420_clip_close(&clip);
+}
+
+/* Time each call made by the capture thread, recorder against fwrite(). */
+
+static void time_writes(const char* filename, unsigned char* frame) {
+    const size_t frame_bytes = COLS * ROWS * 3 / 2;
+    struct timespec start_time;
+    struct timespec end_time;
+    double secs[2] = { 0.0, 0.0 };
+    double max_secs[2] = { 0.0, 0.0 };
+    Frame_Recorder_Stats stats;
+    char header[26];
+    unsigned int ii;
+    make_header(header);
+    FILE* fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fail("can't open for fwrite, errno", errno);
+        return;
+    }
+    fputs(header, fp);
+    for (ii = 0; ii < FRAMES; ++ii) {
+        fill_frame(frame, frame_bytes, ii);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        fwrite(frame, 1, frame_bytes, fp);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        double t = delta_time(&start_time, &end_time);
+        secs[0] += t;
+        if (t > max_secs[0]) max_secs[0] = t;
+        usleep(33333);
+    }
+    fclose(fp);
+    remove_clip(filename);
+
+    Frame_Recorder* rec = frame_recorder_init(filename, header, 25,
+                                              frame_bytes, 8, true);
+    if (rec == NULL) {
+        fail("can't frame_recorder_init, errno", errno);
+        return;
+    }
+    for (ii = 0; ii < FRAMES; ++ii) {
+        fill_frame(frame, frame_bytes, ii);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        (void)frame_recorder_write(rec, frame, frame_bytes, ii);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        double t = delta_time(&start_time, &end_time);
+        secs[1] += t;
+        if (t > max_secs[1]) max_secs[1] = t;
+        usleep(33333);
+    }
+    frame_recorder_deinit(rec, &stats);
+    fprintf(stderr, "%d x %d at 30 fps, per frame on the capture thread: "
+            "fwrite mean= %.6f max= %.6f; frame_recorder_write mean= %.6f "
+            "max= %.6f; dropped= %llu\n", COLS, ROWS, secs[0] / FRAMES,
+            max_secs[0], secs[1] / FRAMES, max_secs[1],
+            (unsigned long long)stats.frames_dropped);
+    if (stats.frames_dropped != 0) {
+        fail("dropped frames at 30 fps", stats.frames_dropped);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const char* dir = argc > 1 ? argv[1] : "/tmp";
+    char filename[FILENAME_MAX];
+    unsigned char* frame = (unsigned char*)malloc(COLS * ROWS * 3 / 2 + 1);
+    snprintf(filename, FILENAME_MAX, "%s/frame_recorder_test.yuv", dir);
+
+    check_all_written(filename, frame);
+    remove_clip(filename);
+    check_write_error(filename, frame);
+    remove_clip(filename);
+    check_variable_size(filename, frame);
+    check_drop_oldest(filename, frame);
+    remove_clip(filename);
+    time_writes(filename, frame);
+    remove_clip(filename);
+    free(frame);
+    fprintf(stderr, "%s: %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
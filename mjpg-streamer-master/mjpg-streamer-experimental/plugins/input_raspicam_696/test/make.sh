@@ -7,16 +7,51 @@
 #2
 #gcc -fprofile-use -Wall -o detect_color_blobs -O2 -I .. -g detect_color_blobs_main.c ../detect_color_blobs.c ../yuv420.c -ljpeg
 
-gcc -o detect_color_blobs -O2 -I .. -g detect_color_blobs_main.c ../detect_color_blobs.c ../yuv420.c -ljpeg
+gcc -o detect_color_blobs -O2 -I .. -g detect_color_blobs_main.c test_util.c ../detect_color_blobs.c ../yuv420.c -ljpeg -lpthread -lm
 
+# Check that the SIMD UV threshold kernels match the scalar one bit for bit.
+# Give it .yuv files to check those too: ./detect_color_blobs_simd *.yuv
+gcc -o detect_color_blobs_simd -O2 -I .. -g detect_color_blobs_simd_main.c test_util.c ../detect_color_blobs.c ../yuv420.c -lpthread -lm
 
+# Check that banded (multi-threaded) detection matches serial detection.
+gcc -o detect_color_blobs_bands -O2 -I .. -g detect_color_blobs_bands_main.c test_util.c ../detect_color_blobs.c ../yuv420.c -lpthread -lm
 
+# Check that multi-class detection matches one detect_color_blobs() per class.
+gcc -o detect_color_blobs_multi -O2 -I .. -g detect_color_blobs_multi_main.c test_util.c ../detect_color_blobs.c ../yuv420.c -lpthread -lm
 
-gcc -o yuv_color_space_image -I .. -g yuv_color_space_image_main.c yuv_color_space_image.c ../yuv420.c
-gcc -o convert_yuv_to_jpg -I .. -g convert_yuv_to_jpg.c ../yuv420.c jpeg_file_io.c -ljpeg
-gcc -o convert_jpg_to_yuv -I .. -g convert_jpg_to_yuv.c ../yuv420.c jpeg_file_io.c -ljpeg
+# Check polygon and ellipse color regions against a brute force classifier.
+gcc -o detect_color_blobs_region -O2 -I .. -g detect_color_blobs_region_main.c test_util.c ../detect_color_blobs.c ../yuv420.c -lpthread -lm
+
+# Check that steady-state blob detection does no heap allocation.
+gcc -o detect_color_blobs_alloc -O2 -I .. -g detect_color_blobs_alloc_main.c test_util.c ../detect_color_blobs.c -lpthread -lm
+
+# Check windowed and tracked detection against full scans.
+gcc -o detect_color_blobs_track -O2 -I .. -g detect_color_blobs_track_main.c test_util.c ../detect_color_blobs.c -lpthread -lm
+
+# Time the vision kernels.  Give it .yuv files to time those too.
+gcc -o vision_bench -O2 -I .. -g vision_bench_main.c test_util.c ../detect_color_blobs.c ../yuv420.c ../overwrite_tif_tags.c -lpthread -lm
+
+# Check the RGB <-> YUV420 conversion kernels against a per-pixel reference.
+gcc -o yuv420_convert -O2 -I .. -g yuv420_convert_main.c test_util.c ../yuv420.c -lpthread
+
+# Check memory-mapped .yuv clips against yuv420_read_next().
+# Give it .yuv files to check those too: ./yuv420_clip *.yuv
+gcc -o yuv420_clip -O2 -I .. -g yuv420_clip_main.c ../yuv420.c -lpthread
+
+# Check that recorded frames are written whole and in order, or dropped oldest
+# first.  To test the SD card instead of /tmp: ./frame_recorder /media/sd
+gcc -o frame_recorder -O2 -I .. -g frame_recorder_main.c test_util.c ../frame_recorder.c ../yuv420.c -lpthread
+
+
+
+
+# Give it a color class file to darken colors outside the classes:
+# ./yuv_color_space_image 512 512 128 classes.txt
+gcc -o yuv_color_space_image -I .. -g yuv_color_space_image_main.c ../yuv_color_space_image.c ../yuv420.c ../detect_color_blobs.c -lpthread -lm
+gcc -o convert_yuv_to_jpg -I .. -g convert_yuv_to_jpg.c ../yuv420.c jpeg_file_io.c -ljpeg -lpthread
+gcc -o convert_jpg_to_yuv -I .. -g convert_jpg_to_yuv.c ../yuv420.c jpeg_file_io.c -ljpeg -lpthread
 #gcc -o convert_jpg_to_jpg -I .. -g convert_jpg_to_jpg.c jpeg_file_io.c -ljpeg
-gcc -o split_yuv -I .. -g split_yuv.c ../yuv420.c
+gcc -o split_yuv -I .. -g split_yuv.c ../yuv420.c -lpthread
 
 
 javac test_udp_client.java
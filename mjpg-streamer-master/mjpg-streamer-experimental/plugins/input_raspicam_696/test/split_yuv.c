@@ -9,29 +9,31 @@ int main(int argc, const char* argv[]) {
         return -1;
     }
     const char* in_filename = argv[1];
-    Yuv_File yuv_file = yuv420_open_read(in_filename);
-    if (yuv420_is_null(&yuv_file)) {
+    Yuv_Clip clip;
+    if (yuv420_clip_open(in_filename, 0, &clip) < 0) {
         fprintf(stderr, "can't open %s for reading\n", in_filename);
         return -1;
     }
-    unsigned int cols = yuv420_get_cols(&yuv_file);
-    unsigned int rows = yuv420_get_rows(&yuv_file);
-    printf("cols=%u rows=%u\n", cols, rows);
-    unsigned char* yuv = yuv420_malloc(&yuv_file);
-    int ii = 0;
-    while (yuv420_read_next(&yuv_file, yuv) >= 0) {
+    unsigned int cols = clip.cols;
+    unsigned int rows = clip.rows;
+    printf("cols=%u rows=%u frames=%u\n", cols, rows, clip.frame_count);
+    unsigned int ii;
+    for (ii = 0; ii < clip.frame_count; ++ii) {
+        const unsigned char* yuv = yuv420_clip_frame(&clip, ii);
         char filename[FILENAME_MAX];
-        snprintf(filename, FILENAME_MAX, "out_%04d.yuv", ii);
+        if (yuv == NULL) {
+            fprintf(stderr, "can't map image %u of %s\n", ii, in_filename);
+            goto quit;
+        }
+        snprintf(filename, FILENAME_MAX, "out_%04u.yuv", ii);
         filename[FILENAME_MAX - 1] = '\0';
-        if (yuv420_write(filename, cols, rows, yuv) < 0) {
+        if (yuv420_write(filename, cols, rows, (unsigned char*)yuv) < 0) {
             fprintf(stderr, "can't write to %s\n", filename);
             goto quit;
         }
-        ++ii;
     }
     return_val = 0;
 quit:
-    yuv420_close(&yuv_file);
-    free(yuv);
+    yuv420_clip_close(&clip);
     return return_val;
 }
@@ -135,6 +135,7 @@ class Blob_Stats {
 class Udp_Blob_List {
     public static final byte MIN_LENGTH = 16;
     public static final byte MSG_ID = 2;
+    public int blob_class;
     public int blob_count;
     public long client_msec;
     public Blob_Stats[] blob;
@@ -152,6 +153,7 @@ class Udp_Blob_List {
             in[0] != MSG_ID) {
             throw new Cant_Construct_From_Bytes("Udp_Blob: length= " + in_length + " msg_id= " + in[0]);
         }
+        blob_class = in[1];
         blob_count = (in_length - OFFSET_OF_BLOB_STATS) / SIZE_OF_BLOB_STATS;
         /*
         blob_count = ((0xff & (int)in[7]) << 24) |
@@ -266,6 +268,7 @@ class TestUDPClient
                                                     in_packet.getLength(),
                                                     in_packet.getData());
                     System.out.println("===============");
+                    System.out.println("blob_class:  " + msg_in.blob_class);
                     System.out.println("blob_count:  " + msg_in.blob_count);
                     System.out.println("client_msec: " + msg_in.client_msec);
                     for (ii = 0; ii < msg_in.blob_count; ++ii) {
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include "test_util.h"
+
+double delta_time(struct timespec* a_ptr, struct timespec* b_ptr) {
+    return (b_ptr->tv_sec - a_ptr->tv_sec) +
+           (b_ptr->tv_nsec - a_ptr->tv_nsec) / 1000000000.0;
+}
+
+static bool stats_are_equal(const Blob_Stats* a, const Blob_Stats* b) {
+    return a->min_x == b->min_x && a->max_x == b->max_x &&
+           a->min_y == b->min_y && a->max_y == b->max_y &&
+           a->sum_x == b->sum_x && a->sum_y == b->sum_y &&
+           a->count == b->count;
+}
+
+bool blob_lists_are_equal(const Blob_List* a, const Blob_List* b) {
+    int ii;
+    if (a->used_root_list_count != b->used_root_list_count) return false;
+    if (a->used_blob_set_count != b->used_blob_set_count) return false;
+    for (ii = 0; ii < a->used_root_list_count; ++ii) {
+        if (!stats_are_equal(&a->root_info[ii].stats,
+                             &b->root_info[ii].stats) ||
+            a->root_info[ii].set_index != b->root_info[ii].set_index) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int compare_stats(const void* void_a_ptr, const void* void_b_ptr) {
+    const Blob_Stats* a = (const Blob_Stats*)void_a_ptr;
+    const Blob_Stats* b = (const Blob_Stats*)void_b_ptr;
+    if (a->count != b->count) return a->count < b->count ? -1 : 1;
+    if (a->sum_x != b->sum_x) return a->sum_x < b->sum_x ? -1 : 1;
+    if (a->sum_y != b->sum_y) return a->sum_y < b->sum_y ? -1 : 1;
+    if (a->min_x != b->min_x) return a->min_x < b->min_x ? -1 : 1;
+    if (a->max_x != b->max_x) return a->max_x < b->max_x ? -1 : 1;
+    if (a->min_y != b->min_y) return a->min_y < b->min_y ? -1 : 1;
+    if (a->max_y != b->max_y) return a->max_y < b->max_y ? -1 : 1;
+    return 0;
+}
+
+/* Sort copies of the stats, in static arrays, as the benchmark and the
+   allocation test count every heap call. */
+
+#define MAX_SORTED_BLOBS 10000
+
+bool blob_lists_have_same_blobs(const Blob_List* a, const Blob_List* b) {
+    static Blob_Stats sa[MAX_SORTED_BLOBS];
+    static Blob_Stats sb[MAX_SORTED_BLOBS];
+    int n = a->used_root_list_count;
+    int ii;
+    if (n != b->used_root_list_count || n > MAX_SORTED_BLOBS) return false;
+    for (ii = 0; ii < n; ++ii) {
+        sa[ii] = a->root_info[ii].stats;
+        sb[ii] = b->root_info[ii].stats;
+    }
+    qsort(sa, n, sizeof(sa[0]), compare_stats);
+    qsort(sb, n, sizeof(sb[0]), compare_stats);
+    for (ii = 0; ii < n; ++ii) {
+        if (!stats_are_equal(&sa[ii], &sb[ii])) return false;
+    }
+    return true;
+}
+
+void make_noise_frame(unsigned int cols,
+                      unsigned int rows,
+                      unsigned int seed,
+                      unsigned char u_low,
+                      unsigned char u_high,
+                      unsigned char v_low,
+                      unsigned char v_high,
+                      unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned char* u = &yuv[pixels];
+    unsigned char* v = &yuv[pixels + pixels / 4];
+    unsigned int ii;
+    srand(seed);
+    for (ii = 0; ii < pixels; ++ii) yuv[ii] = rand() % 256;
+    for (ii = 0; ii < pixels / 4; ++ii) {
+        u[ii] = u_low + rand() % (u_high - u_low + 1);
+        v[ii] = v_low + rand() % (v_high - v_low + 1);
+    }
+}
+
+void paint_uv_rect(unsigned int cols,
+                   unsigned int rows,
+                   unsigned int x0,
+                   unsigned int y0,
+                   unsigned int w,
+                   unsigned int h,
+                   unsigned char u,
+                   unsigned char v,
+                   unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned int x;
+    unsigned int y;
+    for (y = y0; y < y0 + h && y < rows / 2; ++y) {
+        for (x = x0; x < x0 + w && x < cols / 2; ++x) {
+            yuv[pixels + y * (cols / 2) + x] = u;
+            yuv[pixels + pixels / 4 + y * (cols / 2) + x] = v;
+        }
+    }
+}
+
+void make_synthetic_frame(unsigned int cols,
+                          unsigned int rows,
+                          unsigned int seed,
+                          int blob_count,
+                          unsigned int max_width,
+                          unsigned int max_height,
+                          unsigned char u,
+                          unsigned char v,
+                          unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned int x;
+    unsigned int y;
+    int ii;
+    srand(seed);
+    for (y = 0; y < rows; ++y) {
+        for (x = 0; x < cols; ++x) {
+            yuv[y * cols + x] = 64 + (x + y + seed) % 128 + rand() % 16;
+        }
+    }
+    for (ii = 0; ii < pixels / 4; ++ii) {
+        yuv[pixels + ii] = 120 + rand() % 16;
+        yuv[pixels + pixels / 4 + ii] = 120 + rand() % 16;
+    }
+    for (ii = 0; ii < blob_count; ++ii) {
+        unsigned int w = 2 + rand() % (max_width / 2);
+        unsigned int h = 2 + rand() % (max_height / 2);
+        unsigned int x0 = rand() % (cols / 2);
+        unsigned int y0 = rand() % (rows / 2);
+        paint_uv_rect(cols, rows, x0, y0, w, h, u, v, yuv);
+    }
+}
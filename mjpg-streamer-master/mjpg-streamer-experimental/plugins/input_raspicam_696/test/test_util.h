@@ -0,0 +1,56 @@
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+/* Helpers shared by the tests and the benchmark of input_raspicam_696. */
+
+#include <stdbool.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+
+/* Seconds from *a_ptr to *b_ptr. */
+double delta_time(struct timespec* a_ptr, struct timespec* b_ptr);
+
+/* True if a and b hold the same blobs, in the same order and sets. */
+bool blob_lists_are_equal(const Blob_List* a, const Blob_List* b);
+
+/* True if a and b hold blobs with the same stats, in any order. */
+bool blob_lists_have_same_blobs(const Blob_List* a, const Blob_List* b);
+
+/* Seed rand() with seed, then fill the Y plane of yuv with noise, and the
+   U and V planes with noise between u_low and u_high, and v_low and v_high
+   (inclusive). */
+void make_noise_frame(unsigned int cols,
+                      unsigned int rows,
+                      unsigned int seed,
+                      unsigned char u_low,
+                      unsigned char u_high,
+                      unsigned char v_low,
+                      unsigned char v_high,
+                      unsigned char yuv[]);
+
+/* Set a rectangle of the U and V planes, w by h chroma pixels at x0, y0,
+   to u and v.  The part outside the image is left out. */
+void paint_uv_rect(unsigned int cols,
+                   unsigned int rows,
+                   unsigned int x0,
+                   unsigned int y0,
+                   unsigned int w,
+                   unsigned int h,
+                   unsigned char u,
+                   unsigned char v,
+                   unsigned char yuv[]);
+
+/* Fill yuv with a smooth, slightly noisy background near gray, then paint
+   blob_count rectangles of u and v, each up to max_width by max_height
+   pixels, over that. */
+void make_synthetic_frame(unsigned int cols,
+                          unsigned int rows,
+                          unsigned int seed,
+                          int blob_count,
+                          unsigned int max_width,
+                          unsigned int max_height,
+                          unsigned char u,
+                          unsigned char v,
+                          unsigned char yuv[]);
+
+#endif
@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "detect_color_blobs.h"
+#include "overwrite_tif_tags.h"
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Benchmark the vision kernels of input_raspicam_696, without a camera.
+
+   usage: input_raspicam_696_bench [--benchmark_filter=SUBSTRING]
+                                   [--benchmark_min_time=SECS]
+                                   [-blobyuv Y0,Y1,U0,U1,V0,V1]
+                                   [file.yuv ...]
+
+   With no files, synthetic frames are made at 320x240, 640x480, 1280x720
+   and 1920x1080, each with no blobs ("none"), a few large blobs ("sparse")
+   and many small blobs ("dense").  Up to MAX_FILE_FRAMES frames of each
+   given .yuv file are used instead.  Only benchmarks whose name contains
+   SUBSTRING are run.
+
+   Each benchmark runs for at least SECS seconds (default 0.5), cycling
+   through the frames of its input, and prints the mean time per frame, the
+   throughput in megapixels per second, and the number of heap calls per
+   frame.  Where a kernel changes its input (sorting and purging a
+   Blob_List), the input is restored between frames, untimed.
+
+   Malloc() and friends are replaced below, so that every heap call is
+   counted, as in detect_color_blobs_alloc_main.c.  This relies on glibc's
+   __libc_malloc() and friends. */
+
+#define MAX_RUNS 10000
+#define MAX_BLOBS 1000
+#define MAX_BBOXES 20
+#define MIN_PIXELS_PER_BLOB 30
+#define SYNTHETIC_FRAMES 4
+#define MAX_FILE_FRAMES 16
+#define MIN_ITERATIONS 10
+#define JPEG_HEADER_BYTES 1024
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static unsigned long heap_call_count = 0;
+
+void* malloc(size_t size) {
+    ++heap_call_count;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    ++heap_call_count;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    ++heap_call_count;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    if (ptr != NULL) ++heap_call_count;
+    __libc_free(ptr);
+}
+
+/* The color detected in synthetic frames, and painted on their blobs. */
+
+static Color_Class blob_class = { 40, 90, 110, 170, 190 };
+#define BLOB_U 100
+#define BLOB_V 180
+
+/* Everything a benchmark may use.  Frame[] holds the input frames; the
+   other buffers are set up from frame[0] before each benchmark runs. */
+
+typedef struct {
+    unsigned int cols;
+    unsigned int rows;
+    int frame_count;
+    unsigned char* frame[MAX_FILE_FRAMES];
+    int frame_no;                 /// index of the frame to use next
+    unsigned char* yuv;           /// scratch YUV420 image
+    unsigned char* rgb;           /// RGB version of frame[0]
+    Blob_List blob_list;
+    Blob_List saved;              /// blob_list as detected in frame[0]
+    unsigned short bbox_element_count;
+    unsigned short bbox_element[MAX_BBOXES * 4];
+    unsigned char jpeg_header[JPEG_HEADER_BYTES];
+} Bench_State;
+
+typedef struct {
+    const char* name;
+    void (*prepare)(Bench_State* s);  /// untimed, before each run; or NULL
+    void (*run)(Bench_State* s);      /// timed
+} Benchmark;
+
+static unsigned char* next_frame(Bench_State* s) {
+    unsigned char* yuv = s->frame[s->frame_no];
+    if (++s->frame_no >= s->frame_count) s->frame_no = 0;
+    return yuv;
+}
+
+/* Copy the blobs found in one Blob_List to another with room for them. */
+static void blob_list_copy(const Blob_List* src, Blob_List* dst) {
+    memcpy(dst->blob_set, src->blob_set,
+           src->used_blob_set_count * sizeof(src->blob_set[0]));
+    memcpy(dst->root_info, src->root_info,
+           src->used_root_list_count * sizeof(src->root_info[0]));
+    dst->used_blob_set_count = src->used_blob_set_count;
+    dst->used_root_list_count = src->used_root_list_count;
+}
+
+/******************************************************************************
+ * Benchmarks
+ ******************************************************************************/
+
+static void run_detect_color_blobs(Bench_State* s) {
+    detect_color_blobs(&s->blob_list, blob_class.y_low, blob_class.u_low,
+                       blob_class.u_high, blob_class.v_low, blob_class.v_high,
+                       false, s->cols, s->rows, next_frame(s));
+}
+
+static void prepare_blob_list(Bench_State* s) {
+    blob_list_copy(&s->saved, &s->blob_list);
+}
+
+static void run_sort_blobs_by_pixel_count(Bench_State* s) {
+    sort_blobs_by_pixel_count(&s->blob_list);
+}
+
+static void run_blob_list_purge_small_bboxes(Bench_State* s) {
+    (void)blob_list_purge_small_bboxes(&s->blob_list, MIN_PIXELS_PER_BLOB);
+}
+
+static void run_draw_bounding_boxes(Bench_State* s) {
+    static const unsigned char bbox_color_yuv[3] = { 255, 0, 255 };
+    draw_bounding_boxes(&s->saved, MIN_PIXELS_PER_BLOB, bbox_color_yuv,
+                        s->cols, s->rows, s->yuv);
+}
+
+static void run_convert_rgb_to_yuv420(Bench_State* s) {
+    (void)convert_rgb_to_yuv420(s->cols, s->rows, s->rgb,
+                                s->cols * s->rows * 3 / 2, s->yuv);
+}
+
+static void run_convert_yuv420_to_rgb(Bench_State* s) {
+    convert_yuv420_to_rgb(s->cols, s->rows, next_frame(s), s->rgb);
+}
+
+static void run_overwrite_tif_tags(Bench_State* s) {
+    static const unsigned char yuv_meas[3] = { 128, 128, 128 };
+    (void)overwrite_tif_tags(s->cols, s->rows, s->cols, s->rows,
+                             s->bbox_element_count, s->bbox_element,
+                             10000, 1.5, 1.0, 1.25, 1.75, yuv_meas, 0x0b,
+                             s->jpeg_header);
+}
+
+static const Benchmark benchmarks[] = {
+    { "detect_color_blobs", NULL, run_detect_color_blobs },
+    { "sort_blobs_by_pixel_count", prepare_blob_list,
+                                   run_sort_blobs_by_pixel_count },
+    { "blob_list_purge_small_bboxes", prepare_blob_list,
+                                      run_blob_list_purge_small_bboxes },
+    { "draw_bounding_boxes", NULL, run_draw_bounding_boxes },
+    { "convert_rgb_to_yuv420", NULL, run_convert_rgb_to_yuv420 },
+    { "convert_yuv420_to_rgb", NULL, run_convert_yuv420_to_rgb },
+    { "overwrite_tif_tags", NULL, run_overwrite_tif_tags },
+};
+#define BENCHMARK_COUNT (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+/* Set up the buffers that depend on frame[0]: its blobs, their bounding
+   boxes, and its RGB version.  Also write a fresh JPEG APP1 header. */
+static void bench_state_prepare(Bench_State* s) {
+    unsigned int pixels = s->cols * s->rows;
+    unsigned int length = JPEG_HEADER_BYTES - 4;
+    detect_color_blobs(&s->saved, blob_class.y_low, blob_class.u_low,
+                       blob_class.u_high, blob_class.v_low, blob_class.v_high,
+                       false, s->cols, s->rows, s->frame[0]);
+    blob_list_copy(&s->saved, &s->blob_list);
+    s->bbox_element_count = copy_best_bounding_boxes(&s->blob_list,
+                                                     MAX_BBOXES * 4,
+                                                     s->bbox_element);
+    memcpy(s->yuv, s->frame[0], pixels * 3 / 2);
+    convert_yuv420_to_rgb(s->cols, s->rows, s->frame[0], s->rgb);
+    memset(s->jpeg_header, 0, sizeof(s->jpeg_header));
+    s->jpeg_header[0] = 0xff;
+    s->jpeg_header[1] = 0xd8;
+    s->jpeg_header[2] = 0xff;
+    s->jpeg_header[3] = 0xe1;
+    s->jpeg_header[4] = length >> 8;
+    s->jpeg_header[5] = length & 0xff;
+    s->frame_no = 0;
+}
+
+/* Run one benchmark for at least min_secs of wall clock time, and print its
+   results.  Return the mean time per frame in nanoseconds. */
+static double run_benchmark(const Benchmark* b,
+                            const char* input_name,
+                            Bench_State* s,
+                            double min_secs) {
+    struct timespec wall_start;
+    struct timespec start_time;
+    struct timespec end_time;
+    double timed_secs = 0.0;
+    unsigned long iterations = 0;
+    unsigned long heap_calls = 0;
+
+    bench_state_prepare(s);
+    if (b->prepare != NULL) b->prepare(s);
+    b->run(s);  // warm up
+    bench_state_prepare(s);
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    do {
+        unsigned long batch = 1;
+        unsigned long start_heap_call_count;
+        unsigned long ii;
+        if (b->prepare != NULL) {
+            b->prepare(s);
+        } else if (iterations >= MIN_ITERATIONS) {
+            batch = iterations;
+        } else {
+            batch = MIN_ITERATIONS;
+        }
+        start_heap_call_count = heap_call_count;
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        for (ii = 0; ii < batch; ++ii) b->run(s);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        heap_calls += heap_call_count - start_heap_call_count;
+        timed_secs += delta_time(&start_time, &end_time);
+        iterations += batch;
+    } while (delta_time(&wall_start, &end_time) < min_secs ||
+             iterations < MIN_ITERATIONS);
+
+    double ns_per_frame = timed_secs * 1e9 / iterations;
+    double mpix_per_sec = (double)s->cols * s->rows * iterations /
+                          timed_secs / 1e6;
+    char name[128];
+    snprintf(name, sizeof(name), "%s/%ux%u/%s", b->name, s->cols, s->rows,
+             input_name);
+    printf("%-52s %12.0f %10.1f %12.2f %10lu\n", name, ns_per_frame,
+           mpix_per_sec, (double)heap_calls / iterations, iterations);
+    fflush(stdout);
+    return ns_per_frame;
+}
+
+static void run_benchmarks(const char* input_name,
+                           Bench_State* s,
+                           const char* filter,
+                           double min_secs) {
+    unsigned int pixels = s->cols * s->rows;
+    int ii;
+    s->yuv = (unsigned char*)malloc(pixels * 3 / 2);
+    s->rgb = (unsigned char*)malloc(pixels * 3);
+    s->blob_list = blob_list_init(MAX_RUNS, MAX_BLOBS, s->cols);
+    s->saved = blob_list_init(MAX_RUNS, MAX_BLOBS, s->cols);
+    for (ii = 0; ii < BENCHMARK_COUNT; ++ii) {
+        char name[128];
+        snprintf(name, sizeof(name), "%s/%ux%u/%s", benchmarks[ii].name,
+                 s->cols, s->rows, input_name);
+        if (filter == NULL || strstr(name, filter) != NULL) {
+            (void)run_benchmark(&benchmarks[ii], input_name, s, min_secs);
+        }
+    }
+    blob_list_deinit(&s->saved);
+    blob_list_deinit(&s->blob_list);
+    free(s->rgb);
+    free(s->yuv);
+}
+
+/******************************************************************************
+ * Inputs
+ ******************************************************************************/
+
+static int run_synthetic_benchmarks(const char* filter, double min_secs) {
+    static const unsigned int sizes[][2] = {
+        { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 }
+    };
+    static const struct {
+        const char* name;
+        int blob_count;
+        unsigned int size_divisor;  /// blobs are up to cols / size_divisor
+    } densities[] = {
+        { "none", 0, 1 },
+        { "sparse", 4, 6 },
+        { "dense", 150, 48 },
+    };
+    int ii;
+    int jj;
+    int kk;
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        for (jj = 0; jj < sizeof(densities) / sizeof(densities[0]); ++jj) {
+            Bench_State s;
+            s.cols = sizes[ii][0];
+            s.rows = sizes[ii][1];
+            s.frame_count = SYNTHETIC_FRAMES;
+            for (kk = 0; kk < s.frame_count; ++kk) {
+                s.frame[kk] = (unsigned char*)malloc(s.cols * s.rows * 3 / 2);
+                make_synthetic_frame(s.cols, s.rows, kk + 1,
+                                     densities[jj].blob_count,
+                                     s.cols / densities[jj].size_divisor,
+                                     s.rows / densities[jj].size_divisor,
+                                     BLOB_U, BLOB_V, s.frame[kk]);
+            }
+            run_benchmarks(densities[jj].name, &s, filter, min_secs);
+            for (kk = 0; kk < s.frame_count; ++kk) free(s.frame[kk]);
+        }
+    }
+    return 0;
+}
+
+static int run_file_benchmarks(const char* path,
+                               const char* filter,
+                               double min_secs) {
+    Yuv_File yuv_file = yuv420_open_read(path);
+    Bench_State s;
+    const char* name = strrchr(path, '/');
+    int kk;
+    if (yuv420_is_null(&yuv_file)) {
+        fprintf(stderr, "can't read %s\n", path);
+        return -1;
+    }
+    s.cols = yuv420_get_cols(&yuv_file);
+    s.rows = yuv420_get_rows(&yuv_file);
+    s.frame_count = 0;
+    while (s.frame_count < MAX_FILE_FRAMES) {
+        unsigned char* yuv = yuv420_malloc(&yuv_file);
+        if (yuv420_read_next(&yuv_file, yuv) < 0) {
+            free(yuv);
+            break;
+        }
+        s.frame[s.frame_count++] = yuv;
+    }
+    yuv420_close(&yuv_file);
+    if (s.frame_count == 0) {
+        fprintf(stderr, "no frames in %s\n", path);
+        return -1;
+    }
+    run_benchmarks(name == NULL ? path : name + 1, &s, filter, min_secs);
+    for (kk = 0; kk < s.frame_count; ++kk) free(s.frame[kk]);
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* filter = NULL;
+    double min_secs = 0.5;
+    int file_count = 0;
+    int status = 0;
+    int ii;
+
+    for (ii = 1; ii < argc; ++ii) {
+        const char* arg = argv[ii];
+        if (strncmp(arg, "--benchmark_filter=", 19) == 0) {
+            filter = &arg[19];
+        } else if (strncmp(arg, "--benchmark_min_time=", 21) == 0) {
+            min_secs = atof(&arg[21]);
+        } else if (strcmp(arg, "-blobyuv") == 0 && ii + 1 < argc) {
+            int y_low, y_high, u_low, u_high, v_low, v_high;
+            if (sscanf(argv[++ii], "%d,%d,%d,%d,%d,%d", &y_low, &y_high,
+                       &u_low, &u_high, &v_low, &v_high) != 6) {
+                fprintf(stderr, "bad -blobyuv %s\n", argv[ii]);
+                return 1;
+            }
+            blob_class.y_low = y_low;
+            blob_class.u_low = u_low;
+            blob_class.u_high = u_high;
+            blob_class.v_low = v_low;
+            blob_class.v_high = v_high;
+        } else if (arg[0] == '-') {
+            fprintf(stderr,
+                    "usage: %s [--benchmark_filter=SUBSTRING] "
+                    "[--benchmark_min_time=SECS]\n"
+                    "       [-blobyuv Y0,Y1,U0,U1,V0,V1] [file.yuv ...]\n",
+                    argv[0]);
+            return 1;
+        } else {
+            ++file_count;
+        }
+    }
+
+    printf("detect_color_blobs kernel: %s\n",
+           detect_color_blobs_kernel_name(detect_color_blobs_get_kernel()));
+    printf("yuv420 kernel: %s\n", yuv420_kernel_name(yuv420_get_kernel()));
+    printf("%-52s %12s %10s %12s %10s\n", "Benchmark", "ns/frame", "MPix/s",
+           "allocs/frame", "Iterations");
+    if (file_count == 0) {
+        status = run_synthetic_benchmarks(filter, min_secs);
+    }
+    for (ii = 1; ii < argc; ++ii) {
+        if (strcmp(argv[ii], "-blobyuv") == 0) {
+            ++ii;
+        } else if (argv[ii][0] != '-') {
+            if (run_file_benchmarks(argv[ii], filter, min_secs) < 0) {
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "yuv420.h"
+
+/* Check that memory-mapped clips give the same images as yuv420_read_next(),
+   in order and at random, both mapped whole and through a small window, and
+   that the index gives back the timestamps written to it.
+
+   usage: yuv420_clip [file.yuv ...]
+
+   A clip of numbered images is written to /tmp and checked.  Give it .yuv
+   files to check those too. */
+
+#define TEST_COLS 64
+#define TEST_ROWS 48
+#define TEST_FRAMES 37
+
+static int failures = 0;
+
+static void fail(const char* filename, const char* what, unsigned int ii) {
+    fprintf(stderr, "FAIL: %s: %s %u\n", filename, what, ii);
+    ++failures;
+}
+
+/* Compare every image of the clip against yuv420_read_next(), then read
+   them again in a scrambled order. */
+
+static void check_clip(const char* filename, size_t max_map_bytes) {
+    Yuv_File yuv_file = yuv420_open_read(filename);
+    Yuv_Clip clip;
+    unsigned int ii;
+    if (yuv420_is_null(&yuv_file) ||
+        yuv420_clip_open(filename, max_map_bytes, &clip) < 0) {
+        fail(filename, "can't open, max_map_bytes", max_map_bytes);
+        if (!yuv420_is_null(&yuv_file)) yuv420_close(&yuv_file);
+        return;
+    }
+    if (clip.cols != yuv420_get_cols(&yuv_file) ||
+        clip.rows != yuv420_get_rows(&yuv_file) ||
+        clip.frame_bytes != yuv420_get_bytes(&yuv_file)) {
+        fail(filename, "wrong size, max_map_bytes", max_map_bytes);
+    }
+    unsigned char* buf = yuv420_malloc(&yuv_file);
+    unsigned char** frames =
+        (unsigned char**)calloc(clip.frame_count + 1, sizeof(unsigned char*));
+    for (ii = 0; yuv420_read_next(&yuv_file, buf) >= 0; ++ii) {
+        const unsigned char* frame = yuv420_clip_frame(&clip, ii);
+        if (ii >= clip.frame_count) {
+            fail(filename, "too few frames; read_next has", ii + 1);
+            break;
+        }
+        frames[ii] = (unsigned char*)malloc(clip.frame_bytes);
+        memcpy(frames[ii], buf, clip.frame_bytes);
+        if (frame == NULL || memcmp(frame, buf, clip.frame_bytes) != 0) {
+            fail(filename, "sequential mismatch at", ii);
+        }
+    }
+    if (ii != clip.frame_count) fail(filename, "too many frames", ii);
+    if (yuv420_clip_frame(&clip, clip.frame_count) != NULL) {
+        fail(filename, "frame past the end", clip.frame_count);
+    }
+
+    /* 7 and 37 are coprime, so this visits every image of the test clip,
+       jumping back and forth. */
+
+    for (ii = 0; ii < clip.frame_count; ++ii) {
+        unsigned int frame_no = (ii * 7 + 3) % clip.frame_count;
+        yuv420_clip_prefetch(&clip, frame_no, 2);
+        const unsigned char* frame = yuv420_clip_frame(&clip, frame_no);
+        if (frame == NULL || frames[frame_no] == NULL ||
+            memcmp(frame, frames[frame_no], clip.frame_bytes) != 0) {
+            fail(filename, "random access mismatch at", frame_no);
+        }
+    }
+    for (ii = 0; ii < clip.frame_count; ++ii) free(frames[ii]);
+    free(frames);
+    free(buf);
+    yuv420_clip_close(&clip);
+    yuv420_close(&yuv_file);
+}
+
+/* Write a clip whose every byte depends on its image number and position,
+   with an index. */
+
+static int write_test_clip(const char* filename) {
+    unsigned int frame_bytes = TEST_COLS * TEST_ROWS * 3 / 2;
+    unsigned char* img = (unsigned char*)malloc(frame_bytes);
+    FILE* fp = fopen(filename, "wb");
+    FILE* index_fp = yuv420_index_open_write(filename);
+    unsigned int ii;
+    unsigned int jj;
+    if (fp == NULL || index_fp == NULL) return -1;
+    fprintf(fp, "#!YUV420 %7u,%7u\n", TEST_COLS, TEST_ROWS);
+    for (ii = 0; ii < TEST_FRAMES; ++ii) {
+        for (jj = 0; jj < frame_bytes; ++jj) img[jj] = ii * 31 + jj * 7;
+        fwrite(img, 1, frame_bytes, fp);
+        (void)yuv420_index_append(index_fp, 1000000000000LL + ii * 33333);
+    }
+
+    /* A partly written last image, as left by a camera that was stopped,
+       should be ignored. */
+
+    fwrite(img, 1, frame_bytes / 2, fp);
+    fclose(index_fp);
+    fclose(fp);
+    free(img);
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* test_filename = "/tmp/yuv420_clip_test.yuv";
+    size_t page_bytes = (size_t)sysconf(_SC_PAGESIZE);
+    size_t frame_bytes = TEST_COLS * TEST_ROWS * 3 / 2;
+    Yuv_Clip clip;
+    unsigned int ii;
+    int jj;
+
+    if (write_test_clip(test_filename) < 0) {
+        fail(test_filename, "can't write test clip", 0);
+    } else {
+        check_clip(test_filename, 0);
+        check_clip(test_filename, frame_bytes + page_bytes);
+        check_clip(test_filename, 5 * frame_bytes);
+        if (yuv420_clip_open(test_filename, 0, &clip) < 0) {
+            fail(test_filename, "can't open", 0);
+        } else {
+            if (clip.frame_count != TEST_FRAMES) {
+                fail(test_filename, "wrong frame count", clip.frame_count);
+            }
+            for (ii = 0; ii < TEST_FRAMES; ++ii) {
+                if (yuv420_clip_get_usecs(&clip, ii) !=
+                    1000000000000LL + ii * 33333) {
+                    fail(test_filename, "wrong timestamp at", ii);
+                }
+            }
+            if (yuv420_clip_get_usecs(&clip, TEST_FRAMES) != -1) {
+                fail(test_filename, "timestamp past the end", TEST_FRAMES);
+            }
+            yuv420_clip_close(&clip);
+        }
+        if (yuv420_clip_open(test_filename, frame_bytes, &clip) == 0) {
+            fail(test_filename, "accepted a too small window", frame_bytes);
+            yuv420_clip_close(&clip);
+        }
+        char index_filename[FILENAME_MAX];
+        snprintf(index_filename, FILENAME_MAX, "%s.idx", test_filename);
+        unlink(index_filename);
+        unlink(test_filename);
+    }
+    for (jj = 1; jj < argc; ++jj) {
+        check_clip(argv[jj], 0);
+        check_clip(argv[jj], 4 * 1024 * 1024);
+    }
+    fprintf(stderr, "%s: %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "yuv420.h"
+#include "test_util.h"
+
+/* Check that every kernel and thread count of convert_rgb_to_yuv420() and
+   convert_yuv420_to_rgb() matches a plain per-pixel reference bit for bit,
+   and compare their speed.
+
+   usage: yuv420_convert
+
+   Images of random bytes are used, at sizes chosen to exercise the vector
+   loops, their scalar tails, and odd widths and heights. */
+
+#define TIMED_REPEATS 10
+
+static int clamp(int val) {
+    return val < 0 ? 0 : (val > 255 ? 255 : val);
+}
+
+/* The formulas of yuv420.c, applied one pixel at a time. */
+
+static int y_of(const unsigned char* p) {
+    return ((66 * p[0] + 129 * p[1] + 25 * p[2] + 128) >> 8) + 16;
+}
+
+static int u_of(const unsigned char* p) {
+    return ((-38 * p[0] - 74 * p[1] + 112 * p[2] + 128) >> 8) + 128;
+}
+
+static int v_of(const unsigned char* p) {
+    return ((112 * p[0] - 94 * p[1] - 18 * p[2] + 128) >> 8) + 128;
+}
+
+static void reference_rgb_to_yuv420(unsigned int cols,
+                                    unsigned int rows,
+                                    const unsigned char rgb[],
+                                    unsigned char yuv[]) {
+    unsigned int pixels = cols * rows;
+    unsigned char* u = &yuv[pixels];
+    unsigned char* v = &yuv[pixels + pixels / 4];
+    unsigned int x;
+    unsigned int y;
+    for (y = 0; y < rows; ++y) {
+        for (x = 0; x < cols; ++x) {
+            yuv[y * cols + x] = y_of(&rgb[3 * (y * cols + x)]);
+        }
+    }
+    for (y = 0; y < rows / 2; ++y) {
+        for (x = 0; x < cols / 2; ++x) {
+            const unsigned char* p00 = &rgb[3 * (2 * y * cols + 2 * x)];
+            const unsigned char* p01 = p00 + 3;
+            const unsigned char* p10 = p00 + 3 * cols;
+            const unsigned char* p11 = p10 + 3;
+            int u_sum = u_of(p00) + u_of(p01) + u_of(p10) + u_of(p11);
+            int v_sum = v_of(p00) + v_of(p01) + v_of(p10) + v_of(p11);
+            u[y * (cols / 2) + x] = (u_sum + 2) / 4;
+            v[y * (cols / 2) + x] = (v_sum + 2) / 4;
+        }
+    }
+}
+
+static void reference_yuv420_to_rgb(unsigned int cols,
+                                    unsigned int rows,
+                                    const unsigned char yuv[],
+                                    unsigned char rgb[]) {
+    unsigned int pixels = cols * rows;
+    unsigned int x;
+    unsigned int y;
+    for (y = 0; y < rows; ++y) {
+        for (x = 0; x < cols; ++x) {
+            unsigned int uv_y = (y / 2 < rows / 2) ? y / 2 : rows / 2 - 1;
+            unsigned int uv_x = (x / 2 < cols / 2) ? x / 2 : cols / 2 - 1;
+            unsigned int uv_offset = uv_y * (cols / 2) + uv_x;
+            int c = yuv[y * cols + x] - 16;
+            int d = yuv[pixels + uv_offset] - 128;
+            int e = yuv[pixels + pixels / 4 + uv_offset] - 128;
+            unsigned char* p = &rgb[3 * (y * cols + x)];
+            p[0] = clamp((298 * c + 409 * e + 128) >> 8);
+            p[1] = clamp((298 * c - 100 * d - 208 * e + 128) >> 8);
+            p[2] = clamp((298 * c + 516 * d + 128) >> 8);
+        }
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    static const unsigned int sizes[][2] = {
+        { 2, 2 }, { 16, 2 }, { 18, 4 }, { 33, 7 }, { 47, 31 },
+        { 320, 240 }, { 641, 481 }, { 1280, 720 }, { 1920, 1080 }
+    };
+    static const Yuv420_Kernel kernels[] = {
+        YUV420_KERNEL_SCALAR, YUV420_KERNEL_SSSE3, YUV420_KERNEL_NEON
+    };
+    static const int thread_counts[] = { 1, 2, 3, 4 };
+    int failures = 0;
+    int ii;
+
+    for (ii = 0; ii < sizeof(sizes) / sizeof(sizes[0]); ++ii) {
+        unsigned int cols = sizes[ii][0];
+        unsigned int rows = sizes[ii][1];
+        unsigned int pixels = cols * rows;
+        unsigned int yuv_bytes = pixels + pixels / 2;
+        unsigned char* rgb = (unsigned char*)malloc(pixels * 3);
+        unsigned char* yuv = (unsigned char*)malloc(yuv_bytes);
+        unsigned char* expected_rgb = (unsigned char*)malloc(pixels * 3);
+        unsigned char* expected_yuv = (unsigned char*)malloc(yuv_bytes);
+        unsigned char* actual = (unsigned char*)malloc(pixels * 3);
+        double reference_secs[2] = { 0.0, 0.0 };
+        struct timespec start_time;
+        struct timespec end_time;
+        unsigned int kk;
+        int tt;
+        int rr;
+
+        srand(ii + 1);
+        for (kk = 0; kk < pixels * 3; ++kk) rgb[kk] = rand() % 256;
+        for (kk = 0; kk < yuv_bytes; ++kk) yuv[kk] = rand() % 256;
+
+        /* With odd sizes, the planes don't fill yuv_bytes.  The bytes between
+           are never written, so give them the same garbage as below. */
+
+        memset(expected_yuv, 0xa5, yuv_bytes);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        reference_rgb_to_yuv420(cols, rows, rgb, expected_yuv);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        reference_secs[0] = delta_time(&start_time, &end_time);
+        clock_gettime(CLOCK_MONOTONIC, &start_time);
+        reference_yuv420_to_rgb(cols, rows, yuv, expected_rgb);
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        reference_secs[1] = delta_time(&start_time, &end_time);
+
+        for (kk = 0; kk < sizeof(kernels) / sizeof(kernels[0]); ++kk) {
+            if (yuv420_set_kernel(kernels[kk]) != kernels[kk]) continue;
+            for (tt = 0; tt < sizeof(thread_counts) / sizeof(int); ++tt) {
+                double secs[2] = { 0.0, 0.0 };
+                (void)yuv420_set_thread_count(thread_counts[tt]);
+
+                /* Fill the output with garbage first, so that bytes left
+                   unwritten are caught. */
+
+                memset(actual, 0xa5, yuv_bytes);
+                if (convert_rgb_to_yuv420(cols, rows, rgb, yuv_bytes,
+                                          actual) != yuv_bytes ||
+                    memcmp(actual, expected_yuv, yuv_bytes) != 0) {
+                    fprintf(stderr, "FAIL: convert_rgb_to_yuv420 %u x %u "
+                            "kernel %s threads %d\n", cols, rows,
+                            yuv420_kernel_name(kernels[kk]),
+                            thread_counts[tt]);
+                    ++failures;
+                }
+                memset(actual, 0xa5, pixels * 3);
+                convert_yuv420_to_rgb(cols, rows, yuv, actual);
+                if (memcmp(actual, expected_rgb, pixels * 3) != 0) {
+                    fprintf(stderr, "FAIL: convert_yuv420_to_rgb %u x %u "
+                            "kernel %s threads %d\n", cols, rows,
+                            yuv420_kernel_name(kernels[kk]),
+                            thread_counts[tt]);
+                    ++failures;
+                }
+                if (pixels < 320 * 240) continue;
+
+                clock_gettime(CLOCK_MONOTONIC, &start_time);
+                for (rr = 0; rr < TIMED_REPEATS; ++rr) {
+                    (void)convert_rgb_to_yuv420(cols, rows, rgb, yuv_bytes,
+                                                actual);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end_time);
+                secs[0] = delta_time(&start_time, &end_time) / TIMED_REPEATS;
+                clock_gettime(CLOCK_MONOTONIC, &start_time);
+                for (rr = 0; rr < TIMED_REPEATS; ++rr) {
+                    convert_yuv420_to_rgb(cols, rows, yuv, actual);
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end_time);
+                secs[1] = delta_time(&start_time, &end_time) / TIMED_REPEATS;
+                fprintf(stderr, "%u x %u %s threads= %d: "
+                        "rgb_to_yuv420_secs= %.6f (%.1fx) "
+                        "yuv420_to_rgb_secs= %.6f (%.1fx)\n",
+                        cols, rows, yuv420_kernel_name(kernels[kk]),
+                        thread_counts[tt], secs[0],
+                        reference_secs[0] / secs[0], secs[1],
+                        reference_secs[1] / secs[1]);
+            }
+        }
+        free(actual);
+        free(expected_yuv);
+        free(expected_rgb);
+        free(yuv);
+        free(rgb);
+    }
+    fprintf(stderr, "%s: %d failures\n",
+            failures == 0 ? "PASS" : "FAIL", failures);
+    return failures == 0 ? 0 : 1;
+}
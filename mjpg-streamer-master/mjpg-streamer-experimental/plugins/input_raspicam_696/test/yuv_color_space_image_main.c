@@ -3,8 +3,9 @@
 #include "yuv420.h"
 #include "yuv_color_space_image.h"
 int main(int argc, const char* argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "usage: yuv_color_space_image cols rows y_value\n");
+    if (argc != 4 && argc != 5) {
+        fprintf(stderr, "usage: yuv_color_space_image cols rows y_value "
+                "[color_class_file]\n");
         return -1;
     }
     int cols = atoi(argv[1]);
@@ -12,6 +13,19 @@ int main(int argc, const char* argv[]) {
     int y_value = atoi(argv[3]);
     unsigned char* yuv = (unsigned char*)malloc(cols * rows * 3 / 2);
     yuv_color_space_image(cols, rows, y_value, yuv);
+    if (argc == 5) {
+        /* Darken the colors that are in none of the classes. */
+
+        static Color_Class_Table table;
+        Color_Class color_class[MAX_COLOR_CLASSES];
+        Uv_Region uv_region[MAX_COLOR_CLASSES];
+        int class_count = color_classes_read(argv[4], color_class, uv_region);
+        if (class_count < 0) return -1;
+        table.class_count = -1;
+        (void)color_class_table_set_regions(&table, class_count, color_class,
+                                            uv_region);
+        yuv_color_space_image_show_classes(cols, rows, &table, yuv);
+    }
 
     yuv420_write("out.yuv", cols, rows, yuv);
     return 0;
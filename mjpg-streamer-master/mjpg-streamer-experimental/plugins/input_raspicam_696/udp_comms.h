@@ -74,7 +74,8 @@ typedef struct {
 #define MAX_UDP_BLOBS 20
 typedef struct {
     signed char msg_id;
-    signed char filler[3];
+    signed char blob_class;    /// color class of all blobs in the message
+    signed char filler[2];
     int blob_count;
     int64_t client_msec;
     Blob_Stats blob[MAX_UDP_BLOBS];
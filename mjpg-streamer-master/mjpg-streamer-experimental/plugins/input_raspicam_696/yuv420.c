@@ -47,13 +47,28 @@
  *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _FILE_OFFSET_BITS 64  // for clips over 2 GB on 32-bit systems
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "yuv420.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV420_HAVE_X86
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV420_HAVE_NEON
+#endif
+
 Yuv_File yuv420_open_read(const char* filename) {
     Yuv_File file;
     file.cols = 0;
@@ -131,6 +146,191 @@ int yuv420_write(const char* filename,
     return 0;
 }
 
+/*******************************************************************************
+ * Memory-mapped clips.
+ ******************************************************************************/
+
+#define YUV_INDEX_SUFFIX ".idx"
+#define YUV_INDEX_HEADER "#!YUV420IDX"
+
+// The window mapped at a time if the whole clip can't be.
+#define DEFAULT_CLIP_WINDOW_BYTES (64 * 1024 * 1024)
+
+static int get_index_filename(const char* yuv_filename,
+                              char index_filename[FILENAME_MAX]) {
+    int length = snprintf(index_filename, FILENAME_MAX, "%s%s",
+                          yuv_filename, YUV_INDEX_SUFFIX);
+    if (length < 0 || length >= FILENAME_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Read the timestamps of clip from its index file, if there is one.  A
+   missing index is not an error; a short one gives timestamps for only the
+   first images. */
+
+static int read_clip_index(const char* yuv_filename, Yuv_Clip* clip) {
+    char index_filename[FILENAME_MAX];
+    char header[sizeof(YUV_INDEX_HEADER) + 1];
+    long long usecs;
+    if (get_index_filename(yuv_filename, index_filename) < 0) return 0;
+    FILE* fp = fopen(index_filename, "r");
+    if (fp == NULL) return 0;
+    if (fgets(header, sizeof(header), fp) == NULL ||
+        strncmp(header, YUV_INDEX_HEADER, strlen(YUV_INDEX_HEADER)) != 0) {
+        fclose(fp);
+        errno = EINVAL;
+        return -1;
+    }
+    if (clip->frame_count > 0) {
+        clip->usecs = (int64_t*)malloc(clip->frame_count * sizeof(int64_t));
+        if (clip->usecs == NULL) {
+            fclose(fp);
+            return -1;
+        }
+        while (clip->usecs_count < clip->frame_count &&
+               fscanf(fp, "%lld", &usecs) == 1) {
+            clip->usecs[clip->usecs_count++] = usecs;
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static size_t get_page_bytes(void) {
+    return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+int yuv420_clip_open(const char* filename,
+                     size_t max_map_bytes,
+                     Yuv_Clip* clip) {
+    unsigned char header[YUV_HEADER_BYTES + 1];
+    struct stat st;
+    int saved_errno;
+    memset(clip, 0, sizeof(*clip));
+    clip->map = NULL;
+    clip->usecs = NULL;
+    clip->fd = open(filename, O_RDONLY);
+    if (clip->fd < 0) return -1;
+    if (fstat(clip->fd, &st) < 0) goto fail;
+    if (pread(clip->fd, header, YUV_HEADER_BYTES, 0) != YUV_HEADER_BYTES) {
+        errno = EINVAL;
+        goto fail;
+    }
+    header[YUV_HEADER_BYTES] = '\0';
+    if (sscanf((const char*)header, "#!YUV420 %u,%u",
+               &clip->cols, &clip->rows) != 2 ||
+        clip->cols == 0 || clip->rows == 0) {
+        errno = EINVAL;
+        goto fail;
+    }
+    clip->frame_bytes = (size_t)clip->cols * clip->rows * 3 / 2;
+    clip->file_bytes = st.st_size;
+    clip->frame_count =
+        (clip->file_bytes - YUV_HEADER_BYTES) / clip->frame_bytes;
+
+    /* Map the whole file if allowed and possible.  Otherwise fall back to
+       a window, mapped by yuv420_clip_frame(). */
+
+    if ((max_map_bytes == 0 || clip->file_bytes <= max_map_bytes) &&
+        clip->file_bytes <= (size_t)-1) {
+        void* map = mmap(NULL, clip->file_bytes, PROT_READ, MAP_SHARED,
+                         clip->fd, 0);
+        if (map != MAP_FAILED) {
+            clip->map = (unsigned char*)map;
+            clip->map_bytes = clip->file_bytes;
+            (void)madvise(map, clip->map_bytes, MADV_SEQUENTIAL);
+        }
+    }
+    if (clip->map == NULL) {
+        if (max_map_bytes == 0) max_map_bytes = DEFAULT_CLIP_WINDOW_BYTES;
+        if (max_map_bytes < clip->frame_bytes + get_page_bytes()) {
+            errno = EINVAL;
+            goto fail;
+        }
+        clip->max_map_bytes = max_map_bytes;
+        (void)posix_fadvise(clip->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (read_clip_index(filename, clip) < 0) goto fail;
+    return 0;
+fail:
+    saved_errno = errno;
+    yuv420_clip_close(clip);
+    errno = saved_errno;
+    return -1;
+}
+
+void yuv420_clip_close(Yuv_Clip* clip) {
+    if (clip->map != NULL) munmap(clip->map, clip->map_bytes);
+    if (clip->fd >= 0) close(clip->fd);
+    free(clip->usecs);
+    clip->map = NULL;
+    clip->fd = -1;
+    clip->usecs = NULL;
+    clip->usecs_count = 0;
+}
+
+const unsigned char* yuv420_clip_frame(Yuv_Clip* clip,
+                                       unsigned int frame_no) {
+    if (frame_no >= clip->frame_count) return NULL;
+    uint64_t offset =
+        YUV_HEADER_BYTES + (uint64_t)frame_no * clip->frame_bytes;
+    if (clip->map != NULL && offset >= clip->map_offset &&
+        offset + clip->frame_bytes <= clip->map_offset + clip->map_bytes) {
+        return clip->map + (offset - clip->map_offset);
+    }
+
+    /* Move the window so that it starts at the page holding the image, and
+       holds as many of the images after it as fit. */
+
+    if (clip->map != NULL) {
+        munmap(clip->map, clip->map_bytes);
+        clip->map = NULL;
+    }
+    uint64_t map_offset = offset & ~(uint64_t)(get_page_bytes() - 1);
+    uint64_t map_bytes = clip->file_bytes - map_offset;
+    if (map_bytes > clip->max_map_bytes) map_bytes = clip->max_map_bytes;
+    void* map = mmap(NULL, map_bytes, PROT_READ, MAP_SHARED, clip->fd,
+                     map_offset);
+    if (map == MAP_FAILED) return NULL;
+    (void)madvise(map, map_bytes, MADV_SEQUENTIAL);
+    clip->map = (unsigned char*)map;
+    clip->map_offset = map_offset;
+    clip->map_bytes = map_bytes;
+    return clip->map + (offset - map_offset);
+}
+
+void yuv420_clip_prefetch(Yuv_Clip* clip,
+                          unsigned int frame_no,
+                          unsigned int count) {
+    if (frame_no >= clip->frame_count) return;
+    if (count > clip->frame_count - frame_no) {
+        count = clip->frame_count - frame_no;
+    }
+    uint64_t offset =
+        YUV_HEADER_BYTES + (uint64_t)frame_no * clip->frame_bytes;
+    uint64_t bytes = (uint64_t)count * clip->frame_bytes;
+    if (clip->max_map_bytes != 0) {
+        /* Windowed: the images may not be mapped yet, so advise the file. */
+
+        (void)posix_fadvise(clip->fd, offset, bytes, POSIX_FADV_WILLNEED);
+        return;
+    }
+    uint64_t start = offset & ~(uint64_t)(get_page_bytes() - 1);
+    (void)madvise(clip->map + start, offset + bytes - start, MADV_WILLNEED);
+}
+
+FILE* yuv420_index_open_write(const char* yuv_filename) {
+    char index_filename[FILENAME_MAX];
+    if (get_index_filename(yuv_filename, index_filename) < 0) return NULL;
+    FILE* fp = fopen(index_filename, "w");
+    if (fp == NULL) return NULL;
+    fprintf(fp, "%s\n", YUV_INDEX_HEADER);
+    return fp;
+}
+
 /* formulas are from https://en.wikipedia.org/wiki/YUV */
 static inline unsigned char y_from_rgb(unsigned short r,
                                        unsigned short g,
@@ -150,96 +350,686 @@ static inline unsigned char v_from_rgb(unsigned short r,
    return ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
 }
 
+static unsigned char limit255(int val) {
+    if (val < 0) return 0;
+    if (val > 255) return 255;
+    return val;
+}
+
+/* Convert columns jj .. width - 1 of a pair of RGB rows.  Each 2x2 block is
+   read once, giving four Y values and one U and one V.  An odd last column
+   gets Y only. */
+static void rgb_to_yuv420_row_pair(unsigned int width,
+                                   unsigned int jj,
+                                   const unsigned char rgb0[],
+                                   const unsigned char rgb1[],
+                                   unsigned char y0[],
+                                   unsigned char y1[],
+                                   unsigned char u[],
+                                   unsigned char v[]) {
+    for (; jj + 1 < width; jj += 2) {
+        const unsigned char* p00 = &rgb0[3 * jj];
+        const unsigned char* p01 = p00 + 3;
+        const unsigned char* p10 = &rgb1[3 * jj];
+        const unsigned char* p11 = p10 + 3;
+
+        y0[jj] = y_from_rgb(p00[0], p00[1], p00[2]);
+        y0[jj + 1] = y_from_rgb(p01[0], p01[1], p01[2]);
+        y1[jj] = y_from_rgb(p10[0], p10[1], p10[2]);
+        y1[jj + 1] = y_from_rgb(p11[0], p11[1], p11[2]);
+
+        unsigned short u_val = u_from_rgb(p00[0], p00[1], p00[2]);
+        u_val += u_from_rgb(p01[0], p01[1], p01[2]);
+        u_val += u_from_rgb(p10[0], p10[1], p10[2]);
+        u_val += u_from_rgb(p11[0], p11[1], p11[2]);
+        u[jj / 2] = (unsigned char)((u_val + 2) / 4);
+
+        unsigned short v_val = v_from_rgb(p00[0], p00[1], p00[2]);
+        v_val += v_from_rgb(p01[0], p01[1], p01[2]);
+        v_val += v_from_rgb(p10[0], p10[1], p10[2]);
+        v_val += v_from_rgb(p11[0], p11[1], p11[2]);
+        v[jj / 2] = (unsigned char)((v_val + 2) / 4);
+    }
+    if (jj < width) {
+        y0[jj] = y_from_rgb(rgb0[3 * jj], rgb0[3 * jj + 1], rgb0[3 * jj + 2]);
+        y1[jj] = y_from_rgb(rgb1[3 * jj], rgb1[3 * jj + 1], rgb1[3 * jj + 2]);
+    }
+}
+
+/* Convert columns jj .. cols - 1 of one row.  Columns jj and jj + 1 share a
+   chroma sample.  An odd last column shares the chroma sample before it. */
+static void yuv420_to_rgb_row(unsigned int cols,
+                              unsigned int jj,
+                              const unsigned char y_row[],
+                              const unsigned char u_row[],
+                              const unsigned char v_row[],
+                              unsigned char rgb_row[]) {
+    const unsigned int last_uv = cols / 2 - 1;
+    for (; jj < cols; ++jj) {
+        unsigned int k = (jj / 2 > last_uv) ? last_uv : jj / 2;
+        int c = y_row[jj] - 16;
+        int d = u_row[k] - 128;
+        int e = v_row[k] - 128;
+        rgb_row[3 * jj + 0] = limit255((298*c + 409*e + 128) >> 8);
+        rgb_row[3 * jj + 1] = limit255((298*c - 100*d - 208*e + 128) >> 8);
+        rgb_row[3 * jj + 2] = limit255((298*c + 516*d + 128) >> 8);
+    }
+}
+
+static void rgb_to_yuv420_row_pair_scalar(unsigned int width,
+                                          const unsigned char rgb0[],
+                                          const unsigned char rgb1[],
+                                          unsigned char y0[],
+                                          unsigned char y1[],
+                                          unsigned char u[],
+                                          unsigned char v[]) {
+    rgb_to_yuv420_row_pair(width, 0, rgb0, rgb1, y0, y1, u, v);
+}
+
+static void yuv420_to_rgb_row_scalar(unsigned int cols,
+                                     const unsigned char y_row[],
+                                     const unsigned char u_row[],
+                                     const unsigned char v_row[],
+                                     unsigned char rgb_row[]) {
+    yuv420_to_rgb_row(cols, 0, y_row, u_row, v_row, rgb_row);
+}
+
+#ifdef YUV420_HAVE_X86
+/* _mm_shuffle_epi8() masks.  Deinterleave_mask[c][k] gathers the bytes of
+   color c (0: red, 1: green, 2: blue) from the k-th 16 bytes of 16 RGB
+   pixels.  Interleave_mask[k][c] scatters them back. */
+static const signed char deinterleave_mask[3][3][16] = {
+    { { 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13 } },
+    { { 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14 } },
+    { { 2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1 },
+      { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15 } }
+};
+
+static const signed char interleave_mask[3][3][16] = {
+    { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+      { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+      { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 } },
+    { { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+      { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+      { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 } },
+    { { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+      { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+      { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } }
+};
+
+#define SSSE3_MASK(table, i, j) \
+    _mm_loadu_si128((const __m128i*)table[i][j])
+
+/* Gather color c of the 16 pixels in chunk[0..2]. */
+__attribute__((target("ssse3")))
+static inline __m128i deinterleave_ssse3(const __m128i chunk[3], int c) {
+    return _mm_or_si128(
+        _mm_or_si128(
+            _mm_shuffle_epi8(chunk[0], SSSE3_MASK(deinterleave_mask, c, 0)),
+            _mm_shuffle_epi8(chunk[1], SSSE3_MASK(deinterleave_mask, c, 1))),
+        _mm_shuffle_epi8(chunk[2], SSSE3_MASK(deinterleave_mask, c, 2)));
+}
+
+/* Store 16 pixels, given as 16 reds, 16 greens and 16 blues. */
+__attribute__((target("ssse3")))
+static inline void interleave_store_ssse3(__m128i r,
+                                          __m128i g,
+                                          __m128i b,
+                                          unsigned char rgb[]) {
+    int k;
+    for (k = 0; k < 3; ++k) {
+        __m128i chunk = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(r, SSSE3_MASK(interleave_mask, k, 0)),
+                _mm_shuffle_epi8(g, SSSE3_MASK(interleave_mask, k, 1))),
+            _mm_shuffle_epi8(b, SSSE3_MASK(interleave_mask, k, 2)));
+        _mm_storeu_si128((__m128i*)&rgb[16 * k], chunk);
+    }
+}
+
+/* The same fixed point sums as y_from_rgb() and friends, on eight 16 bit
+   lanes.  The Y sum fits in 16 bits unsigned, and the U and V sums in 16
+   bits signed. */
+__attribute__((target("ssse3")))
+static inline __m128i y_from_rgb_ssse3(__m128i r, __m128i g, __m128i b) {
+    __m128i sum = _mm_add_epi16(
+                     _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                   _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                     _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)),
+                                   _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+__attribute__((target("ssse3")))
+static inline __m128i chroma_from_rgb_ssse3(__m128i r,
+                                            __m128i g,
+                                            __m128i b,
+                                            short kr,
+                                            short kg,
+                                            short kb) {
+    __m128i sum = _mm_add_epi16(
+                     _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)),
+                                   _mm_mullo_epi16(g, _mm_set1_epi16(kg))),
+                     _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kb)),
+                                   _mm_set1_epi16(128)));
+    return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+__attribute__((target("ssse3")))
+static void rgb_to_yuv420_row_pair_ssse3(unsigned int width,
+                                         const unsigned char rgb0[],
+                                         const unsigned char rgb1[],
+                                         unsigned char y0[],
+                                         unsigned char y1[],
+                                         unsigned char u[],
+                                         unsigned char v[]) {
+    const __m128i zero = _mm_setzero_si128();
+    unsigned int jj;
+    for (jj = 0; jj + 16 <= width; jj += 16) {
+        __m128i u_sum[2] = { zero, zero };
+        __m128i v_sum[2] = { zero, zero };
+        int row;
+        int half;
+        for (row = 0; row < 2; ++row) {
+            const unsigned char* rgb = &(row == 0 ? rgb0 : rgb1)[3 * jj];
+            unsigned char* y = &(row == 0 ? y0 : y1)[jj];
+            __m128i chunk[3];
+            __m128i y16[2];
+            chunk[0] = _mm_loadu_si128((const __m128i*)&rgb[0]);
+            chunk[1] = _mm_loadu_si128((const __m128i*)&rgb[16]);
+            chunk[2] = _mm_loadu_si128((const __m128i*)&rgb[32]);
+            __m128i r8 = deinterleave_ssse3(chunk, 0);
+            __m128i g8 = deinterleave_ssse3(chunk, 1);
+            __m128i b8 = deinterleave_ssse3(chunk, 2);
+            for (half = 0; half < 2; ++half) {
+                __m128i r = half ? _mm_unpackhi_epi8(r8, zero) :
+                                   _mm_unpacklo_epi8(r8, zero);
+                __m128i g = half ? _mm_unpackhi_epi8(g8, zero) :
+                                   _mm_unpacklo_epi8(g8, zero);
+                __m128i b = half ? _mm_unpackhi_epi8(b8, zero) :
+                                   _mm_unpacklo_epi8(b8, zero);
+                y16[half] = y_from_rgb_ssse3(r, g, b);
+                u_sum[half] = _mm_add_epi16(u_sum[half],
+                              chroma_from_rgb_ssse3(r, g, b, -38, -74, 112));
+                v_sum[half] = _mm_add_epi16(v_sum[half],
+                              chroma_from_rgb_ssse3(r, g, b, 112, -94, -18));
+            }
+            _mm_storeu_si128((__m128i*)y, _mm_packus_epi16(y16[0], y16[1]));
+        }
+
+        /* Add horizontal neighbors, so each lane holds a 2x2 block sum. */
+
+        const __m128i two = _mm_set1_epi16(2);
+        __m128i u4 = _mm_hadd_epi16(u_sum[0], u_sum[1]);
+        __m128i v4 = _mm_hadd_epi16(v_sum[0], v_sum[1]);
+        u4 = _mm_srli_epi16(_mm_add_epi16(u4, two), 2);
+        v4 = _mm_srli_epi16(_mm_add_epi16(v4, two), 2);
+        _mm_storel_epi64((__m128i*)&u[jj / 2], _mm_packus_epi16(u4, u4));
+        _mm_storel_epi64((__m128i*)&v[jj / 2], _mm_packus_epi16(v4, v4));
+    }
+    rgb_to_yuv420_row_pair(width, jj, rgb0, rgb1, y0, y1, u, v);
+}
+
+/* Compute one color of 4 pixels as in yuv420_to_rgb_row(), with the
+   products in 32 bits.  Xy holds (x, y) pairs, and kxy the matching
+   (kx, ky) pairs.  The result is (kx * x + ky * y + 128) >> 8. */
+__attribute__((target("ssse3")))
+static inline __m128i weigh_pairs_ssse3(__m128i xy, __m128i kxy) {
+    return _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(xy, kxy),
+                                        _mm_set1_epi32(128)), 8);
+}
+
+/* Convert 8 pixels, given c = y - 16, d = u - 128 and e = v - 128 in 16 bit
+   lanes, to 16 bit red, green and blue. */
+__attribute__((target("ssse3")))
+static inline void rgb_from_yuv_ssse3(__m128i c,
+                                      __m128i d,
+                                      __m128i e,
+                                      __m128i* r,
+                                      __m128i* g,
+                                      __m128i* b) {
+    const __m128i k_r = _mm_setr_epi16(298, 409, 298, 409,
+                                       298, 409, 298, 409);
+    const __m128i k_g = _mm_setr_epi16(298, -208, 298, -208,
+                                       298, -208, 298, -208);
+    const __m128i k_gd = _mm_setr_epi16(-100, 0, -100, 0, -100, 0, -100, 0);
+    const __m128i k_b = _mm_setr_epi16(298, 516, 298, 516,
+                                       298, 516, 298, 516);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i ce_lo = _mm_unpacklo_epi16(c, e);
+    __m128i ce_hi = _mm_unpackhi_epi16(c, e);
+    __m128i cd_lo = _mm_unpacklo_epi16(c, d);
+    __m128i cd_hi = _mm_unpackhi_epi16(c, d);
+    __m128i d_lo = _mm_madd_epi16(_mm_unpacklo_epi16(d, zero), k_gd);
+    __m128i d_hi = _mm_madd_epi16(_mm_unpackhi_epi16(d, zero), k_gd);
+    *r = _mm_packs_epi32(weigh_pairs_ssse3(ce_lo, k_r),
+                         weigh_pairs_ssse3(ce_hi, k_r));
+    *g = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                                         _mm_madd_epi16(ce_lo, k_g), d_lo),
+                                         _mm_set1_epi32(128)), 8),
+            _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(
+                                         _mm_madd_epi16(ce_hi, k_g), d_hi),
+                                         _mm_set1_epi32(128)), 8));
+    *b = _mm_packs_epi32(weigh_pairs_ssse3(cd_lo, k_b),
+                         weigh_pairs_ssse3(cd_hi, k_b));
+}
+
+__attribute__((target("ssse3")))
+static void yuv420_to_rgb_row_ssse3(unsigned int cols,
+                                    const unsigned char y_row[],
+                                    const unsigned char u_row[],
+                                    const unsigned char v_row[],
+                                    unsigned char rgb_row[]) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i k128 = _mm_set1_epi16(128);
+    unsigned int jj;
+    for (jj = 0; jj + 16 <= cols; jj += 16) {
+        __m128i y8 = _mm_loadu_si128((const __m128i*)&y_row[jj]);
+        __m128i u8 = _mm_loadl_epi64((const __m128i*)&u_row[jj / 2]);
+        __m128i v8 = _mm_loadl_epi64((const __m128i*)&v_row[jj / 2]);
+        __m128i r16[2];
+        __m128i g16[2];
+        __m128i b16[2];
+        int half;
+
+        /* Each chroma sample covers two adjacent pixels. */
+
+        u8 = _mm_unpacklo_epi8(u8, u8);
+        v8 = _mm_unpacklo_epi8(v8, v8);
+        for (half = 0; half < 2; ++half) {
+            __m128i c = half ? _mm_unpackhi_epi8(y8, zero) :
+                               _mm_unpacklo_epi8(y8, zero);
+            __m128i d = half ? _mm_unpackhi_epi8(u8, zero) :
+                               _mm_unpacklo_epi8(u8, zero);
+            __m128i e = half ? _mm_unpackhi_epi8(v8, zero) :
+                               _mm_unpacklo_epi8(v8, zero);
+            rgb_from_yuv_ssse3(_mm_sub_epi16(c, k16), _mm_sub_epi16(d, k128),
+                               _mm_sub_epi16(e, k128),
+                               &r16[half], &g16[half], &b16[half]);
+        }
+        interleave_store_ssse3(_mm_packus_epi16(r16[0], r16[1]),
+                               _mm_packus_epi16(g16[0], g16[1]),
+                               _mm_packus_epi16(b16[0], b16[1]),
+                               &rgb_row[3 * jj]);
+    }
+    yuv420_to_rgb_row(cols, jj, y_row, u_row, v_row, rgb_row);
+}
+#endif
+
+#ifdef YUV420_HAVE_NEON
+/* Vld3q_u8() and vst3q_u8() do the RGB (de)interleaving.  The arithmetic
+   matches the SSSE3 kernels. */
+
+static inline int16x8_t chroma_from_rgb_neon(int16x8_t r,
+                                             int16x8_t g,
+                                             int16x8_t b,
+                                             short kr,
+                                             short kg,
+                                             short kb) {
+    int16x8_t sum = vmlaq_n_s16(vmlaq_n_s16(vmlaq_n_s16(vdupq_n_s16(128),
+                                                        r, kr),
+                                            g, kg),
+                                b, kb);
+    return vaddq_s16(vshrq_n_s16(sum, 8), vdupq_n_s16(128));
+}
+
+static void rgb_to_yuv420_row_pair_neon(unsigned int width,
+                                        const unsigned char rgb0[],
+                                        const unsigned char rgb1[],
+                                        unsigned char y0[],
+                                        unsigned char y1[],
+                                        unsigned char u[],
+                                        unsigned char v[]) {
+    unsigned int jj;
+    for (jj = 0; jj + 16 <= width; jj += 16) {
+        int16x8_t u_sum[2] = { vdupq_n_s16(0), vdupq_n_s16(0) };
+        int16x8_t v_sum[2] = { vdupq_n_s16(0), vdupq_n_s16(0) };
+        int row;
+        int half;
+        for (row = 0; row < 2; ++row) {
+            const unsigned char* rgb = &(row == 0 ? rgb0 : rgb1)[3 * jj];
+            unsigned char* y = &(row == 0 ? y0 : y1)[jj];
+            uint8x16x3_t px = vld3q_u8(rgb);
+            uint8x8_t y8[2];
+            for (half = 0; half < 2; ++half) {
+                uint16x8_t r = vmovl_u8(half ? vget_high_u8(px.val[0]) :
+                                               vget_low_u8(px.val[0]));
+                uint16x8_t g = vmovl_u8(half ? vget_high_u8(px.val[1]) :
+                                               vget_low_u8(px.val[1]));
+                uint16x8_t b = vmovl_u8(half ? vget_high_u8(px.val[2]) :
+                                               vget_low_u8(px.val[2]));
+                uint16x8_t sum = vmlaq_n_u16(vmlaq_n_u16(vmlaq_n_u16(
+                                                vdupq_n_u16(128), r, 66),
+                                             g, 129),
+                                             b, 25);
+                y8[half] = vmovn_u16(vaddq_u16(vshrq_n_u16(sum, 8),
+                                               vdupq_n_u16(16)));
+                int16x8_t rs = vreinterpretq_s16_u16(r);
+                int16x8_t gs = vreinterpretq_s16_u16(g);
+                int16x8_t bs = vreinterpretq_s16_u16(b);
+                u_sum[half] = vaddq_s16(u_sum[half], chroma_from_rgb_neon(
+                                                rs, gs, bs, -38, -74, 112));
+                v_sum[half] = vaddq_s16(v_sum[half], chroma_from_rgb_neon(
+                                                rs, gs, bs, 112, -94, -18));
+            }
+            vst1q_u8(y, vcombine_u8(y8[0], y8[1]));
+        }
+
+        /* Add horizontal neighbors, so each lane holds a 2x2 block sum. */
+
+        int16x8_t u4 = vcombine_s16(vpadd_s16(vget_low_s16(u_sum[0]),
+                                              vget_high_s16(u_sum[0])),
+                                    vpadd_s16(vget_low_s16(u_sum[1]),
+                                              vget_high_s16(u_sum[1])));
+        int16x8_t v4 = vcombine_s16(vpadd_s16(vget_low_s16(v_sum[0]),
+                                              vget_high_s16(v_sum[0])),
+                                    vpadd_s16(vget_low_s16(v_sum[1]),
+                                              vget_high_s16(v_sum[1])));
+        u4 = vshrq_n_s16(vaddq_s16(u4, vdupq_n_s16(2)), 2);
+        v4 = vshrq_n_s16(vaddq_s16(v4, vdupq_n_s16(2)), 2);
+        vst1_u8(&u[jj / 2], vqmovun_s16(u4));
+        vst1_u8(&v[jj / 2], vqmovun_s16(v4));
+    }
+    rgb_to_yuv420_row_pair(width, jj, rgb0, rgb1, y0, y1, u, v);
+}
+
+/* (kc * c + kx * x + ky * y + 128) >> 8 for 8 pixels, saturated to 0..255.
+   The products need 32 bits. */
+static inline uint8x8_t rgb_from_yuv_neon(int16x8_t c,
+                                          int16x8_t x,
+                                          int16x8_t y,
+                                          short kc,
+                                          short kx,
+                                          short ky) {
+    int32x4_t lo = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vdupq_n_s32(128),
+                                           vget_low_s16(c), kc),
+                                           vget_low_s16(x), kx),
+                               vget_low_s16(y), ky);
+    int32x4_t hi = vmlal_n_s16(vmlal_n_s16(vmlal_n_s16(vdupq_n_s32(128),
+                                           vget_high_s16(c), kc),
+                                           vget_high_s16(x), kx),
+                               vget_high_s16(y), ky);
+    return vqmovun_s16(vcombine_s16(vmovn_s32(vshrq_n_s32(lo, 8)),
+                                    vmovn_s32(vshrq_n_s32(hi, 8))));
+}
+
+static void yuv420_to_rgb_row_neon(unsigned int cols,
+                                   const unsigned char y_row[],
+                                   const unsigned char u_row[],
+                                   const unsigned char v_row[],
+                                   unsigned char rgb_row[]) {
+    unsigned int jj;
+    for (jj = 0; jj + 16 <= cols; jj += 16) {
+        uint8x16_t y8 = vld1q_u8(&y_row[jj]);
+        uint8x8x2_t u8 = vzip_u8(vld1_u8(&u_row[jj / 2]),
+                                 vld1_u8(&u_row[jj / 2]));
+        uint8x8x2_t v8 = vzip_u8(vld1_u8(&v_row[jj / 2]),
+                                 vld1_u8(&v_row[jj / 2]));
+        uint8x16x3_t px;
+        uint8x8_t r[2];
+        uint8x8_t g[2];
+        uint8x8_t b[2];
+        int half;
+        for (half = 0; half < 2; ++half) {
+            int16x8_t c = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                                half ? vget_high_u8(y8) : vget_low_u8(y8))),
+                                    vdupq_n_s16(16));
+            int16x8_t d = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                                u8.val[half])), vdupq_n_s16(128));
+            int16x8_t e = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(
+                                v8.val[half])), vdupq_n_s16(128));
+            r[half] = rgb_from_yuv_neon(c, d, e, 298, 0, 409);
+            g[half] = rgb_from_yuv_neon(c, d, e, 298, -100, -208);
+            b[half] = rgb_from_yuv_neon(c, d, e, 298, 516, 0);
+        }
+        px.val[0] = vcombine_u8(r[0], r[1]);
+        px.val[1] = vcombine_u8(g[0], g[1]);
+        px.val[2] = vcombine_u8(b[0], b[1]);
+        vst3q_u8(&rgb_row[3 * jj], px);
+    }
+    yuv420_to_rgb_row(cols, jj, y_row, u_row, v_row, rgb_row);
+}
+#endif
+
+typedef void (*Rgb_To_Yuv420_Row_Pair_Fn)(unsigned int width,
+                                          const unsigned char rgb0[],
+                                          const unsigned char rgb1[],
+                                          unsigned char y0[],
+                                          unsigned char y1[],
+                                          unsigned char u[],
+                                          unsigned char v[]);
+
+typedef void (*Yuv420_To_Rgb_Row_Fn)(unsigned int cols,
+                                     const unsigned char y_row[],
+                                     const unsigned char u_row[],
+                                     const unsigned char v_row[],
+                                     unsigned char rgb_row[]);
+
+/* The kernels in use.  Selected on first conversion, or by
+   yuv420_set_kernel(). */
+static Rgb_To_Yuv420_Row_Pair_Fn rgb_to_yuv420_row_pair_fn = NULL;
+static Yuv420_To_Rgb_Row_Fn yuv420_to_rgb_row_fn = NULL;
+static Yuv420_Kernel yuv420_kernel = YUV420_KERNEL_AUTO;
+static int yuv420_thread_count = 1;
+
+static bool kernel_is_supported(Yuv420_Kernel kernel) {
+    switch (kernel) {
+    case YUV420_KERNEL_SCALAR:
+        return true;
+#ifdef YUV420_HAVE_X86
+    case YUV420_KERNEL_SSSE3:
+        return __builtin_cpu_supports("ssse3");
+#endif
+#ifdef YUV420_HAVE_NEON
+    case YUV420_KERNEL_NEON:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+Yuv420_Kernel yuv420_set_kernel(Yuv420_Kernel kernel) {
+    if (kernel == YUV420_KERNEL_AUTO) {
+        if (kernel_is_supported(YUV420_KERNEL_SSSE3)) {
+            kernel = YUV420_KERNEL_SSSE3;
+        } else if (kernel_is_supported(YUV420_KERNEL_NEON)) {
+            kernel = YUV420_KERNEL_NEON;
+        } else {
+            kernel = YUV420_KERNEL_SCALAR;
+        }
+    } else if (!kernel_is_supported(kernel)) {
+        kernel = YUV420_KERNEL_SCALAR;
+    }
+    switch (kernel) {
+#ifdef YUV420_HAVE_X86
+    case YUV420_KERNEL_SSSE3:
+        rgb_to_yuv420_row_pair_fn = rgb_to_yuv420_row_pair_ssse3;
+        yuv420_to_rgb_row_fn = yuv420_to_rgb_row_ssse3;
+        break;
+#endif
+#ifdef YUV420_HAVE_NEON
+    case YUV420_KERNEL_NEON:
+        rgb_to_yuv420_row_pair_fn = rgb_to_yuv420_row_pair_neon;
+        yuv420_to_rgb_row_fn = yuv420_to_rgb_row_neon;
+        break;
+#endif
+    default:
+        rgb_to_yuv420_row_pair_fn = rgb_to_yuv420_row_pair_scalar;
+        yuv420_to_rgb_row_fn = yuv420_to_rgb_row_scalar;
+        break;
+    }
+    yuv420_kernel = kernel;
+    return kernel;
+}
+
+Yuv420_Kernel yuv420_get_kernel(void) {
+    if (rgb_to_yuv420_row_pair_fn == NULL) {
+        (void)yuv420_set_kernel(YUV420_KERNEL_AUTO);
+    }
+    return yuv420_kernel;
+}
+
+const char* yuv420_kernel_name(Yuv420_Kernel kernel) {
+    switch (kernel) {
+    case YUV420_KERNEL_AUTO:   return "auto";
+    case YUV420_KERNEL_SCALAR: return "scalar";
+    case YUV420_KERNEL_SSSE3:  return "ssse3";
+    case YUV420_KERNEL_NEON:   return "neon";
+    }
+    return "unknown";
+}
+
+int yuv420_set_thread_count(int thread_count) {
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > MAX_YUV420_THREADS) thread_count = MAX_YUV420_THREADS;
+    yuv420_thread_count = thread_count;
+    return thread_count;
+}
+
+int yuv420_get_thread_count(void) {
+    return yuv420_thread_count;
+}
+
+/* One conversion, split into bands of rows.  Every band but the last starts
+   and ends on an even row, so that no 2x2 block is split. */
+
+typedef struct Convert_Job Convert_Job;
+
+struct Convert_Job {
+    void (*convert_rows)(const Convert_Job* job,
+                         unsigned int row_begin,
+                         unsigned int row_end);
+    unsigned int cols;
+    unsigned int rows;
+    const unsigned char* src;
+    unsigned char* dst;
+};
+
+typedef struct {
+    const Convert_Job* job;
+    unsigned int row_begin;
+    unsigned int row_end;
+} Convert_Band;
+
+static void* convert_band(void* void_band_ptr) {
+    Convert_Band* band = (Convert_Band*)void_band_ptr;
+    band->job->convert_rows(band->job, band->row_begin, band->row_end);
+    return NULL;
+}
+
+static void convert_in_bands(const Convert_Job* job) {
+    Convert_Band band[MAX_YUV420_THREADS];
+    pthread_t thread[MAX_YUV420_THREADS];
+    bool started[MAX_YUV420_THREADS];
+    int band_count = yuv420_thread_count;
+    int ii;
+    if (band_count > job->rows / 2) band_count = job->rows / 2;
+    if (band_count <= 1) {
+        job->convert_rows(job, 0, job->rows);
+        return;
+    }
+    unsigned int band_rows = (job->rows / band_count) & ~1u;
+    for (ii = 0; ii < band_count; ++ii) {
+        band[ii].job = job;
+        band[ii].row_begin = ii * band_rows;
+        band[ii].row_end = (ii < band_count - 1) ?
+                                band[ii].row_begin + band_rows : job->rows;
+    }
+
+    /* Convert band 0 here.  If a thread can't be started, convert its band
+       here too. */
+
+    for (ii = 1; ii < band_count; ++ii) {
+        started[ii] = (pthread_create(&thread[ii], NULL, convert_band,
+                                      &band[ii]) == 0);
+        if (!started[ii]) (void)convert_band(&band[ii]);
+    }
+    (void)convert_band(&band[0]);
+    for (ii = 1; ii < band_count; ++ii) {
+        if (started[ii]) pthread_join(thread[ii], NULL);
+    }
+}
+
+static void convert_rgb_to_yuv420_rows(const Convert_Job* job,
+                                       unsigned int row_begin,
+                                       unsigned int row_end) {
+    const unsigned int width = job->cols;
+    const unsigned int pixels = job->cols * job->rows;
+    const unsigned char* rgb = job->src;
+    unsigned char* y = job->dst;
+    unsigned char* u = &y[pixels];
+    unsigned char* v = &y[pixels + pixels / 4];
+    unsigned int ii;
+    for (ii = row_begin; ii + 1 < row_end; ii += 2) {
+        unsigned int uv_offset = (ii / 2) * (width / 2);
+        rgb_to_yuv420_row_pair_fn(width,
+                                  &rgb[3 * ii * width],
+                                  &rgb[3 * (ii + 1) * width],
+                                  &y[ii * width], &y[(ii + 1) * width],
+                                  &u[uv_offset], &v[uv_offset]);
+    }
+    if (ii < row_end) {
+        // An odd last row gets Y only.
+
+        unsigned int jj;
+        for (jj = 0; jj < width; ++jj) {
+            const unsigned char* p = &rgb[3 * (ii * width + jj)];
+            y[ii * width + jj] = y_from_rgb(p[0], p[1], p[2]);
+        }
+    }
+}
+
 int convert_rgb_to_yuv420(unsigned int width,
                           unsigned int height,
                           const unsigned char rgb[],
                           size_t yuv_bytes,
                           unsigned char yuv[]) {
-    unsigned int ii;
-    unsigned int jj;
-    unsigned char* y = yuv;
     unsigned int pixels = width * height;
     unsigned int required_yuv_bytes = pixels + pixels / 2;
     if (yuv_bytes < required_yuv_bytes) return -1;
-    unsigned char* u = &yuv[pixels];
-    unsigned char* v = &yuv[pixels + pixels / 4];
-    for (ii = 0; ii < height; ++ii) {
-        for (jj = 0; jj < width; ++jj) {
-            unsigned int yno_00 = ii * width + jj;
-            unsigned int yno_01 = yno_00 + 1;
-            unsigned int yno_10 = yno_00 + width;
-            unsigned int yno_11 = yno_10 + 1;
-            unsigned short r00 = rgb[yno_00 * 3 + 0];
-            unsigned short g00 = rgb[yno_00 * 3 + 1];
-            unsigned short b00 = rgb[yno_00 * 3 + 2];
-            unsigned short r01 = rgb[yno_01 * 3 + 0];
-            unsigned short g01 = rgb[yno_01 * 3 + 1];
-            unsigned short b01 = rgb[yno_01 * 3 + 2];
-            unsigned short r10 = rgb[yno_10 * 3 + 0];
-            unsigned short g10 = rgb[yno_10 * 3 + 1];
-            unsigned short b10 = rgb[yno_10 * 3 + 2];
-            unsigned short r11 = rgb[yno_11 * 3 + 0];
-            unsigned short g11 = rgb[yno_11 * 3 + 1];
-            unsigned short b11 = rgb[yno_11 * 3 + 2];
-
-            y[yno_00] = y_from_rgb(r00, g00, b00);
-            y[yno_01] = y_from_rgb(r01, g01, b01);
-            y[yno_10] = y_from_rgb(r10, g10, b10);
-            y[yno_11] = y_from_rgb(r11, g11, b11);
-
-            if (ii % 2 == 0 && jj % 2 == 0) {
-                unsigned int uvno = (ii / 2) * (width / 2) + (jj / 2);
-                unsigned short u_val = u_from_rgb(r00, g00, b00);
-                u_val += u_from_rgb(r01, g01, b01);
-                u_val += u_from_rgb(r10, g10, b10);
-                u_val += u_from_rgb(r11, g11, b11);
-                u[uvno] = (unsigned char)((u_val + 2) / 4);
-
-                unsigned short v_val = v_from_rgb(r00, g00, b00);
-                v_val += v_from_rgb(r01, g01, b01);
-                v_val += v_from_rgb(r10, g10, b10);
-                v_val += v_from_rgb(r11, g11, b11);
-                v[uvno] = (unsigned char)((v_val + 2) / 4);
-            }
-        }
+    if (rgb_to_yuv420_row_pair_fn == NULL) {
+        (void)yuv420_set_kernel(YUV420_KERNEL_AUTO);
     }
+    Convert_Job job = { convert_rgb_to_yuv420_rows, width, height, rgb, yuv };
+    convert_in_bands(&job);
     return required_yuv_bytes;
 }
 
+static void convert_yuv420_to_rgb_rows(const Convert_Job* job,
+                                       unsigned int row_begin,
+                                       unsigned int row_end) {
+    const unsigned int cols = job->cols;
+    const unsigned int pixels = job->cols * job->rows;
+    const unsigned int last_uv_row = job->rows / 2 - 1;
+    const unsigned char* yuv = job->src;
+    unsigned int ii;
+    for (ii = row_begin; ii < row_end; ++ii) {
+        // An odd last row shares the chroma row before it.
 
-static unsigned char limit255(int val) {
-    if (val < 0) return 0;
-    if (val > 255) return 255;
-    return val;
+        unsigned int uv_row = (ii / 2 > last_uv_row) ? last_uv_row : ii / 2;
+        const unsigned char* u_row = &yuv[pixels + uv_row * (cols / 2)];
+        yuv420_to_rgb_row_fn(cols, &yuv[ii * cols], u_row, u_row + pixels / 4,
+                             &job->dst[ii * (3 * cols)]);
+    }
 }
 
-
 void convert_yuv420_to_rgb(unsigned int cols,
                            unsigned int rows,
                            const unsigned char yuv[],
                            unsigned char rgb[]) {
-    unsigned int ii;
-    unsigned int jj;
-    unsigned int pixels = cols * rows;
-    for (ii = 0; ii < rows; ++ii) {
-        unsigned char* row = &rgb[ii * (3 * cols)];
-        for (jj = 0; jj < cols; ++jj) {
-            /* formulas are from https://en.wikipedia.org/wiki/YUV */
-            int y = yuv[ii * cols + jj];
-            int uv_offset = (ii / 2) * (cols / 2) + (jj / 2);
-            int u = yuv[pixels + uv_offset];
-            int v = yuv[pixels + uv_offset + (pixels / 4)];
-            int c = y - 16;
-            int d = u - 128;
-            int e = v - 128;
-            unsigned char r = limit255((298*c + 409*e + 128) >> 8);
-            unsigned char g = limit255((298*c - 100*d - 208*e + 128) >> 8);
-            unsigned char b = limit255((298*c + 516*d + 128) >> 8);
-            row[3 * jj + 0] = r;
-            row[3 * jj + 1] = g;
-            row[3 * jj + 2] = b;
-        }
+    if (yuv420_to_rgb_row_fn == NULL) {
+        (void)yuv420_set_kernel(YUV420_KERNEL_AUTO);
     }
+    Convert_Job job = { convert_yuv420_to_rgb_rows, cols, rows, yuv, rgb };
+    convert_in_bands(&job);
 }
 
 void yuv420_get_pixel(unsigned int cols,
@@ -60,6 +60,8 @@
  */
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 typedef struct {
     FILE* fp;
@@ -163,16 +165,128 @@ int yuv420_write(const char* filename,
                  unsigned int height,
                  unsigned char* img);
 
+/*******************************************************************************
+ * Memory-mapped clips.
+ *
+ * A clip is a .yuv file holding any number of images, read through mmap(2)
+ * rather than copied one image at a time.  Any image can be had at once by
+ * its number, as a pointer into the mapping.
+ *
+ * A clip may have a sidecar index file, named by appending ".idx" to the
+ * name of the .yuv file.  It is text: the line "#!YUV420IDX", then one line
+ * per image, giving the microsecond timestamp of the image as a decimal
+ * integer.
+ ******************************************************************************/
+
+typedef struct {
+    int fd;
+    unsigned int cols;
+    unsigned int rows;
+    unsigned int frame_count;  /// number of whole images in the file
+    size_t frame_bytes;        /// bytes in each image
+    uint64_t file_bytes;
+    size_t max_map_bytes;      /// 0 if the whole file is mapped
+    unsigned char* map;        /// the current mapping, or NULL
+    uint64_t map_offset;       /// the file offset of map[0]
+    size_t map_bytes;
+    int64_t* usecs;            /// one per image, or NULL if there's no index
+    unsigned int usecs_count;
+} Yuv_Clip;
+
+/**
+ * Open a YUV420 file (.yuv) as a clip, and read its index, if any.
+ *
+ * The whole file is mapped if it fits in max_map_bytes, or if max_map_bytes
+ * is 0 and the mapping succeeds.  Otherwise (for instance, a clip of many
+ * gigabytes on a 32-bit system), a window of images is mapped at a time.
+ *
+ * @param filename [in]      Path to the .yuv file to read from.
+ * @param max_map_bytes [in] The largest mapping to make, or 0 for no limit.
+ *                           Must be 0 or at least 1 image plus a page.
+ * @param clip [out]         Returns the opened clip.
+ * @return Zero on success, -1 on failure, with errno set.
+ */
+int yuv420_clip_open(const char* filename,
+                     size_t max_map_bytes,
+                     Yuv_Clip* clip);
+
+/**
+ * Unmap and close a clip opened by yuv420_clip_open().
+ */
+void yuv420_clip_close(Yuv_Clip* clip);
+
+/**
+ * Return image number frame_no of the clip, without copying it.
+ *
+ * If the whole file is mapped, the returned pointer is good until the clip is
+ * closed.  Otherwise, it is good until the next call to yuv420_clip_frame(),
+ * and asking for images in order costs one mmap(2) per window.
+ *
+ * @param clip [in]     A clip returned by yuv420_clip_open().
+ * @param frame_no [in] The image number, from 0 to frame_count - 1.
+ * @return The image, or NULL if frame_no is out of range or can't be mapped.
+ */
+const unsigned char* yuv420_clip_frame(Yuv_Clip* clip,
+                                       unsigned int frame_no);
+
+/**
+ * Ask the kernel to start reading images into memory before they are needed.
+ *
+ * Yuv420_clip_open() already advises the kernel that the clip will be read
+ * in order.  Call this after seeking, so that the images after the seek are
+ * read ahead too.
+ *
+ * @param clip [in]     A clip returned by yuv420_clip_open().
+ * @param frame_no [in] The first image to read.
+ * @param count [in]    The number of images to read, starting at frame_no.
+ */
+void yuv420_clip_prefetch(Yuv_Clip* clip,
+                          unsigned int frame_no,
+                          unsigned int count);
+
+/**
+ * Return the timestamp of image frame_no from the clip's index, in
+ * microseconds, or -1 if it isn't known.
+ */
+static inline int64_t yuv420_clip_get_usecs(const Yuv_Clip* clip,
+                                            unsigned int frame_no) {
+    return frame_no < clip->usecs_count ? clip->usecs[frame_no] : -1;
+}
+
 /**
- * Convert an RGB image to  YUV420 RGB format.
+ * Open the index file of a .yuv file for writing, and write its header line.
+ *
+ * @param yuv_filename [in] Path to the .yuv file; ".idx" is appended to it.
+ * @return The open index file, or NULL on failure.
+ */
+FILE* yuv420_index_open_write(const char* yuv_filename);
+
+/**
+ * Append the timestamp of the next image to an index file opened by
+ * yuv420_index_open_write().
+ */
+static inline int yuv420_index_append(FILE* index_fp, int64_t usecs) {
+    return fprintf(index_fp, "%lld\n", (long long)usecs) < 0 ? -1 : 0;
+}
+
+/**
+ * Convert an RGB image to YUV420 format.
+ *
+ * Each 2x2 block of pixels gives four Y values and one U and one V value,
+ * the rounded mean of the block's per-pixel U and V.  If width is odd, the
+ * last column gets Y only; likewise the last row if height is odd.
  *
  * @param width [in]             The number of columns in the RGB image.
+ *                               At least 2.
  * @param height [in]            The number of rows in the RGB image.
- * @param rgb [out]              The RGB image.  This should point to
- *                               width * height bytes.
+ *                               At least 2.
+ * @param rgb [in]               The RGB image.  This should point to
+ *                               width * height * 3 bytes.
  * @param yuv_bytes [in]         The number of bytes in the yuv array.  This
  *                               must be at least width * height * 3 / 2.
- * @param yuv [in]               Memory to store the returned YUV420 image.
+ * @param yuv [out]              Memory to store the returned YUV420 image.
+ * @return The number of bytes written to yuv, or -1 if yuv_bytes is too
+ *         small.
  */
 int convert_rgb_to_yuv420(unsigned int width,
                           unsigned int height,
@@ -183,18 +297,84 @@ int convert_rgb_to_yuv420(unsigned int width,
 /**
  * Convert a YUV420 image to RGB format.
  *
+ * If width is odd, the last column uses the chroma of the column before it;
+ * likewise the last row if height is odd.
+ *
  * @param width [in]             The number of columns in the YUV420 image.
+ *                               At least 2.
  * @param height [in]            The number of rows in the YUV420 image.
+ *                               At least 2.
  * @param yuv [in]               The YUV420 image.  This should point to
  *                               width * height * 3 / 2 bytes of memory.
  * @param rgb [out]              Memory to store the returned RGB image.
- *                               This should point to width * height bytes.
+ *                               This should point to width * height * 3
+ *                               bytes.
  */
 void convert_yuv420_to_rgb(unsigned int width,
                            unsigned int height,
                            const unsigned char yuv[],
                            unsigned char rgb[]);
 
+/**
+ * The implementations of convert_rgb_to_yuv420() and
+ * convert_yuv420_to_rgb().
+ *
+ * All kernels produce bit-identical results.  The vectorized kernels convert
+ * 16 pixels at a time.
+ */
+typedef enum {
+    YUV420_KERNEL_AUTO = 0, /// the fastest kernel supported by this CPU
+    YUV420_KERNEL_SCALAR,   /// portable C, one 2x2 block at a time
+    YUV420_KERNEL_SSSE3,    /// x86 SSSE3
+    YUV420_KERNEL_NEON      /// ARM NEON
+} Yuv420_Kernel;
+
+/**
+ * Select the kernel used by convert_rgb_to_yuv420() and
+ * convert_yuv420_to_rgb().
+ *
+ * By default, the fastest kernel supported by the CPU is chosen at run time
+ * on the first conversion.  This is mostly useful for testing and
+ * benchmarking.
+ *
+ * @param kernel [in] The kernel to use.  If the CPU does not support it,
+ *                    YUV420_KERNEL_SCALAR is used instead.
+ * @return The kernel actually selected.  Never YUV420_KERNEL_AUTO.
+ */
+Yuv420_Kernel yuv420_set_kernel(Yuv420_Kernel kernel);
+
+/**
+ * Return the kernel used by convert_rgb_to_yuv420() and
+ * convert_yuv420_to_rgb().
+ */
+Yuv420_Kernel yuv420_get_kernel(void);
+
+/**
+ * Return a printable name for the given kernel.
+ */
+const char* yuv420_kernel_name(Yuv420_Kernel kernel);
+
+#define MAX_YUV420_THREADS 16
+
+/**
+ * Set the number of threads used by each convert_rgb_to_yuv420() and
+ * convert_yuv420_to_rgb() call.
+ *
+ * Each call splits the image into this many bands of rows, and converts all
+ * but one of them on threads of their own, started for the call.  The
+ * default is 1, which converts on the calling thread only.  This is meant
+ * for converting large numbers of frames offline.
+ *
+ * @param thread_count [in] The thread count, from 1 to MAX_YUV420_THREADS.
+ * @return The thread count actually set.
+ */
+int yuv420_set_thread_count(int thread_count);
+
+/**
+ * Return the number of threads used by each conversion.
+ */
+int yuv420_get_thread_count(void);
+
 /**
  * Return the pixel value at (x ,y) coord within the given YUV420 image.
  *
@@ -48,6 +48,7 @@
  *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 #include <assert.h>
+#include "yuv_color_space_image.h"
 
 /**
  * @brief Convert a floaing point number to unsigned char.
@@ -130,3 +131,27 @@ void yuv_color_space_image(const unsigned int cols,
         ++ii2;
     }
 }
+
+void yuv_color_space_image_show_classes(const unsigned int cols,
+                                        const unsigned int rows,
+                                        const Color_Class_Table* t,
+                                        unsigned char* yuv) {
+    unsigned int ii2;
+    unsigned int jj2;
+    for (ii2 = 0; ii2 < rows / 2; ++ii2) {
+        int u_offset = cols * rows + ii2 * (cols / 2);
+        int v_offset = u_offset + cols * rows / 4;
+        const unsigned char* u_row = &yuv[u_offset];
+        const unsigned char* v_row = &yuv[v_offset];
+        unsigned char* y_row0 = &yuv[2 * ii2 * cols];
+        unsigned char* y_row1 = y_row0 + cols;
+        for (jj2 = 0; jj2 < cols / 2; ++jj2) {
+            if (t->uv_class_mask[(u_row[jj2] << 8) | v_row[jj2]] == 0) {
+                y_row0[2 * jj2] /= 4;
+                y_row0[2 * jj2 + 1] /= 4;
+                y_row1[2 * jj2] /= 4;
+                y_row1[2 * jj2 + 1] /= 4;
+            }
+        }
+    }
+}
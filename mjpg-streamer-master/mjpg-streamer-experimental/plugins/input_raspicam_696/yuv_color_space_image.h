@@ -47,6 +47,7 @@
  *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
  *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include "detect_color_blobs.h"
 
 /**
  * @brief Fill the yuv buffer with a color space image.
@@ -67,3 +68,20 @@ void yuv_color_space_image(const unsigned int cols,
                            const unsigned int rows,
                            const unsigned char y,
                            unsigned char* yuv);
+
+/**
+ * @brief Darken the parts of an image whose color is in no color class.
+ *
+ * Applied to a color space image, this shows which U-V values each class of
+ * the table accepts, which helps in tuning polygon and ellipse regions.
+ * Only Y values are changed, so U and V values can still be measured.
+ *
+ * @param cols [in]     The number of columns in the image.
+ * @param rows [in]     The number of rows in the image.
+ * @param t [in]        The color classes to show.
+ * @param yuv [in,out]  The YUV420 image to change.
+ */
+void yuv_color_space_image_show_classes(const unsigned int cols,
+                                        const unsigned int rows,
+                                        const Color_Class_Table* t,
+                                        unsigned char* yuv);
@@ -243,6 +243,9 @@ void *worker_thread(void *arg)
         pglobal->in[plugin_number].size = pics->sequence[i].size;
         memcpy(pglobal->in[plugin_number].buf, pics->sequence[i].data, pglobal->in[plugin_number].size);
 
+        /* share it with the output plugins through the frame ring */
+        input_frame_publish_buf(&pglobal->in[plugin_number]);
+
         /* signal fresh_frame */
         pthread_cond_broadcast(&pglobal->in[plugin_number].db_update);
         pthread_mutex_unlock(&pglobal->in[plugin_number].db);
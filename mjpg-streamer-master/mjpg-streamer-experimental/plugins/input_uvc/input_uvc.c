@@ -115,6 +115,7 @@ static context_settings * init_settings() {
     }
     
     settings->quality = 80;
+    settings->encoders = 1;
     return settings;
 }
 
@@ -205,6 +206,8 @@ int input_init(input_parameter *param, int id)
             {"gain", required_argument, 0, 0},
             {"cagc", required_argument, 0, 0},
             {"cb", required_argument, 0, 0},
+            {"encoders", required_argument, 0, 0},
+            {"chroma", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -361,6 +364,20 @@ int input_init(input_parameter *param, int id)
             break;
         OPTION_INT_AUTO(38, cb)
             break;
+
+        /* encoders */
+        case 39:
+            DBG("case 39\n");
+            settings->encoders = MIN(MAX(atoi(optarg), 1), 16);
+            break;
+
+        /* chroma */
+        case 40:
+            DBG("case 40\n");
+            #ifndef NO_LIBJPEG
+            settings->chroma = (atoi(optarg) == 422) ? JPEG_CHROMA_422 : JPEG_CHROMA_420;
+            #endif
+            break;
     
         default:
             DBG("default case\n");
@@ -405,8 +422,11 @@ int input_init(input_parameter *param, int id)
 
     IPRINT("Format............: %s\n", fmtString);
     #ifndef NO_LIBJPEG
-        if(format != V4L2_PIX_FMT_MJPEG)
+        if(format != V4L2_PIX_FMT_MJPEG) {
             IPRINT("JPEG Quality......: %d\n", settings->quality);
+            IPRINT("JPEG Encoders.....: %d\n", settings->encoders);
+            IPRINT("JPEG Chroma.......: %s\n", settings->chroma == JPEG_CHROMA_422 ? "4:2:2" : "4:2:0");
+        }
     #endif
 
     if (tvnorm != V4L2_STD_UNKNOWN) {
@@ -461,7 +481,8 @@ int input_run(int id)
     context *pctx = (context*)in->context;
     
     in->buf = malloc(pctx->videoIn->framesizeIn);
-    if(in->buf == NULL) {
+    pctx->back_buf = malloc(pctx->videoIn->framesizeIn);
+    if(in->buf == NULL || pctx->back_buf == NULL) {
         fprintf(stderr, "could not allocate memory\n");
         exit(EXIT_FAILURE);
     }
@@ -510,6 +531,10 @@ void help(void)
     " [-y | --yuv  ] ........: Use YUV format, default: MJPEG (uses more cpu power)\n" \
     " [-fourcc ] ............: Use FOURCC codec 'argopt', \n" \
     "                          currently supported codecs are: RGBP \n" \
+    " [-encoders ] ..........: number of threads compressing YUV and RGBP frames,\n" \
+    "                          each adds a frame of latency, default: 1\n" \
+    " [-chroma ] ............: chroma subsampling of YUV and RGBP frames,\n" \
+    "                          420 or 422, default: 420\n" \
     " ---------------------------------------------------------------\n");
 
     fprintf(stderr, "\n"                                                \
@@ -545,6 +570,14 @@ void *cam_thread(void *arg)
     
     unsigned int every_count = 0;
     int quality = settings->quality;
+    #ifndef NO_LIBJPEG
+    int encoders = settings->encoders;
+    int chroma = settings->chroma;
+    #endif
+    int size;
+    struct timeval timestamp;
+    unsigned char *tmp;
+    input_frame *frame;
     
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(cam_cleanup, in);
@@ -670,10 +703,10 @@ void *cam_thread(void *arg)
             DBG("Lagg: %ld\n", (current - last) - pcontext->videoIn->frame_period_time);
         }
 
-        /* copy JPG picture to global buffer */
-        pthread_mutex_lock(&pglobal->in[pcontext->id].db);
-
         /*
+         * Prepare the JPG picture in the back buffer, without holding db, so
+         * that the output plugins are not held up meanwhile.
+         *
          * If capturing in YUV mode convert to JPEG now.
          * This compression requires many CPU cycles, so try to avoid YUV format.
          * Getting JPEGs straight from the webcam, is one of the major advantages of
@@ -684,19 +717,49 @@ void *cam_thread(void *arg)
 	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_UYVY) ||
 	    (pcontext->videoIn->formatIn == V4L2_PIX_FMT_RGB565) ) {
             DBG("compressing frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = compress_image_to_jpeg(pcontext->videoIn, pglobal->in[pcontext->id].buf, pcontext->videoIn->framesizeIn, quality);
-            /* copy this frame's timestamp to user space */
-            pglobal->in[pcontext->id].timestamp = pcontext->videoIn->buf.timestamp;
+            /* (re)create the encoders for the current resolution */
+            if(pcontext->encoder_pool != NULL &&
+               !jpeg_encoder_pool_matches(pcontext->encoder_pool, pcontext->videoIn->width, pcontext->videoIn->height, pcontext->videoIn->formatIn)) {
+                jpeg_encoder_pool_destroy(pcontext->encoder_pool);
+                pcontext->encoder_pool = NULL;
+            }
+            if(pcontext->encoder_pool == NULL) {
+                pcontext->encoder_pool = jpeg_encoder_pool_create(pcontext->videoIn->width, pcontext->videoIn->height, pcontext->videoIn->formatIn, chroma, quality, encoders);
+                if(pcontext->encoder_pool == NULL) {
+                    IPRINT("could not start the JPEG encoders\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            /* with several encoders, this is an older frame, or none yet */
+            size = jpeg_encoder_pool_encode(pcontext->encoder_pool, pcontext->videoIn->framebuffer, pcontext->videoIn->buf.timestamp,
+                                            pcontext->back_buf, pcontext->videoIn->framesizeIn, &timestamp);
+            if(size == 0)
+                continue;
         } else {
         #endif
             DBG("copying frame from input: %d\n", (int)pcontext->id);
-            pglobal->in[pcontext->id].size = memcpy_picture(pglobal->in[pcontext->id].buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
+            size = memcpy_picture(pcontext->back_buf, pcontext->videoIn->tmpbuffer, pcontext->videoIn->tmpbytesused);
             /* copy this frame's timestamp to user space */
-            pglobal->in[pcontext->id].timestamp = pcontext->videoIn->tmptimestamp;
+            timestamp = pcontext->videoIn->tmptimestamp;
         #ifndef NO_LIBJPEG
         }
         #endif
 
+        /* share it with the output plugins through the frame ring */
+        frame = input_frame_claim_copy(in, pcontext->back_buf, size, timestamp);
+
+        /* publish the picture, by swapping the back buffer with the global buffer */
+        input_db_lock(in);
+
+        tmp = in->buf;
+        in->buf = pcontext->back_buf;
+        pcontext->back_buf = tmp;
+        in->size = size;
+        in->timestamp = timestamp;
+
+        if(frame != NULL)
+            input_frame_publish_locked(in, frame);
+
 #if 0
         /* motion detection can be done just by comparing the picture size, but it is not very accurate!! */
         if((prev_size - global->size)*(prev_size - global->size) > 4 * 1024 * 1024) {
@@ -705,7 +768,6 @@ void *cam_thread(void *arg)
         prev_size = global->size;
 #endif
 
-
         /* signal fresh_frame */
         pthread_cond_broadcast(&pglobal->in[pcontext->id].db_update);
         pthread_mutex_unlock(&pglobal->in[pcontext->id].db);
@@ -728,6 +790,7 @@ void cam_cleanup(void *arg)
     context *pctx = (context*)in->context;
     
     IPRINT("cleaning up resources allocated by input thread\n");
+    input_db_print_wait(in);
 
     if (pctx->videoIn != NULL) {
         close_v4l2(pctx->videoIn);
@@ -739,6 +802,12 @@ void cam_cleanup(void *arg)
     free(in->buf);
     in->buf = NULL;
     in->size = 0;
+    free(pctx->back_buf);
+    pctx->back_buf = NULL;
+#ifndef NO_LIBJPEG
+    jpeg_encoder_pool_destroy(pctx->encoder_pool);
+    pctx->encoder_pool = NULL;
+#endif
 }
 
 /******************************************************************************
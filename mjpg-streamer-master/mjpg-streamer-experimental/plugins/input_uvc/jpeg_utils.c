@@ -26,11 +26,24 @@
 #include <stdio.h>
 #include <jpeglib.h>
 #include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
 
 #include "v4l2uvc.h"
+#include "jpeg_utils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define JPEG_UTILS_HAVE_SSE2
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define JPEG_UTILS_HAVE_NEON
+#endif
 
 #define OUTPUT_BUF_SIZE  4096
 
@@ -126,141 +139,720 @@ GLOBAL(void) dest_buffer(j_compress_ptr cinfo, unsigned char *buffer, int size,
     dest->written = written;
 }
 
+/* a compressor for one size and format of picture, kept from frame to frame */
+typedef struct {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    int written;
+
+    int width, height, format, chroma;
+
+    /* DCTSIZE lines of Cb and Cr and the lines of Y that go with them, fed to
+       libjpeg as they are, padded to whole blocks */
+    unsigned char *planes;
+    JSAMPROW y_rows[2 * DCTSIZE], cb_rows[DCTSIZE], cr_rows[DCTSIZE];
+    int y_width, c_width;
+    int y_lines;
+} jpeg_encoder;
+
+/******************************************************************************
+Description.: prepares a compressor for pictures of the given size and format
+              The pictures are split into Y, Cb and Cr, subsampled as given,
+              and handed to libjpeg as they are; YUYV and UYVY are not
+              converted at all.
+Input Value.: enc is the compressor to set up, width, height and format as
+              in struct vdIn, chroma is JPEG_CHROMA_420 or JPEG_CHROMA_422,
+              quality of the JPEG encoding
+Return Value: 0 if ok, -1 if out of memory
+******************************************************************************/
+static int jpeg_encoder_init(jpeg_encoder *enc, int width, int height, int format, int chroma, int quality)
+{
+    int i;
+
+    memset(enc, 0, sizeof(*enc));
+    enc->width = width;
+    enc->height = height;
+    enc->format = format;
+    enc->chroma = chroma;
+
+    enc->cinfo.err = jpeg_std_error(&enc->jerr);
+    jpeg_create_compress(&enc->cinfo);
+
+    enc->cinfo.image_width = width;
+    enc->cinfo.image_height = height;
+    enc->cinfo.input_components = 3;
+    enc->cinfo.in_color_space = JCS_YCbCr;
+
+    jpeg_set_defaults(&enc->cinfo);
+    jpeg_set_quality(&enc->cinfo, quality, TRUE);
+
+    /* Cb and Cr are subsampled 2:1 horizontally, and for 4:2:0 vertically */
+    enc->cinfo.raw_data_in = TRUE;
+    enc->cinfo.comp_info[0].h_samp_factor = 2;
+    enc->cinfo.comp_info[0].v_samp_factor = (chroma == JPEG_CHROMA_422) ? 1 : 2;
+    enc->cinfo.comp_info[1].h_samp_factor = 1;
+    enc->cinfo.comp_info[1].v_samp_factor = 1;
+    enc->cinfo.comp_info[2].h_samp_factor = 1;
+    enc->cinfo.comp_info[2].v_samp_factor = 1;
+    enc->y_lines = enc->cinfo.comp_info[0].v_samp_factor * DCTSIZE;
+
+    /* libjpeg reads whole blocks, so round the lines up to them */
+    enc->y_width = (width + 2 * DCTSIZE - 1) & ~(2 * DCTSIZE - 1);
+    enc->c_width = enc->y_width / 2;
+
+    if((enc->planes = malloc(2 * DCTSIZE * enc->y_width + 2 * DCTSIZE * enc->c_width)) == NULL) {
+        jpeg_destroy_compress(&enc->cinfo);
+        return -1;
+    }
+    for(i = 0; i < 2 * DCTSIZE; i++)
+        enc->y_rows[i] = enc->planes + i * enc->y_width;
+    for(i = 0; i < DCTSIZE; i++) {
+        enc->cb_rows[i] = enc->planes + 2 * DCTSIZE * enc->y_width + i * enc->c_width;
+        enc->cr_rows[i] = enc->planes + 2 * DCTSIZE * enc->y_width + (DCTSIZE + i) * enc->c_width;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: frees what jpeg_encoder_init() allocated
+Input Value.: enc is the compressor
+Return Value: -
+******************************************************************************/
+static void jpeg_encoder_free(jpeg_encoder *enc)
+{
+    jpeg_destroy_compress(&enc->cinfo);
+    free(enc->planes);
+    enc->planes = NULL;
+}
+
+#if defined(JPEG_UTILS_HAVE_SSE2)
+/******************************************************************************
+Description.: splits 16 pixels of YUYV or UYVY, storing their Y
+Input Value.: src the pixels, y the offset of the first Y in a pair, py
+              where to store Y
+Return Value: their U and V, still interleaved
+******************************************************************************/
+static inline __m128i split16_sse2(const unsigned char *src, int y, unsigned char *py)
+{
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+
+    /* the even bytes are Y in YUYV, U and V in UYVY */
+    if(y == 0) {
+        _mm_storeu_si128((__m128i *)py, _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low)));
+        return _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    }
+    _mm_storeu_si128((__m128i *)py, _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    return _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+}
+#endif
+
+/******************************************************************************
+Description.: splits 32 pixels at a time of one or two lines of YUYV or UYVY
+              into Y, Cb and Cr, with SSE2 or NEON where available
+              For two lines, U and V are averaged as the scalar code does.
+Input Value.: src0 and src1 the lines, pairs the number of pixel pairs, y
+              the offset of the first Y in a pair, py0 and py1 the lines of Y
+              to fill, py1 == py0 for one line, pu and pv the lines of Cb
+              and Cr
+Return Value: the number of pixel pairs done, the rest is left to the caller
+******************************************************************************/
+static int deinterleave_simd(const unsigned char *src0, const unsigned char *src1, int pairs, int y,
+                             unsigned char *py0, unsigned char *py1, unsigned char *pu, unsigned char *pv)
+{
+    int x = 0;
+#if defined(JPEG_UTILS_HAVE_SSE2)
+    const __m128i low = _mm_set1_epi16(0x00ff);
+
+    for(; x + 16 <= pairs; x += 16) {
+        /* U0 V0 U1 V1 ... */
+        __m128i c0 = split16_sse2(src0 + 4 * x, y, py0 + 2 * x);
+        __m128i c1 = split16_sse2(src0 + 4 * x + 32, y, py0 + 2 * x + 16);
+
+        if(src1 != src0) {
+            /* (a + b + 1) >> 1 */
+            c0 = _mm_avg_epu8(c0, split16_sse2(src1 + 4 * x, y, py1 + 2 * x));
+            c1 = _mm_avg_epu8(c1, split16_sse2(src1 + 4 * x + 32, y, py1 + 2 * x + 16));
+        } else if(py1 != py0) {
+            memcpy(py1 + 2 * x, py0 + 2 * x, 32);
+        }
+        _mm_storeu_si128((__m128i *)(pu + x), _mm_packus_epi16(_mm_and_si128(c0, low), _mm_and_si128(c1, low)));
+        _mm_storeu_si128((__m128i *)(pv + x), _mm_packus_epi16(_mm_srli_epi16(c0, 8), _mm_srli_epi16(c1, 8)));
+    }
+#elif defined(JPEG_UTILS_HAVE_NEON)
+    for(; x + 16 <= pairs; x += 16) {
+        /* YUYV: Y0 U Y1 V, UYVY: U Y0 V Y1 */
+        uint8x16x4_t a = vld4q_u8(src0 + 4 * x);
+        uint8x16x2_t ys;
+        uint8x16_t u = a.val[1 - y], v = a.val[3 - y];
+
+        ys.val[0] = a.val[y];
+        ys.val[1] = a.val[y + 2];
+        vst2q_u8(py0 + 2 * x, ys);
+        if(src1 != src0) {
+            uint8x16x4_t b = vld4q_u8(src1 + 4 * x);
+            ys.val[0] = b.val[y];
+            ys.val[1] = b.val[y + 2];
+            vst2q_u8(py1 + 2 * x, ys);
+            /* (a + b + 1) >> 1 */
+            u = vrhaddq_u8(u, b.val[1 - y]);
+            v = vrhaddq_u8(v, b.val[3 - y]);
+        } else if(py1 != py0) {
+            memcpy(py1 + 2 * x, py0 + 2 * x, 32);
+        }
+        vst1q_u8(pu + x, u);
+        vst1q_u8(pv + x, v);
+    }
+#endif
+    return x;
+}
+
+/******************************************************************************
+Description.: splits pixel pairs x to pairs of one or two lines of YUYV or
+              UYVY into Y, Cb and Cr one pair at a time, the reference for
+              deinterleave_simd()
+Input Value.: as for deinterleave_simd(), x the first pixel pair to split
+Return Value: -
+******************************************************************************/
+static void deinterleave_scalar(const unsigned char *src0, const unsigned char *src1, int x, int pairs, int y,
+                                unsigned char *py0, unsigned char *py1, unsigned char *pu, unsigned char *pv)
+{
+    int u = 1 - y;
+
+    for(; x < pairs; x++) {
+        py0[2 * x] = src0[4 * x + y];
+        py0[2 * x + 1] = src0[4 * x + y + 2];
+        py1[2 * x] = src1[4 * x + y];
+        py1[2 * x + 1] = src1[4 * x + y + 2];
+        pu[x] = (src0[4 * x + u] + src1[4 * x + u] + 1) >> 1;
+        pv[x] = (src0[4 * x + u + 2] + src1[4 * x + u + 2] + 1) >> 1;
+    }
+}
+
+/******************************************************************************
+Description.: splits one line (4:2:2) or two lines (4:2:0) of YUYV or UYVY
+              into Y, Cb and Cr, averaging the two lines' U and V, and
+              repeats the last samples up to the padded width
+Input Value.: enc is the compressor, src0 and src1 the lines, src1 == src0
+              for 4:2:2, row the row of Cb and Cr to fill
+Return Value: -
+******************************************************************************/
+static void deinterleave_lines(jpeg_encoder *enc, const unsigned char *src0, const unsigned char *src1, int row)
+{
+    /* Y0 U Y1 V or U Y0 V Y1 */
+    int y = (enc->format == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    int two_lines = (enc->chroma != JPEG_CHROMA_422);
+    unsigned char *py0 = enc->y_rows[two_lines ? 2 * row : row];
+    unsigned char *py1 = enc->y_rows[two_lines ? 2 * row + 1 : row];
+    unsigned char *pu = enc->cb_rows[row];
+    unsigned char *pv = enc->cr_rows[row];
+    int x, pairs = enc->width / 2;
+
+    if(!two_lines)
+        src1 = src0;
+
+    x = deinterleave_simd(src0, src1, pairs, y, py0, py1, pu, pv);
+    deinterleave_scalar(src0, src1, x, pairs, y, py0, py1, pu, pv);
+    for(x = 2 * pairs; x < enc->y_width; x++) {
+        py0[x] = py0[2 * pairs - 1];
+        py1[x] = py1[2 * pairs - 1];
+    }
+    for(x = pairs; x < enc->c_width; x++) {
+        pu[x] = pu[pairs - 1];
+        pv[x] = pv[pairs - 1];
+    }
+}
+
+#if defined(JPEG_UTILS_HAVE_SSE2)
+/******************************************************************************
+Description.: unpacks 8 pixels of RGB565 as the scalar code does and
+              stores their Y
+Input Value.: src the pixels, r, g and b to hold the components, py where to
+              store Y
+Return Value: -
+******************************************************************************/
+static inline void rgb565_unpack8_sse2(const unsigned char *src, __m128i *r, __m128i *g, __m128i *b, unsigned char *py)
+{
+    /* the coefficients must fit in 16 bits, so G is doubled */
+    const __m128i y_rg = _mm_setr_epi16(19595, 19235, 19595, 19235, 19595, 19235, 19595, 19235);
+    const __m128i y_b = _mm_setr_epi16(7471, 16384, 7471, 16384, 7471, 16384, 7471, 16384);
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i v = _mm_loadu_si128((const __m128i *)src);
+    __m128i g2, lo, hi;
+
+    *r = _mm_and_si128(_mm_srli_epi16(v, 8), _mm_set1_epi16(248));
+    *g = _mm_srli_epi16(_mm_and_si128(v, _mm_set1_epi16(2016)), 3);
+    *b = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(31)), 3);
+    g2 = _mm_slli_epi16(*g, 1);
+
+    /* 19595 r + 38470 g + 7471 b + 32768 */
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(*r, g2), y_rg),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(*b, two), y_b));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(*r, g2), y_rg),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(*b, two), y_b));
+    v = _mm_packs_epi32(_mm_srli_epi32(lo, 16), _mm_srli_epi32(hi, 16));
+    _mm_storel_epi64((__m128i *)py, _mm_packus_epi16(v, v));
+}
+
+/******************************************************************************
+Description.: computes Cb and Cr of 4 pixel pairs from their summed components
+Input Value.: r, g and b the components summed over one or two lines,
+              offset and shift as in the scalar code, cb and cr for the result
+Return Value: -
+******************************************************************************/
+static inline void rgb565_chroma4_sse2(__m128i r, __m128i g, __m128i b, __m128i offset, __m128i shift, __m128i *cb, __m128i *cr)
+{
+    const __m128i low = _mm_set1_epi32(0xffff);
+    const __m128i cb_rg = _mm_setr_epi16(-11059, -21709, -11059, -21709, -11059, -21709, -11059, -21709);
+    const __m128i cr_gb = _mm_setr_epi16(-27439, -5329, -27439, -5329, -27439, -5329, -27439, -5329);
+
+    /* add each pair, leaving the sum in the low half of 32 bits */
+    r = _mm_and_si128(_mm_add_epi16(r, _mm_srli_epi32(r, 16)), low);
+    g = _mm_and_si128(_mm_add_epi16(g, _mm_srli_epi32(g, 16)), low);
+    b = _mm_and_si128(_mm_add_epi16(b, _mm_srli_epi32(b, 16)), low);
+
+    /* 32768 is out of range for madd, but is a shift */
+    *cb = _mm_add_epi32(_mm_madd_epi16(_mm_or_si128(r, _mm_slli_epi32(g, 16)), cb_rg), _mm_slli_epi32(b, 15));
+    *cr = _mm_add_epi32(_mm_madd_epi16(_mm_or_si128(g, _mm_slli_epi32(b, 16)), cr_gb), _mm_slli_epi32(r, 15));
+    *cb = _mm_sra_epi32(_mm_add_epi32(*cb, offset), shift);
+    *cr = _mm_sra_epi32(_mm_add_epi32(*cr, offset), shift);
+}
+#endif
+
+/******************************************************************************
+Description.: converts 16 pixels at a time of one or two lines of RGB565 with
+              SSE2 where available, giving the same values as the scalar code
+Input Value.: src0 and src1 the lines, pairs the number of pixel pairs, py0
+              and py1 the lines of Y to fill, py1 == py0 for one line, pu
+              and pv the lines of Cb and Cr
+Return Value: the number of pixel pairs done, the rest is left to the caller
+******************************************************************************/
+static int rgb565_simd(const unsigned char *src0, const unsigned char *src1, int pairs,
+                       unsigned char *py0, unsigned char *py1, unsigned char *pu, unsigned char *pv)
+{
+    int x = 0;
+#if defined(JPEG_UTILS_HAVE_SSE2)
+    int two_lines = (py1 != py0);
+    __m128i offset = _mm_set1_epi32((two_lines ? 4 : 2) * ((128 << 16) + 32767));
+    __m128i shift = _mm_cvtsi32_si128(two_lines ? 18 : 17);
+
+    for(; x + 8 <= pairs; x += 8) {
+        __m128i r[2], g[2], b[2], r1, g1, b1, cb[2], cr[2];
+        int i;
+
+        for(i = 0; i < 2; i++) {
+            rgb565_unpack8_sse2(src0 + 4 * x + 16 * i, &r[i], &g[i], &b[i], py0 + 2 * x + 8 * i);
+            if(two_lines) {
+                rgb565_unpack8_sse2(src1 + 4 * x + 16 * i, &r1, &g1, &b1, py1 + 2 * x + 8 * i);
+                r[i] = _mm_add_epi16(r[i], r1);
+                g[i] = _mm_add_epi16(g[i], g1);
+                b[i] = _mm_add_epi16(b[i], b1);
+            }
+            rgb565_chroma4_sse2(r[i], g[i], b[i], offset, shift, &cb[i], &cr[i]);
+        }
+        cb[0] = _mm_packs_epi32(cb[0], cb[1]);
+        cr[0] = _mm_packs_epi32(cr[0], cr[1]);
+        _mm_storel_epi64((__m128i *)(pu + x), _mm_packus_epi16(cb[0], cb[0]));
+        _mm_storel_epi64((__m128i *)(pv + x), _mm_packus_epi16(cr[0], cr[0]));
+    }
+#endif
+    return x;
+}
+
+/******************************************************************************
+Description.: converts pixel pairs x to pairs of one or two lines of RGB565
+              to Y, Cb and Cr one pair at a time, the reference for
+              rgb565_simd()
+Input Value.: as for rgb565_simd(), x the first pixel pair to convert
+Return Value: -
+******************************************************************************/
+static void rgb565_scalar(const unsigned char *src0, const unsigned char *src1, int x, int pairs,
+                          unsigned char *py0, unsigned char *py1, unsigned char *pu, unsigned char *pv)
+{
+    int two_lines = (py1 != py0);
+    unsigned char *py[2];
+    const unsigned char *src[2];
+    int i, j, lines, pixels, shift;
+
+    py[0] = py0;
+    py[1] = py1;
+    src[0] = src0;
+    src[1] = src1;
+    lines = two_lines ? 2 : 1;
+    pixels = 2 * lines;
+    shift = two_lines ? 18 : 17;
+
+    for(; x < pairs; x++) {
+        int r_sum = 0, g_sum = 0, b_sum = 0;
+
+        for(i = 0; i < lines; i++) {
+            for(j = 0; j < 2; j++) {
+                const unsigned char *p = src[i] + 4 * x + 2 * j;
+                /* as the RGB565 conversion always did */
+                int r = (p[1] & 248);
+                int g = (((p[1] << 8) + p[0]) & 2016) >> 3;
+                int b = ((p[0] & 31) * 8);
+
+                py[i][2 * x + j] = (19595 * r + 38470 * g + 7471 * b + 32768) >> 16;
+                r_sum += r;
+                g_sum += g;
+                b_sum += b;
+            }
+        }
+        pu[x] = (-11059 * r_sum - 21709 * g_sum + 32768 * b_sum + pixels * ((128 << 16) + 32767)) >> shift;
+        pv[x] = (32768 * r_sum - 27439 * g_sum - 5329 * b_sum + pixels * ((128 << 16) + 32767)) >> shift;
+    }
+}
+
+/******************************************************************************
+Description.: converts one line (4:2:2) or two lines (4:2:0) of RGB565 to Y,
+              Cb and Cr with the coefficients libjpeg uses, Cb and Cr from
+              the sum of each 2x1 or 2x2 pixels, and repeats the last samples
+              up to the padded width
+Input Value.: enc is the compressor, src0 and src1 the lines, src1 == src0
+              for 4:2:2, row the row of Cb and Cr to fill
+Return Value: -
+******************************************************************************/
+static void rgb565_lines(jpeg_encoder *enc, const unsigned char *src0, const unsigned char *src1, int row)
+{
+    int two_lines = (enc->chroma != JPEG_CHROMA_422);
+    unsigned char *py0 = enc->y_rows[two_lines ? 2 * row : row];
+    unsigned char *py1 = enc->y_rows[two_lines ? 2 * row + 1 : row];
+    unsigned char *pu = enc->cb_rows[row];
+    unsigned char *pv = enc->cr_rows[row];
+    int x, pairs = enc->width / 2;
+
+    x = rgb565_simd(src0, src1, pairs, py0, py1, pu, pv);
+    rgb565_scalar(src0, src1, x, pairs, py0, py1, pu, pv);
+    for(x = 2 * pairs; x < enc->y_width; x++) {
+        py0[x] = py0[2 * pairs - 1];
+        py1[x] = py1[2 * pairs - 1];
+    }
+    for(x = pairs; x < enc->c_width; x++) {
+        pu[x] = pu[pairs - 1];
+        pv[x] = pv[pairs - 1];
+    }
+}
+
+/******************************************************************************
+Description.: compresses a picture with a compressor set up by
+              jpeg_encoder_init()
+              It uses the destination manager implemented above to compress
+              the picture to memory.
+Input Value.: enc is the compressor, raw the picture as grabbed, the
+              destination buffer and its size
+              the buffer must be large enough, no error/size checking is done!
+Return Value: the size of the compressed picture in buffer
+******************************************************************************/
+static int jpeg_encoder_compress(jpeg_encoder *enc, const unsigned char *raw, unsigned char *buffer, int size)
+{
+    JSAMPARRAY planes[3] = { enc->y_rows, enc->cb_rows, enc->cr_rows };
+    int lines_per_row = enc->y_lines / DCTSIZE;
+    int line, i;
+
+    dest_buffer(&enc->cinfo, buffer, size, &enc->written);
+    jpeg_start_compress(&enc->cinfo, TRUE);
+
+    for(line = 0; line < enc->height; line += enc->y_lines) {
+        for(i = 0; i < DCTSIZE; i++) {
+            /* repeat the last line into the last blocks */
+            int line0 = line + lines_per_row * i;
+            int line1 = line0 + lines_per_row - 1;
+            const unsigned char *src0, *src1;
+
+            line0 = (line0 < enc->height) ? line0 : enc->height - 1;
+            line1 = (line1 < enc->height) ? line1 : enc->height - 1;
+            src0 = raw + line0 * enc->width * 2;
+            src1 = raw + line1 * enc->width * 2;
+
+            if(enc->format == V4L2_PIX_FMT_RGB565)
+                rgb565_lines(enc, src0, src1, i);
+            else
+                deinterleave_lines(enc, src0, src1, i);
+        }
+        jpeg_write_raw_data(&enc->cinfo, planes, enc->y_lines);
+    }
+
+    jpeg_finish_compress(&enc->cinfo);
+
+    return enc->written;
+}
+
 /******************************************************************************
 Description.: yuv2jpeg function is based on compress_yuyv_to_jpeg written by
               Gabriel A. Devenyi.
               modified to support other formats like RGB5:6:5 by Miklós Márton
-              It uses the destination manager implemented above to compress
-              YUYV data to JPEG. Most other implementations use the
-              "jpeg_stdio_dest" from libjpeg, which can not store compressed
-              pictures to memory instead of a file.
+              It compresses a single picture with a compressor made for it,
+              for compressors kept from frame to frame use a
+              jpeg_encoder_pool.
 Input Value.: video structure from v4l2uvc.c/h, destination buffer and buffersize
               the buffer must be large enough, no error/size checking is done!
 Return Value: the buffer will contain the compressed data
 ******************************************************************************/
 int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality)
 {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    JSAMPROW row_pointer[1];
-    unsigned char *line_buffer, *yuyv;
-    int z;
-    static int written;
-
-    line_buffer = calloc(vd->width * 3, 1);
-    yuyv = vd->framebuffer;
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    /* jpeg_stdio_dest (&cinfo, file); */
-    dest_buffer(&cinfo, buffer, size, &written);
-
-    cinfo.image_width = vd->width;
-    cinfo.image_height = vd->height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-
-    jpeg_start_compress(&cinfo, TRUE);
-
-    z = 0;
-    if (vd->formatIn == V4L2_PIX_FMT_YUYV) {
-        while(cinfo.next_scanline < vd->height) {
-            int x;
-            unsigned char *ptr = line_buffer;
-
-
-            for(x = 0; x < vd->width; x++) {
-                int r, g, b;
-                int y, u, v;
-
-                if(!z)
-                    y = yuyv[0] << 8;
-                else
-                    y = yuyv[2] << 8;
-                u = yuyv[1] - 128;
-                v = yuyv[3] - 128;
-
-                r = (y + (359 * v)) >> 8;
-                g = (y - (88 * u) - (183 * v)) >> 8;
-                b = (y + (454 * u)) >> 8;
-
-                *(ptr++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-                *(ptr++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-                *(ptr++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
-
-                if(z++) {
-                    z = 0;
-                    yuyv += 4;
-                }
-            }
+    jpeg_encoder enc;
+    int written;
 
-            row_pointer[0] = line_buffer;
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
-        }
-    } else if (vd->formatIn == V4L2_PIX_FMT_RGB565) {
-        while(cinfo.next_scanline < vd->height) {
-            int x;
-            unsigned char *ptr = line_buffer;
-
-            for(x = 0; x < vd->width; x++) {
-                /*
-                unsigned int tb = ((unsigned char)raw[i+1] << 8) + (unsigned char)raw[i];
-                r =  ((unsigned char)(raw[i+1]) & 248);
-                g = (unsigned char)(( tb & 2016) >> 3);
-                b =  ((unsigned char)raw[i] & 31) * 8;
-                */
-                unsigned int twoByte = (yuyv[1] << 8) + yuyv[0];
-                *(ptr++) = (yuyv[1] & 248);
-                *(ptr++) = (unsigned char)((twoByte & 2016) >> 3);
-                *(ptr++) = ((yuyv[0] & 31) * 8);
-                yuyv += 2;
-            }
+    if(jpeg_encoder_init(&enc, vd->width, vd->height, vd->formatIn, JPEG_CHROMA_420, quality) < 0)
+        return 0;
+    written = jpeg_encoder_compress(&enc, vd->framebuffer, buffer, size);
+    jpeg_encoder_free(&enc);
+
+    return written;
+}
+
+/* a picture grabbed and its compressed copy */
+typedef struct {
+    unsigned char *raw;
+    unsigned char *jpeg;
+    int jpeg_size;
+    struct timeval timestamp;
+    int done;
+} jpeg_job;
+
+typedef struct {
+    jpeg_encoder_pool *pool;
+    int id;
+} jpeg_worker_arg;
+
+/* compressors each on their own thread, working on the next pictures */
+struct _jpeg_encoder_pool {
+    int threads;
+    int raw_size, jpeg_buffer_size;
+    jpeg_encoder *encoders;
+    pthread_t *workers;
+    jpeg_worker_arg *worker_args;
+    int workers_started;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t job_submitted;
+    pthread_cond_t job_done;
+
+    /* jobs[n % threads] for the n-th picture, counting them out as they
+       are submitted, picked up by a worker and collected, in that order */
+    jpeg_job *jobs;
+    unsigned int submitted, started, collected;
+    int stop;
+};
+
+/******************************************************************************
+Description.: compresses the oldest pictures not yet picked up by another
+              worker, until the pool is destroyed
+Input Value.: a jpeg_worker_arg
+Return Value: NULL
+******************************************************************************/
+static void *jpeg_worker(void *arg)
+{
+    jpeg_encoder_pool *pool = ((jpeg_worker_arg *)arg)->pool;
+    jpeg_encoder *enc = &pool->encoders[((jpeg_worker_arg *)arg)->id];
+    jpeg_job *job;
+
+    pthread_mutex_lock(&pool->mutex);
+    for(;;) {
+        while(pool->started == pool->submitted && !pool->stop)
+            pthread_cond_wait(&pool->job_submitted, &pool->mutex);
+        if(pool->stop)
+            break;
+        job = &pool->jobs[pool->started++ % pool->threads];
+        pthread_mutex_unlock(&pool->mutex);
+
+        job->jpeg_size = jpeg_encoder_compress(enc, job->raw, job->jpeg, pool->jpeg_buffer_size);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->done = 1;
+        pthread_cond_broadcast(&pool->job_done);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: copies the oldest compressed picture out and frees its job
+              pool->mutex must be held
+Input Value.: pool, buffer and its size, picture_timestamp is set to the
+              time the picture was grabbed
+Return Value: the size of the picture, 0 if it did not fit
+******************************************************************************/
+static int collect_job(jpeg_encoder_pool *pool, unsigned char *buffer, int size, struct timeval *picture_timestamp)
+{
+    jpeg_job *job = &pool->jobs[pool->collected++ % pool->threads];
+
+    if(job->jpeg_size > size)
+        return 0;
+    memcpy(buffer, job->jpeg, job->jpeg_size);
+    *picture_timestamp = job->timestamp;
+    return job->jpeg_size;
+}
+
+static void unlock_mutex(void *mutex)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+/******************************************************************************
+Description.: starts threads compressors, each compressing one picture at a
+              time; with one, pictures are compressed on the calling thread
+Input Value.: width, height and format as in struct vdIn, chroma is
+              JPEG_CHROMA_420 or JPEG_CHROMA_422, quality of the JPEG
+              encoding, the number of threads
+Return Value: the pool, or NULL if out of memory
+******************************************************************************/
+jpeg_encoder_pool *jpeg_encoder_pool_create(int width, int height, int format, int chroma, int quality, int threads)
+{
+    jpeg_encoder_pool *pool;
+    int i;
+
+    if((pool = calloc(1, sizeof(jpeg_encoder_pool))) == NULL)
+        return NULL;
+    pool->threads = (threads < 1) ? 1 : threads;
+    pool->raw_size = width * height * 2;
+    /* as for the global buffer: no picture compresses worse than this */
+    pool->jpeg_buffer_size = width * height * 2;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_submitted, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    pool->encoders = calloc(pool->threads, sizeof(jpeg_encoder));
+    pool->jobs = calloc(pool->threads, sizeof(jpeg_job));
+    pool->workers = calloc(pool->threads, sizeof(pthread_t));
+    pool->worker_args = calloc(pool->threads, sizeof(jpeg_worker_arg));
+    if(pool->encoders == NULL || pool->jobs == NULL || pool->workers == NULL || pool->worker_args == NULL) {
+        jpeg_encoder_pool_destroy(pool);
+        return NULL;
+    }
 
-            row_pointer[0] = line_buffer;
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    for(i = 0; i < pool->threads; i++) {
+        if(jpeg_encoder_init(&pool->encoders[i], width, height, format, chroma, quality) < 0) {
+            jpeg_encoder_pool_destroy(pool);
+            return NULL;
         }
-    }  else if (vd->formatIn == V4L2_PIX_FMT_UYVY) {
-        while(cinfo.next_scanline < vd->height) {
-            int x;
-            unsigned char *ptr = line_buffer;
-
-
-            for(x = 0; x < vd->width; x++) {
-                int r, g, b;
-                int y, u, v;
-
-                if(!z)
-                    y = yuyv[1] << 8;
-                else
-                    y = yuyv[3] << 8;
-                u = yuyv[0] - 128;
-                v = yuyv[2] - 128;
-
-                r = (y + (359 * v)) >> 8;
-                g = (y - (88 * u) - (183 * v)) >> 8;
-                b = (y + (454 * u)) >> 8;
-
-                *(ptr++) = (r > 255) ? 255 : ((r < 0) ? 0 : r);
-                *(ptr++) = (g > 255) ? 255 : ((g < 0) ? 0 : g);
-                *(ptr++) = (b > 255) ? 255 : ((b < 0) ? 0 : b);
-
-                if(z++) {
-                    z = 0;
-                    yuyv += 4;
-                }
-            }
+    }
+    if(pool->threads == 1)
+        return pool;
+
+    for(i = 0; i < pool->threads; i++) {
+        pool->jobs[i].raw = malloc(pool->raw_size);
+        pool->jobs[i].jpeg = malloc(pool->jpeg_buffer_size);
+        if(pool->jobs[i].raw == NULL || pool->jobs[i].jpeg == NULL) {
+            jpeg_encoder_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    for(i = 0; i < pool->threads; i++) {
+        pool->worker_args[i].pool = pool;
+        pool->worker_args[i].id = i;
+        if(pthread_create(&pool->workers[i], NULL, jpeg_worker, &pool->worker_args[i]) != 0) {
+            jpeg_encoder_pool_destroy(pool);
+            return NULL;
+        }
+        pool->workers_started++;
+    }
 
-            row_pointer[0] = line_buffer;
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    return pool;
+}
+
+/******************************************************************************
+Description.: stops the threads of the pool and frees it, dropping the
+              pictures still in it
+Input Value.: pool
+Return Value: -
+******************************************************************************/
+void jpeg_encoder_pool_destroy(jpeg_encoder_pool *pool)
+{
+    int i;
+
+    if(pool == NULL)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->job_submitted);
+    pthread_mutex_unlock(&pool->mutex);
+    for(i = 0; i < pool->workers_started; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    for(i = 0; i < pool->threads; i++) {
+        if(pool->encoders != NULL && pool->encoders[i].cinfo.err != NULL)
+            jpeg_encoder_free(&pool->encoders[i]);
+        if(pool->jobs != NULL) {
+            free(pool->jobs[i].raw);
+            free(pool->jobs[i].jpeg);
         }
     }
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
+    free(pool->encoders);
+    free(pool->jobs);
+    free(pool->workers);
+    free(pool->worker_args);
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_submitted);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/******************************************************************************
+Description.: tells if the pool compresses pictures of this size and format
+Input Value.: pool, width, height and format as in struct vdIn
+Return Value: 1 if so, else 0
+******************************************************************************/
+int jpeg_encoder_pool_matches(jpeg_encoder_pool *pool, int width, int height, int format)
+{
+    return pool->encoders[0].width == width && pool->encoders[0].height == height &&
+           pool->encoders[0].format == format;
+}
+
+/******************************************************************************
+Description.: hands a grabbed picture to the pool, and takes back the oldest
+              compressed one if there is one
+              With several threads, up to that many pictures are compressed
+              at the same time.  The pictures come out in the order they
+              went in, some calls later; when every thread has a picture,
+              this waits for the oldest one.
+Input Value.: pool, raw picture as grabbed and the time it was grabbed,
+              buffer to copy the compressed picture to and its size,
+              picture_timestamp is set to the time that picture was grabbed
+Return Value: the size of the compressed picture, 0 if none is ready yet
+******************************************************************************/
+int jpeg_encoder_pool_encode(jpeg_encoder_pool *pool, const unsigned char *raw, struct timeval timestamp,
+                             unsigned char *buffer, int size, struct timeval *picture_timestamp)
+{
+    jpeg_job *job;
+    int written = 0;
+
+    if(pool->threads == 1) {
+        *picture_timestamp = timestamp;
+        return jpeg_encoder_compress(&pool->encoders[0], raw, buffer, size);
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cleanup_push(unlock_mutex, &pool->mutex);
+
+    /* make room for the new picture */
+    if(pool->submitted - pool->collected == pool->threads) {
+        job = &pool->jobs[pool->collected % pool->threads];
+        while(!job->done)
+            pthread_cond_wait(&pool->job_done, &pool->mutex);
+        written = collect_job(pool, buffer, size, picture_timestamp);
+    }
+
+    /* no worker touches the job until it is submitted */
+    job = &pool->jobs[pool->submitted % pool->threads];
+    pthread_mutex_unlock(&pool->mutex);
+    memcpy(job->raw, raw, pool->raw_size);
+    pthread_mutex_lock(&pool->mutex);
+    job->timestamp = timestamp;
+    job->done = 0;
+    pool->submitted++;
+    pthread_cond_signal(&pool->job_submitted);
+
+    if(written == 0 && pool->submitted != pool->collected &&
+       pool->jobs[pool->collected % pool->threads].done)
+        written = collect_job(pool, buffer, size, picture_timestamp);
 
-    free(line_buffer);
+    pthread_cleanup_pop(1);
 
-    return (written);
+    return written;
 }
@@ -1 +1,14 @@
 int compress_image_to_jpeg(struct vdIn *vd, unsigned char *buffer, int size, int quality);
+
+/* chroma subsampling of the compressed pictures */
+#define JPEG_CHROMA_420 0
+#define JPEG_CHROMA_422 1
+
+/* compressors kept from frame to frame, each on its own thread */
+typedef struct _jpeg_encoder_pool jpeg_encoder_pool;
+
+jpeg_encoder_pool *jpeg_encoder_pool_create(int width, int height, int format, int chroma, int quality, int threads);
+void jpeg_encoder_pool_destroy(jpeg_encoder_pool *pool);
+int jpeg_encoder_pool_matches(jpeg_encoder_pool *pool, int width, int height, int format);
+int jpeg_encoder_pool_encode(jpeg_encoder_pool *pool, const unsigned char *raw, struct timeval timestamp,
+                             unsigned char *buffer, int size, struct timeval *picture_timestamp);
@@ -0,0 +1,132 @@
+/*******************************************************************************
+# Linux-UVC streaming input-plugin for MJPG-streamer                           #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; either version 2 of the License, or            #
+# (at your option) any later version.                                          #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Checks that deinterleave_simd() and rgb565_simd(), with the scalar code
+ * finishing the tail as the encoder does, give byte for byte the planes of
+ * the scalar code alone, for random lines of every width up to MAX_PAIRS
+ * pixel pairs.  The static functions are reached by including jpeg_utils.c.
+ *
+ *   usage: ./jpeg_utils_simd [SEED]
+ */
+
+#include "../jpeg_utils.c"
+
+#define MAX_PAIRS 100
+/* bytes past the end of each plane that must be left alone */
+#define GUARD 64
+
+/* one line of Y, or two for 4:2:0, and a line of Cb and Cr */
+typedef struct {
+    unsigned char y0[2 * MAX_PAIRS + GUARD];
+    unsigned char y1[2 * MAX_PAIRS + GUARD];
+    unsigned char u[MAX_PAIRS + GUARD];
+    unsigned char v[MAX_PAIRS + GUARD];
+} planes;
+
+/* the line layouts deinterleave_lines() and rgb565_lines() ask for */
+enum { ONE_LINE, TWO_LINES, ONE_LINE_TWICE };
+static const char *layout_names[] = { "4:2:2", "4:2:0", "4:2:2 into two Y lines" };
+
+static void clear_planes(planes *p)
+{
+    memset(p, 0xa5, sizeof(*p));
+}
+
+/******************************************************************************
+Description.: compares the planes of the scalar and the SIMD path
+Input Value.: what was converted, its layout and width in pairs, expected and
+              actual the planes
+Return Value: 0 if they are equal, 1 if not
+******************************************************************************/
+static int compare_planes(const char *what, int layout, int pairs, const planes *expected, const planes *actual)
+{
+    if(memcmp(expected, actual, sizeof(*expected)) == 0)
+        return 0;
+
+    fprintf(stderr, "FAIL: %s %s, %d pixel pairs:%s%s%s%s\n", what, layout_names[layout], pairs,
+            memcmp(expected->y0, actual->y0, sizeof(expected->y0)) ? " Y0" : "",
+            memcmp(expected->y1, actual->y1, sizeof(expected->y1)) ? " Y1" : "",
+            memcmp(expected->u, actual->u, sizeof(expected->u)) ? " Cb" : "",
+            memcmp(expected->v, actual->v, sizeof(expected->v)) ? " Cr" : "");
+    return 1;
+}
+
+/******************************************************************************
+Description.: converts random lines with and without SIMD
+Input Value.: layout one of the line layouts, pairs the width in pixel pairs
+Return Value: the number of failures
+******************************************************************************/
+static int check_width(int layout, int pairs)
+{
+    unsigned char src[2][4 * MAX_PAIRS];
+    const unsigned char *src1 = (layout == TWO_LINES) ? src[1] : src[0];
+    static planes expected, actual;
+    unsigned char *py1;
+    int i, y, x, failures = 0;
+
+    for(i = 0; i < (int)sizeof(src); i++)
+        src[i / (4 * MAX_PAIRS)][i % (4 * MAX_PAIRS)] = rand();
+
+    /* YUYV, then UYVY */
+    for(y = 0; y < 2; y++) {
+        clear_planes(&expected);
+        clear_planes(&actual);
+        py1 = (layout == ONE_LINE) ? expected.y0 : expected.y1;
+        deinterleave_scalar(src[0], src1, 0, pairs, y, expected.y0, py1, expected.u, expected.v);
+        py1 = (layout == ONE_LINE) ? actual.y0 : actual.y1;
+        x = deinterleave_simd(src[0], src1, pairs, y, actual.y0, py1, actual.u, actual.v);
+        deinterleave_scalar(src[0], src1, x, pairs, y, actual.y0, py1, actual.u, actual.v);
+        failures += compare_planes(y ? "UYVY" : "YUYV", layout, pairs, &expected, &actual);
+    }
+
+    /* rgb565_lines() only passes a second line for 4:2:0 */
+    if(layout == ONE_LINE_TWICE)
+        return failures;
+
+    clear_planes(&expected);
+    clear_planes(&actual);
+    py1 = (layout == ONE_LINE) ? expected.y0 : expected.y1;
+    rgb565_scalar(src[0], src1, 0, pairs, expected.y0, py1, expected.u, expected.v);
+    py1 = (layout == ONE_LINE) ? actual.y0 : actual.y1;
+    x = rgb565_simd(src[0], src1, pairs, actual.y0, py1, actual.u, actual.v);
+    rgb565_scalar(src[0], src1, x, pairs, actual.y0, py1, actual.u, actual.v);
+    failures += compare_planes("RGB565", layout, pairs, &expected, &actual);
+
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    int layout, pairs, round, checks = 0, failures = 0;
+
+    srand(argc > 1 ? atoi(argv[1]) : 1);
+
+    for(round = 0; round < 20; round++) {
+        for(layout = ONE_LINE; layout <= ONE_LINE_TWICE; layout++) {
+            for(pairs = 1; pairs <= MAX_PAIRS; pairs++) {
+                failures += check_width(layout, pairs);
+                checks++;
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: %d lines, %d failures\n", failures == 0 ? "PASS" : "FAIL", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -132,7 +132,8 @@ typedef struct {
         pl_set, pl,
         gain_set, gain_auto, gain,
         cagc_set, cagc_auto, cagc,
-        cb_set, cb_auto, cb;
+        cb_set, cb_auto, cb,
+        encoders, chroma;
 } context_settings;
 
 /* context of each camera thread */
@@ -143,6 +144,8 @@ typedef struct {
     pthread_mutex_t controls_mutex;
     struct vdIn *videoIn;
     context_settings *init_settings;
+    unsigned char *back_buf; // filled without holding db, then swapped with the global buffer
+    struct _jpeg_encoder_pool *encoder_pool; // compresses YUYV, UYVY and RGB565 frames
 } context;
 
 int init_videoIn(struct vdIn *vd, char *device, int width, int height, int fps, int format, int grabmethod, globals *pglobal, int id, v4l2_std_id vstd);
@@ -0,0 +1,359 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Event clips: the frames of the last seconds are kept in memory, and a
+ * trigger saves them along with those of the seconds after it to a clip.
+ *
+ * Each frame is copied once into an arena of fixed size, a frame of the ring
+ * of the input can't be held that long without keeping the input from
+ * publishing. The clip thread writes the frames of a clip straight from the
+ * arena to a recording, see recorder.c, while the worker thread goes on
+ * adding frames. Frames not written yet are kept, if the disk can't keep up
+ * and they fill the arena, new frames are dropped until there is room.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "../../utils.h"
+#include "../../mjpg_streamer.h"
+#include "recorder.h"
+#include "event.h"
+
+/* a frame in the arena */
+typedef struct {
+    size_t offset;
+    int size;
+    struct timeval timestamp;   /* capture time, for the recording */
+    uint64_t arrived;           /* monotonic usecs, for the windows */
+} event_frame;
+
+struct _event_buffer {
+    char *folder;
+    uint64_t pre, post;         /* usecs */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;        /* frames added, triggers and stopping */
+    pthread_t thread;
+    int stop;
+
+    /* the arena, frames are numbered in the order they were added */
+    unsigned char *data;
+    size_t capacity;
+    size_t head;                /* where the next frame goes */
+    event_frame frames[EVENT_FRAMES];
+    unsigned long first, next;  /* the oldest frame kept, and the next one */
+
+    /* the clip being saved, it keeps the frames from clip_next on */
+    int active;
+    char *filename;             /* of the next clip, set by the trigger */
+    unsigned long clip_next;
+    uint64_t end;               /* monotonic usecs, frames after it are not saved */
+    unsigned long dropped;
+};
+
+static uint64_t monotonic_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/******************************************************************************
+Description.: finds room for a frame after the newest one in the arena
+Input Value.: the event buffer and the size of the frame
+Return Value: the offset of the room, or -1 if there is none
+******************************************************************************/
+static long event_room(event_buffer *eb, size_t size)
+{
+    size_t tail;
+
+    if(eb->first == eb->next)
+        return size <= eb->capacity ? 0 : -1;
+    if(eb->next - eb->first == EVENT_FRAMES)
+        return -1;
+
+    /* the frames kept lie from tail to head, maybe wrapping around */
+    tail = eb->frames[eb->first % EVENT_FRAMES].offset;
+    if(eb->head > tail) {
+        if(eb->head + size <= eb->capacity)
+            return eb->head;
+        return size < tail ? 0 : -1;
+    }
+    return eb->head + size < tail ? (long)eb->head : -1;
+}
+
+/* may the oldest frame go, it does once it is not part of a clip */
+static int event_may_drop_oldest(event_buffer *eb)
+{
+    return eb->first != eb->next && (!eb->active || eb->first < eb->clip_next);
+}
+
+/******************************************************************************
+Description.: the clip thread, saves a clip when triggered: the frames kept
+              from before the trigger, then those added up to the end of
+              its window. A trigger during a clip extends its window.
+Input Value.: the event buffer
+Return Value: NULL
+******************************************************************************/
+static void *event_thread(void *arg)
+{
+    event_buffer *eb = arg;
+    event_frame *f;
+    input_frame frame;
+    recorder *rec;
+    char *filename;
+    struct timespec until;
+    unsigned long dropped;
+    int failed;
+
+    pthread_mutex_lock(&eb->mutex);
+    while(1) {
+        while(!eb->stop && eb->filename == NULL)
+            pthread_cond_wait(&eb->cond, &eb->mutex);
+        if(eb->filename == NULL)
+            break;
+
+        filename = eb->filename;
+        eb->filename = NULL;
+        pthread_mutex_unlock(&eb->mutex);
+
+        OPRINT("saving event clip %s\n", filename);
+        rec = recorder_open(filename);
+        if(rec == NULL) {
+            OPRINT("could not open the file %s: %s\n", filename, strerror(errno));
+        }
+
+        pthread_mutex_lock(&eb->mutex);
+        failed = rec == NULL;
+        while(!failed) {
+            if(eb->clip_next != eb->next) {
+                f = &eb->frames[eb->clip_next % EVENT_FRAMES];
+                if(f->arrived > eb->end)
+                    break;
+
+                /* the frame stays in the arena while it is written */
+                memset(&frame, 0, sizeof(frame));
+                frame.buf = eb->data + f->offset;
+                frame.size = f->size;
+                frame.timestamp = f->timestamp;
+                pthread_mutex_unlock(&eb->mutex);
+                failed = recorder_write(rec, &frame) < 0;
+                pthread_mutex_lock(&eb->mutex);
+                eb->clip_next++;
+                continue;
+            }
+
+            if(eb->stop || monotonic_usecs() > eb->end)
+                break;
+
+            /* wait for the next frame, but not past the window */
+            until.tv_sec = (eb->end / 1000000) + 1;
+            until.tv_nsec = 0;
+            pthread_cond_timedwait(&eb->cond, &eb->mutex, &until);
+        }
+        eb->active = 0;
+        dropped = eb->dropped;
+        pthread_mutex_unlock(&eb->mutex);
+
+        if(rec != NULL && (recorder_close(rec) < 0 || failed)) {
+            OPRINT("could not write to file %s: %s\n", filename, strerror(errno));
+        } else if(rec != NULL) {
+            OPRINT("saved event clip %s, %lu frames dropped\n", filename, dropped);
+        }
+        free(filename);
+
+        pthread_mutex_lock(&eb->mutex);
+    }
+    pthread_mutex_unlock(&eb->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: creates an event buffer and starts its clip thread
+Input Value.: folder of clips named by the time of their trigger, seconds to
+              keep before and to save after a trigger, megabytes of memory
+              for the frames
+Return Value: the event buffer, or NULL
+******************************************************************************/
+event_buffer *event_buffer_new(const char *folder, int pre, int post, int megabytes)
+{
+    event_buffer *eb;
+    pthread_condattr_t attr;
+
+    if((eb = calloc(1, sizeof(event_buffer))) == NULL)
+        return NULL;
+    eb->capacity = (size_t)megabytes * 1024 * 1024;
+    if((eb->data = malloc(eb->capacity)) == NULL || (eb->folder = strdup(folder)) == NULL) {
+        free(eb->data);
+        free(eb);
+        return NULL;
+    }
+    eb->pre = pre * 1000000ULL;
+    eb->post = post * 1000000ULL;
+
+    pthread_mutex_init(&eb->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&eb->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if(pthread_create(&eb->thread, NULL, event_thread, eb) != 0) {
+        pthread_cond_destroy(&eb->cond);
+        pthread_mutex_destroy(&eb->mutex);
+        free(eb->folder);
+        free(eb->data);
+        free(eb);
+        return NULL;
+    }
+
+    return eb;
+}
+
+/******************************************************************************
+Description.: keeps a copy of a frame, in place of the oldest ones once they
+              are older than the seconds before a trigger, or to make room.
+              Frames of a clip not written yet are kept, if there is no other
+              room the frame is dropped.
+Input Value.: the event buffer and the frame
+Return Value: -
+******************************************************************************/
+void event_buffer_add(event_buffer *eb, input_frame *frame)
+{
+    uint64_t now = monotonic_usecs();
+    event_frame *f;
+    long offset;
+
+    pthread_mutex_lock(&eb->mutex);
+
+    while(event_may_drop_oldest(eb) &&
+          eb->frames[eb->first % EVENT_FRAMES].arrived + eb->pre < now)
+        eb->first++;
+    while((offset = event_room(eb, frame->size)) < 0 && event_may_drop_oldest(eb))
+        eb->first++;
+    if(offset < 0) {
+        eb->dropped++;
+        pthread_mutex_unlock(&eb->mutex);
+        return;
+    }
+    if(eb->first == eb->next)
+        eb->head = 0;
+
+    f = &eb->frames[eb->next % EVENT_FRAMES];
+    f->offset = offset;
+    f->size = frame->size;
+    f->timestamp = frame->timestamp;
+    if(f->timestamp.tv_sec == 0 && f->timestamp.tv_usec == 0)
+        gettimeofday(&f->timestamp, NULL);
+    f->arrived = now;
+    pthread_mutex_unlock(&eb->mutex);
+
+    /* the room is the worker thread's alone until the frame is added */
+    memcpy(eb->data + offset, frame->buf, frame->size);
+
+    pthread_mutex_lock(&eb->mutex);
+    eb->head = offset + frame->size;
+    eb->next++;
+    if(eb->active)
+        pthread_cond_broadcast(&eb->cond);
+    pthread_mutex_unlock(&eb->mutex);
+}
+
+/******************************************************************************
+Description.: triggers an event, a clip is saved of the frames from the
+              seconds before it to the seconds after it. During a clip, the
+              trigger extends that clip instead. The clip is named after
+              the time in the folder of the event buffer.
+Input Value.: the event buffer
+Return Value: 0 if OK, -1 if there is not enough memory
+******************************************************************************/
+int event_buffer_trigger(event_buffer *eb)
+{
+    char buffer[64], *name;
+    time_t t;
+    struct tm now;
+
+    pthread_mutex_lock(&eb->mutex);
+    eb->end = monotonic_usecs() + eb->post;
+    if(eb->active) {
+        DBG("event during a clip, it ends later\n");
+        pthread_mutex_unlock(&eb->mutex);
+        return 0;
+    }
+    pthread_mutex_unlock(&eb->mutex);
+
+    t = time(NULL);
+    localtime_r(&t, &now);
+    strftime(buffer, sizeof(buffer), "%Y_%m_%d_%H_%M_%S_event.mkv", &now);
+    name = malloc(strlen(eb->folder) + strlen(buffer) + 2);
+    if(name == NULL)
+        return -1;
+    sprintf(name, "%s/%s", eb->folder, buffer);
+
+    pthread_mutex_lock(&eb->mutex);
+    if(eb->active) {
+        free(name);
+    } else {
+        /* the frames kept are those of the seconds before */
+        eb->active = 1;
+        eb->clip_next = eb->first;
+        eb->dropped = 0;
+        free(eb->filename);
+        eb->filename = name;
+        pthread_cond_broadcast(&eb->cond);
+    }
+    pthread_mutex_unlock(&eb->mutex);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: stops the clip thread, a clip being saved gets the frames added
+              so far, and frees the event buffer
+Input Value.: the event buffer
+Return Value: -
+******************************************************************************/
+void event_buffer_free(event_buffer *eb)
+{
+    pthread_mutex_lock(&eb->mutex);
+    eb->stop = 1;
+    pthread_cond_broadcast(&eb->cond);
+    pthread_mutex_unlock(&eb->mutex);
+    pthread_join(eb->thread, NULL);
+
+    free(eb->filename);
+    pthread_cond_destroy(&eb->cond);
+    pthread_mutex_destroy(&eb->mutex);
+    free(eb->folder);
+    free(eb->data);
+    free(eb);
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef EVENT_H
+#define EVENT_H
+
+/* default megabytes of frames kept for events */
+#define EVENT_MEMORY 32
+
+/* the most frames kept for events, whatever their size */
+#define EVENT_FRAMES 8192
+
+/* default seconds of frames saved after a trigger */
+#define EVENT_POST 5
+
+typedef struct _event_buffer event_buffer;
+
+event_buffer *event_buffer_new(const char *folder, int pre, int post, int megabytes);
+void event_buffer_add(event_buffer *eb, input_frame *frame);
+int event_buffer_trigger(event_buffer *eb);
+void event_buffer_free(event_buffer *eb);
+
+#endif
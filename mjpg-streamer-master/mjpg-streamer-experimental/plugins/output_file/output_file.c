@@ -41,17 +41,38 @@
 
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
+#include "recorder.h"
+#include "event.h"
 
 #define OUTPUT_PLUGIN_NAME "FILE output plugin"
 
 static pthread_t worker;
 static globals *pglobal;
-static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0, max_frame_size;
+static int fd, delay, ringbuffer_size = -1, ringbuffer_exceed = 0;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static char *command = NULL;
 static int input_number = 0;
 static char *mjpgFileName = NULL;
+static recorder *rec = NULL;
+static event_buffer *events = NULL;
+static int event_pre = -1, event_post = EVENT_POST, event_memory = EVENT_MEMORY;
+
+/* file names, oldest first, see fifo_push() */
+typedef struct {
+    char **names;
+    int first, count, capacity;
+} name_fifo;
+
+/*
+ * the pictures of the ringbuffer, and those to delete by the unlink thread,
+ * see maintain_ringbuffer()
+ */
+static name_fifo ring, doomed;
+static pthread_t unlinker;
+static pthread_mutex_t unlink_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t unlink_cond = PTHREAD_COND_INITIALIZER;
+static int unlinker_running = 0, unlinker_stop = 0;
 
 /******************************************************************************
 Description.: print a help message
@@ -65,16 +86,65 @@ void help(void)
             " ---------------------------------------------------------------\n" \
             " The following parameters can be passed to this plugin:\n\n" \
             " [-f | --folder ]........: folder to save pictures\n" \
-            " [-m | --mjpeg ].........: save the frames to an mjpg file \n" \
+            " [-m | --mjpeg ].........: save the frames to an mjpg file, or to a\n" \
+            "                           Matroska file with an index if it ends\n" \
+            "                           with .mkv\n" \
             " [-d | --delay ].........: delay after saving pictures in ms\n" \
             " [-i | --input ].........: read frames from the specified input plugin\n" \
             " The following arguments are takes effect only if the current mode is not MJPG\n" \
             " [-s | --size ]..........: size of ring buffer (max number of pictures to hold)\n" \
             " [-e | --exceed ]........: allow ringbuffer to exceed limit by this amount\n" \
             " [-c | --command ].......: execute command after saving picture\n"\
+            " The following arguments save clips of events instead, see the\n" \
+            " \"Trigger event\" command\n" \
+            " [-p | --pre ]...........: seconds of frames kept before an event\n" \
+            " [-a | --post ]..........: seconds of frames saved after an event,\n" \
+            "                           default: 5\n" \
+            " [-b | --buffer ]........: megabytes of memory for the frames kept,\n" \
+            "                           default: 32\n" \
             " ---------------------------------------------------------------\n");
 }
 
+/******************************************************************************
+Description.: appends a file name to a fifo, which grows as needed
+Input Value.: the fifo and the name, which belongs to the fifo from now on
+Return Value: 0 if OK, -1 if there is not enough memory
+******************************************************************************/
+static int fifo_push(name_fifo *fifo, char *name)
+{
+    char **names;
+    int i;
+
+    if(fifo->count == fifo->capacity) {
+        names = malloc(MAX(2 * fifo->capacity, 64) * sizeof(char *));
+        if(names == NULL)
+            return -1;
+        for(i = 0; i < fifo->count; i++)
+            names[i] = fifo->names[(fifo->first + i) % fifo->capacity];
+        free(fifo->names);
+        fifo->names = names;
+        fifo->first = 0;
+        fifo->capacity = MAX(2 * fifo->capacity, 64);
+    }
+
+    fifo->names[(fifo->first + fifo->count) % fifo->capacity] = name;
+    fifo->count++;
+    return 0;
+}
+
+/* the oldest name, or NULL if there is none */
+static char *fifo_pop(name_fifo *fifo)
+{
+    char *name;
+
+    if(fifo->count == 0)
+        return NULL;
+    name = fifo->names[fifo->first];
+    fifo->first = (fifo->first + 1) % fifo->capacity;
+    fifo->count--;
+    return name;
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -83,10 +153,7 @@ Return Value: -
 void worker_cleanup(void *arg)
 {
     static unsigned char first_run = 1;
-
-    if (mjpgFileName != NULL) {
-        close(fd);
-    }
+    char *name;
 
     if(!first_run) {
         DBG("already cleaned up resources\n");
@@ -97,9 +164,37 @@ void worker_cleanup(void *arg)
     OPRINT("cleaning up resources allocated by worker thread\n");
 
     if(frame != NULL) {
-        free(frame);
+        input_frame_release(frame);
+        frame = NULL;
     }
-    close(fd);
+
+    /* finish the event clip being saved */
+    if(events != NULL) {
+        event_buffer_free(events);
+        events = NULL;
+    }
+
+    /* write the rest of the recording, and its index */
+    if(rec != NULL) {
+        if(recorder_close(rec) < 0) {
+            OPRINT("could not write to file %s: %s\n", mjpgFileName, strerror(errno));
+        }
+        rec = NULL;
+    }
+
+    /* the unlink thread deletes the files handed to it, then ends */
+    if(unlinker_running) {
+        pthread_mutex_lock(&unlink_mutex);
+        unlinker_stop = 1;
+        pthread_cond_signal(&unlink_cond);
+        pthread_mutex_unlock(&unlink_mutex);
+        pthread_join(unlinker, NULL);
+        unlinker_running = 0;
+    }
+    while((name = fifo_pop(&ring)) != NULL)
+        free(name);
+    free(ring.names);
+    free(doomed.names);
 }
 
 /******************************************************************************
@@ -143,54 +238,108 @@ int check_for_filename(const struct dirent *entry)
 }
 
 /******************************************************************************
-Description.: delete oldest files, just keep "size" most recent files
-              This funtion MAY delete the wrong files if the time is not valid
-Input Value.: how many files to keep
-Return Value: -
+Description.: deletes the files handed over by maintain_ringbuffer(), so the
+              worker thread does not wait for the file system. When stopped
+              it deletes those left before it ends.
+Input Value.: unused argument
+Return Value: NULL
 ******************************************************************************/
-void maintain_ringbuffer(int size)
+void *unlink_thread(void *arg)
 {
-    struct dirent **namelist;
-    int n, i;
-    char buffer[1<<16];
+    char *name;
 
-    /* do nothing if ringbuffer is not set or wrong value is set */
-    if(size < 0) return;
+    pthread_mutex_lock(&unlink_mutex);
+    while(1) {
+        while(doomed.count == 0 && !unlinker_stop)
+            pthread_cond_wait(&unlink_cond, &unlink_mutex);
+        if((name = fifo_pop(&doomed)) == NULL)
+            break;
+        pthread_mutex_unlock(&unlink_mutex);
+
+        DBG("delete: %s\n", name);
+        if(unlink(name) == -1) {
+            perror("could not delete file");
+        }
+        free(name);
+
+        pthread_mutex_lock(&unlink_mutex);
+    }
+    pthread_mutex_unlock(&unlink_mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: fills the ringbuffer with the pictures already in the folder,
+              sorted by name and thus oldest first, and starts the unlink
+              thread. The folder is read only this once, from then on the
+              ringbuffer knows the files it wrote.
+              This funtion MAY sort the files wrong if the time is not valid
+Input Value.: -
+Return Value: 0 if OK, -1 on errors
+******************************************************************************/
+int seed_ringbuffer(void)
+{
+    struct dirent **namelist;
+    char buffer[1<<16], *name;
+    int n, i, rc = 0;
 
     /* get a sorted list of directory items */
     n = scandir(folder, &namelist, check_for_filename, alphasort);
     if(n < 0) {
         perror("scandir");
-        return;
+        return -1;
     }
 
     DBG("found %d directory entries\n", n);
 
-    /* delete the first (thus oldest) number of files */
-    for(i = 0; i < (n - size); i++) {
-
+    for(i = 0; i < n; i++) {
         /* put together the folder name and the directory item */
         snprintf(buffer, sizeof(buffer), "%s/%s", folder, namelist[i]->d_name);
-
-        DBG("delete: %s\n", buffer);
-
-        /* mark item for deletion */
-        if(unlink(buffer) == -1) {
-            perror("could not delete file");
+        if(rc == 0 && ((name = strdup(buffer)) == NULL || fifo_push(&ring, name) < 0)) {
+            free(name);
+            rc = -1;
         }
-
-        /* free allocated memory for name */
         free(namelist[i]);
     }
+    free(namelist);
 
-    /* keep the rest, but we still have to free every result */
-    for(i = MAX(n - size, 0); i < n; i++) {
-        DBG("keep: %s\n", namelist[i]->d_name);
-        free(namelist[i]);
+    if(rc == 0 && pthread_create(&unlinker, NULL, unlink_thread, NULL) != 0)
+        rc = -1;
+    unlinker_running = rc == 0;
+
+    return rc;
+}
+
+/******************************************************************************
+Description.: adds a file just written to the ringbuffer, once there are more
+              than "size" plus "ringbuffer_exceed" the oldest are handed to the
+              unlink thread, to keep just "size" most recent files
+Input Value.: the name of the file and how many files to keep
+Return Value: -
+******************************************************************************/
+void maintain_ringbuffer(const char *filename, int size)
+{
+    char *name;
+
+    /* do nothing if ringbuffer is not set or wrong value is set */
+    if(size < 0 || !unlinker_running) return;
+
+    if((name = strdup(filename)) == NULL || fifo_push(&ring, name) < 0) {
+        LOG("not enough memory\n");
+        free(name);
+        return;
     }
 
-    /* free last just allocated resources */
-    free(namelist);
+    if(ring.count <= size + MAX(ringbuffer_exceed, 0))
+        return;
+
+    /* the names move to the other fifo, the files are deleted meanwhile */
+    pthread_mutex_lock(&unlink_mutex);
+    while(ring.count > size && fifo_push(&doomed, ring.names[ring.first]) == 0)
+        fifo_pop(&ring);
+    pthread_cond_signal(&unlink_cond);
+    pthread_mutex_unlock(&unlink_mutex);
 }
 
 /******************************************************************************
@@ -202,45 +351,35 @@ Return Value:
 void *worker_thread(void *arg)
 {
     int ok = 1, frame_size = 0, rc = 0;
+    unsigned int seq = 0;
     char buffer1[1024] = {0}, buffer2[1024] = {0};
     unsigned long long counter = 0;
     time_t t;
     struct tm *now;
-    unsigned char *tmp_framebuffer = NULL;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
+    /* learn the pictures of the ringbuffer, those in the folder already */
+    if(events == NULL && mjpgFileName == NULL && ringbuffer_size >= 0 && seed_ringbuffer() < 0) {
+        OPRINT("could not read the folder %s, no ringbuffer\n", folder);
+    }
+
     while(ok >= 0 && !pglobal->stop) {
         DBG("waiting for fresh frame\n");
 
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
-
-            frame = tmp_framebuffer;
+        /* take a reference to a fresh frame, instead of copying it */
+        if((frame = input_frame_wait(&pglobal->in[input_number], seq)) == NULL) {
+            LOG("not enough memory\n");
+            return NULL;
         }
+        seq = frame->seq;
+        frame_size = frame->size;
 
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-
-        if (mjpgFileName == NULL) { // single files with ringbuffer mode
+        if(events != NULL) { // event clips
+            /* keep a copy, the clip thread saves it if an event comes */
+            event_buffer_add(events, frame);
+        } else if (mjpgFileName == NULL) { // single files with ringbuffer mode
             /* prepare filename */
             memset(buffer1, 0, sizeof(buffer1));
             memset(buffer2, 0, sizeof(buffer2));
@@ -256,7 +395,7 @@ void *worker_thread(void *arg)
             /* prepare string, add time and date values */
             if(strftime(buffer1, sizeof(buffer1), "%%s/%Y_%m_%d_%H_%M_%S_picture_%%09llu.jpg", now) == 0) {
                 OPRINT("strftime returned 0\n");
-                free(frame); frame = NULL;
+                input_frame_release(frame); frame = NULL;
                 return NULL;
             }
 
@@ -274,7 +413,7 @@ void *worker_thread(void *arg)
             }
 
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame_size) < 0) {
                 OPRINT("could not write to file %s\n", buffer2);
                 perror("write()");
                 close(fd);
@@ -302,28 +441,19 @@ void *worker_thread(void *arg)
                 }
             }
 
-            /*
-             * maintain ringbuffer
-             * do not maintain ringbuffer for each picture, this saves resources since
-             * each run of the maintainance function involves sorting/malloc/free operations
-             */
-            if(ringbuffer_exceed <= 0) {
-                /* keep ringbuffer excactly at specified siOUTPUT_PLUGIN_NAMEze */
-                maintain_ringbuffer(ringbuffer_size);
-            } else if(counter == 1 || counter % (ringbuffer_exceed + 1) == 0) {
-                DBG("counter: %llu, will clean-up now\n", counter);
-                maintain_ringbuffer(ringbuffer_size);
-            }
+            /* maintain ringbuffer, buffer2 still contains the filename */
+            maintain_ringbuffer(buffer2, ringbuffer_size);
         } else { // recording to MJPG file
-            /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
-                OPRINT("could not write to file %s\n", buffer2);
-                perror("write()");
-                close(fd);
-                return NULL;
+            /* save picture to the write-behind buffers of the recording */
+            if(recorder_write(rec, frame) < 0) {
+                OPRINT("could not write to file %s: %s\n", mjpgFileName, strerror(errno));
+                ok = -1;
             }
         }
 
+        input_frame_release(frame);
+        frame = NULL;
+
         /* if specified, wait now */
         if(delay > 0) {
             usleep(1000 * delay);
@@ -378,6 +508,12 @@ int output_init(output_parameter *param, int id)
             {"input", required_argument, 0, 0},
             {"m", required_argument, 0, 0},
             {"mjpeg", required_argument, 0, 0},
+            {"p", required_argument, 0, 0},
+            {"pre", required_argument, 0, 0},
+            {"a", required_argument, 0, 0},
+            {"post", required_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"buffer", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -443,6 +579,24 @@ int output_init(output_parameter *param, int id)
             DBG("case 12,13\n");
             mjpgFileName = strdup(optarg);
             break;
+            /* p, pre */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            event_pre = MAX(atoi(optarg), 0);
+            break;
+            /* a, post */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            event_post = MAX(atoi(optarg), 0);
+            break;
+            /* b, buffer */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            event_memory = MAX(atoi(optarg), 1);
+            break;
         }
     }
 
@@ -454,7 +608,13 @@ int output_init(output_parameter *param, int id)
     OPRINT("output folder.....: %s\n", folder);
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
     OPRINT("delay after save..: %d\n", delay);
-    if  (mjpgFileName == NULL) {
+    if(event_pre >= 0) {
+        OPRINT("event clips.......: %d s before to %d s after, %d MB\n", event_pre, event_post, event_memory);
+        if((events = event_buffer_new(folder, event_pre, event_post, event_memory)) == NULL) {
+            OPRINT("could not allocate %d MB for event clips\n", event_memory);
+            return 1;
+        }
+    } else if  (mjpgFileName == NULL) {
         if(ringbuffer_size > 0) {
             OPRINT("ringbuffer size...: %d to %d\n", ringbuffer_size, ringbuffer_size + ringbuffer_exceed);
         } else {
@@ -465,17 +625,17 @@ int output_init(output_parameter *param, int id)
         sprintf(fnBuffer, "%s/%s", folder, mjpgFileName);
 
         OPRINT("output file.......: %s\n", fnBuffer);
-        if((fd = open(fnBuffer, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
-            OPRINT("could not open the file %s\n", fnBuffer);
+        if((rec = recorder_open(fnBuffer)) == NULL) {
+            OPRINT("could not open the file %s: %s\n", fnBuffer, strerror(errno));
             free(fnBuffer);
             return 1;
         }
         free(fnBuffer);
     }
 
-    param->global->out[id].parametercount = 2;
+    param->global->out[id].parametercount = 3;
 
-    param->global->out[id].out_parameters = (control*) calloc(2, sizeof(control));
+    param->global->out[id].out_parameters = (control*) calloc(3, sizeof(control));
 
     control take_ctrl;
 	take_ctrl.group = IN_CMD_GENERIC;
@@ -509,12 +669,29 @@ int output_init(output_parameter *param, int id)
 
 	param->global->out[id].out_parameters[1] = filename_ctrl;
 
+    control trigger_ctrl;
+	trigger_ctrl.group = IN_CMD_GENERIC;
+	trigger_ctrl.menuitems = NULL;
+	trigger_ctrl.value = 1;
+	trigger_ctrl.class_id = 0;
+
+	trigger_ctrl.ctrl.id = OUT_FILE_CMD_TRIGGER;
+	trigger_ctrl.ctrl.type = V4L2_CTRL_TYPE_BUTTON;
+	strcpy((char*) trigger_ctrl.ctrl.name, "Trigger event");
+	trigger_ctrl.ctrl.minimum = 0;
+	trigger_ctrl.ctrl.maximum = 1;
+	trigger_ctrl.ctrl.step = 1;
+	trigger_ctrl.ctrl.default_value = 0;
+
+	param->global->out[id].out_parameters[2] = trigger_ctrl;
+
 
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function stops the worker thread
+Description.: calling this function stops the worker thread, it is joined
+              so a recording is complete when this returns
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
@@ -522,6 +699,7 @@ int output_stop(int id)
 {
     DBG("will cancel worker thread\n");
     pthread_cancel(worker);
+    pthread_join(worker, NULL);
     return 0;
 }
 
@@ -534,7 +712,6 @@ int output_run(int id)
 {
     DBG("launching worker thread\n");
     pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
     return 0;
 }
 
@@ -550,35 +727,12 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
 					switch(control_id) {
                             case OUT_FILE_CMD_TAKE: {
                                 if (valueStr != NULL) {
-                                    int frame_size = 0;
-                                    unsigned char *tmp_framebuffer = NULL;
-
-                                    if(pthread_mutex_lock(&pglobal->in[input_number].db)) {
-                                        DBG("Unable to lock mutex\n");
+                                    /* the latest frame; the worker thread may hold another */
+                                    input_frame *latest = input_frame_get_any(&pglobal->in[input_number]);
+                                    if(latest == NULL) {
+                                        LOG("not enough memory\n");
                                         return -1;
                                     }
-                                    /* read buffer */
-                                    frame_size = pglobal->in[input_number].size;
-
-                                    /* check if buffer for frame is large enough, increase it if necessary */
-                                    if(frame_size > max_frame_size) {
-                                        DBG("increasing buffer size to %d\n", frame_size);
-
-                                        max_frame_size = frame_size + (1 << 16);
-                                        if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                                            pthread_mutex_unlock(&pglobal->in[input_number].db);
-                                            LOG("not enough memory\n");
-                                            return -1;
-                                        }
-
-                                        frame = tmp_framebuffer;
-                                    }
-
-                                    /* copy frame to our local buffer now */
-                                    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-                                    /* allow others to access the global buffer again */
-                                    pthread_mutex_unlock(&pglobal->in[input_number].db);
 
                                     DBG("writing file: %s\n", valueStr);
 
@@ -586,18 +740,21 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                     /* open file for write */
                                     if((fd = open(valueStr, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
                                         OPRINT("could not open the file %s\n", valueStr);
+                                        input_frame_release(latest);
                                         return -1;
                                     }
 
                                     /* save picture to file */
-                                    if(write(fd, frame, frame_size) < 0) {
+                                    if(write(fd, latest->buf, latest->size) < 0) {
                                         OPRINT("could not write to file %s\n", valueStr);
                                         perror("write()");
                                         close(fd);
+                                        input_frame_release(latest);
                                         return -1;
                                     }
 
                                     close(fd);
+                                    input_frame_release(latest);
                                 } else {
                                     DBG("No filename specified\n");
                                     return -1;
@@ -607,6 +764,17 @@ int output_cmd(int plugin_id, unsigned int control_id, unsigned int group, int v
                                 DBG("Not yet implemented\n");
                                 return -1;
                             } break;
+                            case OUT_FILE_CMD_TRIGGER: {
+                                /* the clip is named after the time, valueStr is not a name here */
+                                if(events == NULL) {
+                                    DBG("No event clips, see --pre\n");
+                                    return -1;
+                                }
+                                if(event_buffer_trigger(events) < 0) {
+                                    LOG("not enough memory\n");
+                                    return -1;
+                                }
+                            } break;
                             default: {
                                 DBG("Unknown command\n");
                                 return -1;
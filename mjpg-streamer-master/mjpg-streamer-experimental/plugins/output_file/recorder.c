@@ -0,0 +1,777 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * Recording of frames to one file, either just the JPEGs one after the other
+ * or, for a file name ending with .mkv, as Matroska with the capture time of
+ * each frame and an index of all frames, so players can seek in it.
+ *
+ * The frames are collected in write-behind buffers, which a thread of the
+ * recording writes to the file, so the thread recording them never waits
+ * for the disk unless all buffers are full.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../../utils.h"
+#include "../../mjpg_streamer.h"
+#include "recorder.h"
+
+/* the Matroska elements used, see https://www.matroska.org/technical/elements.html */
+#define MKV_EBML                0x1A45DFA3
+#define MKV_EBML_VERSION        0x4286
+#define MKV_EBML_READ_VERSION   0x42F7
+#define MKV_EBML_MAX_ID_LENGTH  0x42F2
+#define MKV_EBML_MAX_SIZE_LENGTH 0x42F3
+#define MKV_DOC_TYPE            0x4282
+#define MKV_DOC_TYPE_VERSION    0x4287
+#define MKV_DOC_TYPE_READ_VERSION 0x4285
+#define MKV_SEGMENT             0x18538067
+#define MKV_SEEK_HEAD           0x114D9B74
+#define MKV_SEEK                0x4DBB
+#define MKV_SEEK_ID             0x53AB
+#define MKV_SEEK_POSITION       0x53AC
+#define MKV_INFO                0x1549A966
+#define MKV_TIMECODE_SCALE      0x2AD7B1
+#define MKV_MUXING_APP          0x4D80
+#define MKV_WRITING_APP         0x5741
+#define MKV_DATE_UTC            0x4461
+#define MKV_DURATION            0x4489
+#define MKV_TRACKS              0x1654AE6B
+#define MKV_TRACK_ENTRY         0xAE
+#define MKV_TRACK_NUMBER        0xD7
+#define MKV_TRACK_UID           0x73C5
+#define MKV_TRACK_TYPE          0x83
+#define MKV_FLAG_LACING         0x9C
+#define MKV_CODEC_ID            0x86
+#define MKV_VIDEO               0xE0
+#define MKV_PIXEL_WIDTH         0xB0
+#define MKV_PIXEL_HEIGHT        0xBA
+#define MKV_CLUSTER             0x1F43B675
+#define MKV_TIMECODE            0xE7
+#define MKV_SIMPLE_BLOCK        0xA3
+#define MKV_CUES                0x1C53BB6B
+#define MKV_CUE_POINT           0xBB
+#define MKV_CUE_TIME            0xB3
+#define MKV_CUE_TRACK_POSITIONS 0xB7
+#define MKV_CUE_TRACK           0xF7
+#define MKV_CUE_CLUSTER_POSITION 0xF1
+#define MKV_CUE_RELATIVE_POSITION 0xF0
+#define MKV_VOID                0xEC
+
+/* a size not known yet, for the segment until the recording is closed */
+#define MKV_UNKNOWN_SIZE 0xFFFFFFFFFFFFFFULL
+
+/* the bytes of a cluster's ID, size and timecode, and of a block's header */
+#define MKV_CLUSTER_HEADER (4 + 8 + 1 + 1 + 8)
+#define MKV_BLOCK_HEADER (1 + 8 + 1 + 2 + 1)
+
+/* the bytes of each cue point, see recorder_cues() */
+#define MKV_CUE_POINT_SIZE (2 + 10 + 2 + 3 + 10 + 10)
+
+/* seconds from 1970 to 2001, when DateUTC starts */
+#define MKV_EPOCH 978307200ULL
+
+typedef struct {
+    unsigned char *data;
+    size_t size;                /* bytes filled */
+    size_t length;              /* bytes written, the rest is carried over */
+    size_t capacity;
+} rec_buffer;
+
+/* a frame of a Matroska recording, for the index */
+typedef struct {
+    uint64_t time;              /* milliseconds since the first frame */
+    uint64_t cluster;           /* position of its cluster in the segment */
+    uint64_t block;             /* of its block in the cluster's data */
+} rec_cue;
+
+struct _recorder {
+    int fd;
+    int matroska;
+
+    /* the write-behind buffers, see recorder_writer() */
+    pthread_t writer;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    rec_buffer buffers[RECORDER_BUFFERS];
+    int first, count;           /* queued for the writer, the oldest first */
+    int current;                /* filled by recorder_write() */
+    uint64_t offset;            /* file position of the current buffer */
+    int pending;                /* frames in it since it was last flushed */
+    uint64_t started;           /* milliseconds of the first of them */
+    int closing;
+    int error;                  /* errno of a failed write */
+    uint64_t written;           /* by the writer, see recorder_writer() */
+    uint64_t allocated;         /* reserved up to here, 0 once fallocate() failed */
+
+    /* Matroska */
+    unsigned long frames;
+    uint64_t base;              /* capture time of the first frame, usecs */
+    uint64_t last;              /* of the last frame, ms since the first */
+    unsigned char header[RECORDER_HEADER_SIZE]; /* patched when closing */
+    int header_size;
+    int segment_size_at, seek_head_at, duration_at, info_at, tracks_at;
+    uint64_t segment;           /* file position of the segment's data */
+    long cluster_at;            /* of the open cluster in the current buffer, or -1 */
+    rec_cue *cues;
+    unsigned long cue_capacity;
+};
+
+/******************************************************************************
+Description.: write EBML IDs, sizes and elements, as Matroska uses them
+Input Value.: p is where to write, the other values are what to write
+Return Value: the byte after the written ones
+******************************************************************************/
+static unsigned char *ebml_id(unsigned char *p, uint32_t id)
+{
+    if(id > 0xFFFFFF) *p++ = id >> 24;
+    if(id > 0xFFFF) *p++ = id >> 16;
+    if(id > 0xFF) *p++ = id >> 8;
+    *p++ = id;
+    return p;
+}
+
+/* as 8 bytes, so it can be patched later */
+static unsigned char *ebml_size8(unsigned char *p, uint64_t size)
+{
+    int i;
+
+    *p++ = 0x01;
+    for(i = 6; i >= 0; i--)
+        *p++ = size >> (8 * i);
+    return p;
+}
+
+static unsigned char *ebml_size(unsigned char *p, uint64_t size)
+{
+    int n = 1, i;
+
+    while(n < 8 && size >= (1ULL << (7 * n)) - 1)
+        n++;
+    for(i = n - 1; i >= 0; i--)
+        *p++ = (i == n - 1 ? 0x80 >> (n - 1) : 0) | (unsigned char)(size >> (8 * i));
+    return p;
+}
+
+/* an unsigned integer of width bytes, or as few as it takes if width is 0 */
+static unsigned char *ebml_uint(unsigned char *p, uint32_t id, uint64_t value, int width)
+{
+    int i;
+
+    if(width == 0)
+        for(width = 1; width < 8 && (value >> (8 * width)) != 0; width++)
+            ;
+    p = ebml_id(p, id);
+    p = ebml_size(p, width);
+    for(i = width - 1; i >= 0; i--)
+        *p++ = value >> (8 * i);
+    return p;
+}
+
+static unsigned char *ebml_double(unsigned char *p, uint32_t id, double value)
+{
+    union {
+        double d;
+        uint64_t u;
+    } v;
+    int i;
+
+    v.d = value;
+    p = ebml_id(p, id);
+    p = ebml_size(p, 8);
+    for(i = 7; i >= 0; i--)
+        *p++ = v.u >> (8 * i);
+    return p;
+}
+
+static unsigned char *ebml_string(unsigned char *p, uint32_t id, const char *s)
+{
+    int size = strlen(s);
+
+    p = ebml_id(p, id);
+    p = ebml_size(p, size);
+    memcpy(p, s, size);
+    return p + size;
+}
+
+/* the start of an element holding others, ebml_end() sets its size */
+static unsigned char *ebml_master(unsigned char *p, uint32_t id, unsigned char **size_at)
+{
+    p = ebml_id(p, id);
+    *size_at = p;
+    return ebml_size8(p, 0);
+}
+
+static void ebml_end(unsigned char *size_at, unsigned char *end)
+{
+    ebml_size8(size_at, end - size_at - 8);
+}
+
+/******************************************************************************
+Description.: find the size of a JPEG in its start of frame segment
+Input Value.: buf and size of the JPEG, width and height are set
+Return Value: -
+******************************************************************************/
+static void jpeg_dimensions(const unsigned char *buf, int size, int *width, int *height)
+{
+    int i = 2, marker;
+
+    *width = *height = 0;
+    while(i + 4 <= size && buf[i] == 0xFF) {
+        marker = buf[i + 1];
+        if(marker == 0xFF) {
+            i++;
+            continue;
+        }
+        if(marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) {
+            i += 2;
+            continue;
+        }
+        if(marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if(i + 9 <= size) {
+                *height = buf[i + 5] << 8 | buf[i + 6];
+                *width = buf[i + 7] << 8 | buf[i + 8];
+            }
+            return;
+        }
+        if(marker == 0xDA)
+            return;
+        i += 2 + (buf[i + 2] << 8 | buf[i + 3]);
+    }
+}
+
+/******************************************************************************
+Description.: the capture time of a frame, or now if the input did not set it
+Input Value.: the frame
+Return Value: microseconds
+******************************************************************************/
+static uint64_t frame_time(input_frame *frame)
+{
+    struct timeval tv = frame->timestamp;
+
+    if(tv.tv_sec == 0 && tv.tv_usec == 0)
+        gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/******************************************************************************
+Description.: writes the queued buffers to the file, oldest first. Disk space
+              is reserved ahead of them, so a long recording is not scattered
+              over the disk along with whatever else is written meanwhile.
+Input Value.: the recording
+Return Value: NULL
+******************************************************************************/
+static void *recorder_writer(void *arg)
+{
+    recorder *rec = arg;
+    rec_buffer *b;
+    size_t done;
+    ssize_t n;
+    int error;
+
+    pthread_mutex_lock(&rec->mutex);
+    while(1) {
+        while(rec->count == 0 && !rec->closing)
+            pthread_cond_wait(&rec->cond, &rec->mutex);
+        if(rec->count == 0)
+            break;
+        b = &rec->buffers[rec->first];
+        error = rec->error;
+        pthread_mutex_unlock(&rec->mutex);
+
+        /* after a failed write, the rest is dropped rather than written */
+        if(error == 0) {
+            if(rec->allocated != 0 && rec->written + b->length > rec->allocated) {
+                if(fallocate(rec->fd, FALLOC_FL_KEEP_SIZE, rec->written, b->length + RECORDER_PREALLOCATE) == 0) {
+                    rec->allocated = rec->written + b->length + RECORDER_PREALLOCATE;
+                } else {
+                    DBG("fallocate() failed, not reserving space any more: %s\n", strerror(errno));
+                    rec->allocated = 0;
+                }
+            }
+
+            for(done = 0; done < b->length; done += n) {
+                n = pwrite(rec->fd, b->data + done, b->length - done, rec->written + done);
+                if(n < 0 && errno == EINTR) {
+                    n = 0;
+                } else if(n <= 0) {
+                    error = n < 0 ? errno : ENOSPC;
+                    break;
+                }
+            }
+            rec->written += b->length;
+        }
+
+        pthread_mutex_lock(&rec->mutex);
+        if(error != 0 && rec->error == 0)
+            rec->error = error;
+        rec->first = (rec->first + 1) % RECORDER_BUFFERS;
+        rec->count--;
+        pthread_cond_broadcast(&rec->cond);
+    }
+    pthread_mutex_unlock(&rec->mutex);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: closes the open cluster of a Matroska recording, its size is
+              known now
+Input Value.: the recording
+Return Value: -
+******************************************************************************/
+static void recorder_close_cluster(recorder *rec)
+{
+    rec_buffer *b = &rec->buffers[rec->current];
+
+    if(rec->cluster_at < 0)
+        return;
+    ebml_end(b->data + rec->cluster_at + 4, b->data + b->size);
+    rec->cluster_at = -1;
+}
+
+/******************************************************************************
+Description.: queues the current buffer for the writer and takes the next.
+              The bytes after the last RECORDER_ALIGN boundary are carried
+              over to the next buffer, so each write starts and ends on it.
+Input Value.: the recording, last is set to write all of it
+Return Value: -
+******************************************************************************/
+static void recorder_flush(recorder *rec, int last)
+{
+    rec_buffer *b = &rec->buffers[rec->current], *next;
+    uint64_t end = rec->offset + b->size;
+    size_t carry;
+
+    recorder_close_cluster(rec);
+    rec->pending = 0;
+
+    if(!last)
+        end &= ~(uint64_t)(RECORDER_ALIGN - 1);
+    if(end <= rec->offset)
+        return;
+    b->length = end - rec->offset;
+
+    pthread_mutex_lock(&rec->mutex);
+    rec->count++;
+    pthread_cond_broadcast(&rec->cond);
+    while(rec->count == RECORDER_BUFFERS)
+        pthread_cond_wait(&rec->cond, &rec->mutex);
+    rec->current = (rec->first + rec->count) % RECORDER_BUFFERS;
+    pthread_mutex_unlock(&rec->mutex);
+
+    next = &rec->buffers[rec->current];
+    carry = b->size - b->length;
+    memcpy(next->data, b->data + b->length, carry);
+    next->size = carry;
+    rec->offset = end;
+}
+
+/******************************************************************************
+Description.: makes room for size bytes in the current buffer, by flushing it
+              or by growing it for a frame larger than a buffer
+Input Value.: the recording and the bytes needed
+Return Value: 0 if there is room, -1 if there is not enough memory
+******************************************************************************/
+static int recorder_reserve(recorder *rec, size_t size)
+{
+    rec_buffer *b = &rec->buffers[rec->current];
+    void *data;
+
+    if(b->size + size <= b->capacity)
+        return 0;
+
+    recorder_flush(rec, 0);
+    b = &rec->buffers[rec->current];
+    if(b->size + size <= b->capacity)
+        return 0;
+
+    if(posix_memalign(&data, RECORDER_ALIGN, b->size + size) != 0)
+        return -1;
+    memcpy(data, b->data, b->size);
+    free(b->data);
+    b->data = data;
+    b->capacity = b->size + size;
+    return 0;
+}
+
+static int recorder_append(recorder *rec, const void *data, size_t size)
+{
+    rec_buffer *b;
+
+    if(recorder_reserve(rec, size) < 0)
+        return -1;
+    b = &rec->buffers[rec->current];
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+    return 0;
+}
+
+/******************************************************************************
+Description.: builds the header of a Matroska recording, the EBML header and
+              the start of the segment with room for the seek head, the info
+              and the track of the JPEGs
+Input Value.: the recording and its first frame
+Return Value: -
+******************************************************************************/
+static void recorder_header(recorder *rec, input_frame *frame)
+{
+    unsigned char *p = rec->header, *size_at, *track_at, *video_at, *seek_at;
+    struct timeval now;
+    int width, height, i;
+
+    jpeg_dimensions(frame->buf, frame->size, &width, &height);
+    gettimeofday(&now, NULL);
+
+    p = ebml_master(p, MKV_EBML, &size_at);
+    p = ebml_uint(p, MKV_EBML_VERSION, 1, 0);
+    p = ebml_uint(p, MKV_EBML_READ_VERSION, 1, 0);
+    p = ebml_uint(p, MKV_EBML_MAX_ID_LENGTH, 4, 0);
+    p = ebml_uint(p, MKV_EBML_MAX_SIZE_LENGTH, 8, 0);
+    p = ebml_string(p, MKV_DOC_TYPE, "matroska");
+    p = ebml_uint(p, MKV_DOC_TYPE_VERSION, 4, 0);
+    p = ebml_uint(p, MKV_DOC_TYPE_READ_VERSION, 2, 0);
+    ebml_end(size_at, p);
+
+    p = ebml_id(p, MKV_SEGMENT);
+    rec->segment_size_at = p - rec->header;
+    p = ebml_size8(p, MKV_UNKNOWN_SIZE);
+    rec->segment = p - rec->header;
+
+    /* the seek head is written when closing, until then a void element
+       keeps the room of its seeks to the info, the tracks and the cues */
+    rec->seek_head_at = p - rec->header;
+    p = ebml_master(p, MKV_SEEK_HEAD, &size_at);
+    for(i = 0; i < 3; i++) {
+        p = ebml_master(p, MKV_SEEK, &seek_at);
+        p = ebml_uint(p, MKV_SEEK_ID, MKV_INFO, 4);
+        p = ebml_uint(p, MKV_SEEK_POSITION, 0, 8);
+        ebml_end(seek_at, p);
+    }
+    memset(rec->header + rec->seek_head_at, 0, p - (rec->header + rec->seek_head_at));
+    rec->header[rec->seek_head_at] = MKV_VOID;
+    ebml_size8(rec->header + rec->seek_head_at + 1, p - (rec->header + rec->seek_head_at) - 9);
+
+    rec->info_at = p - rec->header;
+    p = ebml_master(p, MKV_INFO, &size_at);
+    p = ebml_uint(p, MKV_TIMECODE_SCALE, 1000000, 0);
+    p = ebml_string(p, MKV_MUXING_APP, "mjpg-streamer");
+    p = ebml_string(p, MKV_WRITING_APP, "mjpg-streamer output_file");
+    p = ebml_uint(p, MKV_DATE_UTC, (now.tv_sec - MKV_EPOCH) * 1000000000ULL + now.tv_usec * 1000ULL, 8);
+    rec->duration_at = p - rec->header;
+    p = ebml_double(p, MKV_DURATION, 0);
+    ebml_end(size_at, p);
+
+    rec->tracks_at = p - rec->header;
+    p = ebml_master(p, MKV_TRACKS, &size_at);
+    p = ebml_master(p, MKV_TRACK_ENTRY, &track_at);
+    p = ebml_uint(p, MKV_TRACK_NUMBER, 1, 0);
+    p = ebml_uint(p, MKV_TRACK_UID, (now.tv_sec << 20 ^ now.tv_usec) | 1, 0);
+    p = ebml_uint(p, MKV_TRACK_TYPE, 1, 0);
+    p = ebml_uint(p, MKV_FLAG_LACING, 0, 0);
+    p = ebml_string(p, MKV_CODEC_ID, "V_MJPEG");
+    p = ebml_master(p, MKV_VIDEO, &video_at);
+    p = ebml_uint(p, MKV_PIXEL_WIDTH, width, 0);
+    p = ebml_uint(p, MKV_PIXEL_HEIGHT, height, 0);
+    ebml_end(video_at, p);
+    ebml_end(track_at, p);
+    ebml_end(size_at, p);
+
+    rec->header_size = p - rec->header;
+}
+
+/******************************************************************************
+Description.: appends a frame to a Matroska recording as a block of the open
+              cluster, or of a new one, and adds it to the index
+Input Value.: the recording, the frame and its time since the first frame
+Return Value: 0 if OK, -1 if there is not enough memory
+******************************************************************************/
+static int recorder_block(recorder *rec, input_frame *frame, uint64_t time)
+{
+    unsigned char *p, *start;
+    rec_buffer *b;
+    rec_cue *cue;
+    int16_t relative;
+
+    if(rec->frames == rec->cue_capacity) {
+        rec->cue_capacity = rec->cue_capacity ? rec->cue_capacity * 2 : 1024;
+        cue = realloc(rec->cues, rec->cue_capacity * sizeof(rec_cue));
+        if(cue == NULL)
+            return -1;
+        rec->cues = cue;
+    }
+
+    if(recorder_reserve(rec, MKV_CLUSTER_HEADER + MKV_BLOCK_HEADER + frame->size) < 0)
+        return -1;
+    b = &rec->buffers[rec->current];
+
+    if(rec->cluster_at < 0) {
+        rec->cluster_at = b->size;
+        p = ebml_id(b->data + b->size, MKV_CLUSTER);
+        p = ebml_size8(p, 0);
+        p = ebml_uint(p, MKV_TIMECODE, time, 8);
+        b->size = p - b->data;
+        rec->started = time;
+    }
+
+    cue = &rec->cues[rec->frames];
+    cue->time = time;
+    cue->cluster = rec->offset + rec->cluster_at - rec->segment;
+    cue->block = b->size - (rec->cluster_at + 12);
+
+    start = b->data + b->size;
+    p = ebml_id(start, MKV_SIMPLE_BLOCK);
+    p = ebml_size8(p, 4 + frame->size);
+    *p++ = 0x81;                        /* track 1 */
+    relative = time - rec->started;
+    *p++ = relative >> 8;
+    *p++ = relative;
+    *p++ = 0x80;                        /* a key frame */
+    memcpy(p, frame->buf, frame->size);
+    b->size += p - start + frame->size;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: appends the index of a Matroska recording, a cue point for
+              each frame, with its cluster and where its block is in it
+Input Value.: the recording
+Return Value: -
+******************************************************************************/
+static void recorder_cues(recorder *rec)
+{
+    unsigned char buffer[MKV_CUE_POINT_SIZE], *p;
+    unsigned long i;
+
+    /* the cue points are smaller than a buffer, so there is always room */
+    p = ebml_id(buffer, MKV_CUES);
+    p = ebml_size8(p, (uint64_t)rec->frames * MKV_CUE_POINT_SIZE);
+    recorder_append(rec, buffer, p - buffer);
+
+    for(i = 0; i < rec->frames; i++) {
+        p = ebml_id(buffer, MKV_CUE_POINT);
+        p = ebml_size(p, MKV_CUE_POINT_SIZE - 2);
+        p = ebml_uint(p, MKV_CUE_TIME, rec->cues[i].time, 8);
+        p = ebml_id(p, MKV_CUE_TRACK_POSITIONS);
+        p = ebml_size(p, 3 + 10 + 10);
+        p = ebml_uint(p, MKV_CUE_TRACK, 1, 1);
+        p = ebml_uint(p, MKV_CUE_CLUSTER_POSITION, rec->cues[i].cluster, 8);
+        p = ebml_uint(p, MKV_CUE_RELATIVE_POSITION, rec->cues[i].block, 8);
+        recorder_append(rec, buffer, p - buffer);
+    }
+}
+
+/******************************************************************************
+Description.: creates a recording, a file name ending with .mkv records
+              Matroska, others the JPEGs one after the other
+Input Value.: the file name
+Return Value: the recording, or NULL with errno set
+******************************************************************************/
+recorder *recorder_open(const char *filename)
+{
+    recorder *rec;
+    const char *dot = strrchr(filename, '.');
+    int i, error;
+
+    if((rec = calloc(1, sizeof(recorder))) == NULL)
+        return NULL;
+    rec->matroska = dot != NULL && strcasecmp(dot, ".mkv") == 0;
+    rec->cluster_at = -1;
+    rec->allocated = 1;         /* reserve from the first write on */
+
+    for(i = 0; i < RECORDER_BUFFERS; i++) {
+        if(posix_memalign((void **)&rec->buffers[i].data, RECORDER_ALIGN, RECORDER_BUFFER_SIZE) != 0) {
+            error = ENOMEM;
+            goto fail;
+        }
+        rec->buffers[i].capacity = RECORDER_BUFFER_SIZE;
+    }
+
+    if((rec->fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
+        error = errno;
+        goto fail;
+    }
+
+    pthread_mutex_init(&rec->mutex, NULL);
+    pthread_cond_init(&rec->cond, NULL);
+    if((error = pthread_create(&rec->writer, NULL, recorder_writer, rec)) != 0) {
+        pthread_cond_destroy(&rec->cond);
+        pthread_mutex_destroy(&rec->mutex);
+        close(rec->fd);
+        goto fail;
+    }
+
+    return rec;
+
+fail:
+    for(i = 0; i < RECORDER_BUFFERS; i++)
+        free(rec->buffers[i].data);
+    free(rec);
+    errno = error;
+    return NULL;
+}
+
+/******************************************************************************
+Description.: adds a frame to a recording, the buffer it ends up in is written
+              once it is full or held frames for RECORDER_FLUSH_INTERVAL
+Input Value.: the recording and the frame
+Return Value: 0 if OK, -1 with errno set if writing failed or there is not
+              enough memory
+******************************************************************************/
+int recorder_write(recorder *rec, input_frame *frame)
+{
+    uint64_t usecs = frame_time(frame), time;
+    int rc = 0, state;
+
+    pthread_mutex_lock(&rec->mutex);
+    if(rec->error != 0) {
+        errno = rec->error;
+        rc = -1;
+    }
+    pthread_mutex_unlock(&rec->mutex);
+    if(rc < 0)
+        return rc;
+
+    /* the buffers are consistent again when this returns */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+    if(rec->frames == 0) {
+        rec->base = usecs;
+        if(rec->matroska) {
+            recorder_header(rec, frame);
+            rc = recorder_append(rec, rec->header, rec->header_size);
+        }
+    }
+
+    /* the time of the frames never goes back */
+    time = usecs > rec->base ? (usecs - rec->base) / 1000 : 0;
+    if(time < rec->last)
+        time = rec->last;
+
+    if(rec->pending > 0 && time - rec->started >= RECORDER_FLUSH_INTERVAL)
+        recorder_flush(rec, 0);
+
+    if(rc == 0) {
+        if(rec->matroska) {
+            rc = recorder_block(rec, frame, time);
+        } else {
+            if(rec->pending == 0)
+                rec->started = time;
+            rc = recorder_append(rec, frame->buf, frame->size);
+        }
+    }
+
+    if(rc == 0) {
+        rec->frames++;
+        rec->pending++;
+        rec->last = time;
+    } else {
+        errno = ENOMEM;
+    }
+
+    pthread_setcancelstate(state, NULL);
+    return rc;
+}
+
+/******************************************************************************
+Description.: writes the rest of a recording and closes it. A Matroska
+              recording gets its index, its duration and the seek head
+              pointing to them, a recording cut short is still playable
+              without them.
+Input Value.: the recording
+Return Value: 0 if OK, -1 with errno set if writing failed
+******************************************************************************/
+int recorder_close(recorder *rec)
+{
+    unsigned char *p, *size_at, *seek_at;
+    uint64_t positions[3], ids[3] = { MKV_INFO, MKV_TRACKS, MKV_CUES };
+    int i, error, state;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+    if(rec->matroska && rec->frames > 0) {
+        recorder_close_cluster(rec);
+        positions[0] = rec->info_at - rec->segment;
+        positions[1] = rec->tracks_at - rec->segment;
+        positions[2] = rec->offset + rec->buffers[rec->current].size - rec->segment;
+        recorder_cues(rec);
+    }
+    recorder_flush(rec, 1);
+
+    pthread_mutex_lock(&rec->mutex);
+    rec->closing = 1;
+    pthread_cond_broadcast(&rec->cond);
+    pthread_mutex_unlock(&rec->mutex);
+    pthread_join(rec->writer, NULL);
+    error = rec->error;
+
+    if(error == 0 && rec->matroska && rec->frames > 0) {
+        ebml_size8(rec->header + rec->segment_size_at, rec->offset - rec->segment);
+
+        p = ebml_master(rec->header + rec->seek_head_at, MKV_SEEK_HEAD, &size_at);
+        for(i = 0; i < 3; i++) {
+            p = ebml_master(p, MKV_SEEK, &seek_at);
+            p = ebml_uint(p, MKV_SEEK_ID, ids[i], 4);
+            p = ebml_uint(p, MKV_SEEK_POSITION, positions[i], 8);
+            ebml_end(seek_at, p);
+        }
+        ebml_end(size_at, p);
+
+        /* the last frame lasts as long as the ones before did on average */
+        ebml_double(rec->header + rec->duration_at, MKV_DURATION,
+                    rec->frames > 1 ? rec->last + (double)rec->last / (rec->frames - 1) : 0);
+
+        if(pwrite(rec->fd, rec->header, rec->header_size, 0) != rec->header_size)
+            error = errno ? errno : EIO;
+    }
+
+    /* releases the space reserved beyond the end */
+    if(error == 0 && ftruncate(rec->fd, rec->offset) < 0) {
+        DBG("ftruncate() failed: %s\n", strerror(errno));
+    }
+    if(close(rec->fd) < 0 && error == 0)
+        error = errno;
+
+    for(i = 0; i < RECORDER_BUFFERS; i++)
+        free(rec->buffers[i].data);
+    free(rec->cues);
+    pthread_cond_destroy(&rec->cond);
+    pthread_mutex_destroy(&rec->mutex);
+    free(rec);
+
+    pthread_setcancelstate(state, NULL);
+    errno = error;
+    return error == 0 ? 0 : -1;
+}
@@ -0,0 +1,51 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+/* size of each write-behind buffer, and how many of them there are */
+#define RECORDER_BUFFER_SIZE (1024*1024)
+#define RECORDER_BUFFERS 4
+
+/* writes start and end on this boundary, but for the last one */
+#define RECORDER_ALIGN 4096
+
+/* bytes of disk space reserved ahead of the recording with fallocate() */
+#define RECORDER_PREALLOCATE (32*1024*1024)
+
+/*
+ * milliseconds of frames a buffer holds at most before it is written, this
+ * is also the longest cluster of a Matroska recording
+ */
+#define RECORDER_FLUSH_INTERVAL 1000
+
+/* room for the header of a Matroska recording, see recorder_header() */
+#define RECORDER_HEADER_SIZE 512
+
+typedef struct _recorder recorder;
+
+recorder *recorder_open(const char *filename);
+int recorder_write(recorder *rec, input_frame *frame);
+int recorder_close(recorder *rec);
+
+#endif
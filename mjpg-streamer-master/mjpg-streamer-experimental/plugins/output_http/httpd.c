@@ -28,18 +28,27 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <signal.h>
 #include <sys/socket.h>
-#include <sys/select.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <netdb.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 #include <linux/version.h>
 #include <linux/types.h>          /* for videodev2.h */
 #include <linux/videodev2.h>
+#include <linux/errqueue.h>
 
 #include "../../mjpg_streamer.h"
 #include "../../utils.h"
@@ -52,22 +61,29 @@
 
 #include "../output_file/output_file.h"
 
+/* MSG_ZEROCOPY came with Linux 4.14, older headers may lack it */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+/* since Linux 3.12 */
+#ifndef TCP_NOTSENT_LOWAT
+#define TCP_NOTSENT_LOWAT 25
+#endif
 
 static globals *pglobal;
 extern context servers[MAX_OUTPUT_PLUGINS];
 int piggy_fine = 2; // FIXME make it command line parameter
 
-/******************************************************************************
-Description.: initializes the iobuffer structure properly
-Input Value.: pointer to already allocated iobuffer
-Return Value: iobuf
-******************************************************************************/
-void init_iobuffer(iobuffer *iobuf)
-{
-    memset(iobuf->buffer, 0, sizeof(iobuf->buffer));
-    iobuf->level = 0;
-}
-
 /******************************************************************************
 Description.: initializes the request structure properly
 Input Value.: pointer to already allocated req
@@ -79,6 +95,12 @@ void init_request(request *req)
     req->parameter   = NULL;
     req->client      = NULL;
     req->credentials = NULL;
+    req->query_string = NULL;
+    req->if_none_match = NULL;
+    req->frame_seq = 0;
+    req->http_minor = 0;
+    req->keep_alive = 0;
+    req->has_body = 0;
 }
 
 /******************************************************************************
@@ -93,104 +115,32 @@ void free_request(request *req)
     if(req->client != NULL) free(req->client);
     if(req->credentials != NULL) free(req->credentials);
     if(req->query_string != NULL) free(req->query_string);
+    if(req->if_none_match != NULL) free(req->if_none_match);
 }
 
 /******************************************************************************
-Description.: read with timeout, implemented without using signals
-              tries to read len bytes and returns if enough bytes were read
-              or the timeout was triggered. In case of timeout the return
-              value may differ from the requested bytes "len".
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
-                         before storing values.
-              * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
-******************************************************************************/
-int _read(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
-{
-    int copied = 0, rc, i;
-    fd_set fds;
-    struct timeval tv;
-
-    memset(buffer, 0, len);
-
-    while((copied < len)) {
-        i = MIN(iobuf->level, len - copied);
-        memcpy(buffer + copied, iobuf->buffer + IO_BUFFER - iobuf->level, i);
-
-        iobuf->level -= i;
-        copied += i;
-        if(copied >= len)
-            return copied;
-
-        /* select will return in case of timeout or new data arrived */
-        tv.tv_sec = timeout;
-        tv.tv_usec = 0;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        if((rc = select(fd + 1, &fds, NULL, NULL, &tv)) <= 0) {
-            if(rc < 0)
-                exit(EXIT_FAILURE);
-
-            /* this must be a timeout */
-            return copied;
-        }
-
-        init_iobuffer(iobuf);
-
-        /*
-         * there should be at least one byte, because select signalled it.
-         * But: It may happen (very seldomly), that the socket gets closed remotly between
-         * the select() and the following read. That is the reason for not relying
-         * on reading at least one byte.
-         */
-        if((iobuf->level = read(fd, &iobuf->buffer, IO_BUFFER)) <= 0) {
-            /* an error occured */
-            return -1;
-        }
-
-        /* align data to the end of the buffer if less than IO_BUFFER bytes were read */
-        memmove(iobuf->buffer + (IO_BUFFER - iobuf->level), iobuf->buffer, iobuf->level);
-    }
-
-    return 0;
-}
-
-/******************************************************************************
-Description.: Read a single line from the provided fildescriptor.
-              This funtion will return under two conditions:
-              * line end was reached
-              * timeout occured
-Input Value.: * fd.....: fildescriptor to read from
-              * iobuf..: iobuffer that allows to use this functions from multiple
-                         threads because the complete context is the iobuffer.
-              * buffer.: The buffer to store values at, will be set to zero
+Description.: Copy the next line of a request. The event loop has read the
+              whole request header before it was handed to a worker; what
+              the client sent after it belongs to its next request.
+Input Value.: * conn...: the connection holding the request
+              * pos....: offset of the line in the request, advanced to the
+                         next line
+              * buffer.: The buffer to store the line at, will be set to zero
                          before storing values.
               * len....: the length of buffer
-              * timeout: seconds to wait for an answer
-Return Value: * buffer.: will become filled with bytes read
-              * iobuf..: May get altered to save the context for future calls.
-              * func().: bytes copied to buffer or -1 in case of error
+Return Value: bytes copied to buffer, 0 at the end of the request
 ******************************************************************************/
-/* read just a single line or timeout */
-int _readline(int fd, iobuffer *iobuf, void *buffer, size_t len, int timeout)
+static int request_line(connection *conn, int *pos, char *buffer, size_t len)
 {
-    char c = '\0', *out = buffer;
-    int i;
+    int i = 0;
+    char c = '\0';
+    int end = (conn->request_end > 0) ? conn->request_end : conn->request_size;
 
     memset(buffer, 0, len);
 
-    for(i = 0; i < len && c != '\n'; i++) {
-        if(_read(fd, iobuf, &c, 1, timeout) <= 0) {
-            /* timeout or error occured */
-            return -1;
-        }
-        *out++ = c;
+    while(i < len && c != '\n' && *pos < end) {
+        c = conn->request[(*pos)++];
+        buffer[i++] = c;
     }
 
     return i;
@@ -307,6 +257,8 @@ int unescape(char *string)
 
 #ifdef MANAGMENT
 
+struct _client_infos client_infos;
+
 /******************************************************************************
 Description.: Adds a new client information struct to the ino list.
 Input Value.: Client IP address as a string
@@ -342,6 +294,10 @@ client_info *add_client(char *address)
 
     strcpy(current_client_info->address, address);
     memset(&(current_client_info->last_take_time), 0, sizeof(struct timeval)); // set last time to zero
+    current_client_info->fps = 0;
+    current_client_info->latency = 0;
+    current_client_info->frames_sent = 0;
+    current_client_info->frames_skipped = 0;
 
     client_infos.infos = realloc(client_infos.infos, (client_infos.client_count + 1) * sizeof(client_info*));
     client_infos.infos[client_infos.client_count] = current_client_info;
@@ -392,302 +348,514 @@ void update_client_timestamp(client_info *client)
     memcpy(&client->last_take_time, &tim, sizeof(struct timeval));
     pthread_mutex_unlock(&client_infos.mutex);
 }
-#endif
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a single JPG-frame.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Store how the latest stream of a client is delivered, for
+              send_clients_JSON()
+Input Value.: * client.........: the client, or NULL
+              * fps............: frames sent per second
+              * latency........: milliseconds from a frame arriving to being
+                                 sent
+              * frames_sent....: frames sent in all
+              * frames_skipped.: newer frames replaced them this often
 Return Value: -
 ******************************************************************************/
-void send_snapshot(cfd *context_fd, int input_number)
+void update_client_stats(client_info *client, double fps, double latency, unsigned long frames_sent, unsigned long frames_skipped)
 {
-    unsigned char *frame = NULL;
-    int frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    if(client == NULL)
+        return;
+    pthread_mutex_lock(&client_infos.mutex);
+    client->fps = fps;
+    client->latency = latency;
+    client->frames_sent = frames_sent;
+    client->frames_skipped = frames_skipped;
+    pthread_mutex_unlock(&client_infos.mutex);
+}
+#endif
 
-    /* wait for a fresh frame */
-    pthread_mutex_lock(&pglobal->in[input_number].db);
-    pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Send the status line and header of an answer, and its body if
+              given. The Connection header tells the client whether the
+              connection is kept for its next request, and Content-Length
+              where the body ends.
+Input Value.: * context_fd.: the client
+              * status.....: the status, like "200 OK"
+              * headers....: the other header lines, each ending with "\r\n"
+              * body.......: the body, or NULL if the caller sends it
+              * length.....: the length of the body
+Return Value: 0 if ok, -1 if it could not be sent and the connection is not
+              kept
+******************************************************************************/
+static int send_answer(cfd *context_fd, const char *status, const char *headers, const char *body, size_t length)
+{
+    char buffer[BUFFER_SIZE];
+    struct iovec iov[2];
+    ssize_t size;
+
+    context_fd->answered = 1;
+    snprintf(buffer, sizeof(buffer), "HTTP/1.%d %s\r\n" \
+             "Connection: %s\r\n" \
+             "%s" \
+             "Content-Length: %zu\r\n" \
+             "\r\n", context_fd->http_minor, status,
+             context_fd->keep_alive ? "keep-alive" : "close", headers, length);
+
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = strlen(buffer);
+    iov[1].iov_base = (void *)body;
+    iov[1].iov_len = (body != NULL) ? length : 0;
+    size = iov[0].iov_len + iov[1].iov_len;
+
+    /* blocking, so it was sent unless it failed or timed out */
+    if(writev(context_fd->fd, iov, (body != NULL) ? 2 : 1) != size) {
+        DBG("writev failed\n");
+        context_fd->keep_alive = 0;
+        return -1;
+    }
+    return 0;
+}
 
-    /* read buffer */
-    frame_size = pglobal->in[input_number].size;
+/******************************************************************************
+Description.: Tell if a client polling for snapshots has the frame already,
+              by the ETag it got with it or by its X-Frame-Seq
+Input Value.: * req....: the request of the client, or NULL
+              * etag...: the ETag of the frame
+              * seq....: its seq, 0 if it has none
+Return Value: 1 if the client has the frame, 0 otherwise
+******************************************************************************/
+static int snapshot_unchanged(request *req, const char *etag, unsigned int seq)
+{
+    if(req == NULL || seq == 0)
+        return 0;
+    if(req->frame_seq == seq)
+        return 1;
+    if(req->if_none_match != NULL &&
+       (strchr(req->if_none_match, '*') != NULL || strstr(req->if_none_match, etag) != NULL))
+        return 1;
+    return 0;
+}
 
-    /* allocate a buffer for this single frame */
-    if((frame = malloc(frame_size + 1)) == NULL) {
-        free(frame);
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-        send_error(context_fd->fd, 500, "not enough memory");
+/******************************************************************************
+Description.: Send a complete HTTP response and a single JPG-frame.
+              The frame is sent from the ring of the input, so the clients
+              polling at the same time share it rather than copies. A client
+              that has the frame already gets "304 Not Modified" without it.
+Input Value.: * context_fd...: the client
+              * input_number.: the input to take the frame from
+              * req..........: the request, for its conditional headers, or
+                               NULL to send the frame in any case
+Return Value: -
+******************************************************************************/
+void send_snapshot(cfd *context_fd, int input_number, request *req)
+{
+    input_frame *frame;
+    char headers[BUFFER_SIZE] = {0};
+    char etag[64] = {0}, tags[160] = {0};
+    int unchanged, state;
+
+    /* take the latest frame, waiting only if there is none yet, and hold it
+       while sending; an input may never send one, so the server may cancel
+       the worker while it waits */
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &state);
+    frame = input_frame_wait(&pglobal->in[input_number], 0);
+    pthread_setcancelstate(state, NULL);
+    if(frame == NULL) {
+        send_error(context_fd, 500, "not enough memory");
         return;
     }
-    /* copy v4l2_buffer timeval to user space */
-    timestamp = pglobal->in[input_number].timestamp;
-
-    memcpy(frame, pglobal->in[input_number].buf, frame_size);
-    DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-    pthread_mutex_unlock(&pglobal->in[input_number].db);
+    DBG("got frame (size: %d kB)\n", frame->size / 1024);
 
     #ifdef MANAGMENT
     update_client_timestamp(context_fd->client);
     #endif
 
-    /* write the response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Access-Control-Allow-Origin: *\r\n" \
-            STD_HEADER \
-            "Content-type: image/jpeg\r\n" \
-            "X-Timestamp: %d.%06d\r\n" \
-            "\r\n", (int) timestamp.tv_sec, (int) timestamp.tv_usec);
-
-    /* send header and image now */
-    if (write(context_fd->fd, buffer, strlen(buffer)) < 0 ||
-        write(context_fd->fd, frame, frame_size) < 0) {
-        free(frame);
-        return;
+    /* only frames of the ring have a seq, private copies are always sent */
+    if(frame->seq != 0) {
+        snprintf(etag, sizeof(etag), "\"%lx-%d-%u\"", context_fd->pc->etag_base, input_number, frame->seq);
+        snprintf(tags, sizeof(tags), "ETag: %s\r\nX-Frame-Seq: %u\r\n", etag, frame->seq);
     }
+    unchanged = snapshot_unchanged(req, etag, frame->seq);
+
+    snprintf(headers, sizeof(headers), "Access-Control-Allow-Origin: *\r\n" \
+             "Access-Control-Expose-Headers: ETag, X-Frame-Seq, X-Timestamp\r\n" \
+             SNAPSHOT_HEADER \
+             "Content-type: image/jpeg\r\n" \
+             "%s" \
+             "X-Timestamp: %d.%06d\r\n", tags,
+             (int) frame->timestamp.tv_sec, (int) frame->timestamp.tv_usec);
+
+    /* send header and image at once, a 304 has the length of the image
+       but not the image */
+    if(unchanged)
+        send_answer(context_fd, "304 Not Modified", headers, NULL, frame->size);
+    else
+        send_answer(context_fd, "200 OK", headers, (char *)frame->buf, frame->size);
+
+    input_frame_release(frame);
+}
 
-    free(frame);
+/******************************************************************************
+Description.: Seconds of CLOCK_MONOTONIC, for the timeouts
+Input Value.: -
+Return Value: seconds
+******************************************************************************/
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
 }
 
 /******************************************************************************
-Description.: Send a complete HTTP response and a stream of JPG-frames.
-Input Value.: fildescriptor fd to send the answer to
+Description.: Microseconds of CLOCK_MONOTONIC, for the delivery statistics
+Input Value.: -
+Return Value: microseconds
+******************************************************************************/
+static uint64_t monotonic_usecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/******************************************************************************
+Description.: Queue data to send to a connection
+Input Value.: * conn...: the connection
+              * data...: what to send, it must stay valid until sent
+              * size...: its length
+              * frame..: the frame data points into, released once sent, or
+                         NULL
+              * shared.: 1 if data is the part header of pc->parts rendered
+                         for the frame of the next segment
 Return Value: -
 ******************************************************************************/
-void send_stream(cfd *context_fd, int input_number)
+static void out_append(connection *conn, const char *data, int size, input_frame *frame, int shared)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    out_segment *seg = &conn->out[(conn->out_first + conn->out_count) % OUT_SEGMENTS];
+
+    memset(seg, 0, sizeof(*seg));
+    seg->data = data;
+    seg->size = size;
+    seg->frame = frame;
+    seg->shared = shared;
+    /* conn->header is rewritten for the next frame */
+    seg->zerocopy = (data != conn->header);
+    conn->out_count++;
+}
 
-    DBG("preparing header\n");
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Access-Control-Allow-Origin: *\r\n" \
-            STD_HEADER \
-            "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
-            "\r\n" \
-            "--" BOUNDARY "\r\n");
-
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
-        return;
+/******************************************************************************
+Description.: Release the frame or copy a segment holds
+Input Value.: seg is the segment
+Return Value: -
+******************************************************************************/
+static void out_release(out_segment *seg)
+{
+    if(seg->frame != NULL)
+        input_frame_release(seg->frame);
+    free(seg->copy);
+    memset(seg, 0, sizeof(*seg));
+}
+
+/******************************************************************************
+Description.: Release everything queued for a connection
+Input Value.: conn is the connection
+Return Value: -
+******************************************************************************/
+static void out_clear(connection *conn)
+{
+    while(conn->out_count > 0) {
+        out_release(&conn->out[conn->out_first]);
+        conn->out_first = (conn->out_first + 1) % OUT_SEGMENTS;
+        conn->out_count--;
     }
+    conn->out_offset = 0;
+}
 
-    DBG("Headers send, sending stream now\n");
+/******************************************************************************
+Description.: Prepare a connection for streaming JPG-frames and queue the
+              HTTP response header. The event loop sends the frames once the
+              connection is handed to it.
+Input Value.: * conn.........: the connection, with a worker
+              * input_number.: the input plugin to stream from
+              * wxp..........: 1 for the format of WebcamXP
+Return Value: -
+******************************************************************************/
+static void stream_start(connection *conn, int input_number, int wxp)
+{
+    conn->input_number = input_number;
+    conn->wxp = wxp;
 
-    while(!pglobal->stop) {
+    DBG("preparing header\n");
+    if(!wxp) {
+        sprintf(conn->header, "HTTP/1.0 200 OK\r\n" \
+                "Access-Control-Allow-Origin: *\r\n" \
+                STD_HEADER \
+                "Content-Type: multipart/x-mixed-replace;boundary=" BOUNDARY "\r\n" \
+                "\r\n" \
+                "--" BOUNDARY "\r\n");
+    } else {
+        time_t curDate, expiresDate;
+        char curDateBuffer[80];
+        char expDateBuffer[80];
+
+        curDate = time(NULL);
+        expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
+        strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
+        strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
+        sprintf(conn->header, "HTTP/1.1 200 OK\r\n" \
+                "Connection: keep-alive\r\n" \
+                "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
+                "Content-Length: 9999999\r\n" \
+                "Cache-control: no-cache, must revalidate\r\n" \
+                "Date: %s\r\n" \
+                "Expires: %s\r\n" \
+                "Pragma: no-cache\r\n" \
+                "Server: webcamXP\r\n"
+                "\r\n",
+                curDateBuffer,
+                expDateBuffer);
+    }
+    out_append(conn, conn->header, strlen(conn->header), NULL, 0);
+}
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Render the multipart header of a frame of the ring, unless it
+              was already, and note when the event loop saw the frame
+Input Value.: * pc.............: the server context
+              * input_number...: the input of the frame
+              * frame..........: the frame, held by the caller
+Return Value: the part, valid while the frame is held
+******************************************************************************/
+static stream_part *stream_part_render(context *pc, int input_number, input_frame *frame)
+{
+    /*
+     * only the event loop touches the parts, and a slot keeps its frame
+     * while a client holds it
+     */
+    stream_part *part = &pc->parts[input_number][frame - pglobal->in[input_number].frames];
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    if(part->seq == frame->seq)
+        return part;
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+    /*
+     * print the individual mimetype and the length
+     * sending the content-length fixes random stream disruption observed
+     * with firefox
+     */
+    sprintf(part->header, "Content-Type: image/jpeg\r\n" \
+            "Content-Length: %d\r\n" \
+            "X-Timestamp: %d.%06d\r\n" \
+            "\r\n", frame->size, (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec);
+    part->size = strlen(part->header);
+    part->seq = frame->seq;
+    part->arrived = monotonic_usecs();
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
+    return part;
+}
 
-            frame = tmp;
+/******************************************************************************
+Description.: Queue the latest frame of the input for a streaming client,
+              unless it was queued already. The frame is referenced, not
+              copied, and so is its part header, which is rendered once for
+              all clients. Frames published while the client was still
+              taking the last one are skipped, so a slow client gets fewer
+              frames rather than older ones.
+Input Value.: conn is the connection, its queue must be empty
+Return Value: 1 if a frame was queued, 0 if there is none newer, -1 if out
+              of memory
+******************************************************************************/
+static int stream_queue_frame(connection *conn)
+{
+    input *in = &pglobal->in[conn->input_number];
+    unsigned int updates = __atomic_load_n(&conn->pc->updates[conn->input_number], __ATOMIC_ACQUIRE);
+    input_frame *frame = input_frame_get(in);
+    stream_part *part = NULL;
+
+    if(frame != NULL) {
+        if(frame->seq == conn->seq) {
+            input_frame_release(frame);
+            return 0;
         }
+        if(conn->seq != 0 && frame->seq > conn->seq + 1)
+            conn->frames_skipped += frame->seq - conn->seq - 1;
+        conn->seq = frame->seq;
+        part = stream_part_render(conn->pc, conn->input_number, frame);
+        conn->frame_arrived = part->arrived;
+    } else {
+        /* an input plugin that doesn't publish to the ring */
+        if(updates == conn->updates)
+            return 0;
+        if((frame = input_frame_get_any(in)) == NULL)
+            return -1;
+        conn->frame_arrived = monotonic_usecs();
+    }
+    conn->updates = updates;
+    conn->frame_unsent = 1;
+    DBG("got frame (size: %d kB)\n", frame->size / 1024);
 
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
-
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
+    #ifdef MANAGMENT
+    update_client_timestamp(conn->client);
+    #endif
 
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    if(conn->wxp) {
+        char *header = (part != NULL) ? part->wxp_header : conn->header;
 
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
+        if(part == NULL || part->wxp_seq != frame->seq) {
+            memset(header, 0, 50*sizeof(char));
+            sprintf(header, "mjpeg %07d12345", frame->size);
+            if(part != NULL)
+                part->wxp_seq = frame->seq;
+        }
+        out_append(conn, header, 50, NULL, part != NULL);
+        out_append(conn, (const char *)frame->buf, frame->size, frame, 0);
+        return 1;
+    }
 
-        /*
-         * print the individual mimetype and the length
-         * sending the content-length fixes random stream disruption observed
-         * with firefox
-         */
-        sprintf(buffer, "Content-Type: image/jpeg\r\n" \
+    if(part != NULL) {
+        out_append(conn, part->header, part->size, NULL, 1);
+    } else {
+        sprintf(conn->header, "Content-Type: image/jpeg\r\n" \
                 "Content-Length: %d\r\n" \
                 "X-Timestamp: %d.%06d\r\n" \
-                "\r\n", frame_size, (int)timestamp.tv_sec, (int)timestamp.tv_usec);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
-
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
-
-        DBG("sending boundary\n");
-        sprintf(buffer, "\r\n--" BOUNDARY "\r\n");
-        if(write(context_fd->fd, buffer, strlen(buffer)) < 0) break;
+                "\r\n", frame->size, (int)frame->timestamp.tv_sec, (int)frame->timestamp.tv_usec);
+        out_append(conn, conn->header, strlen(conn->header), NULL, 0);
     }
+    out_append(conn, (const char *)frame->buf, frame->size, frame, 0);
+    out_append(conn, "\r\n--" BOUNDARY "\r\n", strlen("\r\n--" BOUNDARY "\r\n"), NULL, 0);
 
-    free(frame);
+    return 1;
 }
 
-#ifdef WXP_COMPAT
 /******************************************************************************
-Description.: Sends a mjpg stream in the same format as the WebcamXP does
-Input Value.: fildescriptor fd to send the answer to
-Return Value: -
+Description.: Replace the frame queued for a client whose socket was backed
+              up with the newest one, if none of it was sent yet. This way a
+              client that can't keep up gets the latest frame once its
+              socket takes data again, rather than the one it had waiting.
+Input Value.: conn is the connection, in the event loop
+Return Value: 0 if ok, -1 if out of memory
 ******************************************************************************/
-void send_stream_wxp(cfd *context_fd, int input_number)
+static int stream_skip_stale(connection *conn)
 {
-    unsigned char *frame = NULL, *tmp = NULL;
-    int frame_size = 0, max_frame_size = 0;
-    char buffer[BUFFER_SIZE] = {0};
-    struct timeval timestamp;
+    input_frame *frame;
 
-    DBG("preparing header\n");
+    if(!conn->frame_unsent)
+        return 0;
 
-    time_t curDate, expiresDate;
-    curDate = time(NULL);
-    expiresDate = curDate - 1380; // teh expires date is before the current date with 23 minute (1380) sec
-
-    char curDateBuffer[80];
-    char expDateBuffer[80];
-
-    strftime(curDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&curDate));
-    strftime(expDateBuffer, 80, "%a, %d %b %Y %H:%M:%S %Z", localtime(&expiresDate));
-    sprintf(buffer, "HTTP/1.1 200 OK\r\n" \
-                    "Connection: keep-alive\r\n" \
-                    "Content-Type: multipart/x-mixed-replace; boundary=--myboundary\r\n" \
-                    "Content-Length: 9999999\r\n" \
-                    "Cache-control: no-cache, must revalidate\r\n" \
-                    "Date: %s\r\n" \
-                    "Expires: %s\r\n" \
-                    "Pragma: no-cache\r\n" \
-                    "Server: webcamXP\r\n"
-                    "\r\n",
-                    curDateBuffer,
-                    expDateBuffer);
-
-    if(write(context_fd->fd, buffer, strlen(buffer)) < 0) {
-        free(frame);
-        return;
+    /* input plugins that don't publish to the ring have only the latest */
+    if((frame = input_frame_get(&pglobal->in[conn->input_number])) == NULL)
+        return 0;
+    if(frame->seq == conn->seq) {
+        input_frame_release(frame);
+        return 0;
     }
+    input_frame_release(frame);
 
-    DBG("Headers send, sending stream now\n");
-
-    while(!pglobal->stop) {
+    DBG("skipping stale frame #%u\n", conn->seq);
+    out_clear(conn);
+    conn->frames_skipped++;
+    return (stream_queue_frame(conn) < 0) ? -1 : 0;
+}
 
-        /* wait for fresh frames */
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+/******************************************************************************
+Description.: Keep a frame sent with MSG_ZEROCOPY until the kernel is done
+              with it, see connection_zerocopy_done()
+Input Value.: * conn...: the connection
+              * seg....: the segment of the frame, which gives up its
+                         reference
+Return Value: -
+******************************************************************************/
+static void zerocopy_hold(connection *conn, out_segment *seg)
+{
+    zerocopy_frame *zf;
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+    /* there was room when it was sent, and it was the only frame queued */
+    if(conn->zerocopy_count == ZEROCOPY_FRAMES)
+        return;
+    zf = &conn->zerocopy_frames[(conn->zerocopy_first + conn->zerocopy_count) % ZEROCOPY_FRAMES];
+    zf->frame = seg->frame;
+    zf->id = seg->zerocopy_id;
+    conn->zerocopy_count++;
+    seg->frame = NULL;
+}
 
-        /* check if framebuffer is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+/******************************************************************************
+Description.: Copy the unsent rest of the frames queued for a stalled client
+              out of the ring, with their part headers, so the input plugin
+              can reuse their slots.
+Input Value.: conn is the connection
+Return Value: 0 if ok, -1 if out of memory
+******************************************************************************/
+static int stream_detach_frames(connection *conn)
+{
+    int i;
 
-            max_frame_size = frame_size + TEN_K;
-            if((tmp = realloc(frame, max_frame_size)) == NULL) {
-                free(frame);
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                send_error(context_fd->fd, 500, "not enough memory");
-                return;
-            }
+    for(i = 0; i < conn->out_count; i++) {
+        out_segment *seg = &conn->out[(conn->out_first + i) % OUT_SEGMENTS];
+        int offset = (i == 0) ? conn->out_offset : 0;
 
-            frame = tmp;
+        if(seg->copy != NULL)
+            continue;
+        if(!seg->shared && (seg->frame == NULL || seg->frame->private_copy))
+            continue;
+        if((seg->copy = malloc(seg->size - offset)) == NULL)
+            return -1;
+        memcpy(seg->copy, seg->data + offset, seg->size - offset);
+        if(seg->frame != NULL) {
+            if(seg->zerocopy_sent)
+                zerocopy_hold(conn, seg);
+            if(seg->frame != NULL)
+                input_frame_release(seg->frame);
+            seg->frame = NULL;
         }
-
-        /* copy v4l2_buffer timeval to user space */
-        timestamp = pglobal->in[input_number].timestamp;
-
-        #ifdef MANAGMENT
-        update_client_timestamp(context_fd->client);
-        #endif
-
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-        DBG("got frame (size: %d kB)\n", frame_size / 1024);
-
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
-
-        memset(buffer, 0, 50*sizeof(char));
-        sprintf(buffer, "mjpeg %07d12345", frame_size);
-        DBG("sending intemdiate header\n");
-        if(write(context_fd->fd, buffer, 50) < 0) break;
-
-        DBG("sending frame\n");
-        if(write(context_fd->fd, frame, frame_size) < 0) break;
+        seg->data = seg->copy;
+        seg->size -= offset;
+        seg->zerocopy = 0;
+        seg->zerocopy_sent = 0;
+        if(i == 0)
+            conn->out_offset = 0;
     }
 
-    free(frame);
+    return 0;
 }
-#endif
 
 /******************************************************************************
 Description.: Send error messages and headers.
-Input Value.: * fd.....: is the filedescriptor to send the message to
+Input Value.: * context_fd: the client to send the message to
               * which..: HTTP error code, most popular is 404
               * message: append this string to the displayed response
 Return Value: -
 ******************************************************************************/
-void send_error(int fd, int which, char *message)
+void send_error(cfd *context_fd, int which, char *message)
 {
     char buffer[BUFFER_SIZE] = {0};
+    const char *status, *headers = "Content-type: text/plain\r\n" NOCACHE_HEADER;
 
     if(which == 401) {
-        sprintf(buffer, "HTTP/1.0 401 Unauthorized\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n" \
-                "\r\n" \
-                "401: Not Authenticated!\r\n" \
-                "%s", message);
+        status = "401 Unauthorized";
+        headers = "Content-type: text/plain\r\n" \
+                  NOCACHE_HEADER \
+                  "WWW-Authenticate: Basic realm=\"MJPG-Streamer\"\r\n";
+        snprintf(buffer, sizeof(buffer), "401: Not Authenticated!\r\n%s", message);
     } else if(which == 404) {
-        sprintf(buffer, "HTTP/1.0 404 Not Found\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "404: Not Found!\r\n" \
-                "%s", message);
+        status = "404 Not Found";
+        snprintf(buffer, sizeof(buffer), "404: Not Found!\r\n%s", message);
     } else if(which == 500) {
-        sprintf(buffer, "HTTP/1.0 500 Internal Server Error\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "500: Internal Server Error!\r\n" \
-                "%s", message);
+        status = "500 Internal Server Error";
+        snprintf(buffer, sizeof(buffer), "500: Internal Server Error!\r\n%s", message);
     } else if(which == 400) {
-        sprintf(buffer, "HTTP/1.0 400 Bad Request\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "400: Not Found!\r\n" \
-                "%s", message);
+        status = "400 Bad Request";
+        snprintf(buffer, sizeof(buffer), "400: Not Found!\r\n%s", message);
     } else if (which == 403) {
-        sprintf(buffer, "HTTP/1.0 403 Forbidden\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "403: Forbidden!\r\n" \
-                "%s", message);
+        status = "403 Forbidden";
+        snprintf(buffer, sizeof(buffer), "403: Forbidden!\r\n%s", message);
     } else {
-        sprintf(buffer, "HTTP/1.0 501 Not Implemented\r\n" \
-                "Content-type: text/plain\r\n" \
-                STD_HEADER \
-                "\r\n" \
-                "501: Not Implemented!\r\n" \
-                "%s", message);
+        status = "501 Not Implemented";
+        snprintf(buffer, sizeof(buffer), "501: Not Implemented!\r\n%s", message);
     }
 
-    if(write(fd, buffer, strlen(buffer)) < 0) {
-        DBG("write failed, done anyway\n");
-    }
+    send_answer(context_fd, status, headers, buffer, strlen(buffer));
 }
 
 /******************************************************************************
@@ -695,17 +863,19 @@ Description.: Send HTTP header and copy the content of a file. To keep things
               simple, just a single folder gets searched for the file. Just
               files with known extension and supported mimetype get served.
               If no parameter was given, the file "index.html" will be copied.
-Input Value.: * fd.......: filedescriptor to send data to
-              * id.......: specifies which server-context is the right one
+Input Value.: * context_fd: the client to send the file to
               * parameter: string that consists of the filename
 Return Value: -
 ******************************************************************************/
-void send_file(int id, int fd, char *parameter)
+void send_file(cfd *context_fd, char *parameter)
 {
     char buffer[BUFFER_SIZE] = {0};
     char *extension, *mimetype = NULL;
     int i, lfd;
-    config conf = servers[id].conf;
+    struct stat st;
+    off_t offset = 0;
+    ssize_t rc;
+    config conf = context_fd->pc->conf;
 
     /* in case no parameter was given */
     if(parameter == NULL || strlen(parameter) == 0)
@@ -721,7 +891,7 @@ void send_file(int id, int fd, char *parameter)
     }
 
     if(lastDot == 0) {
-        send_error(fd, 400, "No file extension found");
+        send_error(context_fd, 400, "No file extension found");
         return;
     } else {
         extension = parameter + lastDot;
@@ -738,7 +908,7 @@ void send_file(int id, int fd, char *parameter)
 
     /* in case of unknown mimetype or extension leave */
     if(mimetype == NULL) {
-        send_error(fd, 404, "MIME-TYPE not known");
+        send_error(context_fd, 404, "MIME-TYPE not known");
         return;
     }
 
@@ -752,25 +922,30 @@ void send_file(int id, int fd, char *parameter)
     /* try to open that file */
     if((lfd = open(buffer, O_RDONLY)) < 0) {
         DBG("file %s not accessible\n", buffer);
-        send_error(fd, 404, "Could not open file");
+        send_error(context_fd, 404, "Could not open file");
+        return;
+    }
+    if(fstat(lfd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        DBG("%s is no file\n", buffer);
+        send_error(context_fd, 404, "Could not open file");
+        close(lfd);
         return;
     }
     DBG("opened file: %s\n", buffer);
 
-    /* prepare HTTP header */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", mimetype);
-    i = strlen(buffer);
-
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    do {
-        if(write(fd, buffer, i) < 0) {
-            close(lfd);
-            return;
+    /* first transmit HTTP-header, afterwards let the kernel copy the file */
+    snprintf(buffer, sizeof(buffer), "Content-type: %s\r\n" NOCACHE_HEADER, mimetype);
+    if(send_answer(context_fd, "200 OK", buffer, NULL, st.st_size) < 0) {
+        close(lfd);
+        return;
+    }
+    while(offset < st.st_size) {
+        if((rc = sendfile(context_fd->fd, lfd, &offset, st.st_size - offset)) <= 0) {
+            /* the length sent is wrong now */
+            context_fd->keep_alive = 0;
+            break;
         }
-    } while((i = read(lfd, buffer, sizeof(buffer))) > 0);
+    }
 
     /* close file, job done */
     close(lfd);
@@ -778,20 +953,23 @@ void send_file(int id, int fd, char *parameter)
 
 /******************************************************************************
 Description.: Executes the specified CGI file if exists
-Input Value.: * fd...........: filedescriptor to send data to
-              * id...........: specifies which server-context is the right one
+Input Value.: * context_fd...: the client to send the output to
               * parameter....: the requested file name
               * query_string.: query parameters
 Return Value: -
 ******************************************************************************/
-void execute_cgi(int id, int fd, char *parameter, char *query_string)
+void execute_cgi(cfd *context_fd, char *parameter, char *query_string)
 {
     int lfd = 0, i;
     int buffer_length = 0;
     char *buffer = NULL;
     char fn_buffer[BUFFER_SIZE] = {0};
     FILE *f = NULL;
-    config conf = servers[id].conf;
+    config conf = context_fd->pc->conf;
+    int fd = context_fd->fd;
+
+    /* the script writes the header, so its end can't be told */
+    context_fd->keep_alive = 0;
 
     /* build the absolute path to the file */
     strncat(fn_buffer, conf.www_folder, sizeof(fn_buffer) - 1);
@@ -799,7 +977,7 @@ void execute_cgi(int id, int fd, char *parameter, char *query_string)
 
     if((lfd = open(fn_buffer, O_RDONLY)) < 0) {
         DBG("file %s not accessible\n", fn_buffer);
-        send_error(fd, 404, "Could not open file");
+        send_error(context_fd, 404, "Could not open file");
         return;
     }
 
@@ -834,7 +1012,7 @@ void execute_cgi(int id, int fd, char *parameter, char *query_string)
     f = popen(buffer, "r");
     if(f == NULL) {
         DBG("Unable to execute the requested CGI script\n");
-        send_error(fd, 403, "CGI script cannot be executed");
+        send_error(context_fd, 403, "CGI script cannot be executed");
         return;
     }
 
@@ -848,13 +1026,13 @@ void execute_cgi(int id, int fd, char *parameter, char *query_string)
 
 
 /******************************************************************************
-Description.: Perform a command specified by parameter. Send response to fd.
-Input Value.: * fd.......: filedescriptor to send HTTP response to.
+Description.: Perform a command specified by parameter. Send response to the
+              client.
+Input Value.: * context_fd: the client to send the HTTP response to.
               * parameter: contains the command and value as string.
-              * id.......: specifies which server-context to choose.
 Return Value: -
 ******************************************************************************/
-void command(int id, int fd, char *parameter)
+void command(cfd *context_fd, char *parameter)
 {
     char buffer[BUFFER_SIZE] = {0};
     char *command = NULL, *svalue = NULL, *value, *command_id_string;
@@ -865,7 +1043,7 @@ void command(int id, int fd, char *parameter)
     /* sanity check of parameter-string */
     if(parameter == NULL || strlen(parameter) >= 255 || strlen(parameter) == 0) {
         DBG("parameter string looks bad\n");
-        send_error(fd, 400, "Parameter-string of command does not look valid.");
+        send_error(context_fd, 400, "Parameter-string of command does not look valid.");
         return;
     }
 
@@ -882,7 +1060,7 @@ void command(int id, int fd, char *parameter)
     /* search for required variable "command" */
     if((command = strstr(parameter, "id=")) == NULL) {
         DBG("no command id specified\n");
-        send_error(fd, 400, "no GET variable \"id=...\" found, it is required to specify which command id to execute");
+        send_error(context_fd, 400, "no GET variable \"id=...\" found, it is required to specify which command id to execute");
         return;
     }
 
@@ -890,7 +1068,7 @@ void command(int id, int fd, char *parameter)
     command += strlen("id=");
     len = strspn(command, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_1234567890");
     if((command = strndup(command, len)) == NULL) {
-        send_error(fd, 500, "could not allocate memory");
+        send_error(context_fd, 500, "could not allocate memory");
         LOG("could not allocate memory\n");
         return;
     }
@@ -900,7 +1078,7 @@ void command(int id, int fd, char *parameter)
     len = strspn(command_id_string, "-1234567890");
     if((svalue = strndup(command_id_string, len)) == NULL) {
         if(command != NULL) free(command);
-        send_error(fd, 500, "could not allocate memory");
+        send_error(context_fd, 500, "could not allocate memory");
         LOG("could not allocate memory\n");
         return;
     }
@@ -914,7 +1092,7 @@ void command(int id, int fd, char *parameter)
         len = strspn(value, "-1234567890");
         if((svalue = strndup(value, len)) == NULL) {
             if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
+            send_error(context_fd, 500, "could not allocate memory");
             LOG("could not allocate memory\n");
             return;
         }
@@ -928,7 +1106,7 @@ void command(int id, int fd, char *parameter)
         len = strspn(value, "-1234567890");
         if((svalue = strndup(value, len)) == NULL) {
             if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
+            send_error(context_fd, 500, "could not allocate memory");
             LOG("could not allocate memory\n");
             return;
         }
@@ -942,7 +1120,7 @@ void command(int id, int fd, char *parameter)
         len = strspn(value, "-1234567890");
         if((svalue = strndup(value, len)) == NULL) {
             if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
+            send_error(context_fd, 500, "could not allocate memory");
             LOG("could not allocate memory\n");
             return;
         }
@@ -968,7 +1146,7 @@ void command(int id, int fd, char *parameter)
         len = strspn(value, "-1234567890");
         if((svalue = strndup(value, len)) == NULL) {
             if(command != NULL) free(command);
-            send_error(fd, 500, "could not allocate memory");
+            send_error(context_fd, 500, "could not allocate memory");
             LOG("could not allocate memory\n");
             return;
         }
@@ -1000,13 +1178,8 @@ void command(int id, int fd, char *parameter)
     }
 
     /* Send HTTP-response */
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: text/plain\r\n" \
-            STD_HEADER \
-            "\r\n" \
-            "%s: %d", command, res);
-
-    if(write(fd, buffer, strlen(buffer)) < 0) {
+    snprintf(buffer, sizeof(buffer), "%s: %d", command, res);
+    if(send_answer(context_fd, "200 OK", "Content-type: text/plain\r\n" NOCACHE_HEADER, buffer, strlen(buffer)) < 0) {
         DBG("write failed, done anyway\n");
     }
 
@@ -1015,295 +1188,322 @@ void command(int id, int fd, char *parameter)
 }
 
 /******************************************************************************
-Description.: Serve a connected TCP-client. This thread function is called
-              for each connect of a HTTP client like a webbrowser. It determines
-              if it is a valid HTTP request and dispatches between the different
-              response options.
-Input Value.: arg is the filedescriptor and server-context of the connected TCP
-              socket. It must have been allocated so it is freeable by this
-              thread function.
-Return Value: always NULL
+Description.: Split the request line, like "GET /?action=stream HTTP/1.1",
+              into its method, target and HTTP version. The line is changed
+              to hold the parts.
+Input Value.: * line...: the request line
+              * method.: set to the method
+              * target.: set to the path and query of the target
+              * minor..: set to 0 for HTTP/1.0, 1 for HTTP/1.1
+Return Value: 0 if ok, -1 if the line is malformed
 ******************************************************************************/
-/* thread for clients that connected to this server */
-void *client_thread(void *arg)
+static int request_parse_line(char *line, char **method, char **target, int *minor)
 {
-    int cnt;
-    char query_suffixed = 0;
-    int input_number = 0;
-    char buffer[BUFFER_SIZE] = {0}, *pb = buffer;
-    iobuffer iobuf;
-    request req;
-    cfd lcfd; /* local-connected-file-descriptor */
+    char *version;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    *method = line;
+    if((*target = strchr(line, ' ')) == NULL)
+        return -1;
+    *(*target)++ = '\0';
+
+    /* without a version it is a HTTP/1.0 client at best */
+    *minor = 0;
+    if((version = strchr(*target, ' ')) != NULL) {
+        *version++ = '\0';
+        if(strncmp(version, "HTTP/1.", strlen("HTTP/1.")) != 0 || !isdigit((unsigned char)version[strlen("HTTP/1.")]))
+            return -1;
+        *minor = (version[strlen("HTTP/1.")] != '0');
+    }
 
-    /* we really need the fildescriptor and it must be freeable by us */
-    if(arg != NULL) {
-        memcpy(&lcfd, arg, sizeof(cfd));
-        free(arg);
-    } else
-        return NULL;
+    /* the absolute form, "http://host/path", as sent to proxies */
+    if(**target != '/' && (*target = strstr(*target, "://")) != NULL)
+        *target = strchr(*target + strlen("://"), '/');
+    if(*target == NULL)
+        return -1;
+    return 0;
+}
 
-    /* initializes the structures */
-    init_iobuffer(&iobuf);
-    init_request(&req);
+/******************************************************************************
+Description.: The plugin number of a "_N" suffix, like in "snapshot_1"
+Input Value.: s points to where the suffix would be
+Return Value: N, or 0 without a suffix
+******************************************************************************/
+static int plugin_suffix(const char *s)
+{
+    if(s[0] != '_' || !isdigit((unsigned char)s[1]))
+        return 0;
+    return MIN(strtol(s + 1, NULL, 10), MAX_INPUT_PLUGINS);
+}
 
-    /* What does the client want to receive? Read the request. */
-    memset(buffer, 0, sizeof(buffer));
-    if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-        close(lcfd.fd);
-        return NULL;
+/******************************************************************************
+Description.: Copy the start of a string, as far as it has accepted
+              characters but at most 100 of them
+Input Value.: * s......: the string
+              * accept.: the accepted characters
+Return Value: the copy, to be freed
+******************************************************************************/
+static char *request_parameter(const char *s, const char *accept)
+{
+    size_t len = MIN(strspn(s, accept), 100);
+    char *parameter = malloc(len + 1);
+
+    if(parameter == NULL) {
+        exit(EXIT_FAILURE);
     }
+    memcpy(parameter, s, len);
+    parameter[len] = '\0';
+    return parameter;
+}
 
-    req.query_string = NULL;
+/******************************************************************************
+Description.: Determine what to deliver for the target of a request: set the
+              type of the request, and its parameter where it has one.
+Input Value.: * context_fd.: the client, errors are sent to it
+              * req........: the request
+              * method.....: its method
+              * target.....: its target, the path is cut off at the query
+Return Value: the plugin number of the target, or -1 if an error was sent
+******************************************************************************/
+static int request_route(cfd *context_fd, request *req, const char *method, char *target)
+{
+    const char *query_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./";
+    const char *file_chars = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890";
+    char *path = target, *query, *action, *rest = NULL;
+    size_t len;
+
+    if((query = strchr(target, '?')) != NULL)
+        *query++ = '\0';
+    len = strlen(path);
+
+    /* POST is for streams only, as some clients can't GET them */
+    if(strcmp(method, "POST") == 0 && strncmp(path, "/stream", strlen("/stream")) == 0) {
+        req->type = A_STREAM;
+        return plugin_suffix(path + strlen("/stream"));
+    }
+    if(strcmp(method, "GET") != 0) {
+        send_error(context_fd, 501, "only GET requests are supported");
+        return -1;
+    }
 
-    /* determine what to deliver */
-    if(strstr(buffer, "GET /?action=snapshot") != NULL) {
-        req.type = A_SNAPSHOT;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
+    /* the actions, "/?action=name_N&parameters" */
+    if(strcmp(path, "/") == 0 && query != NULL && strncmp(query, "action=", strlen("action=")) == 0) {
+        action = query + strlen("action=");
+        if(strncmp(action, "snapshot", strlen("snapshot")) == 0) {
+            req->type = A_SNAPSHOT;
+            rest = action + strlen("snapshot");
+        } else if(strncmp(action, "stream", strlen("stream")) == 0) {
+            req->type = A_STREAM;
+            rest = action + strlen("stream");
+        } else if(strncmp(action, "take", strlen("take")) == 0) {
+            req->type = A_TAKE;
+            rest = action + strlen("take");
+        } else if(strncmp(action, "command", strlen("command")) == 0) {
+            req->type = A_COMMAND;
+            rest = action + strlen("command");
         }
-        #endif
-    #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".jpg") != NULL)) {
-        req.type = A_SNAPSHOT_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    #endif
-    } else if(strstr(buffer, "POST /stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
-        }
-        #endif
-    } else if(strstr(buffer, "GET /?action=stream") != NULL) {
-        req.type = A_STREAM;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
+
+        if(req->type == A_TAKE || req->type == A_COMMAND) {
+            req->parameter = request_parameter(rest, query_chars);
+            if(unescape(req->parameter) == -1) {
+                send_error(context_fd, 500, "could not properly unescape command parameter string");
+                LOG("could not properly unescape command parameter string\n");
+                return -1;
+            }
+            DBG("command parameter: \"%s\"\n", req->parameter);
         }
-        #endif
+        if(rest != NULL)
+            return plugin_suffix(rest);
+    }
+
     #ifdef WXP_COMPAT
-    } else if((strstr(buffer, "GET /cam") != NULL) && (strstr(buffer, ".mjpg") != NULL)) {
-        req.type = A_STREAM_WXP;
-        query_suffixed = 255;
-        #ifdef MANAGMENT
-        if (check_client_status(lcfd.client)) {
-            req.type = A_UNKNOWN;
-            lcfd.client->last_take_time.tv_sec += piggy_fine;
-            send_error(lcfd.fd, 403, "frame already sent");
-            query_suffixed = 0;
+    /* "/cam_N.jpg" and "/cam_N.mjpg", the cameras count from 1 */
+    if(strncmp(path, "/cam", strlen("/cam")) == 0) {
+        if(len > strlen(".mjpg") && strcmp(path + len - strlen(".mjpg"), ".mjpg") == 0) {
+            req->type = A_STREAM_WXP;
+        } else if(len > strlen(".jpg") && strcmp(path + len - strlen(".jpg"), ".jpg") == 0) {
+            req->type = A_SNAPSHOT_WXP;
         }
-        #endif
-    #endif
-    } else if(strstr(buffer, "GET /?action=take") != NULL) {
-        int len;
-        req.type = A_TAKE;
-        query_suffixed = 255;
-
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=take")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            query_suffixed = 0;
-            return NULL;
-        }
-        pb += strlen("GET /?action=take"); // a pb points to thestring after the first & after command
-
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
+        if(req->type != A_UNKNOWN) {
+            if(path[strlen("/cam")] == '_')
+                return plugin_suffix(path + strlen("/cam")) - 1;
+            return 0;
         }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
-
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
-            LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
-        }
-    } else if((strstr(buffer, "GET /input") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_INPUT_JSON;
-        query_suffixed = 255;
-    } else if((strstr(buffer, "GET /output") != NULL) && (strstr(buffer, ".json") != NULL)) {
-        req.type = A_OUTPUT_JSON;
-        query_suffixed = 255;
-    } else if(strstr(buffer, "GET /program.json") != NULL) {
-        req.type = A_PROGRAM_JSON;
-    #ifdef MANAGMENT
-    } else if(strstr(buffer, "GET /clients.json") != NULL) {
-        req.type = A_CLIENTS_JSON;
+    }
     #endif
-    } else if(strstr(buffer, "GET /?action=command") != NULL) {
-        int len;
-        req.type = A_COMMAND;
 
-        /* advance by the length of known string */
-        if((pb = strstr(buffer, "GET /?action=command")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
+    /* "/input_N.json" and "/output_N.json", N is optional */
+    if(len > strlen(".json") && strcmp(path + len - strlen(".json"), ".json") == 0) {
+        if(strncmp(path, "/input", strlen("/input")) == 0) {
+            req->type = A_INPUT_JSON;
+            return plugin_suffix(path + strlen("/input"));
+        } else if(strncmp(path, "/output", strlen("/output")) == 0) {
+            req->type = A_OUTPUT_JSON;
+            return plugin_suffix(path + strlen("/output"));
+        } else if(strcmp(path, "/program.json") == 0) {
+            req->type = A_PROGRAM_JSON;
+            return 0;
+        #ifdef MANAGMENT
+        } else if(strcmp(path, "/clients.json") == 0) {
+            req->type = A_CLIENTS_JSON;
+            return 0;
+        #endif
         }
-        pb += strlen("GET /?action=command"); // a pb points to thestring after the first & after command
-
-        /* only accept certain characters */
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_-=&1234567890%./"), 0), 100);
+    }
 
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
+    DBG("try to serve a file\n");
+    req->type = A_FILE;
+    req->parameter = request_parameter(path + 1, file_chars);
+    if(strstr(path, ".cgi") != NULL) {
+        req->type = A_CGI;
+        if(query != NULL) {
+            req->query_string = request_parameter(query, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&");
+        } else {
+            req->query_string = strdup(" ");
         }
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
-
-        if(unescape(req.parameter) == -1) {
-            free(req.parameter);
-            send_error(lcfd.fd, 500, "could not properly unescape command parameter string");
-            LOG("could not properly unescape command parameter string\n");
-            close(lcfd.fd);
-            return NULL;
-        }
-
-        DBG("command parameter (len: %d): \"%s\"\n", len, req.parameter);
-    } else {
-        int len;
+    }
+    DBG("parameter: \"%s\"\n", req->parameter);
+    return 0;
+}
 
-        DBG("try to serve a file\n");
-        req.type = A_FILE;
+/******************************************************************************
+Description.: Cleanup handler of a worker cancelled answering a request
+Input Value.: arg is the request
+Return Value: -
+******************************************************************************/
+static void request_cleanup(void *arg)
+{
+    free_request((request *)arg);
+}
 
-        if((pb = strstr(buffer, "GET /")) == NULL) {
-            DBG("HTTP request seems to be malformed\n");
-            send_error(lcfd.fd, 400, "Malformed HTTP request");
-            close(lcfd.fd);
-            return NULL;
-        }
+/******************************************************************************
+Description.: Answer the request of a HTTP client like a webbrowser. A worker
+              thread calls this once the event loop has read the request. It
+              determines if it is a valid HTTP request and dispatches between
+              the different response options.
+              The connection is kept for the next request if the client
+              wants to, if it sent no body, and if the answer said where it
+              ends, see send_answer(); there is no keeping it otherwise.
+Input Value.: conn is the connection, its socket blocking while answering
+Return Value: 1 if the connection streams now and goes back to the event
+              loop, 2 if it is kept for the next request, 0 if it is done
+              and may be closed
+******************************************************************************/
+static int client_request(connection *conn)
+{
+    int pos = 0;
+    int input_number = 0;
+    int streaming = 0;
+    char line[BUFFER_SIZE] = {0}, buffer[BUFFER_SIZE] = {0};
+    char *method, *target, *name, *value;
+    request req;
+    cfd lcfd; /* local-connected-file-descriptor */
 
-        pb += strlen("GET /");
-        len = MIN(MAX(strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890"), 0), 100);
-        req.parameter = malloc(len + 1);
-        if(req.parameter == NULL) {
-            exit(EXIT_FAILURE);
-        }
+    lcfd.pc = conn->pc;
+    lcfd.fd = conn->fd;
+    lcfd.http_minor = 0;
+    lcfd.keep_alive = 0;
+    lcfd.answered = 0;
+    #ifdef MANAGMENT
+    lcfd.client = conn->client;
+    #endif
 
-        memset(req.parameter, 0, len + 1);
-        strncpy(req.parameter, pb, len);
+    /* initializes the structures */
+    init_request(&req);
+    conn->requests++;
 
-        if (strstr(pb, ".cgi") != NULL) {
-            req.type = A_CGI;
-            pb = strchr(pb, '?');
-            if (pb != NULL) {
-                pb++; // skip the ?
-                len = strspn(pb, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-1234567890=&");
-                req.query_string = malloc(len + 1);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                strncpy(req.query_string, pb, len);
-            } else {
-                req.query_string = malloc(2);
-                if (req.query_string == NULL)
-                    exit(EXIT_FAILURE);
-                sprintf(req.query_string, " ");
-            }
-        }
-        DBG("parameter (len: %d): \"%s\"\n", len, req.parameter);
+    /* What does the client want to receive? Look at the request. */
+    if(request_line(conn, &pos, line, sizeof(line) - 1) == 0) {
+        return 0;
     }
-
-    /*
-     * Since when we are working with multiple input plugins
-     * there are some url which could have a _[plugin number suffix]
-     * For compatibility reasons it could be left in that case the output will be
-     * generated from the 0. input plugin
-     */
-    if(query_suffixed) {
-        char *sch = strchr(buffer, '_');
-        if(sch != NULL) {  // there is an _ in the url so the input number should be present
-            DBG("Suffix character: %s\n", sch + 1); // FIXME if more than 10 input plugin is added
-            char numStr[3];
-            memset(numStr, 0, 3);
-            strncpy(numStr, sch + 1, 1);
-            input_number = atoi(numStr);
-
-            if ((req.type == A_SNAPSHOT_WXP) || (req.type == A_STREAM_WXP)) { // webcamxp adds offset to the camera number
-                input_number--;
-            }
-        }
-        DBG("plugin_no: %d\n", input_number);
+    if(request_parse_line(line, &method, &target, &req.http_minor) < 0) {
+        DBG("HTTP request seems to be malformed\n");
+        send_error(&lcfd, 400, "Malformed HTTP request");
+        return 0;
     }
+    lcfd.http_minor = req.http_minor;
+    req.keep_alive = req.http_minor;
 
     /*
      * parse the rest of the HTTP-request
      * the end of the request-header is marked by a single, empty line with "\r\n"
      */
-    do {
-        memset(buffer, 0, sizeof(buffer));
-
-        if((cnt = _readline(lcfd.fd, &iobuf, buffer, sizeof(buffer) - 1, 5)) == -1) {
-            free_request(&req);
-            close(lcfd.fd);
-            return NULL;
-        }
-
-        if(strcasestr(buffer, "User-Agent: ") != NULL) {
-            req.client = strdup(buffer + strlen("User-Agent: "));
-        } else if(strcasestr(buffer, "Authorization: Basic ") != NULL) {
-            req.credentials = strdup(buffer + strlen("Authorization: Basic "));
+    while(request_line(conn, &pos, buffer, sizeof(buffer) - 1) > 0) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if(buffer[0] == '\0')
+            break;
+        if((value = strchr(buffer, ':')) == NULL)
+            continue;
+        name = buffer;
+        *value++ = '\0';
+        value += strspn(value, " \t");
+
+        if(strcasecmp(name, "User-Agent") == 0) {
+            req.client = strdup(value);
+        } else if(strcasecmp(name, "Authorization") == 0 && strncasecmp(value, "Basic ", strlen("Basic ")) == 0) {
+            req.credentials = strdup(value + strlen("Basic "));
             decodeBase64(req.credentials);
             DBG("username:password: %s\n", req.credentials);
+        } else if(strcasecmp(name, "If-None-Match") == 0) {
+            req.if_none_match = strdup(value);
+        } else if(strcasecmp(name, "X-Frame-Seq") == 0) {
+            req.frame_seq = strtoul(value, NULL, 10);
+        } else if(strcasecmp(name, "Connection") == 0) {
+            if(strcasestr(value, "close") != NULL)
+                req.keep_alive = 0;
+            else if(strcasestr(value, "keep-alive") != NULL)
+                req.keep_alive = 1;
+        } else if(strcasecmp(name, "Content-Length") == 0) {
+            req.has_body |= (strtol(value, NULL, 10) != 0);
+        } else if(strcasecmp(name, "Transfer-Encoding") == 0) {
+            req.has_body = 1;
         }
+    }
 
-    } while(cnt > 2 && !(buffer[0] == '\r' && buffer[1] == '\n'));
+    /* a body would be taken for the next request, and a header that did
+       not fit has no known end */
+    lcfd.keep_alive = req.keep_alive && !req.has_body && conn->request_end > 0 &&
+                      lcfd.pc->conf.keepalive > 0 && conn->requests < KEEPALIVE_REQUESTS;
 
     /* check for username and password if parameter -c was given */
     if(lcfd.pc->conf.credentials != NULL) {
         if(req.credentials == NULL || strcmp(lcfd.pc->conf.credentials, req.credentials) != 0) {
             DBG("access denied\n");
-            send_error(lcfd.fd, 401, "username and password do not match to configuration");
-            close(lcfd.fd);
+            send_error(&lcfd, 401, "username and password do not match to configuration");
             free_request(&req);
-            return NULL;
+            return lcfd.keep_alive ? 2 : 0;
         }
         DBG("access granted\n");
     }
 
+    /* determine what to deliver */
+    if((input_number = request_route(&lcfd, &req, method, target)) < 0) {
+        req.type = A_UNKNOWN;
+    }
+    DBG("plugin_no: %d\n", input_number);
+
+    #ifdef MANAGMENT
+    if((req.type == A_SNAPSHOT || req.type == A_SNAPSHOT_WXP || req.type == A_STREAM || req.type == A_STREAM_WXP) &&
+       check_client_status(lcfd.client)) {
+        req.type = A_UNKNOWN;
+        lcfd.client->last_take_time.tv_sec += piggy_fine;
+        send_error(&lcfd, 403, "frame already sent");
+    }
+    #endif
+
     /* now it's time to answer */
-    if (query_suffixed) {
-        if (req.type == A_OUTPUT_JSON) {
-            if(!(input_number < pglobal->outcnt)) {
-                DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
-                send_error(lcfd.fd, 404, "Invalid output plugin number");
-                req.type = A_UNKNOWN;
-            }
-        } else {
-            if(!(input_number < pglobal->incnt)) {
-                DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
-                send_error(lcfd.fd, 404, "Invalid input plugin number");
-                req.type = A_UNKNOWN;
-            }
+    if(req.type == A_OUTPUT_JSON) {
+        if(!(input_number < pglobal->outcnt)) {
+            DBG("Output number: %d out of range (valid: 0..%d)\n", input_number, pglobal->outcnt-1);
+            send_error(&lcfd, 404, "Invalid output plugin number");
+            req.type = A_UNKNOWN;
+        }
+    } else if(req.type == A_SNAPSHOT || req.type == A_SNAPSHOT_WXP || req.type == A_STREAM ||
+              req.type == A_STREAM_WXP || req.type == A_TAKE || req.type == A_INPUT_JSON) {
+        if(!(input_number >= 0 && input_number < pglobal->incnt)) {
+            DBG("Input number: %d out of range (valid: 0..%d)\n", input_number, pglobal->incnt-1);
+            send_error(&lcfd, 404, "Invalid input plugin number");
+            req.type = A_UNKNOWN;
         }
     }
 
@@ -1311,48 +1511,53 @@ void *client_thread(void *arg)
     case A_SNAPSHOT_WXP:
     case A_SNAPSHOT:
         DBG("Request for snapshot from input: %d\n", input_number);
-        send_snapshot(&lcfd, input_number);
+        /* the worker may be cancelled while waiting for the first frame */
+        pthread_cleanup_push(request_cleanup, &req);
+        send_snapshot(&lcfd, input_number, &req);
+        pthread_cleanup_pop(0);
         break;
     case A_STREAM:
         DBG("Request for stream from input: %d\n", input_number);
-        send_stream(&lcfd, input_number);
+        stream_start(conn, input_number, 0);
+        streaming = 1;
         break;
     #ifdef WXP_COMPAT
     case A_STREAM_WXP:
         DBG("Request for WXP compat stream from input: %d\n", input_number);
-        send_stream_wxp(&lcfd, input_number);
+        stream_start(conn, input_number, 1);
+        streaming = 1;
         break;
     #endif
     case A_COMMAND:
         if(lcfd.pc->conf.nocommands) {
-            send_error(lcfd.fd, 501, "this server is configured to not accept commands");
+            send_error(&lcfd, 501, "this server is configured to not accept commands");
             break;
         }
-        command(lcfd.pc->id, lcfd.fd, req.parameter);
+        command(&lcfd, req.parameter);
         break;
     case A_INPUT_JSON:
         DBG("Request for the Input plugin descriptor JSON file\n");
-        send_input_JSON(lcfd.fd, input_number);
+        send_input_JSON(&lcfd, input_number);
         break;
     case A_OUTPUT_JSON:
         DBG("Request for the Output plugin descriptor JSON file\n");
-        send_output_JSON(lcfd.fd, input_number);
+        send_output_JSON(&lcfd, input_number);
         break;
     case A_PROGRAM_JSON:
         DBG("Request for the program descriptor JSON file\n");
-        send_program_JSON(lcfd.fd);
+        send_program_JSON(&lcfd);
         break;
     #ifdef MANAGMENT
     case A_CLIENTS_JSON:
         DBG("Request for the clients JSON file\n");
-        send_clients_JSON(lcfd.fd);
+        send_clients_JSON(&lcfd);
         break;
     #endif
     case A_FILE:
         if(lcfd.pc->conf.www_folder == NULL)
-            send_error(lcfd.fd, 501, "no www-folder configured");
+            send_error(&lcfd, 501, "no www-folder configured");
         else
-            send_file(lcfd.pc->id, lcfd.fd, req.parameter);
+            send_file(&lcfd, req.parameter);
         break;
     /*
         With the take argument we try to save the current image to file before we transmit it to the user.
@@ -1384,7 +1589,8 @@ void *client_thread(void *arg)
                         ret = pglobal->out[i].cmd(i, OUT_FILE_CMD_TAKE, IN_CMD_GENERIC, 0, filenamearg);
                     } else {
                         DBG("filename is not specified int the URL\n");
-                        send_error(lcfd.fd, 404, "The &filename= must present for the take command in the URL");
+                        send_error(&lcfd, 404, "The &filename= must present for the take command in the URL");
+                        ret = -1;
                     }
                     break;
                 }
@@ -1393,69 +1599,869 @@ void *client_thread(void *arg)
 
         if (found == 0) {
             LOG("FILE CHANGE TEST output plugin not loaded\n");
-            send_error(lcfd.fd, 404, "FILE output plugin not loaded, taking snapshot not possible");
+            send_error(&lcfd, 404, "FILE output plugin not loaded, taking snapshot not possible");
         } else {
             if (ret == 0) {
-                send_snapshot(&lcfd, input_number);
-            } else {
-                send_error(lcfd.fd, 404, "Taking snapshot failed!");
+                pthread_cleanup_push(request_cleanup, &req);
+                send_snapshot(&lcfd, input_number, NULL);
+                pthread_cleanup_pop(0);
+            } else if (!lcfd.answered) {
+                send_error(&lcfd, 404, "Taking snapshot failed!");
             }
         }
         } break;
     case A_CGI:
         DBG("cgi script: %s requested\n", req.parameter);
-        execute_cgi(lcfd.pc->id, lcfd.fd, req.parameter, req.query_string);
+        execute_cgi(&lcfd, req.parameter, req.query_string);
         break;
     default:
         DBG("unknown request\n");
     }
 
-    close(lcfd.fd);
     free_request(&req);
 
-    DBG("leaving HTTP client thread\n");
+    if(streaming)
+        return 1;
+
+    /* without an answer that tells its length, the connection is done */
+    if(!lcfd.answered)
+        lcfd.keep_alive = 0;
+    return lcfd.keep_alive ? 2 : 0;
+}
+
+/******************************************************************************
+Description.: unlock a mutex, as cleanup handler of a cancelled thread
+Input Value.: arg is the mutex
+Return Value: -
+******************************************************************************/
+static void unlock_mutex(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: Close the socket of a connection. The kernel would go on
+              sending what is queued from the pages of the frames held for
+              MSG_ZEROCOPY after close(), while the input writes newer
+              frames into them, so what is queued is discarded then.
+Input Value.: conn is the connection
+Return Value: -
+******************************************************************************/
+static void connection_close(connection *conn)
+{
+    struct linger reset = { 1, 0 };
+
+    if(conn->zerocopy_count > 0)
+        setsockopt(conn->fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    close(conn->fd);
+    conn->fd = -1;
+}
+
+/******************************************************************************
+Description.: Close a connection that is not in the event loop and free it
+Input Value.: conn is the connection
+Return Value: -
+******************************************************************************/
+static void connection_free(connection *conn)
+{
+    if(conn->fd >= 0)
+        connection_close(conn);
+    out_clear(conn);
+    while(conn->zerocopy_count > 0) {
+        input_frame_release(conn->zerocopy_frames[conn->zerocopy_first].frame);
+        conn->zerocopy_first = (conn->zerocopy_first + 1) % ZEROCOPY_FRAMES;
+        conn->zerocopy_count--;
+    }
+    free(conn);
+}
+
+/******************************************************************************
+Description.: Add a connection to the list of the event loop, or remove it
+Input Value.: conn is the connection
+Return Value: -
+******************************************************************************/
+static void connection_link(connection *conn)
+{
+    context *pc = conn->pc;
+
+    conn->prev = NULL;
+    conn->next = pc->connections;
+    if(pc->connections != NULL)
+        pc->connections->prev = conn;
+    pc->connections = conn;
+}
+
+static void connection_unlink(connection *conn)
+{
+    context *pc = conn->pc;
+
+    if(conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        pc->connections = conn->next;
+    if(conn->next != NULL)
+        conn->next->prev = conn->prev;
+    conn->prev = conn->next = NULL;
+}
+
+/******************************************************************************
+Description.: Close a connection of the event loop. It is freed after the
+              events at hand are handled, as one of them may be for it.
+Input Value.: conn is the connection
+Return Value: -
+******************************************************************************/
+static void connection_drop(connection *conn)
+{
+    context *pc = conn->pc;
+
+    DBG("closing connection, %lu frames sent, %lu skipped, %.1f fps, %.1f ms latency\n", conn->frames_sent, conn->frames_skipped, conn->fps, conn->latency);
+    connection_unlink(conn);
+    connection_close(conn);
+    conn->state = C_CLOSED;
+    conn->next = pc->closed;
+    pc->closed = conn;
+}
+
+/******************************************************************************
+Description.: Send as much of the answer queued for a connection as its
+              socket takes, without blocking, and queue the next frame of a
+              stream whenever the queue runs empty. All queued segments go
+              with one sendmsg(), usually a whole frame with its part header
+              and boundary. With MSG_ZEROCOPY the kernel sends the frame from
+              the ring rather than copying it, so the frame is held until it
+              reports being done, see connection_zerocopy_done().
+Input Value.: conn is the connection, in the event loop
+Return Value: 0 if ok, -1 if the connection failed and must be closed
+******************************************************************************/
+static int connection_send(connection *conn)
+{
+    struct iovec iov[OUT_SEGMENTS];
+    struct msghdr msg;
+    int copy = 0;
+
+    while(conn->out_count > 0) {
+        int i, rc, sent, flags = MSG_NOSIGNAL, stable = 1, frames = 0;
+
+        for(i = 0; i < conn->out_count; i++) {
+            out_segment *seg = &conn->out[(conn->out_first + i) % OUT_SEGMENTS];
+            int offset = (i == 0) ? conn->out_offset : 0;
+
+            iov[i].iov_base = (void *)(seg->data + offset);
+            iov[i].iov_len = seg->size - offset;
+            stable &= seg->zerocopy;
+            frames |= (seg->frame != NULL);
+        }
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = conn->out_count;
+
+        if(conn->zerocopy == 1 && !copy && stable && frames && conn->zerocopy_count < ZEROCOPY_FRAMES)
+            flags |= MSG_ZEROCOPY;
+
+        if((sent = rc = sendmsg(conn->fd, &msg, flags)) < 0) {
+            if(errno == EINTR)
+                continue;
+            /* epoll reports when it takes more */
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if(errno == ENOBUFS && (flags & MSG_ZEROCOPY)) {
+                /* too many notifications pending, copy this time */
+                copy = 1;
+                continue;
+            }
+            return -1;
+        }
+
+        conn->last_active = monotonic_seconds();
+        if(sent > 0)
+            conn->frame_unsent = 0;
+
+        for(;;) {
+            out_segment *seg = &conn->out[conn->out_first];
+            int left = seg->size - conn->out_offset;
+
+            /* a part header is valid as long as its frame, so hold that */
+            if((flags & MSG_ZEROCOPY) && rc > 0 && (seg->frame != NULL || seg->shared)) {
+                out_segment *held = seg->shared ? &conn->out[(conn->out_first + 1) % OUT_SEGMENTS] : seg;
+                held->zerocopy_sent = 1;
+                held->zerocopy_id = conn->zerocopy_next;
+            }
+            if(rc < left) {
+                conn->out_offset += rc;
+                break;
+            }
+            rc -= left;
+
+            if((seg->frame != NULL || seg->copy != NULL) && !seg->shared) {
+                double latency = (monotonic_usecs() - conn->frame_arrived) / 1000.0;
+
+                conn->latency = (conn->frames_sent == 0) ? latency : (7 * conn->latency + latency) / 8;
+                conn->frames_sent++;
+            }
+            if(seg->zerocopy_sent)
+                zerocopy_hold(conn, seg);
+            out_release(seg);
+            conn->out_first = (conn->out_first + 1) % OUT_SEGMENTS;
+            conn->out_count--;
+            conn->out_offset = 0;
+            if(conn->out_count == 0)
+                break;
+        }
+        if((flags & MSG_ZEROCOPY) && sent > 0)
+            conn->zerocopy_next++;
+
+        /* a short send means the socket is full */
+        if(conn->out_count > 0)
+            return 0;
+
+        if(stream_queue_frame(conn) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: Release the frames the kernel is done sending with
+              MSG_ZEROCOPY, as reported on the error queue of the socket
+Input Value.: conn is the connection, in the event loop
+Return Value: 0 if ok, -1 if the socket reported an error
+******************************************************************************/
+static int connection_zerocopy_done(connection *conn)
+{
+    char control[CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in6))];
+    struct sock_extended_err *serr;
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+
+    for(;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg(conn->fd, &msg, MSG_ERRQUEUE) < 0) {
+            if(errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        for(cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+               !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+                continue;
+            serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                return -1;
+            /* the kernel copied anyway, as for loopback, so stop asking */
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                conn->zerocopy = 2;
+
+            /* sends ee_info to ee_data are done, and all before them */
+            while(conn->zerocopy_count > 0) {
+                zerocopy_frame *zf = &conn->zerocopy_frames[conn->zerocopy_first];
+                if((int)(zf->id - serr->ee_data) > 0)
+                    break;
+                input_frame_release(zf->frame);
+                conn->zerocopy_first = (conn->zerocopy_first + 1) % ZEROCOPY_FRAMES;
+                conn->zerocopy_count--;
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: Find the end of the request header read so far
+Input Value.: conn is the connection
+Return Value: the length of the header, with the empty line ending it, or 0
+              if it is not complete yet
+******************************************************************************/
+static int request_header_size(connection *conn)
+{
+    char *crlf = strstr(conn->request, "\r\n\r\n");
+    char *lf = strstr(conn->request, "\n\n");
+
+    if(crlf != NULL && (lf == NULL || crlf < lf))
+        return crlf - conn->request + 4;
+    if(lf != NULL)
+        return lf - conn->request + 2;
+    return 0;
+}
+
+/******************************************************************************
+Description.: Drop the request answered from the buffer of a kept alive
+              connection, but not what the client sent after it
+Input Value.: conn is the connection
+Return Value: 1 if that is a complete request again, 0 if not
+******************************************************************************/
+static int request_next(connection *conn)
+{
+    conn->request_size -= conn->request_end;
+    memmove(conn->request, conn->request + conn->request_end, conn->request_size);
+    conn->request[conn->request_size] = '\0';
+    conn->request_end = request_header_size(conn);
+    return conn->request_end > 0;
+}
+
+/******************************************************************************
+Description.: Read what a client sent without blocking: its request, or
+              anything it sends while streaming, which is ignored.
+Input Value.: conn is the connection, in the event loop
+Return Value: 1 if the request header is complete, 0 if not yet, -1 if the
+              connection failed or was closed before the request was
+******************************************************************************/
+static int connection_read(connection *conn)
+{
+    char discard[BUFFER_SIZE];
+    int rc;
+
+    for(;;) {
+        if(conn->state == C_STREAMING) {
+            rc = recv(conn->fd, discard, sizeof(discard), 0);
+        } else {
+            /* hand over what fits, the rest of the header is ignored */
+            if(conn->request_size >= REQUEST_SIZE - 1) {
+                conn->request_end = 0;
+                return 1;
+            }
+            rc = recv(conn->fd, conn->request + conn->request_size, REQUEST_SIZE - 1 - conn->request_size, 0);
+        }
+
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        if(rc == 0) {
+            if(conn->state != C_STREAMING)
+                return -1;
+            /* the client may still take the stream */
+            conn->read_closed = 1;
+            return 0;
+        }
+
+        if(conn->state == C_STREAMING)
+            continue;
+
+        /* the time for the request starts with it, not with the last one */
+        if(conn->request_size == 0)
+            conn->last_active = monotonic_seconds();
+        conn->request_size += rc;
+        conn->request[conn->request_size] = '\0';
+        if((conn->request_end = request_header_size(conn)) > 0)
+            return 1;
+    }
+}
+
+/******************************************************************************
+Description.: Hand a connection whose request was read to the workers
+Input Value.: conn is the connection, in the event loop
+Return Value: -
+******************************************************************************/
+static void request_queue(connection *conn)
+{
+    context *pc = conn->pc;
+
+    epoll_ctl(pc->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    connection_unlink(conn);
+    conn->state = C_ANSWERING;
+    conn->events = 0;
+
+    pthread_mutex_lock(&pc->queue_mutex);
+    if(pc->last_request != NULL)
+        pc->last_request->next = conn;
+    else
+        pc->requests = conn;
+    pc->last_request = conn;
+    pthread_cond_signal(&pc->queue_cond);
+    pthread_mutex_unlock(&pc->queue_mutex);
+}
+
+/******************************************************************************
+Description.: Hand a connection that streams now, or waits for its next
+              request, back to the event loop
+Input Value.: conn is the connection, with a worker
+Return Value: -
+******************************************************************************/
+static void connection_hand_back(connection *conn)
+{
+    context *pc = conn->pc;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&pc->queue_mutex);
+    if(pc->stopping) {
+        pthread_mutex_unlock(&pc->queue_mutex);
+        connection_free(conn);
+        return;
+    }
+    conn->next = pc->handed_back;
+    pc->handed_back = conn;
+    if(write(pc->wake_fd, &one, sizeof(one)) < 0) {
+        DBG("could not wake the event loop\n");
+    }
+    pthread_mutex_unlock(&pc->queue_mutex);
+}
+
+/******************************************************************************
+Description.: Cleanup handler of a worker cancelled with a connection
+Input Value.: arg points to the connection of the worker, or to NULL
+Return Value: -
+******************************************************************************/
+static void worker_cleanup(void *arg)
+{
+    connection *conn = *(connection * volatile *)arg;
+
+    if(conn != NULL)
+        connection_free(conn);
+}
+
+/******************************************************************************
+Description.: Worker thread, answers the requests read by the event loop.
+              Answers are sent blocking, but no longer than SEND_TIMEOUT
+              seconds per write, so a few workers serve any number of
+              clients; streams go back to the event loop, and so do kept
+              alive connections once the requests they sent are answered.
+              It is cancelled only while waiting for a request, or for the
+              first frame of an input, see send_snapshot().
+Input Value.: arg is the server context
+Return Value: always NULL
+******************************************************************************/
+static void *worker_thread(void *arg)
+{
+    context *pc = arg;
+    struct timeval timeout = { SEND_TIMEOUT, 0 };
+    /* volatile, as the cleanup handler runs after a longjmp() */
+    connection * volatile conn = NULL;
+    sigset_t signals;
+    int state, rc;
+
+    /* the handler of SIGINT stops the server, which joins the workers, so
+       it must run on another thread */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_cleanup_push(worker_cleanup, (void *)&conn);
+
+    for(;;) {
+        pthread_mutex_lock(&pc->queue_mutex);
+        pthread_cleanup_push(unlock_mutex, &pc->queue_mutex);
+        while(pc->requests == NULL)
+            pthread_cond_wait(&pc->queue_cond, &pc->queue_mutex);
+        conn = pc->requests;
+        pc->requests = conn->next;
+        if(pc->requests == NULL)
+            pc->last_request = NULL;
+        pthread_cleanup_pop(1);
+
+        /* finish the answer even when the server stops */
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+
+        fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) & ~O_NONBLOCK);
+        if(setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+            perror("setsockopt(SO_SNDTIMEO) failed\n");
+        }
+
+        /* answer the requests the client sent without waiting for the
+           answers, one after the other */
+        while((rc = client_request(conn)) == 2 && request_next(conn))
+            ;
+
+        if(rc) {
+            conn->state = (rc == 1) ? C_STREAMING : C_READING;
+            fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+            connection_hand_back(conn);
+        } else {
+            connection_free(conn);
+        }
+        conn = NULL;
+
+        pthread_setcancelstate(state, NULL);
+    }
+
+    pthread_cleanup_pop(0);
+    return NULL;
+}
+
+/******************************************************************************
+Description.: Watcher thread, wakes the event loop for each frame of an input
+Input Value.: arg is the watcher
+Return Value: always NULL
+******************************************************************************/
+static void *watcher_thread(void *arg)
+{
+    watcher *w = arg;
+    input *in = &pglobal->in[w->input_number];
+    unsigned int seq = input_frame_seq(in);
+    uint64_t one = 1;
+
+    for(;;) {
+        seq = input_frame_wait_seq(in, seq);
+
+        __atomic_add_fetch(&w->pc->updates[w->input_number], 1, __ATOMIC_RELEASE);
+        if(write(w->pc->wake_fd, &one, sizeof(one)) < 0) {
+            DBG("could not wake the event loop\n");
+        }
+    }
+
     return NULL;
 }
 
+/******************************************************************************
+Description.: Accept all clients waiting to connect, without blocking, and
+              add them to the event loop to read their requests
+Input Value.: pc is the server context
+Return Value: -
+******************************************************************************/
+static void server_accept(context *pc)
+{
+    struct sockaddr_storage client_addr;
+    socklen_t addr_len;
+    struct epoll_event ev;
+    char name[NI_MAXHOST];
+    connection *conn;
+    int i, fd;
+
+    for(i = 0; i < pc->sd_len; i++) {
+        for(;;) {
+            addr_len = sizeof(client_addr);
+            if((fd = accept4(pc->sd[i], (struct sockaddr *)&client_addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC)) < 0) {
+                if(errno == EINTR)
+                    continue;
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    perror("accept");
+                break;
+            }
+
+            if((conn = calloc(1, sizeof(connection))) == NULL) {
+                fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
+                close(fd);
+                continue;
+            }
+            conn->pc = pc;
+            conn->fd = fd;
+            conn->state = C_READING;
+            conn->last_active = monotonic_seconds();
+
+            if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
+                DBG("serving client: %s\n", name);
+            }
+
+            #if defined(MANAGMENT)
+            conn->client = add_client(name);
+            #endif
+
+            memset(&ev, 0, sizeof(ev));
+            ev.events = conn->events = EPOLLIN | EPOLLRDHUP;
+            ev.data.ptr = conn;
+            if(epoll_ctl(pc->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+                perror("epoll_ctl");
+                connection_free(conn);
+                continue;
+            }
+            connection_link(conn);
+        }
+    }
+}
+
+/******************************************************************************
+Description.: Handle what the other threads signalled: take the streams and
+              kept alive connections the workers handed back, and queue new
+              frames for the streaming clients that took the last one.
+Input Value.: pc is the server context
+Return Value: -
+******************************************************************************/
+static void server_wake(context *pc)
+{
+    struct epoll_event ev;
+    connection *handed_back, *conn, *next;
+    uint64_t count;
+    int i;
+
+    if(read(pc->wake_fd, &count, sizeof(count)) < 0) {
+        DBG("nothing to wake for\n");
+    }
+
+    /* note when new frames arrived, for the latency of the clients */
+    for(i = 0; i < pglobal->incnt; i++) {
+        input_frame *frame = input_frame_get(&pglobal->in[i]);
+
+        if(frame != NULL) {
+            stream_part_render(pc, i, frame);
+            input_frame_release(frame);
+        }
+    }
+
+    pthread_mutex_lock(&pc->queue_mutex);
+    handed_back = pc->handed_back;
+    pc->handed_back = NULL;
+    pthread_mutex_unlock(&pc->queue_mutex);
+
+    for(conn = handed_back; conn != NULL; conn = next) {
+        next = conn->next;
+        conn->last_active = monotonic_seconds();
+
+        /* wait for the next request, the idle time counts from now */
+        if(conn->state == C_READING) {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = conn->events = EPOLLIN | EPOLLRDHUP;
+            ev.data.ptr = conn;
+            if(epoll_ctl(pc->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+                perror("epoll_ctl");
+                connection_free(conn);
+                continue;
+            }
+            connection_link(conn);
+            continue;
+        }
+
+        if(pc->conf.zerocopy) {
+            int one = 1;
+            conn->zerocopy = (setsockopt(conn->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0);
+        }
+        if(pc->conf.backlog > 0 &&
+           setsockopt(conn->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &pc->conf.backlog, sizeof(pc->conf.backlog)) < 0) {
+            DBG("could not limit the backlog of the stream\n");
+        }
+
+        /*
+         * edge triggered, so the socket need not be modified each time it
+         * backs up: connection_send() and connection_read() go on until
+         * it would block
+         */
+        memset(&ev, 0, sizeof(ev));
+        ev.events = conn->events = EPOLLIN | EPOLLRDHUP | EPOLLOUT | EPOLLET;
+        ev.data.ptr = conn;
+        if(epoll_ctl(pc->epfd, EPOLL_CTL_ADD, conn->fd, &ev) < 0) {
+            perror("epoll_ctl");
+            connection_free(conn);
+            continue;
+        }
+        connection_link(conn);
+        if(connection_send(conn) < 0)
+            connection_drop(conn);
+    }
+
+    for(conn = pc->connections; conn != NULL; conn = next) {
+        next = conn->next;
+        if(conn->state != C_STREAMING || conn->out_count > 0)
+            continue;
+        if(stream_queue_frame(conn) < 0 || connection_send(conn) < 0)
+            connection_drop(conn);
+    }
+}
+
+/******************************************************************************
+Description.: Handle the events epoll reported for a connection
+Input Value.: * conn....: the connection
+              * events..: the events
+Return Value: -
+******************************************************************************/
+static void connection_event(connection *conn, int events)
+{
+    int rc;
+
+    if(conn->state == C_CLOSED)
+        return;
+
+    /* notifications of MSG_ZEROCOPY come as errors */
+    if((events & EPOLLERR) && !(events & EPOLLHUP) && conn->zerocopy) {
+        if(connection_zerocopy_done(conn) < 0) {
+            connection_drop(conn);
+            return;
+        }
+        events &= ~EPOLLERR;
+    }
+
+    if(events & (EPOLLERR | EPOLLHUP)) {
+        connection_drop(conn);
+        return;
+    }
+
+    if((events & (EPOLLIN | EPOLLRDHUP)) && !conn->read_closed) {
+        if((rc = connection_read(conn)) < 0) {
+            connection_drop(conn);
+            return;
+        }
+        if(rc == 1) {
+            request_queue(conn);
+            return;
+        }
+    }
+
+    if((events & EPOLLOUT) && (stream_skip_stale(conn) < 0 || connection_send(conn) < 0))
+        connection_drop(conn);
+}
+
+/******************************************************************************
+Description.: Close the connections that timed out: clients that did not
+              send their request in time, kept their connection without
+              sending another, or took no data of their stream.
+              Frames held by stalled streams are copied out of the ring.
+Input Value.: * pc....: the server context
+              * now...: monotonic_seconds()
+Return Value: -
+******************************************************************************/
+static void server_timeouts(context *pc, time_t now)
+{
+    connection *conn, *next;
+
+    for(conn = pc->connections; conn != NULL; conn = next) {
+        next = conn->next;
+        if(conn->state == C_READING && conn->requests > 0 && conn->request_size == 0) {
+            if(now - conn->last_active >= pc->conf.keepalive) {
+                DBG("kept alive connection timed out\n");
+                connection_drop(conn);
+            }
+        } else if(conn->state == C_READING && now - conn->last_active >= REQUEST_TIMEOUT) {
+            DBG("request timed out\n");
+            connection_drop(conn);
+        } else if(conn->state == C_STREAMING && conn->out_count > 0) {
+            if(now - conn->last_active >= SEND_TIMEOUT) {
+                DBG("stream timed out\n");
+                connection_drop(conn);
+            } else if(now - conn->last_active >= STALL_TIMEOUT && stream_detach_frames(conn) < 0) {
+                connection_drop(conn);
+            }
+        }
+    }
+}
+
+/******************************************************************************
+Description.: Update the delivery statistics of the streaming clients, about
+              once a second
+Input Value.: pc is the server context
+Return Value: -
+******************************************************************************/
+static void server_stats(context *pc)
+{
+    uint64_t now = monotonic_usecs();
+    connection *conn;
+
+    for(conn = pc->connections; conn != NULL; conn = conn->next) {
+        if(conn->state != C_STREAMING)
+            continue;
+        if(conn->stats_time != 0 && now > conn->stats_time)
+            conn->fps = (conn->frames_sent - conn->stats_frames) * 1000000.0 / (now - conn->stats_time);
+        conn->stats_time = now;
+        conn->stats_frames = conn->frames_sent;
+
+        #ifdef MANAGMENT
+        update_client_stats(conn->client, conn->fps, conn->latency, conn->frames_sent, conn->frames_skipped);
+        #endif
+    }
+}
+
 /******************************************************************************
 Description.: This function cleans up resources allocated by the server_thread
-Input Value.: arg is not used
+Input Value.: arg is the server context
 Return Value: -
 ******************************************************************************/
 void server_cleanup(void *arg)
 {
     context *pcontext = arg;
+    connection *conn;
     int i;
 
     OPRINT("cleaning up resources allocated by server thread #%02d\n", pcontext->id);
 
+    /* the server thread may get here leaving its loop, and still be
+       cancelled by output_stop() while joining the workers */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    /* workers still answering close their connections themselves, see
+       connection_hand_back() */
+    pthread_mutex_lock(&pcontext->queue_mutex);
+    pcontext->stopping = 1;
+    while((conn = pcontext->requests) != NULL) {
+        pcontext->requests = conn->next;
+        connection_free(conn);
+    }
+    pcontext->last_request = NULL;
+    while((conn = pcontext->handed_back) != NULL) {
+        pcontext->handed_back = conn->next;
+        connection_free(conn);
+    }
+    pthread_mutex_unlock(&pcontext->queue_mutex);
+
+    for(i = 0; i < pcontext->watcher_count; i++) {
+        pthread_cancel(pcontext->watchers[i].threadID);
+        pthread_join(pcontext->watchers[i].threadID, NULL);
+    }
+    pcontext->watcher_count = 0;
+
+    /* workers still answering finish first, which SEND_TIMEOUT bounds */
+    for(i = 0; i < pcontext->worker_count; i++) {
+        pthread_cancel(pcontext->workers[i]);
+        pthread_join(pcontext->workers[i], NULL);
+    }
+    pcontext->worker_count = 0;
+    free(pcontext->workers);
+    pcontext->workers = NULL;
+
+    while((conn = pcontext->connections) != NULL)
+        connection_drop(conn);
+    while((conn = pcontext->closed) != NULL) {
+        pcontext->closed = conn->next;
+        connection_free(conn);
+    }
+
+    if(pcontext->epfd >= 0)
+        close(pcontext->epfd);
+    if(pcontext->wake_fd >= 0)
+        close(pcontext->wake_fd);
+    pcontext->epfd = pcontext->wake_fd = -1;
+
     for(i = 0; i < MAX_SD_LEN; i++)
         close(pcontext->sd[i]);
 }
 
 /******************************************************************************
-Description.: Open a TCP socket and wait for clients to connect. If clients
-              connect, start a new thread for each accepted connection.
+Description.: Open a TCP socket and serve the clients that connect, with an
+              epoll event loop and a few worker threads:
+              * the event loop accepts clients and reads their requests
+                without blocking, then hands each to a worker
+              * a worker answers the request; a stream goes back to the loop
+              * the loop sends the streams without blocking, referencing the
+                frames of the input instead of copying them, and skips frames
+                for clients that don't take them as fast as they come
+              * a watcher thread per input wakes the loop for each frame
+              So the number of threads does not grow with the clients.
 Input Value.: arg is a pointer to the globals struct
 Return Value: always NULL, will only return on exit
 ******************************************************************************/
 void *server_thread(void *arg)
 {
     int on;
-    pthread_t client;
     struct addrinfo *aip, *aip2;
     struct addrinfo hints;
-    struct sockaddr_storage client_addr;
-    socklen_t addr_len = sizeof(struct sockaddr_storage);
-    fd_set selectfds;
-    int max_fds = 0;
+    struct epoll_event ev, events[MAX_EVENTS];
     char name[NI_MAXHOST];
+    time_t checked;
+    struct timeval tv;
     int err;
     int i;
 
     context *pcontext = arg;
     pglobal = pcontext->pglobal;
 
+    pcontext->epfd = pcontext->wake_fd = -1;
+    pcontext->connections = pcontext->closed = NULL;
+    pcontext->requests = pcontext->last_request = pcontext->handed_back = NULL;
+    pcontext->workers = NULL;
+    pcontext->worker_count = pcontext->watcher_count = 0;
+    pcontext->stopping = 0;
+    gettimeofday(&tv, NULL);
+    pcontext->etag_base = (unsigned long)tv.tv_sec * 1000000 + tv.tv_usec;
+    for(i = 0; i < MAX_SD_LEN; i++)
+        pcontext->sd[i] = -1;
+    if(pthread_mutex_init(&pcontext->queue_mutex, NULL) != 0 ||
+       pthread_cond_init(&pcontext->queue_cond, NULL) != 0) {
+        perror("Mutex initialization failed");
+        exit(EXIT_FAILURE);
+    }
+
     /* set cleanup handler to cleanup resources */
     pthread_cleanup_push(server_cleanup, pcontext);
 
@@ -1470,9 +2476,6 @@ void *server_thread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    for(i = 0; i < MAX_SD_LEN; i++)
-        pcontext->sd[i] = -1;
-
     #ifdef MANAGMENT
     if (pthread_mutex_init(&client_infos.mutex, NULL)) {
         perror("Mutex initialization failed");
@@ -1486,7 +2489,7 @@ void *server_thread(void *arg)
     /* open sockets for server (1 socket / address family) */
     i = 0;
     for(aip2 = aip; aip2 != NULL; aip2 = aip2->ai_next) {
-        if((pcontext->sd[i] = socket(aip2->ai_family, aip2->ai_socktype, 0)) < 0) {
+        if((pcontext->sd[i] = socket(aip2->ai_family, aip2->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
             continue;
         }
 
@@ -1508,12 +2511,15 @@ void *server_thread(void *arg)
 
         if(bind(pcontext->sd[i], aip2->ai_addr, aip2->ai_addrlen) < 0) {
             perror("bind");
+            close(pcontext->sd[i]);
             pcontext->sd[i] = -1;
             continue;
         }
 
-        if(listen(pcontext->sd[i], 10) < 0) {
+        /* many viewers may connect at once */
+        if(listen(pcontext->sd[i], SOMAXCONN) < 0) {
             perror("listen");
+            close(pcontext->sd[i]);
             pcontext->sd[i] = -1;
         } else {
             i++;
@@ -1524,6 +2530,7 @@ void *server_thread(void *arg)
             }
         }
     }
+    freeaddrinfo(aip);
 
     pcontext->sd_len = i;
 
@@ -1533,62 +2540,83 @@ void *server_thread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    /* create a child for every client that connects */
-    while(!pglobal->stop) {
-        //int *pfd = (int *)malloc(sizeof(int));
-        cfd *pcfd = malloc(sizeof(cfd));
-
-        if(pcfd == NULL) {
-            fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
+    /* the listening sockets are told apart by a NULL pointer, the eventfd by the context */
+    if((pcontext->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+       (pcontext->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("epoll/eventfd");
+        exit(EXIT_FAILURE);
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    for(i = 0; i < pcontext->sd_len; i++) {
+        ev.data.ptr = NULL;
+        if(epoll_ctl(pcontext->epfd, EPOLL_CTL_ADD, pcontext->sd[i], &ev) < 0) {
+            perror("epoll_ctl");
             exit(EXIT_FAILURE);
         }
+    }
+    ev.data.ptr = pcontext;
+    if(epoll_ctl(pcontext->epfd, EPOLL_CTL_ADD, pcontext->wake_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
 
-        DBG("waiting for clients to connect\n");
-
-        do {
-            FD_ZERO(&selectfds);
-
-            for(i = 0; i < MAX_SD_LEN; i++) {
-                if(pcontext->sd[i] != -1) {
-                    FD_SET(pcontext->sd[i], &selectfds);
-
-                    if(pcontext->sd[i] > max_fds)
-                        max_fds = pcontext->sd[i];
-                }
-            }
-
-            err = select(max_fds + 1, &selectfds, NULL, NULL, NULL);
+    /* start the threads waking the loop for each frame, and the workers */
+    for(i = 0; i < pglobal->incnt; i++) {
+        pcontext->watchers[i].pc = pcontext;
+        pcontext->watchers[i].input_number = i;
+        if(pthread_create(&pcontext->watchers[i].threadID, NULL, watcher_thread, &pcontext->watchers[i]) != 0) {
+            perror("could not start watcher thread");
+            exit(EXIT_FAILURE);
+        }
+        pcontext->watcher_count++;
+    }
+    if((pcontext->workers = calloc(pcontext->conf.workers, sizeof(pthread_t))) == NULL) {
+        fprintf(stderr, "failed to allocate (a very small amount of) memory\n");
+        exit(EXIT_FAILURE);
+    }
+    for(i = 0; i < pcontext->conf.workers; i++) {
+        if(pthread_create(&pcontext->workers[i], NULL, worker_thread, pcontext) != 0) {
+            perror("could not start worker thread");
+            exit(EXIT_FAILURE);
+        }
+        pcontext->worker_count++;
+    }
 
-            if(err < 0 && errno != EINTR) {
-                perror("select");
-                exit(EXIT_FAILURE);
-            }
-        } while(err <= 0);
+    checked = monotonic_seconds();
+    while(!pglobal->stop) {
+        int n;
+        time_t now;
+        connection *conn;
 
-        for(i = 0; i < max_fds + 1; i++) {
-            if(pcontext->sd[i] != -1 && FD_ISSET(pcontext->sd[i], &selectfds)) {
-                pcfd->fd = accept(pcontext->sd[i], (struct sockaddr *)&client_addr, &addr_len);
-                pcfd->pc = pcontext;
+        DBG("waiting for events\n");
 
-                /* start new thread that will handle this TCP connected client */
-                DBG("create thread to handle client that just established a connection\n");
+        /* wake up every second to check the timeouts */
+        if((n = epoll_wait(pcontext->epfd, events, MAX_EVENTS, 1000)) < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            exit(EXIT_FAILURE);
+        }
 
-                if(getnameinfo((struct sockaddr *)&client_addr, addr_len, name, sizeof(name), NULL, 0, NI_NUMERICHOST) == 0) {
-                    DBG("serving client: %s\n", name);
-                }
+        for(i = 0; i < n; i++) {
+            if(events[i].data.ptr == NULL)
+                server_accept(pcontext);
+            else if(events[i].data.ptr == pcontext)
+                server_wake(pcontext);
+            else
+                connection_event(events[i].data.ptr, events[i].events);
+        }
 
-                #if defined(MANAGMENT)
-                pcfd->client = add_client(name);
-                #endif
+        if((now = monotonic_seconds()) != checked) {
+            server_timeouts(pcontext, now);
+            server_stats(pcontext);
+            checked = now;
+        }
 
-                if(pthread_create(&client, NULL, &client_thread, pcfd) != 0) {
-                    DBG("could not launch another client thread\n");
-                    close(pcfd->fd);
-                    free(pcfd);
-                    continue;
-                }
-                pthread_detach(client);
-            }
+        while((conn = pcontext->closed) != NULL) {
+            pcontext->closed = conn->next;
+            connection_free(conn);
         }
     }
 
@@ -1604,14 +2632,10 @@ Description.: Send a JSON file which is contains information about the input plu
 Input Value.: fildescriptor fd to send the answer to
 Return Value: -
 ******************************************************************************/
-void send_input_JSON(int fd, int input_number)
+void send_input_JSON(cfd *context_fd, int input_number)
 {
     char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
     int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
 
     DBG("Serving the input plugin %d descriptor JSON file\n", input_number);
 
@@ -1814,21 +2838,16 @@ void send_input_JSON(int fd, int input_number)
             "}\n");
     i = strlen(buffer);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
+    if(send_answer(context_fd, "200 OK", "Content-type: application/x-javascript\r\n" NOCACHE_HEADER, buffer, i) < 0) {
         DBG("unable to serve the control JSON file\n");
     }
 }
 
 
-void send_program_JSON(int fd)
+void send_program_JSON(cfd *context_fd)
 {
     char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
     int i, k;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
 
     DBG("Serving the program descriptor JSON file\n");
 
@@ -1886,8 +2905,7 @@ void send_program_JSON(int fd)
             "]}\n");
     i = strlen(buffer);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
+    if(send_answer(context_fd, "200 OK", "Content-type: application/x-javascript\r\n" NOCACHE_HEADER, buffer, i) < 0) {
         DBG("unable to serve the program JSON file\n");
     }
 }
@@ -1917,14 +2935,10 @@ Description.: Send a JSON file which is contains information about the output pl
 Input Value.: fildescriptor fd to send the answer to
 Return Value: -
 ******************************************************************************/
-void send_output_JSON(int fd, int input_number)
+void send_output_JSON(cfd *context_fd, int input_number)
 {
     char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
     int i;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
 
     DBG("Serving the output plugin %d descriptor JSON file\n", input_number);
 
@@ -2015,21 +3029,16 @@ void send_output_JSON(int fd, int input_number)
             "}\n");
     i = strlen(buffer);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
+    if(send_answer(context_fd, "200 OK", "Content-type: application/x-javascript\r\n" NOCACHE_HEADER, buffer, i) < 0) {
         DBG("unable to serve the control JSON file\n");
     }
 }
 
 #ifdef MANAGMENT
-void send_clients_JSON(int fd)
+void send_clients_JSON(cfd *context_fd)
 {
     char buffer[BUFFER_SIZE*16] = {0}; // FIXME do reallocation if the buffer size is small
     unsigned long i = 0 ;
-    sprintf(buffer, "HTTP/1.0 200 OK\r\n" \
-            "Content-type: %s\r\n" \
-            STD_HEADER \
-            "\r\n", "application/x-javascript");
 
     DBG("Serving the clients JSON file\n");
 
@@ -2037,19 +3046,33 @@ void send_clients_JSON(int fd)
             "{\n"
             "\"clients\": [\n");
 
+    pthread_mutex_lock(&client_infos.mutex);
     for (; i<client_infos.client_count; i++) {
+        /* leave room for the entry and the end of the list */
+        if(strlen(buffer) + 512 > sizeof(buffer))
+            break;
+
+        if(i != 0) {
+            sprintf(buffer + strlen(buffer), ",\n");
+        }
+
         sprintf(buffer + strlen(buffer),
             "{\n"
             "\"address\": \"%s\",\n"
-            "\"timestamp\": %ld\n"
+            "\"timestamp\": %ld,\n"
+            "\"fps\": %.1f,\n"
+            "\"latency_ms\": %.1f,\n"
+            "\"frames_sent\": %lu,\n"
+            "\"frames_skipped\": %lu\n"
             "}\n",
             client_infos.infos[i]->address,
-            (unsigned long)client_infos.infos[i]->last_take_time.tv_sec);
-
-        if(i != (client_infos.client_count - 1)) {
-            sprintf(buffer + strlen(buffer), ",\n");
-        }
+            (unsigned long)client_infos.infos[i]->last_take_time.tv_sec,
+            client_infos.infos[i]->fps,
+            client_infos.infos[i]->latency,
+            client_infos.infos[i]->frames_sent,
+            client_infos.infos[i]->frames_skipped);
     }
+    pthread_mutex_unlock(&client_infos.mutex);
 
     sprintf(buffer + strlen(buffer),
             "]");
@@ -2058,8 +3081,7 @@ void send_clients_JSON(int fd)
             "\n}\n");
     i = strlen(buffer);
 
-    /* first transmit HTTP-header, afterwards transmit content of file */
-    if(write(fd, buffer, i) < 0) {
+    if(send_answer(context_fd, "200 OK", "Content-type: application/x-javascript\r\n" NOCACHE_HEADER, buffer, i) < 0) {
         DBG("unable to serve the control JSON file\n");
     }
 }
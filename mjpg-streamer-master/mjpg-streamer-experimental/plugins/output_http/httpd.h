@@ -20,9 +20,50 @@
 #                                                                              #
 *******************************************************************************/
 
-#define IO_BUFFER 256
 #define BUFFER_SIZE 1024
 
+/* the longest request header accepted */
+#define REQUEST_SIZE (8*1024)
+
+/*
+ * Timeouts in seconds: for a client to send its request, and for a client
+ * to take any data of its answer or stream.
+ */
+#define REQUEST_TIMEOUT 5
+#define SEND_TIMEOUT 10
+
+/*
+ * default for the seconds a kept alive connection may wait for its next
+ * request, and the most requests answered on one connection
+ */
+#define KEEPALIVE_TIMEOUT 10
+#define KEEPALIVE_REQUESTS 1000
+
+/*
+ * A streaming client that takes no data for this many seconds has the rest
+ * of its frame copied out of the ring, so the input plugin can reuse it.
+ */
+#define STALL_TIMEOUT 1
+
+/* default number of threads answering requests other than streams */
+#define WORKER_THREADS 4
+
+/*
+ * default for the bytes of a stream the kernel may hold unsent, see
+ * TCP_NOTSENT_LOWAT; the less, the sooner a client that can't keep up gets
+ * the newest frame rather than the next one
+ */
+#define STREAM_BACKLOG (16*1024)
+
+/* epoll events handled at once by the event loop */
+#define MAX_EVENTS 64
+
+/*
+ * frames sent with MSG_ZEROCOPY the kernel may still read, per client; they
+ * keep their slots of the input's ring until it is done
+ */
+#define ZEROCOPY_FRAMES 2
+
 /* the boundary is used for the M-JPEG stream, it separates the multipart stream of pictures */
 #define BOUNDARY "boundarydonotcross"
 
@@ -43,12 +84,23 @@
  * Many browser seem to ignore, or at least not always obey those headers
  * since i observed caching of files from time to time.
  */
-#define STD_HEADER "Connection: close\r\n" \
-    "Server: MJPG-Streamer/0.2\r\n" \
+#define NOCACHE_HEADER "Server: MJPG-Streamer/0.2\r\n" \
     "Cache-Control: no-store, no-cache, must-revalidate, pre-check=0, post-check=0, max-age=0\r\n" \
     "Pragma: no-cache\r\n" \
     "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
 
+/* for answers that last as long as the connection, like streams */
+#define STD_HEADER "Connection: close\r\n" NOCACHE_HEADER
+
+/*
+ * Header of snapshots: a browser may keep them, but has to ask whether the
+ * frame changed before using one again, see send_snapshot().
+ */
+#define SNAPSHOT_HEADER "Server: MJPG-Streamer/0.2\r\n" \
+    "Cache-Control: no-cache, max-age=0\r\n" \
+    "Pragma: no-cache\r\n" \
+    "Expires: Mon, 3 Jan 2000 12:34:56 GMT\r\n"
+
 /*
  * Maximum number of server sockets (i.e. protocol families) to listen.
  */
@@ -109,14 +161,13 @@ typedef struct {
     char *client;
     char *credentials;
     char *query_string;
+    char *if_none_match;        /* the ETags of snapshots the client has */
+    unsigned int frame_seq;     /* X-Frame-Seq of the snapshot it has, or 0 */
+    int http_minor;             /* HTTP/1.0 or HTTP/1.1 */
+    int keep_alive;             /* Connection: keep-alive, or 1.1 without close */
+    int has_body;               /* Content-Length or Transfer-Encoding */
 } request;
 
-/* the iobuffer structure is used to read from the HTTP-client */
-typedef struct {
-    int level;              /* how full is the buffer */
-    char buffer[IO_BUFFER]; /* the data */
-} iobuffer;
-
 /* store configuration for each server instance */
 typedef struct {
     int port;
@@ -124,19 +175,12 @@ typedef struct {
     char *credentials;
     char *www_folder;
     char nocommands;
+    int workers;
+    char zerocopy;
+    int backlog;
+    int keepalive;
 } config;
 
-/* context of each server thread */
-typedef struct {
-    int sd[MAX_SD_LEN];
-    int sd_len;
-    int id;
-    globals *pglobal;
-    pthread_t threadID;
-
-    config conf;
-} context;
-
 
 #if defined(MANAGMENT)
 /*
@@ -146,16 +190,78 @@ typedef struct _client_info {
     struct _client_info *next;
     char *address;
     struct timeval last_take_time;
+
+    /* of the stream it took frames from last, see update_client_stats() */
+    double fps;
+    double latency;
+    unsigned long frames_sent;
+    unsigned long frames_skipped;
 } client_info;
 
-struct {
+struct _client_infos {
     client_info **infos;
     unsigned int client_count;
     pthread_mutex_t mutex;
-} client_infos;
+};
+extern struct _client_infos client_infos;
 
 #endif
 
+typedef struct _connection connection;
+typedef struct _context context;
+
+/* a thread signalling the event loop about each frame of an input */
+typedef struct {
+    pthread_t threadID;
+    context *pc;
+    int input_number;
+} watcher;
+
+/*
+ * the multipart header of a frame, rendered once for all clients streaming
+ * it; kept for each slot of the ring, valid while the frame is held
+ */
+typedef struct {
+    unsigned int seq;           /* of the frame it was rendered for, 0 if none */
+    uint64_t arrived;           /* monotonic_usecs() when the loop saw it */
+    int size;
+    char header[128];
+    unsigned int wxp_seq;       /* the same for WebcamXP */
+    char wxp_header[50];
+} stream_part;
+
+/* context of each server thread */
+struct _context {
+    int sd[MAX_SD_LEN];
+    int sd_len;
+    int id;
+    globals *pglobal;
+    pthread_t threadID;
+    unsigned long etag_base;    /* tells the ETags of other runs apart */
+
+    config conf;
+
+    /* the event loop, see server_thread() */
+    int epfd;
+    int wake_fd;                /* eventfd the other threads signal */
+    connection *connections;    /* all connections in the event loop */
+    connection *closed;         /* see connection_drop() */
+    unsigned int updates[MAX_INPUT_PLUGINS]; /* frames signalled by the watchers */
+    watcher watchers[MAX_INPUT_PLUGINS];
+    int watcher_count;
+    stream_part parts[MAX_INPUT_PLUGINS][INPUT_FRAME_RING]; /* by slot */
+
+    /* requests waiting for a worker, and the streams and kept alive
+       connections handed back to the loop */
+    pthread_t *workers;
+    int worker_count;
+    pthread_mutex_t queue_mutex;
+    pthread_cond_t queue_cond;
+    connection *requests, *last_request;
+    connection *handed_back;
+    int stopping;
+};
+
 /*
  * this struct is just defined to allow passing all necessary details to a worker thread
  * "cfd" is for connected/accepted filedescriptor
@@ -163,26 +269,103 @@ struct {
 typedef struct {
     context *pc;
     int fd;
+    int http_minor;             /* of the request, for the answer */
+    int keep_alive;             /* the connection is kept for the next request */
+    int answered;               /* see send_answer() */
     #ifdef MANAGMENT
     client_info *client;
     #endif
 } cfd;
 
+/* a piece of an answer waiting to be sent */
+typedef struct {
+    const char *data;
+    int size;
+    input_frame *frame;         /* data points into it, released once sent */
+    char *copy;                 /* or into this, freed once sent */
+    int shared;                 /* the part header of the next segment's frame */
+    int zerocopy;               /* data stays as it is while frames are held */
+    int zerocopy_sent;          /* frame was sent with MSG_ZEROCOPY */
+    unsigned int zerocopy_id;   /* by the last send that did */
+} out_segment;
+
+/* a frame the kernel may still read, after a send with MSG_ZEROCOPY */
+typedef struct {
+    input_frame *frame;
+    unsigned int id;
+} zerocopy_frame;
+
+#define OUT_SEGMENTS 4
+
+/* a connection is either in the event loop or with a worker thread */
+typedef enum {
+    C_READING,                  /* the loop reads the request */
+    C_ANSWERING,                /* a worker answers it */
+    C_STREAMING,                /* the loop sends it frames */
+    C_CLOSED                    /* closed, freed after the events at hand */
+} connection_state;
+
+/* a connected client, see server_thread() */
+struct _connection {
+    connection *prev, *next;
+    context *pc;
+    int fd;
+    connection_state state;
+    int events;                 /* registered with epoll */
+    int read_closed;            /* the client won't send any more */
+    time_t last_active;         /* CLOCK_MONOTONIC seconds, for the timeouts */
+
+    char request[REQUEST_SIZE];
+    int request_size;
+    int request_end;            /* length of its header, 0 if it did not fit */
+    unsigned int requests;      /* answered on this connection */
+
+    /* the stream, see stream_queue_frame() */
+    int input_number;
+    int wxp;
+    unsigned int seq;           /* of the last frame queued */
+    unsigned int updates;       /* of the input, when it was queued */
+    unsigned long frames_sent;
+    unsigned long frames_skipped;
+    int frame_unsent;           /* nothing of the queued frame was sent yet */
+    uint64_t frame_arrived;     /* see stream_part */
+    char header[BUFFER_SIZE];   /* the HTTP header, then each part's header */
+    out_segment out[OUT_SEGMENTS];
+    int out_first, out_count, out_offset;
+
+    /* MSG_ZEROCOPY, see connection_send() */
+    int zerocopy;                   /* 1: on, 2: on but the kernel copies */
+    unsigned int zerocopy_next;     /* id of the next send */
+    zerocopy_frame zerocopy_frames[ZEROCOPY_FRAMES];
+    int zerocopy_first, zerocopy_count;
+
+    /* delivery of the stream, see server_stats() */
+    double fps;
+    double latency;             /* milliseconds from arrival to sent, smoothed */
+    unsigned long stats_frames; /* frames_sent at stats_time */
+    uint64_t stats_time;
+
+    #ifdef MANAGMENT
+    client_info *client;
+    #endif
+};
+
 
 
 /* prototypes */
 void *server_thread(void *arg);
-void send_error(int fd, int which, char *message);
-void send_output_JSON(int fd, int plugin_number);
-void send_input_JSON(int fd, int plugin_number);
-void send_program_JSON(int fd);
+void send_error(cfd *context_fd, int which, char *message);
+void send_output_JSON(cfd *context_fd, int plugin_number);
+void send_input_JSON(cfd *context_fd, int plugin_number);
+void send_program_JSON(cfd *context_fd);
 void check_JSON_string(char *source, char *destination);
 
 #ifdef MANAGMENT
 client_info *add_client(char *address);
 int check_client_status(client_info *client);
 void update_client_timestamp(client_info *client);
-void send_clients_JSON(int fd);
+void update_client_stats(client_info *client, double fps, double latency, unsigned long frames_sent, unsigned long frames_skipped);
+void send_clients_JSON(cfd *context_fd);
 #endif
 
 
@@ -64,6 +64,16 @@ void help(void)
 	    " [-l ] --listen ]........: Listen on Hostname / IP\n" \
             " [-c | --credentials ]...: ask for \"username:password\" on connect\n" \
             " [-n | --nocommands ]....: disable execution of commands\n"
+            " [-t | --threads ].......: threads answering requests other than\n" \
+            "                           streams, default: 4\n"
+            " [-z | --zerocopy ]......: send frames with MSG_ZEROCOPY\n"
+            " [-b | --backlog ].......: bytes of a stream the kernel may hold\n" \
+            "                           unsent, so a slow client gets the newest\n" \
+            "                           frame once it catches up, 0: no limit,\n" \
+            "                           default: 16384\n"
+            " [-k | --keepalive ].....: seconds a connection is kept for the\n" \
+            "                           next request, 0: one request each,\n" \
+            "                           default: 10\n"
             " ---------------------------------------------------------------\n");
 }
 
@@ -82,7 +92,8 @@ int output_init(output_parameter *param, int id)
     int i;
     int  port;
     char *credentials, *www_folder, *hostname = NULL;
-    char nocommands;
+    char nocommands, zerocopy;
+    int workers, backlog, keepalive;
 
     DBG("output #%02d\n", param->id);
 
@@ -90,6 +101,10 @@ int output_init(output_parameter *param, int id)
     credentials = NULL;
     www_folder = NULL;
     nocommands = 0;
+    workers = WORKER_THREADS;
+    zerocopy = 0;
+    backlog = STREAM_BACKLOG;
+    keepalive = KEEPALIVE_TIMEOUT;
 
     param->argv[0] = OUTPUT_PLUGIN_NAME;
 
@@ -115,6 +130,14 @@ int output_init(output_parameter *param, int id)
             {"www", required_argument, 0, 0},
             {"n", no_argument, 0, 0},
             {"nocommands", no_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"threads", required_argument, 0, 0},
+            {"z", no_argument, 0, 0},
+            {"zerocopy", no_argument, 0, 0},
+            {"b", required_argument, 0, 0},
+            {"backlog", required_argument, 0, 0},
+            {"k", required_argument, 0, 0},
+            {"keepalive", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -175,6 +198,34 @@ int output_init(output_parameter *param, int id)
             DBG("case 10,11\n");
             nocommands = 1;
             break;
+
+            /* t, threads */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            workers = MAX(atoi(optarg), 1);
+            break;
+
+            /* z, zerocopy */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            zerocopy = 1;
+            break;
+
+            /* b, backlog */
+        case 16:
+        case 17:
+            DBG("case 16,17\n");
+            backlog = MAX(atoi(optarg), 0);
+            break;
+
+            /* k, keepalive */
+        case 18:
+        case 19:
+            DBG("case 18,19\n");
+            keepalive = MAX(atoi(optarg), 0);
+            break;
         }
     }
 
@@ -185,12 +236,28 @@ int output_init(output_parameter *param, int id)
     servers[param->id].conf.credentials = credentials;
     servers[param->id].conf.www_folder = www_folder;
     servers[param->id].conf.nocommands = nocommands;
+    servers[param->id].conf.workers = workers;
+    servers[param->id].conf.zerocopy = zerocopy;
+    servers[param->id].conf.backlog = backlog;
+    servers[param->id].conf.keepalive = keepalive;
 
     OPRINT("www-folder-path......: %s\n", (www_folder == NULL) ? "disabled" : www_folder);
     OPRINT("HTTP TCP port........: %d\n", ntohs(port));
     OPRINT("HTTP Listen Address..: %s\n", hostname);
     OPRINT("username:password....: %s\n", (credentials == NULL) ? "disabled" : credentials);
     OPRINT("commands.............: %s\n", (nocommands) ? "disabled" : "enabled");
+    OPRINT("worker threads.......: %d\n", workers);
+    OPRINT("zero-copy sends......: %s\n", (zerocopy) ? "enabled" : "disabled");
+    if(backlog > 0) {
+        OPRINT("stream backlog.......: %d bytes\n", backlog);
+    } else {
+        OPRINT("stream backlog.......: unlimited\n");
+    }
+    if(keepalive > 0) {
+        OPRINT("keep-alive...........: %d seconds\n", keepalive);
+    } else {
+        OPRINT("keep-alive...........: disabled\n");
+    }
 
     param->global->out[id].name = malloc((strlen(OUTPUT_PLUGIN_NAME) + 1) * sizeof(char));
     sprintf(param->global->out[id].name, OUTPUT_PLUGIN_NAME);
@@ -199,10 +266,12 @@ int output_init(output_parameter *param, int id)
 }
 
 /******************************************************************************
-Description.: this will stop the server thread, client threads
-              will not get cleaned properly, because they run detached and
-              no pointer is kept. This is not a huge issue, because this
-              funtion is intended to clean up the biggest mess on shutdown.
+Description.: this will stop the server thread, which closes the
+              connections of its event loop; worker threads still answering
+              a request finish it and close that connection themselves
+              before they are joined.
+              The server thread may have left its loop already, on seeing
+              pglobal->stop, so it is joined rather than detached.
 Input Value.: id determines which server instance to send commands to
 Return Value: always 0
 ******************************************************************************/
@@ -211,6 +280,7 @@ int output_stop(int id)
 
     DBG("will cancel server thread #%02d\n", id);
     pthread_cancel(servers[id].threadID);
+    pthread_join(servers[id].threadID, NULL);
 
     return 0;
 }
@@ -226,7 +296,6 @@ int output_run(int id)
 
     /* create thread and pass context to thread function */
     pthread_create(&(servers[id].threadID), NULL, server_thread, &(servers[id]));
-    pthread_detach(servers[id].threadID);
 
     return 0;
 }
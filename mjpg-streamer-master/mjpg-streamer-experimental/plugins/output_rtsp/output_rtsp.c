@@ -21,57 +21,94 @@
 *******************************************************************************/
 
 /*
-  This output plugin is based on code from output_file.c
-  Writen by Dimitrios Zachariadis
-  Version 0.1, May 2010
+  This output plugin streams the frames with RTP, as JPEG (RFC 2435), to the
+  clients of a minimal RTSP server, each by unicast UDP or all of them by
+  multicast.
 
-  It provides a mechanism to take snapshots with a trigger from a UDP packet.
-  The UDP msg contains the path for the snapshot jpeg file
-  It echoes the message received back to the sender, after taking the snapshot
+  The server thread answers the RTSP requests and keeps the sessions, the
+  worker thread packetizes each frame once and sends the packets to every
+  session playing, in batches with sendmmsg().
 */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <strings.h>
 #include <errno.h>
 #include <signal.h>
 #include <sys/socket.h>
-#include <resolv.h>
+#include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <getopt.h>
 #include <pthread.h>
-#include <fcntl.h>
+#include <poll.h>
 #include <time.h>
-#include <syslog.h>
-
-#include <dirent.h>
-
+#include <sys/time.h>
 
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
+#include "rtp_jpeg.h"
 
 #define OUTPUT_PLUGIN_NAME "RTSP output plugin"
 
+/* clients at most, each with one session */
+#define RTSP_CLIENTS 16
+
+/* bytes of a request at most */
+#define RTSP_REQUEST_SIZE 4096
+
+/* seconds a session lasts without requests or receiver reports */
+#define RTSP_TIMEOUT 60
+
+/* seconds a reply may take to send */
+#define RTSP_SEND_TIMEOUT 5
+
+/* packets sent with one sendmmsg() */
+#define RTP_BATCH 64
+
+/* seconds between sender reports */
+#define RTCP_INTERVAL 1
+
 enum RTSP_State {
     RTSP_State_Setup,
     RTSP_State_Playing,
     RTSP_State_Paused,
-    RTSP_State_Teardown,
 };
 
-static pthread_t worker;
+typedef struct {
+    int fd;                     /* the connection, -1 if the slot is free */
+    char request[RTSP_REQUEST_SIZE];
+    int length;
+    time_t active;              /* of the last request or receiver report */
+
+    /* the session set up on the connection, guarded by clients_mutex */
+    unsigned int session;       /* 0 if there is none */
+    enum RTSP_State state;
+    int multicast;
+    struct sockaddr_in rtp, rtcp;
+} rtsp_client;
+
+static pthread_t worker, server;
 static globals *pglobal;
-static int fd, max_frame_size;
-static unsigned char *frame = NULL;
-static char *command = NULL;
+static input_frame *frame = NULL;
 static int input_number = 0;
 
-// UDP port
-static int port = 554;
+// RTSP port, and the RTP port, RTCP uses the next one
+static int port = 8554;
+static int rtp_port = 5004;
+
+// multicast group, if any, and the time to live of its packets
+static char *multicast = NULL;
+static int ttl = 1;
+static struct sockaddr_in group;
+
+static int rtsp_fd = -1, rtp_fd = -1, rtcp_fd = -1;
+static rtsp_client clients[RTSP_CLIENTS];
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t playing = PTHREAD_COND_INITIALIZER;
+static rtp_stream stream;
 
 /******************************************************************************
 Description.: print a help message
@@ -84,152 +121,564 @@ void help(void)
             " Help for output plugin..: "OUTPUT_PLUGIN_NAME"\n" \
             " ---------------------------------------------------------------\n" \
             " The following parameters can be passed to this plugin:\n\n" \
-            " [-p | --port ]..........: UDP port to listen for picture requests. UDP message is the filename to save\n\n" \
+            " [-p | --port ]..........: TCP port of the RTSP server, default: 8554\n\n" \
+            " [-r | --rtp ]...........: UDP port to send RTP from, RTCP uses the next one,\n" \
+            "                           default: 5004\n\n" \
+            " [-m | --multicast ].....: multicast group for the clients asking for it,\n" \
+            "                           the packets are sent to it on the RTP port\n\n" \
+            " [-t | --ttl ]...........: time to live of the multicast packets, default: 1\n\n" \
             " [-i | --input ].......: read frames from the specified input plugin (first input plugin between the arguments is the 0th)\n\n" \
             " ---------------------------------------------------------------\n");
 }
 
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void unlock_mutex(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
 /******************************************************************************
-Description.: clean up allocated resources
-Input Value.: unused argument
+Description.: copies the value of a header of a request
+Input Value.: the request, the name of the header and room for its value
+Return Value: 0 if the request has the header, -1 if not
+******************************************************************************/
+static int rtsp_header(const char *request, const char *name, char *value, int size)
+{
+    const char *p = request, *end;
+    int length = strlen(name);
+
+    while((p = strstr(p, "\r\n")) != NULL) {
+        p += 2;
+        if(strncasecmp(p, name, length) != 0 || p[length] != ':')
+            continue;
+
+        p += length + 1;
+        while(*p == ' ' || *p == '\t')
+            p++;
+        if((end = strstr(p, "\r\n")) == NULL)
+            end = p + strlen(p);
+        if(end - p >= size)
+            return -1;
+        memcpy(value, p, end - p);
+        value[end - p] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+/******************************************************************************
+Description.: sends a reply to a request
+Input Value.: the client, the status, the CSeq of the request, more headers
+              and a body, both may be NULL
+Return Value: 0 if OK, -1 if the connection is broken
+******************************************************************************/
+static int rtsp_reply(rtsp_client *c, const char *status, const char *cseq, const char *headers, const char *body)
+{
+    char buffer[2048];
+    int length;
+
+    length = snprintf(buffer, sizeof(buffer), "RTSP/1.0 %s\r\n" \
+                      "CSeq: %s\r\n" \
+                      "Server: MJPG-Streamer/0.2\r\n" \
+                      "%s", status, cseq, headers != NULL ? headers : "");
+    if(body != NULL)
+        length += snprintf(buffer + length, sizeof(buffer) - length, "Content-Length: %d\r\n\r\n%s", (int)strlen(body), body);
+    else
+        length += snprintf(buffer + length, sizeof(buffer) - length, "\r\n");
+
+    if(length >= (int)sizeof(buffer))
+        return -1;
+    return send(c->fd, buffer, length, MSG_NOSIGNAL) == length ? 0 : -1;
+}
+
+/******************************************************************************
+Description.: answers a request, SETUP sets up the session of the client, or
+              changes its transport, the other requests for a session must
+              be for that session
+Input Value.: the client and the request, without its body
+Return Value: 0 if OK, -1 if the connection is broken
+******************************************************************************/
+static int rtsp_request(rtsp_client *c, char *request)
+{
+    char method[32], url[256], version[16], cseq[32], value[512];
+    char headers[768], body[512], address[INET_ADDRSTRLEN];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int rtp, rtcp, mc;
+
+    if(sscanf(request, "%31s %255s %15s", method, url, version) != 3 || strncmp(version, "RTSP/1.", 7) != 0)
+        return -1;
+    if(rtsp_header(request, "CSeq", cseq, sizeof(cseq)) < 0)
+        strcpy(cseq, "0");
+    DBG("RTSP request %s %s\n", method, url);
+
+    /* requests for a session are for the one of the client */
+    if(rtsp_header(request, "Session", value, sizeof(value)) == 0 &&
+       (c->session == 0 || strtoul(value, NULL, 16) != c->session))
+        return rtsp_reply(c, "454 Session Not Found", cseq, NULL, NULL);
+
+    if(strcmp(method, "OPTIONS") == 0) {
+        return rtsp_reply(c, "200 OK", cseq, "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n", NULL);
+    }
+
+    if(strcmp(method, "DESCRIBE") == 0) {
+        if(getsockname(c->fd, (struct sockaddr *)&addr, &addr_len) < 0)
+            return -1;
+        inet_ntop(AF_INET, &addr.sin_addr, address, sizeof(address));
+
+        if(multicast != NULL)
+            snprintf(value, sizeof(value), "%s/%d", multicast, ttl);
+        else
+            strcpy(value, "0.0.0.0");
+        snprintf(body, sizeof(body), "v=0\r\n" \
+                 "o=- %u 1 IN IP4 %s\r\n" \
+                 "s=MJPG-Streamer\r\n" \
+                 "c=IN IP4 %s\r\n" \
+                 "t=0 0\r\n" \
+                 "a=control:*\r\n" \
+                 "m=video 0 RTP/AVP %d\r\n" \
+                 "a=control:track0\r\n", stream.ssrc, address, value, RTP_PT_JPEG);
+
+        if(url[strlen(url) - 1] == '/')
+            url[strlen(url) - 1] = '\0';
+        snprintf(headers, sizeof(headers), "Content-Base: %s/\r\n" \
+                 "Content-Type: application/sdp\r\n", url);
+        return rtsp_reply(c, "200 OK", cseq, headers, body);
+    }
+
+    if(strcmp(method, "SETUP") == 0) {
+        if(rtsp_header(request, "Transport", value, sizeof(value)) < 0 ||
+           strstr(value, "RTP/AVP/TCP") != NULL || strstr(value, "interleaved") != NULL)
+            return rtsp_reply(c, "461 Unsupported Transport", cseq, NULL, NULL);
+
+        mc = strstr(value, "multicast") != NULL;
+        if(mc && multicast == NULL)
+            return rtsp_reply(c, "461 Unsupported Transport", cseq, NULL, NULL);
+        if(!mc && (strstr(value, "client_port=") == NULL ||
+                   sscanf(strstr(value, "client_port=") + 12, "%d-%d", &rtp, &rtcp) != 2))
+            return rtsp_reply(c, "461 Unsupported Transport", cseq, NULL, NULL);
+        if(!mc && getpeername(c->fd, (struct sockaddr *)&addr, &addr_len) < 0)
+            return -1;
+
+        pthread_mutex_lock(&clients_mutex);
+        if(c->session == 0) {
+            do {
+                c->session = random();
+            } while(c->session == 0);
+            c->state = RTSP_State_Setup;
+        }
+        c->multicast = mc;
+        if(!mc) {
+            c->rtp = addr;
+            c->rtp.sin_port = htons(rtp);
+            c->rtcp = addr;
+            c->rtcp.sin_port = htons(rtcp);
+        }
+        pthread_mutex_unlock(&clients_mutex);
+
+        if(mc)
+            snprintf(headers, sizeof(headers), "Transport: RTP/AVP;multicast;destination=%s;port=%d-%d;ttl=%d;ssrc=%08X\r\n" \
+                     "Session: %08X;timeout=%d\r\n", multicast, rtp_port, rtp_port + 1, ttl, stream.ssrc, c->session, RTSP_TIMEOUT);
+        else
+            snprintf(headers, sizeof(headers), "Transport: RTP/AVP;unicast;client_port=%d-%d;server_port=%d-%d;ssrc=%08X\r\n" \
+                     "Session: %08X;timeout=%d\r\n", rtp, rtcp, rtp_port, rtp_port + 1, stream.ssrc, c->session, RTSP_TIMEOUT);
+        return rtsp_reply(c, "200 OK", cseq, headers, NULL);
+    }
+
+    if(strcmp(method, "PLAY") == 0 || strcmp(method, "PAUSE") == 0 ||
+       strcmp(method, "TEARDOWN") == 0 || strcmp(method, "GET_PARAMETER") == 0) {
+        if(c->session == 0)
+            return rtsp_reply(c, "454 Session Not Found", cseq, NULL, NULL);
+        snprintf(headers, sizeof(headers), "Session: %08X\r\n", c->session);
+
+        pthread_mutex_lock(&clients_mutex);
+        if(strcmp(method, "PLAY") == 0) {
+            c->state = RTSP_State_Playing;
+            pthread_cond_broadcast(&playing);
+            strcat(headers, "Range: npt=0.000-\r\n");
+        } else if(strcmp(method, "PAUSE") == 0) {
+            c->state = RTSP_State_Paused;
+        } else if(strcmp(method, "TEARDOWN") == 0) {
+            c->session = 0;
+        }
+        pthread_mutex_unlock(&clients_mutex);
+
+        return rtsp_reply(c, "200 OK", cseq, headers, NULL);
+    }
+
+    return rtsp_reply(c, "501 Not Implemented", cseq, NULL, NULL);
+}
+
+/******************************************************************************
+Description.: closes the connection of a client, which ends its session
+Input Value.: the client
 Return Value: -
 ******************************************************************************/
-void worker_cleanup(void *arg)
+static void rtsp_close(rtsp_client *c)
 {
-    static unsigned char first_run = 1;
+    pthread_mutex_lock(&clients_mutex);
+    c->session = 0;
+    pthread_mutex_unlock(&clients_mutex);
 
-    if(!first_run) {
-        DBG("already cleaned up resources\n");
+    close(c->fd);
+    c->fd = -1;
+    c->length = 0;
+}
+
+/******************************************************************************
+Description.: accepts a connection, if there is room for another client
+Input Value.: the current time
+Return Value: -
+******************************************************************************/
+static void rtsp_accept(time_t now)
+{
+    struct timeval timeout = {RTSP_SEND_TIMEOUT, 0};
+    int fd, i;
+
+    if((fd = accept(rtsp_fd, NULL, NULL)) < 0)
         return;
-    }
 
-    first_run = 0;
-    OPRINT("cleaning up resources allocated by worker thread\n");
+    for(i = 0; i < RTSP_CLIENTS && clients[i].fd >= 0; i++);
+    if(i == RTSP_CLIENTS) {
+        DBG("too many RTSP clients\n");
+        close(fd);
+        return;
+    }
 
-    if(frame != NULL) {
-        free(frame);
+    if(setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        perror("setsockopt(SO_SNDTIMEO) failed\n");
     }
-    close(fd);
+    clients[i].fd = fd;
+    clients[i].length = 0;
+    clients[i].active = now;
 }
 
 /******************************************************************************
-Description.: this is the main worker thread
-              it loops forever, grabs a fresh frame and stores it to file
-Input Value.:
-Return Value:
+Description.: reads from the connection of a client and answers each request
+              that came in whole
+Input Value.: the client and the current time
+Return Value: -
 ******************************************************************************/
-void *worker_thread(void *arg)
+static void rtsp_read(rtsp_client *c, time_t now)
 {
-    int ok = 1, frame_size = 0, rc = 0;
-    char buffer1[1024] = {0};
-    unsigned char *tmp_framebuffer = NULL;
+    char request[RTSP_REQUEST_SIZE], value[32], *end;
+    int n, size, content;
 
-    /* set cleanup handler to cleanup allocated resources */
-    pthread_cleanup_push(worker_cleanup, NULL);
+    n = recv(c->fd, c->request + c->length, RTSP_REQUEST_SIZE - 1 - c->length, 0);
+    if(n < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if(n <= 0) {
+        rtsp_close(c);
+        return;
+    }
+    c->length += n;
+    c->request[c->length] = '\0';
+    c->active = now;
+
+    while((end = strstr(c->request, "\r\n\r\n")) != NULL) {
+        size = end + 4 - c->request;
+        memcpy(request, c->request, size);
+        request[size] = '\0';
+
+        /* the body of a request is not used, but skipped */
+        content = 0;
+        if(rtsp_header(request, "Content-Length", value, sizeof(value)) == 0)
+            content = atoi(value);
+        if(content < 0 || content >= RTSP_REQUEST_SIZE - size) {
+            rtsp_close(c);
+            return;
+        }
+        size += content;
+        if(size > c->length)
+            break;
 
-    // set UDP server data structures ---------------------------
-    if(port <= 0) {
-        OPRINT("a valid UDP port must be provided\n");
-        return NULL;
+        if(rtsp_request(c, request) < 0) {
+            rtsp_close(c);
+            return;
+        }
+        memmove(c->request, c->request + size, c->length - size + 1);
+        c->length -= size;
     }
-    struct sockaddr_in addr;
-    int sd;
-    int bytes;
-    unsigned int addr_len = sizeof(addr);
-    char udpbuffer[1024] = {0};
-    sd = socket(PF_INET, SOCK_DGRAM, 0);
-    bzero(&addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-    if(bind(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
-        perror("bind");
-    // -----------------------------------------------------------
 
-    while(ok >= 0 && !pglobal->stop) {
-        DBG("waiting for a UDP message\n");
+    if(c->length == RTSP_REQUEST_SIZE - 1) {
+        DBG("RTSP request too large\n");
+        rtsp_close(c);
+    }
+}
+
+/******************************************************************************
+Description.: reads the receiver reports, which keep a unicast session
+Input Value.: the current time
+Return Value: -
+******************************************************************************/
+static void rtcp_receive(time_t now)
+{
+    unsigned char buffer[1500];
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int i;
 
-        // UDP receive ---------------------------------------------
-        memset(udpbuffer, 0, sizeof(udpbuffer));
-        bytes = recvfrom(sd, udpbuffer, sizeof(udpbuffer), 0, (struct sockaddr*)&addr, &addr_len);
-        // ---------------------------------------------------------
+    while(recvfrom(rtcp_fd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&addr, &addr_len) >= 0) {
+        pthread_mutex_lock(&clients_mutex);
+        for(i = 0; i < RTSP_CLIENTS; i++) {
+            if(clients[i].session != 0 && !clients[i].multicast &&
+               clients[i].rtcp.sin_addr.s_addr == addr.sin_addr.s_addr &&
+               clients[i].rtcp.sin_port == addr.sin_port)
+                clients[i].active = now;
+        }
+        pthread_mutex_unlock(&clients_mutex);
+        addr_len = sizeof(addr);
+    }
+}
 
+/******************************************************************************
+Description.: clean up the resources of the server thread
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+void server_cleanup(void *arg)
+{
+    int i;
 
+    OPRINT("cleaning up resources allocated by server thread\n");
 
-        DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
+    for(i = 0; i < RTSP_CLIENTS; i++) {
+        if(clients[i].fd >= 0)
+            rtsp_close(&clients[i]);
+    }
+    close(rtsp_fd);
+}
 
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
+/******************************************************************************
+Description.: the server thread, answers the RTSP requests of the clients and
+              ends the sessions that time out
+Input Value.: unused argument
+Return Value: NULL
+******************************************************************************/
+void *server_thread(void *arg)
+{
+    struct pollfd fds[2 + RTSP_CLIENTS];
+    int slots[RTSP_CLIENTS];
+    int i, nfds;
+    time_t now;
+
+    pthread_cleanup_push(server_cleanup, NULL);
+
+    while(!pglobal->stop) {
+        fds[0].fd = rtsp_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = rtcp_fd;
+        fds[1].events = POLLIN;
+        for(nfds = 2, i = 0; i < RTSP_CLIENTS; i++) {
+            if(clients[i].fd < 0)
+                continue;
+            fds[nfds].fd = clients[i].fd;
+            fds[nfds].events = POLLIN;
+            slots[nfds - 2] = i;
+            nfds++;
+        }
 
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
+        if(poll(fds, nfds, 1000) < 0) {
+            if(errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        now = monotonic_seconds();
+
+        if(fds[0].revents & POLLIN)
+            rtsp_accept(now);
+        if(fds[1].revents & POLLIN)
+            rtcp_receive(now);
+        for(i = 2; i < nfds; i++) {
+            if(fds[i].revents != 0 && clients[slots[i - 2]].fd >= 0)
+                rtsp_read(&clients[slots[i - 2]], now);
+        }
 
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
+        for(i = 0; i < RTSP_CLIENTS; i++) {
+            if(clients[i].fd >= 0 && now - clients[i].active > RTSP_TIMEOUT) {
+                DBG("RTSP client timed out\n");
+                rtsp_close(&clients[i]);
             }
-
-            frame = tmp_framebuffer;
         }
+    }
 
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
+    pthread_cleanup_pop(1);
 
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+    return NULL;
+}
 
-        /* only save a file if a name came in with the UDP message */
-        if(strlen(udpbuffer) > 0) {
-            DBG("writing file: %s\n", udpbuffer);
+/******************************************************************************
+Description.: collects where to send the packets, for each session playing,
+              must be called with clients_mutex locked
+Input Value.: room for the RTP and RTCP addresses
+Return Value: the number of addresses
+******************************************************************************/
+static int rtp_destinations(struct sockaddr_in *rtp, struct sockaddr_in *rtcp)
+{
+    int i, n = 0, mc = 0;
+
+    for(i = 0; i < RTSP_CLIENTS; i++) {
+        if(clients[i].session == 0 || clients[i].state != RTSP_State_Playing)
+            continue;
+        if(clients[i].multicast) {
+            mc = 1;
+            continue;
+        }
+        rtp[n] = clients[i].rtp;
+        rtcp[n] = clients[i].rtcp;
+        n++;
+    }
 
-            /* open file for write. Path must pre-exist */
-            if((fd = open(udpbuffer, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)) < 0) {
-                OPRINT("could not open the file %s\n", udpbuffer);
-                return NULL;
-            }
+    /* the group gets each packet once, for all of its sessions */
+    if(mc) {
+        rtp[n] = group;
+        rtcp[n] = group;
+        rtcp[n].sin_port = htons(rtp_port + 1);
+        n++;
+    }
 
-            /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
-                OPRINT("could not write to file %s\n", udpbuffer);
-                perror("write()");
-                close(fd);
-                return NULL;
-            }
+    return n;
+}
 
-            close(fd);
+/******************************************************************************
+Description.: sends a batch of packets, a packet that fails is dropped
+Input Value.: the packets and their number
+Return Value: -
+******************************************************************************/
+static void rtp_send(struct mmsghdr *msgs, int count)
+{
+    int sent = 0, n;
+
+    while(sent < count) {
+        n = sendmmsg(rtp_fd, msgs + sent, count - sent, 0);
+        if(n < 0) {
+            if(errno != EINTR) {
+                DBG("sendmmsg: %s\n", strerror(errno));
+                sent++;
+            }
+            continue;
         }
+        sent += n;
+    }
+}
 
-        // send back client's message that came in udpbuffer
-        sendto(sd, udpbuffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
+/******************************************************************************
+Description.: clean up allocated resources
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+void worker_cleanup(void *arg)
+{
+    static unsigned char first_run = 1;
+
+    if(!first_run) {
+        DBG("already cleaned up resources\n");
+        return;
+    }
 
-        /* call the command if user specified one, pass current filename as argument */
-        if(command != NULL) {
-            memset(buffer1, 0, sizeof(buffer1));
+    first_run = 0;
+    OPRINT("cleaning up resources allocated by worker thread\n");
 
-            /* udpbuffer still contains the filename, pass it to the command as parameter */
-            snprintf(buffer1, sizeof(buffer1), "%s \"%s\"", command, udpbuffer);
-            DBG("calling command %s", buffer1);
+    if(frame != NULL) {
+        input_frame_release(frame);
+        frame = NULL;
+    }
+}
 
-            /* in addition provide the filename as environment variable */
-            if((rc = setenv("MJPG_FILE", udpbuffer, 1)) != 0) {
-                LOG("setenv failed (return value %d)\n", rc);
-            }
+/******************************************************************************
+Description.: this is the main worker thread
+              it loops while sessions are playing, grabs a fresh frame and
+              sends it to each of them
+Input Value.: unused argument
+Return Value: NULL
+******************************************************************************/
+void *worker_thread(void *arg)
+{
+    static rtp_packet packets[RTP_BATCH];
+    static struct mmsghdr msgs[RTP_BATCH];
+    static struct iovec iov[RTP_BATCH][2];
+    struct sockaddr_in rtp[RTSP_CLIENTS + 1], rtcp[RTSP_CLIENTS + 1];
+    struct timeval timestamp, now, report = {0, 0};
+    unsigned char buffer[64];
+    const char *error = NULL;
+    unsigned int seq = 0;
+    uint32_t ts;
+    int destinations, offset, i, n, d;
+    rtp_jpeg jpeg;
 
-            /* execute the command now */
-            if((rc = system(buffer1)) != 0) {
-                LOG("command failed (return value %d)\n", rc);
+    /* set cleanup handler to cleanup allocated resources */
+    pthread_cleanup_push(worker_cleanup, NULL);
+
+    while(!pglobal->stop) {
+        /* wait for a session to play */
+        pthread_mutex_lock(&clients_mutex);
+        pthread_cleanup_push(unlock_mutex, &clients_mutex);
+        while((destinations = rtp_destinations(rtp, rtcp)) == 0)
+            pthread_cond_wait(&playing, &clients_mutex);
+        pthread_cleanup_pop(1);
+
+        DBG("waiting for fresh frame\n");
+        if((frame = input_frame_wait(&pglobal->in[input_number], seq)) == NULL) {
+            LOG("not enough memory\n");
+            break;
+        }
+        seq = frame->seq;
+
+        if(rtp_jpeg_parse(&jpeg, frame->buf, frame->size) < 0) {
+            if(jpeg.error != error) {
+                OPRINT("can not send the frames: %s\n", jpeg.error);
+            }
+            error = jpeg.error;
+            input_frame_release(frame);
+            frame = NULL;
+            continue;
+        }
+        error = NULL;
+
+        timestamp = frame->timestamp;
+        if(timestamp.tv_sec == 0 && timestamp.tv_usec == 0)
+            gettimeofday(&timestamp, NULL);
+        ts = rtp_timestamp(&stream, &timestamp);
+
+        /* the packets point into the frame, which is held until they are sent */
+        offset = 0;
+        while((n = rtp_jpeg_packets(&stream, &jpeg, ts, &offset, packets, RTP_BATCH)) > 0) {
+            for(i = 0; i < n; i++) {
+                iov[i][0].iov_base = packets[i].header;
+                iov[i][0].iov_len = packets[i].header_size;
+                iov[i][1].iov_base = (void *)packets[i].payload;
+                iov[i][1].iov_len = packets[i].payload_size;
+                memset(&msgs[i], 0, sizeof(struct mmsghdr));
+                msgs[i].msg_hdr.msg_iov = iov[i];
+                msgs[i].msg_hdr.msg_iovlen = 2;
+                msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            }
+            for(d = 0; d < destinations; d++) {
+                for(i = 0; i < n; i++)
+                    msgs[i].msg_hdr.msg_name = &rtp[d];
+                rtp_send(msgs, n);
             }
         }
-    }
 
-    // close UDP port
-    if(port > 0)
-        close(sd);
+        input_frame_release(frame);
+        frame = NULL;
+
+        gettimeofday(&now, NULL);
+        if(now.tv_sec - report.tv_sec >= RTCP_INTERVAL) {
+            n = rtcp_sender_report(&stream, buffer, sizeof(buffer));
+            for(d = 0; d < destinations; d++)
+                sendto(rtcp_fd, buffer, n, 0, (struct sockaddr *)&rtcp[d], sizeof(struct sockaddr_in));
+            report = now;
+        }
+    }
 
     /* cleanup now */
     pthread_cleanup_pop(1);
@@ -237,6 +686,37 @@ void *worker_thread(void *arg)
     return NULL;
 }
 
+/******************************************************************************
+Description.: opens a socket bound to a port of all addresses
+Input Value.: the type of the socket and the port
+Return Value: the socket, or -1
+******************************************************************************/
+static int open_socket(int type, int port)
+{
+    struct sockaddr_in addr;
+    int sd, on = 1;
+
+    if((sd = socket(PF_INET, type, 0)) < 0) {
+        perror("socket");
+        return -1;
+    }
+    if(setsockopt(sd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_REUSEADDR) failed\n");
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if(bind(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        close(sd);
+        return -1;
+    }
+
+    return sd;
+}
+
 /*** plugin interface functions ***/
 /******************************************************************************
 Description.: this function is called first, in order to initialise
@@ -266,6 +746,12 @@ int output_init(output_parameter *param)
             {"port", required_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"r", required_argument, 0, 0},
+            {"rtp", required_argument, 0, 0},
+            {"m", required_argument, 0, 0},
+            {"multicast", required_argument, 0, 0},
+            {"t", required_argument, 0, 0},
+            {"ttl", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -299,6 +785,24 @@ int output_init(output_parameter *param)
             DBG("case 4,5\n");
             input_number = atoi(optarg);
             break;
+            /* r, rtp */
+        case 6:
+        case 7:
+            DBG("case 6,7\n");
+            rtp_port = atoi(optarg);
+            break;
+            /* m, multicast */
+        case 8:
+        case 9:
+            DBG("case 8,9\n");
+            multicast = strdup(optarg);
+            break;
+            /* t, ttl */
+        case 10:
+        case 11:
+            DBG("case 10,11\n");
+            ttl = atoi(optarg);
+            break;
         }
     }
 
@@ -308,34 +812,77 @@ int output_init(output_parameter *param)
         return 1;
     }
 
+    if(port <= 0 || rtp_port <= 0 || rtp_port >= 65535) {
+        OPRINT("ERROR: valid RTSP and RTP ports must be provided\n");
+        return 1;
+    }
+
+    memset(&group, 0, sizeof(group));
+    group.sin_family = AF_INET;
+    group.sin_port = htons(rtp_port);
+    if(multicast != NULL && (inet_pton(AF_INET, multicast, &group.sin_addr) != 1 ||
+                             !IN_MULTICAST(ntohl(group.sin_addr.s_addr)))) {
+        OPRINT("ERROR: %s is not a multicast group\n", multicast);
+        return 1;
+    }
+
+    for(i = 0; i < RTSP_CLIENTS; i++) {
+        clients[i].fd = -1;
+    }
+
+    srandom(time(NULL) ^ getpid());
+    stream.ssrc = random();
+    stream.seq = random();
+    stream.offset = random();
+
+    if((rtsp_fd = open_socket(SOCK_STREAM, port)) < 0 || listen(rtsp_fd, SOMAXCONN) < 0 ||
+       (rtp_fd = open_socket(SOCK_DGRAM, rtp_port)) < 0 ||
+       (rtcp_fd = open_socket(SOCK_DGRAM, rtp_port + 1)) < 0) {
+        OPRINT("ERROR: could not open the RTSP port %d or the RTP ports %d-%d\n", port, rtp_port, rtp_port + 1);
+        return 1;
+    }
+    if(multicast != NULL && (setsockopt(rtp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+                             setsockopt(rtcp_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)) {
+        perror("setsockopt(IP_MULTICAST_TTL) failed\n");
+    }
+
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
-    OPRINT("UDP port..........: %d\n", port);
+    OPRINT("RTSP port........: %d\n", port);
+    OPRINT("RTP/RTCP ports...: %d-%d\n", rtp_port, rtp_port + 1);
+    if(multicast != NULL) {
+        OPRINT("multicast group..: %s, ttl %d\n", multicast, ttl);
+    }
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function stops the worker thread
+Description.: calling this function stops the worker and the server thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_stop(int id)
 {
-    DBG("will cancel worker thread\n");
+    DBG("will cancel worker and server thread\n");
     pthread_cancel(worker);
+    pthread_cancel(server);
+    pthread_join(worker, NULL);
+    pthread_join(server, NULL);
+    close(rtp_fd);
+    close(rtcp_fd);
+    free(multicast);
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function creates and starts the worker thread
+Description.: calling this function creates and starts the worker and the
+              server thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
-    DBG("launching worker thread\n");
+    DBG("launching worker and server thread\n");
     pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    pthread_create(&server, 0, server_thread, NULL);
     return 0;
 }
-
-
@@ -0,0 +1,357 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * RTP payload format for JPEG, RFC 2435.
+ *
+ * The receiver rebuilds the headers of each JPEG from the type, the size and
+ * the quantization tables sent along with the entropy coded data, so only
+ * baseline JPEGs with three components sampled 4:2:2 or 4:2:0 and the
+ * standard Huffman tables can be sent. Those of input_uvc are, it inserts
+ * the standard tables into the frames of the cameras that leave them out.
+ * The tables are sent with each frame (Q = 255), so they may change.
+ */
+
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "rtp_jpeg.h"
+#include "../input_uvc/huffman.h"
+
+/* seconds from 1900, the start of NTP time, to 1970 */
+#define NTP_OFFSET 2208988800U
+
+/* the canonical name of the source in the sender reports */
+#define RTCP_CNAME "mjpg-streamer"
+
+static void put16(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/******************************************************************************
+Description.: checks if a Huffman table of a DHT segment is one of the
+              standard tables of the JPEG specification, which the receiver
+              decodes with
+Input Value.: the table, its class and number followed by the counts and the
+              values, and its size
+Return Value: 1 if it is, 0 if not
+******************************************************************************/
+static int standard_huffman(const unsigned char *table, int size)
+{
+    const unsigned char *s = dht_data + 4, *end = dht_data + sizeof(dht_data);
+    int i, n;
+
+    while(s < end) {
+        for(n = 17, i = 1; i <= 16; i++)
+            n += s[i];
+        if(n == size && memcmp(s, table, size) == 0)
+            return 1;
+        s += n;
+    }
+    return 0;
+}
+
+/******************************************************************************
+Description.: parses the headers of a JPEG for what RFC 2435 sends of it
+Input Value.: the JPEG to fill in, the frame and its size
+Return Value: 0 if the frame can be sent, -1 if not, with the reason in
+              jpeg->error
+******************************************************************************/
+int rtp_jpeg_parse(rtp_jpeg *jpeg, const unsigned char *buf, int size)
+{
+    unsigned char dqt[4][128];
+    int dqt_size[4] = {0, 0, 0, 0};
+    int pos = 2, next, length, marker, qt = 0, i, n, sampling = 0, frame = 0;
+    const unsigned char *seg;
+
+    memset(jpeg, 0, sizeof(rtp_jpeg));
+    if(size < 4 || buf[0] != 0xff || buf[1] != 0xd8) {
+        jpeg->error = "not a JPEG";
+        return -1;
+    }
+
+    while(1) {
+        if(pos + 4 > size || buf[pos] != 0xff) {
+            jpeg->error = "broken JPEG";
+            return -1;
+        }
+        marker = buf[pos + 1];
+        if(marker == 0xff) {
+            pos++;
+            continue;
+        }
+        length = (buf[pos + 2] << 8) | buf[pos + 3];
+        if(length < 2 || pos + 2 + length > size) {
+            jpeg->error = "broken JPEG";
+            return -1;
+        }
+        next = pos + 2 + length;
+        seg = buf + pos + 4;
+        length -= 2;
+
+        switch(marker) {
+        case 0xdb:
+            /* DQT, one or more quantization tables */
+            while(length > 0) {
+                n = (seg[0] >> 4) ? 128 : 64;
+                if((seg[0] & 0x0f) > 3 || 1 + n > length) {
+                    jpeg->error = "broken quantization table";
+                    return -1;
+                }
+                memcpy(dqt[seg[0] & 0x0f], seg + 1, n);
+                dqt_size[seg[0] & 0x0f] = n;
+                seg += 1 + n;
+                length -= 1 + n;
+            }
+            break;
+
+        case 0xc4:
+            /* DHT, one or more Huffman tables */
+            while(length > 0) {
+                if(length < 17) {
+                    jpeg->error = "broken Huffman table";
+                    return -1;
+                }
+                for(n = 17, i = 1; i <= 16; i++)
+                    n += seg[i];
+                if(n > length) {
+                    jpeg->error = "broken Huffman table";
+                    return -1;
+                }
+                if(!standard_huffman(seg, n)) {
+                    jpeg->error = "not the standard Huffman tables";
+                    return -1;
+                }
+                seg += n;
+                length -= n;
+            }
+            break;
+
+        case 0xdd:
+            /* DRI, the restart interval */
+            if(length < 2) {
+                jpeg->error = "broken JPEG";
+                return -1;
+            }
+            jpeg->restart_interval = (seg[0] << 8) | seg[1];
+            break;
+
+        case 0xc0:
+            /* SOF0, baseline */
+            if(length < 6 + 3 * 3 || seg[0] != 8 || seg[5] != 3 || seg[8] > 3 || seg[11] > 3) {
+                jpeg->error = "not three components of 8 bit";
+                return -1;
+            }
+            jpeg->height = (((seg[1] << 8) | seg[2]) + 7) / 8;
+            jpeg->width = (((seg[3] << 8) | seg[4]) + 7) / 8;
+            sampling = seg[7];
+            qt = (seg[8] << 4) | seg[11];
+            if(seg[10] != 0x11 || seg[13] != 0x11 || seg[11] != seg[14] ||
+               (sampling != 0x21 && sampling != 0x22)) {
+                jpeg->error = "not sampled 4:2:2 or 4:2:0";
+                return -1;
+            }
+            frame = 1;
+            break;
+
+        case 0xc1: case 0xc2: case 0xc3: case 0xc5: case 0xc6: case 0xc7:
+        case 0xc9: case 0xca: case 0xcb: case 0xcd: case 0xce: case 0xcf:
+            jpeg->error = "not a baseline JPEG";
+            return -1;
+
+        case 0xda:
+            /* SOS, the entropy coded data follows up to EOI */
+            if(!frame) {
+                jpeg->error = "broken JPEG";
+                return -1;
+            }
+            jpeg->scan = seg + length;
+            jpeg->scan_size = buf + size - jpeg->scan;
+            for(i = jpeg->scan_size - 2; i >= 0; i--) {
+                if(jpeg->scan[i] == 0xff && jpeg->scan[i + 1] == 0xd9) {
+                    jpeg->scan_size = i;
+                    break;
+                }
+            }
+            if(jpeg->scan_size <= 0) {
+                jpeg->error = "broken JPEG";
+                return -1;
+            }
+            goto scan;
+        }
+
+        pos = next;
+    }
+
+scan:
+    if(jpeg->width == 0 || jpeg->height == 0 || jpeg->width > 255 || jpeg->height > 255) {
+        jpeg->error = "larger than 2040 pixels";
+        return -1;
+    }
+    if(dqt_size[qt >> 4] == 0 || dqt_size[qt & 0x0f] == 0) {
+        jpeg->error = "no quantization tables";
+        return -1;
+    }
+
+    jpeg->type = (sampling == 0x21) ? 0 : 1;
+    if(jpeg->restart_interval != 0)
+        jpeg->type += 64;
+
+    /* the table of the luminance, then that of the chrominance */
+    memcpy(jpeg->qtables, dqt[qt >> 4], dqt_size[qt >> 4]);
+    memcpy(jpeg->qtables + dqt_size[qt >> 4], dqt[qt & 0x0f], dqt_size[qt & 0x0f]);
+    jpeg->qtables_size = dqt_size[qt >> 4] + dqt_size[qt & 0x0f];
+    jpeg->precision = (dqt_size[qt >> 4] == 128 ? 1 : 0) | (dqt_size[qt & 0x0f] == 128 ? 2 : 0);
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: converts the capture time of a frame to its RTP timestamp
+Input Value.: the stream and the time
+Return Value: the timestamp
+******************************************************************************/
+uint32_t rtp_timestamp(rtp_stream *stream, struct timeval *time)
+{
+    uint64_t ticks = (uint64_t)time->tv_sec * RTP_CLOCK + (uint64_t)time->tv_usec * RTP_CLOCK / 1000000;
+
+    stream->time = *time;
+    stream->timestamp = stream->offset + (uint32_t)ticks;
+    return stream->timestamp;
+}
+
+/******************************************************************************
+Description.: packetizes the next part of a JPEG, the data of the packets
+              points into the frame
+Input Value.: the stream, the JPEG and its timestamp, the offset in the
+              entropy coded data to start at, which is moved on, and room
+              for count packets
+Return Value: the number of packets, 0 once the JPEG is done
+******************************************************************************/
+int rtp_jpeg_packets(rtp_stream *stream, rtp_jpeg *jpeg, uint32_t timestamp, int *offset, rtp_packet *packets, int count)
+{
+    rtp_packet *p;
+    unsigned char *h;
+    int n;
+
+    for(n = 0; n < count && *offset < jpeg->scan_size; n++) {
+        p = &packets[n];
+        h = p->header + 12;
+
+        /* main JPEG header, with Q = 255 for the tables of this frame */
+        h[0] = 0;
+        h[1] = *offset >> 16;
+        h[2] = *offset >> 8;
+        h[3] = *offset;
+        h[4] = jpeg->type;
+        h[5] = 255;
+        h[6] = jpeg->width;
+        h[7] = jpeg->height;
+        h += 8;
+
+        /*
+         * restart marker header, the packets don't start at restart markers,
+         * which is F = L = 1 and a count of 0x3fff
+         */
+        if(jpeg->type & 64) {
+            put16(h, jpeg->restart_interval);
+            put16(h + 2, 0xffff);
+            h += 4;
+        }
+
+        /* quantization table header, in the first packet only */
+        if(*offset == 0) {
+            h[0] = 0;
+            h[1] = jpeg->precision;
+            put16(h + 2, jpeg->qtables_size);
+            memcpy(h + 4, jpeg->qtables, jpeg->qtables_size);
+            h += 4 + jpeg->qtables_size;
+        }
+
+        p->header_size = h - p->header;
+        p->payload = jpeg->scan + *offset;
+        p->payload_size = jpeg->scan_size - *offset;
+        if(p->payload_size > RTP_PACKET_SIZE - p->header_size)
+            p->payload_size = RTP_PACKET_SIZE - p->header_size;
+        *offset += p->payload_size;
+
+        /* RTP header, the marker bit is set on the last packet of a frame */
+        p->header[0] = 0x80;
+        p->header[1] = RTP_PT_JPEG | (*offset == jpeg->scan_size ? 0x80 : 0);
+        put16(p->header + 2, stream->seq++);
+        put32(p->header + 4, timestamp);
+        put32(p->header + 8, stream->ssrc);
+
+        stream->packets++;
+        stream->octets += p->header_size - 12 + p->payload_size;
+    }
+
+    return n;
+}
+
+/******************************************************************************
+Description.: builds an RTCP sender report, with the canonical name of the
+              source, for the last frame
+Input Value.: the stream and room for the report
+Return Value: the size of the report
+******************************************************************************/
+int rtcp_sender_report(rtp_stream *stream, unsigned char *buf, int size)
+{
+    int cname = strlen(RTCP_CNAME), sdes = (4 + 4 + 2 + cname + 1 + 3) & ~3;
+
+    if(28 + sdes > size)
+        return 0;
+
+    /* SR */
+    buf[0] = 0x80;
+    buf[1] = 200;
+    put16(buf + 2, 6);
+    put32(buf + 4, stream->ssrc);
+    put32(buf + 8, stream->time.tv_sec + NTP_OFFSET);
+    put32(buf + 12, (uint32_t)(((uint64_t)stream->time.tv_usec << 32) / 1000000));
+    put32(buf + 16, stream->timestamp);
+    put32(buf + 20, stream->packets);
+    put32(buf + 24, stream->octets);
+
+    /* SDES with the CNAME, padded with zeros */
+    memset(buf + 28, 0, sdes);
+    buf[28] = 0x81;
+    buf[29] = 202;
+    put16(buf + 30, sdes / 4 - 1);
+    put32(buf + 32, stream->ssrc);
+    buf[36] = 1;
+    buf[37] = cname;
+    memcpy(buf + 38, RTCP_CNAME, cname);
+
+    return 28 + sdes;
+}
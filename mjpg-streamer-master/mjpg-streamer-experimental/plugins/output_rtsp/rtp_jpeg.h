@@ -0,0 +1,78 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+#ifndef RTP_JPEG_H
+#define RTP_JPEG_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/* the static RTP payload type of JPEG, and its clock rate */
+#define RTP_PT_JPEG 26
+#define RTP_CLOCK 90000
+
+/* bytes of a packet at most, headers included, to stay below the usual MTU */
+#define RTP_PACKET_SIZE 1400
+
+/*
+ * bytes of the headers of a packet at most: RTP, JPEG, restart marker and
+ * quantization table header with two tables of 16 bit precision
+ */
+#define RTP_HEADER_SIZE (12 + 8 + 4 + 4 + 2*128)
+
+/* the JPEG of a frame, as RFC 2435 carries it */
+typedef struct {
+    int type;                   /* 0 for 4:2:2, 1 for 4:2:0, plus 64 with restart markers */
+    int width, height;          /* in blocks of 8 pixels */
+    int restart_interval;
+    unsigned char qtables[2*128];
+    int qtables_size;
+    int precision;              /* bit 0 and 1 are set for tables of 16 bit */
+    const unsigned char *scan;  /* the entropy coded data */
+    int scan_size;
+    const char *error;          /* why the frame can't be sent */
+} rtp_jpeg;
+
+/* the state of an RTP stream, shared by all its receivers */
+typedef struct {
+    uint32_t ssrc;
+    uint16_t seq;
+    uint32_t packets, octets;   /* sent so far, for the sender reports */
+    uint32_t offset;            /* random start of the timestamps */
+    uint32_t timestamp;         /* of the last frame */
+    struct timeval time;        /* of the last frame */
+} rtp_stream;
+
+/* a packet, its headers and the part of the scan it carries */
+typedef struct {
+    unsigned char header[RTP_HEADER_SIZE];
+    int header_size;
+    const unsigned char *payload;
+    int payload_size;
+} rtp_packet;
+
+int rtp_jpeg_parse(rtp_jpeg *jpeg, const unsigned char *buf, int size);
+uint32_t rtp_timestamp(rtp_stream *stream, struct timeval *time);
+int rtp_jpeg_packets(rtp_stream *stream, rtp_jpeg *jpeg, uint32_t timestamp, int *offset, rtp_packet *packets, int count);
+int rtcp_sender_report(rtp_stream *stream, unsigned char *buf, int size);
+
+#endif
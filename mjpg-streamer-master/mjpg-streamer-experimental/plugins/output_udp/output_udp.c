@@ -28,6 +28,13 @@
   It provides a mechanism to take snapshots with a trigger from a UDP packet.
   The UDP msg contains the path for the snapshot jpeg file
   It echoes the message received back to the sender, after taking the snapshot
+
+  It also pushes each frame to the subscribers, split into datagrams of the
+  size of the MTU, see udp_frame.h. The subscribers are given on the command
+  line, or subscribe by sending UDP_SUBSCRIBE to the UDP port with the cookie
+  of their address, which the plugin sends to that address first. The
+  datagrams of a frame go to each subscriber in batches with sendmmsg(),
+  optionally with XOR parity packets, to recover one lost fragment per group.
 */
 
 #include <stdio.h>
@@ -46,25 +53,52 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
 #include <syslog.h>
+#include <netdb.h>
+#include <netinet/in.h>
 
 #include <dirent.h>
 
 #include "../../utils.h"
 #include "../../mjpg_streamer.h"
+#include "udp_frame.h"
 
 #define OUTPUT_PLUGIN_NAME "UDP output plugin"
 
-static pthread_t worker;
+/* subscribers at most */
+#define UDP_SUBSCRIBERS 16
+
+/* datagrams sent with one sendmmsg() */
+#define UDP_BATCH 64
+
+typedef struct {
+    struct sockaddr_in addr;
+    time_t expires;             /* 0 for those of the command line */
+} subscriber;
+
+static pthread_t worker, pusher;
 static globals *pglobal;
-static int fd, delay, max_frame_size;
+static int fd, delay;
 static char *folder = "/tmp";
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static char *command = NULL;
 static int input_number = 0;
 
 // UDP port
 static int port = 0;
+static int sd = -1;
+
+// the subscribers, and the fragments per parity group, 0 for no parity
+static subscriber subscribers[UDP_SUBSCRIBERS];
+static int subscriber_count = 0;
+static pthread_mutex_t subscribers_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t subscribed = PTHREAD_COND_INITIALIZER;
+static input_frame *push_frame = NULL;
+static int fec = 0;
+
+// the secret the cookies of the subscribers are made from
+static unsigned char cookie_key[16];
 
 /******************************************************************************
 Description.: print a help message
@@ -80,11 +114,253 @@ void help(void)
             " [-f | --folder ]........: folder to save pictures\n" \
             " [-d | --delay ].........: delay after saving pictures in ms\n" \
             " [-c | --command ].......: execute command after saveing picture\n" \
-            " [-p | --port ]..........: UDP port to listen for picture requests. UDP message is the filename to save\n\n" \
+            " [-p | --port ]..........: UDP port to listen for picture requests. UDP message is the filename to save,\n" \
+            "                           or "UDP_SUBSCRIBE" and a cookie to have the frames pushed, see udp_frame.h\n\n" \
+            " [-s | --subscriber ]....: host:port to push the frames to, may be given more than once\n" \
+            " [-e | --fec ]...........: send a parity packet after each group of this many fragments,\n" \
+            "                           to recover one lost fragment per group, 0: none, default: 0\n\n" \
             " [-i | --input ].......: read frames from the specified input plugin (first input plugin between the arguments is the 0th)\n\n" \
             " ---------------------------------------------------------------\n");
 }
 
+static time_t monotonic_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static void unlock_mutex(void *arg)
+{
+    pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+/******************************************************************************
+Description.: adds a subscriber, or renews its subscription
+Input Value.: its address, and when the subscription expires, 0 for never
+Return Value: 0 if OK, -1 if there are too many subscribers
+******************************************************************************/
+static int subscribe(struct sockaddr_in *addr, time_t expires)
+{
+    int i, rc = 0;
+
+    pthread_mutex_lock(&subscribers_mutex);
+    for(i = 0; i < subscriber_count; i++) {
+        if(subscribers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+           subscribers[i].addr.sin_port == addr->sin_port)
+            break;
+    }
+    if(i < subscriber_count) {
+        if(subscribers[i].expires != 0)
+            subscribers[i].expires = expires;
+    } else if(subscriber_count < UDP_SUBSCRIBERS) {
+        subscribers[subscriber_count].addr = *addr;
+        subscribers[subscriber_count].expires = expires;
+        subscriber_count++;
+        pthread_cond_broadcast(&subscribed);
+    } else {
+        rc = -1;
+    }
+    pthread_mutex_unlock(&subscribers_mutex);
+
+    if(rc < 0) {
+        OPRINT("too many subscribers, ignoring %s:%d\n", inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    }
+    return rc;
+}
+
+/******************************************************************************
+Description.: removes a subscriber, those of the command line stay
+Input Value.: its address
+Return Value: -
+******************************************************************************/
+static void unsubscribe(struct sockaddr_in *addr)
+{
+    int i;
+
+    pthread_mutex_lock(&subscribers_mutex);
+    for(i = 0; i < subscriber_count; i++) {
+        if(subscribers[i].expires != 0 &&
+           subscribers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+           subscribers[i].addr.sin_port == addr->sin_port) {
+            subscribers[i] = subscribers[--subscriber_count];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&subscribers_mutex);
+}
+
+/******************************************************************************
+Description.: reads the secret the cookies are made from
+Input Value.: -
+Return Value: 0 if OK, -1 if there is no /dev/urandom to read it from
+******************************************************************************/
+static int cookie_key_init(void)
+{
+    int f, rc = -1;
+
+    if((f = open("/dev/urandom", O_RDONLY)) < 0)
+        return -1;
+    if(read(f, cookie_key, sizeof(cookie_key)) == sizeof(cookie_key))
+        rc = 0;
+    close(f);
+
+    return rc;
+}
+
+#define ROTL64(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND(v0, v1, v2, v3) do { \
+        v0 += v1; v1 = ROTL64(v1, 13); v1 ^= v0; v0 = ROTL64(v0, 32); \
+        v2 += v3; v3 = ROTL64(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL64(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL64(v1, 17); v1 ^= v2; v2 = ROTL64(v2, 32); \
+    } while(0)
+
+static uint64_t load64_le(const unsigned char *p)
+{
+    uint64_t v = 0;
+    int i;
+
+    for(i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/******************************************************************************
+Description.: SipHash-2-4, a keyed hash that cannot be predicted without the
+              key, even from other hashes made with it
+Input Value.: the key, the data and its size
+Return Value: the hash
+******************************************************************************/
+static uint64_t siphash(const unsigned char *key, const unsigned char *in, size_t size)
+{
+    uint64_t k0 = load64_le(key), k1 = load64_le(key + 8);
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;
+    uint64_t m, b = (uint64_t)size << 56;
+    size_t i;
+
+    for(i = 0; i + 8 <= size; i += 8) {
+        m = load64_le(in + i);
+        v3 ^= m;
+        SIPROUND(v0, v1, v2, v3);
+        SIPROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    for(; i < size; i++)
+        b |= (uint64_t)in[i] << (8 * (i % 8));
+
+    v3 ^= b;
+    SIPROUND(v0, v1, v2, v3);
+    SIPROUND(v0, v1, v2, v3);
+    v0 ^= b;
+    v2 ^= 0xff;
+    for(i = 0; i < 4; i++)
+        SIPROUND(v0, v1, v2, v3);
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/******************************************************************************
+Description.: makes the cookie of an address, only those who receive what
+              is sent to the address learn it
+Input Value.: the address, room for UDP_COOKIE_SIZE characters and a '\0'
+Return Value: -
+******************************************************************************/
+static void make_cookie(struct sockaddr_in *addr, char *cookie)
+{
+    unsigned char in[6];
+
+    memcpy(in, &addr->sin_addr.s_addr, 4);
+    memcpy(in + 4, &addr->sin_port, 2);
+    snprintf(cookie, UDP_COOKIE_SIZE + 1, "%016llx",
+             (unsigned long long)siphash(cookie_key, in, sizeof(in)));
+}
+
+/******************************************************************************
+Description.: tells if a message is a verb, followed by a space and a cookie
+Input Value.: the message, the verb, where to store the cookie
+Return Value: 1 if it is, 0 otherwise
+******************************************************************************/
+static int subscription_verb(const char *msg, const char *verb, const char **cookie)
+{
+    size_t n = strlen(verb);
+
+    if(strncmp(msg, verb, n) != 0 || msg[n] != ' ')
+        return 0;
+    *cookie = msg + n + 1;
+    return 1;
+}
+
+/******************************************************************************
+Description.: handles a subscription message. With the cookie of the sender
+              it subscribes or unsubscribes it and is echoed back. A
+              subscription with another cookie is answered with the right
+              one, in a reply shorter than the message, so a spoofed sender
+              can neither have the frames pushed to another host nor get
+              more sent to it than it sent itself
+Input Value.: the message, '\0' terminated, its size and its sender
+Return Value: 1 if it was a subscription message, 0 otherwise
+******************************************************************************/
+static int subscription_message(const char *msg, int size, struct sockaddr_in *addr)
+{
+    char expected[UDP_COOKIE_SIZE + 1];
+    char reply[sizeof(UDP_COOKIE) + UDP_COOKIE_SIZE + 1];
+    const char *cookie;
+    int subscribing;
+
+    if(subscription_verb(msg, UDP_SUBSCRIBE, &cookie))
+        subscribing = 1;
+    else if(subscription_verb(msg, UDP_UNSUBSCRIBE, &cookie))
+        subscribing = 0;
+    else
+        return 0;
+
+    make_cookie(addr, expected);
+    if(strcmp(cookie, expected) != 0) {
+        if(subscribing && size >= (int)sizeof(reply) - 1) {
+            snprintf(reply, sizeof(reply), "%s %s", UDP_COOKIE, expected);
+            sendto(sd, reply, strlen(reply), 0, (struct sockaddr*)addr, sizeof(*addr));
+        }
+        return 1;
+    }
+
+    if(subscribing)
+        subscribe(addr, monotonic_seconds() + UDP_SUBSCRIBE_TIMEOUT);
+    else
+        unsubscribe(addr);
+    sendto(sd, msg, size, 0, (struct sockaddr*)addr, sizeof(*addr));
+
+    return 1;
+}
+
+/******************************************************************************
+Description.: drops the subscriptions that expired and collects where to
+              push the frames, must be called with subscribers_mutex locked
+Input Value.: room for UDP_SUBSCRIBERS addresses
+Return Value: the number of addresses
+******************************************************************************/
+static int subscribers_collect(struct sockaddr_in *to)
+{
+    time_t now = monotonic_seconds();
+    int i = 0;
+
+    while(i < subscriber_count) {
+        if(subscribers[i].expires != 0 && subscribers[i].expires < now) {
+            subscribers[i] = subscribers[--subscriber_count];
+            continue;
+        }
+        to[i] = subscribers[i].addr;
+        i++;
+    }
+
+    return subscriber_count;
+}
+
 /******************************************************************************
 Description.: clean up allocated resources
 Input Value.: unused argument
@@ -103,7 +379,8 @@ void worker_cleanup(void *arg)
     OPRINT("cleaning up resources allocated by worker thread\n");
 
     if(frame != NULL) {
-        free(frame);
+        input_frame_release(frame);
+        frame = NULL;
     }
     close(fd);
 }
@@ -118,66 +395,36 @@ void *worker_thread(void *arg)
 {
     int ok = 1, frame_size = 0, rc = 0;
     char buffer1[1024] = {0};
-    unsigned char *tmp_framebuffer = NULL;
 
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
-    // set UDP server data structures ---------------------------
-    if(port <= 0) {
-        OPRINT("a valid UDP port must be provided\n");
-        return NULL;
-    }
+    // UDP server data structures, the socket is bound to the port already
     struct sockaddr_in addr;
-    int sd;
     int bytes;
     unsigned int addr_len = sizeof(addr);
     char udpbuffer[1024] = {0};
-    sd = socket(PF_INET, SOCK_DGRAM, 0);
-    bzero(&addr, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = INADDR_ANY;
-    addr.sin_port = htons(port);
-    if(bind(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
-        perror("bind");
-    // -----------------------------------------------------------
 
     while(ok >= 0 && !pglobal->stop) {
         DBG("waiting for a UDP message\n");
 
         // UDP receive ---------------------------------------------
         memset(udpbuffer, 0, sizeof(udpbuffer));
-        bytes = recvfrom(sd, udpbuffer, sizeof(udpbuffer), 0, (struct sockaddr*)&addr, &addr_len);
+        addr_len = sizeof(addr);
+        bytes = recvfrom(sd, udpbuffer, sizeof(udpbuffer) - 1, 0, (struct sockaddr*)&addr, &addr_len);
         // ---------------------------------------------------------
 
+        /* subscriptions take no snapshot */
+        if(bytes >= 0 && subscription_message(udpbuffer, bytes, &addr))
+            continue;
 
 
         DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-
-        /* check if buffer for frame is large enough, increase it if necessary */
-        if(frame_size > max_frame_size) {
-            DBG("increasing buffer size to %d\n", frame_size);
-
-            max_frame_size = frame_size + (1 << 16);
-            if((tmp_framebuffer = realloc(frame, max_frame_size)) == NULL) {
-                pthread_mutex_unlock(&pglobal->in[input_number].db);
-                LOG("not enough memory\n");
-                return NULL;
-            }
-
-            frame = tmp_framebuffer;
+        if((frame = input_frame_wait_next(&pglobal->in[input_number])) == NULL) {
+            LOG("not enough memory\n");
+            return NULL;
         }
-
-        /* copy frame to our local buffer now */
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-        /* allow others to access the global buffer again */
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        frame_size = frame->size;
 
         /* only save a file if a name came in with the UDP message */
         if(strlen(udpbuffer) > 0) {
@@ -190,7 +437,7 @@ void *worker_thread(void *arg)
             }
 
             /* save picture to file */
-            if(write(fd, frame, frame_size) < 0) {
+            if(write(fd, frame->buf, frame_size) < 0) {
                 OPRINT("could not write to file %s\n", udpbuffer);
                 perror("write()");
                 close(fd);
@@ -200,6 +447,9 @@ void *worker_thread(void *arg)
             close(fd);
         }
 
+        input_frame_release(frame);
+        frame = NULL;
+
         // send back client's message that came in udpbuffer
         sendto(sd, udpbuffer, bytes, 0, (struct sockaddr*)&addr, sizeof(addr));
 
@@ -228,16 +478,211 @@ void *worker_thread(void *arg)
         }
     }
 
-    // close UDP port
-    if(port > 0)
-        close(sd);
-
     /* cleanup now */
     pthread_cleanup_pop(1);
 
     return NULL;
 }
 
+/******************************************************************************
+Description.: sends a batch of datagrams to each subscriber, a datagram
+              that fails is dropped
+Input Value.: the datagrams, their number, the subscribers and their number
+Return Value: -
+******************************************************************************/
+static void push_batch(struct mmsghdr *msgs, int count, struct sockaddr_in *to, int destinations)
+{
+    int d, i, n, sent;
+
+    for(d = 0; d < destinations; d++) {
+        for(i = 0; i < count; i++) {
+            msgs[i].msg_hdr.msg_name = &to[d];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+        for(sent = 0; sent < count;) {
+            n = sendmmsg(sd, msgs + sent, count - sent, 0);
+            if(n < 0) {
+                if(errno != EINTR) {
+                    DBG("sendmmsg: %s\n", strerror(errno));
+                    sent++;
+                }
+                continue;
+            }
+            sent += n;
+        }
+    }
+}
+
+/******************************************************************************
+Description.: pushes a frame to the subscribers, split into fragments, each
+              group of them followed by its parity if asked for
+Input Value.: the frame, its number, the subscribers and their number
+Return Value: -
+******************************************************************************/
+static void push_frame_out(input_frame *f, uint32_t number, struct sockaddr_in *to, int destinations)
+{
+    static unsigned char headers[UDP_BATCH][UDP_FRAME_HEADER_SIZE];
+    static unsigned char parity[UDP_BATCH][UDP_FRAGMENT_SIZE];
+    static unsigned char group_parity[UDP_FRAGMENT_SIZE];
+    static struct iovec iov[UDP_BATCH][2];
+    static struct mmsghdr msgs[UDP_BATCH];
+    udp_frame_header header;
+    struct timeval timestamp = f->timestamp;
+    unsigned char *data;
+    int i, n = 0, length, group_length = 0;
+
+    if(timestamp.tv_sec == 0 && timestamp.tv_usec == 0)
+        gettimeofday(&timestamp, NULL);
+
+    memset(&header, 0, sizeof(header));
+    header.frame = number;
+    header.size = f->size;
+    header.fragment_size = UDP_FRAGMENT_SIZE;
+    header.fragments = (f->size + UDP_FRAGMENT_SIZE - 1) / UDP_FRAGMENT_SIZE;
+    header.group = fec;
+    header.timestamp = timestamp.tv_sec * 1000000ULL + timestamp.tv_usec;
+
+    memset(msgs, 0, sizeof(msgs));
+    for(i = 0; i < header.fragments; i++) {
+        data = f->buf + i * UDP_FRAGMENT_SIZE;
+        length = MIN(UDP_FRAGMENT_SIZE, f->size - i * UDP_FRAGMENT_SIZE);
+
+        /* the fragment is sent straight from the frame */
+        header.flags = 0;
+        header.index = i;
+        udp_frame_write(headers[n], &header);
+        iov[n][0].iov_base = headers[n];
+        iov[n][0].iov_len = UDP_FRAME_HEADER_SIZE;
+        iov[n][1].iov_base = data;
+        iov[n][1].iov_len = length;
+        msgs[n].msg_hdr.msg_iov = iov[n];
+        msgs[n].msg_hdr.msg_iovlen = 2;
+        n++;
+
+        if(fec > 0) {
+            /* the first fragment of a group is the longest */
+            if(i % fec == 0) {
+                memset(group_parity, 0, length);
+                group_length = length;
+            }
+            udp_frame_xor(group_parity, data, length);
+
+            if(i % fec == fec - 1 || i == header.fragments - 1) {
+                if(n == UDP_BATCH) {
+                    push_batch(msgs, n, to, destinations);
+                    n = 0;
+                }
+                memcpy(parity[n], group_parity, group_length);
+                header.flags = UDP_FRAME_PARITY;
+                header.index = i - i % fec;
+                udp_frame_write(headers[n], &header);
+                iov[n][0].iov_base = headers[n];
+                iov[n][0].iov_len = UDP_FRAME_HEADER_SIZE;
+                iov[n][1].iov_base = parity[n];
+                iov[n][1].iov_len = group_length;
+                msgs[n].msg_hdr.msg_iov = iov[n];
+                msgs[n].msg_hdr.msg_iovlen = 2;
+                n++;
+            }
+        }
+
+        if(n == UDP_BATCH) {
+            push_batch(msgs, n, to, destinations);
+            n = 0;
+        }
+    }
+
+    if(n > 0)
+        push_batch(msgs, n, to, destinations);
+}
+
+/******************************************************************************
+Description.: clean up the resources of the push thread
+Input Value.: unused argument
+Return Value: -
+******************************************************************************/
+void push_cleanup(void *arg)
+{
+    OPRINT("cleaning up resources allocated by push thread\n");
+
+    if(push_frame != NULL) {
+        input_frame_release(push_frame);
+        push_frame = NULL;
+    }
+}
+
+/******************************************************************************
+Description.: the push thread, while there are subscribers it grabs each
+              fresh frame and pushes it to them
+Input Value.: unused argument
+Return Value: NULL
+******************************************************************************/
+void *push_thread(void *arg)
+{
+    struct sockaddr_in to[UDP_SUBSCRIBERS];
+    unsigned int seq = 0;
+    uint32_t number = 0;
+    int destinations;
+
+    pthread_cleanup_push(push_cleanup, NULL);
+
+    while(!pglobal->stop) {
+        /* wait for a subscriber */
+        pthread_mutex_lock(&subscribers_mutex);
+        pthread_cleanup_push(unlock_mutex, &subscribers_mutex);
+        while((destinations = subscribers_collect(to)) == 0)
+            pthread_cond_wait(&subscribed, &subscribers_mutex);
+        pthread_cleanup_pop(1);
+
+        if((push_frame = input_frame_wait(&pglobal->in[input_number], seq)) == NULL) {
+            LOG("not enough memory\n");
+            break;
+        }
+        seq = push_frame->seq;
+
+        if((push_frame->size + UDP_FRAGMENT_SIZE - 1) / UDP_FRAGMENT_SIZE > 0xffff) {
+            OPRINT("frame of %d bytes too large to push\n", push_frame->size);
+        } else {
+            push_frame_out(push_frame, ++number, to, destinations);
+        }
+
+        input_frame_release(push_frame);
+        push_frame = NULL;
+    }
+
+    pthread_cleanup_pop(1);
+
+    return NULL;
+}
+
+/******************************************************************************
+Description.: adds a subscriber of the command line
+Input Value.: host:port
+Return Value: 0 if OK, -1 if the address is not valid
+******************************************************************************/
+static int subscriber_option(const char *arg)
+{
+    struct addrinfo hints, *ai;
+    char *host, *colon;
+    int rc = -1;
+
+    if((host = strdup(arg)) == NULL)
+        return -1;
+    if((colon = strrchr(host, ':')) != NULL) {
+        *colon = '\0';
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        if(getaddrinfo(host, colon + 1, &hints, &ai) == 0) {
+            rc = subscribe((struct sockaddr_in *)ai->ai_addr, 0);
+            freeaddrinfo(ai);
+        }
+    }
+    free(host);
+
+    return rc;
+}
+
 /*** plugin interface functions ***/
 /******************************************************************************
 Description.: this function is called first, in order to initialise
@@ -275,6 +720,10 @@ int output_init(output_parameter *param)
             {"port", required_argument, 0, 0},
             {"i", required_argument, 0, 0},
             {"input", required_argument, 0, 0},
+            {"s", required_argument, 0, 0},
+            {"subscriber", required_argument, 0, 0},
+            {"e", required_argument, 0, 0},
+            {"fec", required_argument, 0, 0},
             {0, 0, 0, 0}
         };
 
@@ -333,6 +782,21 @@ int output_init(output_parameter *param)
             DBG("case 10,11\n");
             input_number = atoi(optarg);
             break;
+            /* s, subscriber */
+        case 12:
+        case 13:
+            DBG("case 12,13\n");
+            if(subscriber_option(optarg) < 0) {
+                OPRINT("ERROR: could not add the subscriber %s\n", optarg);
+                return 1;
+            }
+            break;
+            /* e, fec */
+        case 14:
+        case 15:
+            DBG("case 14,15\n");
+            fec = atoi(optarg);
+            break;
         }
     }
 
@@ -341,6 +805,31 @@ int output_init(output_parameter *param)
         OPRINT("ERROR: the %d input_plugin number is too much only %d plugins loaded\n", input_number, pglobal->incnt);
         return 1;
     }
+    if(port <= 0 && subscriber_count == 0) {
+        OPRINT("ERROR: a valid UDP port or a subscriber must be provided\n");
+        return 1;
+    }
+    if(fec < 0 || fec > 255) {
+        OPRINT("ERROR: the fragments per parity group must be 0 to 255\n");
+        return 1;
+    }
+    if(port > 0 && cookie_key_init() < 0) {
+        OPRINT("ERROR: could not read the cookie secret from /dev/urandom\n");
+        return 1;
+    }
+
+    /* the port takes snapshot requests and subscriptions, and the frames are pushed from it */
+    struct sockaddr_in addr;
+    sd = socket(PF_INET, SOCK_DGRAM, 0);
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port > 0 ? port : 0);
+    if(sd < 0 || bind(sd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        perror("bind");
+        return 1;
+    }
+
     OPRINT("input plugin.....: %d: %s\n", input_number, pglobal->in[input_number].plugin);
     OPRINT("output folder.....: %s\n", folder);
     OPRINT("delay after save..: %d\n", delay);
@@ -350,31 +839,46 @@ int output_init(output_parameter *param)
     } else {
         OPRINT("UDP port..........: %s\n", "disabled");
     }
+    OPRINT("subscribers.......: %d\n", subscriber_count);
+    if(fec > 0) {
+        OPRINT("parity............: after each %d fragments\n", fec);
+    } else {
+        OPRINT("parity............: %s\n", "disabled");
+    }
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function stops the worker thread
+Description.: calling this function stops the worker and the push thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_stop(int id)
 {
-    DBG("will cancel worker thread\n");
-    pthread_cancel(worker);
+    DBG("will cancel worker and push thread\n");
+    if(port > 0) {
+        pthread_cancel(worker);
+        pthread_join(worker, NULL);
+    }
+    pthread_cancel(pusher);
+    pthread_join(pusher, NULL);
+    close(sd);
     return 0;
 }
 
 /******************************************************************************
-Description.: calling this function creates and starts the worker thread
+Description.: calling this function creates and starts the worker thread,
+              if there is a UDP port, and the push thread
 Input Value.: -
 Return Value: always 0
 ******************************************************************************/
 int output_run(int id)
 {
-    DBG("launching worker thread\n");
-    pthread_create(&worker, 0, worker_thread, NULL);
-    pthread_detach(worker);
+    DBG("launching worker and push thread\n");
+    if(port > 0) {
+        pthread_create(&worker, 0, worker_thread, NULL);
+    }
+    pthread_create(&pusher, 0, push_thread, NULL);
     return 0;
 }
 
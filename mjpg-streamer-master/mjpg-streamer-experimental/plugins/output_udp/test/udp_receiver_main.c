@@ -0,0 +1,213 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+  Receives the frames pushed by output_udp, and prints once a second how many
+  came, were lost, had fragments recovered from the parity, and how long they
+  took from their capture, which only means something with the same clock on
+  both ends.
+
+  usage: output_udp_receiver [-l LOSS%] [-n FRAMES] [-o FILE] HOST PORT
+
+  It subscribes at the UDP port of output_udp on HOST with the cookie that
+  comes back from the first try, and renews the subscription until it ends.
+  -l drops that many percent of the packets at random, to try the parity, -n
+  ends after that many frames and -o keeps the latest frame in FILE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "udp_frame.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void signal_handler(int sig)
+{
+    stop = 1;
+}
+
+/* sends verb and the cookie, all zeros until the plugin sent the right one */
+static void send_subscription(int sd, struct addrinfo *ai, const char *verb, const char *cookie)
+{
+    char msg[64];
+
+    snprintf(msg, sizeof(msg), "%s %s", verb, cookie);
+    sendto(sd, msg, strlen(msg), 0, ai->ai_addr, ai->ai_addrlen);
+}
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-l LOSS%%] [-n FRAMES] [-o FILE] HOST PORT\n", name);
+    return 1;
+}
+
+static uint64_t usecs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/* writes the frame to a file next to it first, so FILE is always whole */
+static void save_frame(const char *filename, const unsigned char *buf, size_t size)
+{
+    char temp[1024];
+    FILE *f;
+
+    snprintf(temp, sizeof(temp), "%s.part", filename);
+    if((f = fopen(temp, "wb")) == NULL) {
+        perror(temp);
+        return;
+    }
+    if(fwrite(buf, size, 1, f) != 1)
+        perror(temp);
+    fclose(f);
+    rename(temp, filename);
+}
+
+int main(int argc, char *argv[])
+{
+    struct addrinfo hints, *ai;
+    struct pollfd pfd;
+    udp_receiver r;
+    unsigned char packet[65536];
+    const char *output = NULL;
+    char cookie[UDP_COOKIE_SIZE + 1];
+    uint64_t now, second, subscribed = 0, latency = 0;
+    unsigned long frames = 0, broken = 0, limit = 0, dropped = 0, counted = 0;
+    int c, sd, size, loss = 0;
+
+    while((c = getopt(argc, argv, "l:n:o:")) != -1) {
+        switch(c) {
+        case 'l':
+            loss = atoi(optarg);
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if(optind + 2 != argc)
+        return usage(argv[0]);
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if(getaddrinfo(argv[optind], argv[optind + 1], &hints, &ai) != 0) {
+        fprintf(stderr, "unknown host or port %s:%s\n", argv[optind], argv[optind + 1]);
+        return 1;
+    }
+    if((sd = socket(PF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        return 1;
+    }
+    size = 4 * 1024 * 1024;
+    setsockopt(sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    srandom(time(NULL));
+    udp_receiver_init(&r);
+    memset(cookie, '0', UDP_COOKIE_SIZE);
+    cookie[UDP_COOKIE_SIZE] = '\0';
+
+    second = usecs();
+    pfd.fd = sd;
+    pfd.events = POLLIN;
+    while(!stop && (limit == 0 || r.frames < limit)) {
+        now = usecs();
+        if(now - subscribed >= UDP_SUBSCRIBE_TIMEOUT * 1000000ULL / 3) {
+            send_subscription(sd, ai, UDP_SUBSCRIBE, cookie);
+            subscribed = now;
+        }
+        if(now - second >= 1000000) {
+            printf("%lu frames, %lu lost, %lu broken, %lu fragments recovered, %lu packets dropped",
+                   r.frames - frames, r.lost, broken, r.recovered, dropped);
+            if(counted > 0)
+                printf(", %.1f ms from capture", latency / 1000.0 / counted);
+            printf("\n");
+            fflush(stdout);
+            frames = r.frames;
+            latency = counted = 0;
+            second = now;
+        }
+
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        if((size = recv(sd, packet, sizeof(packet), 0)) < 0)
+            continue;
+        if(size == strlen(UDP_COOKIE) + 1 + UDP_COOKIE_SIZE &&
+           memcmp(packet, UDP_COOKIE " ", strlen(UDP_COOKIE) + 1) == 0) {
+            /* subscribe again right away, with the cookie */
+            memcpy(cookie, packet + strlen(UDP_COOKIE) + 1, UDP_COOKIE_SIZE);
+            subscribed = 0;
+            continue;
+        }
+        if(size >= strlen(UDP_SUBSCRIBE) && memcmp(packet, UDP_SUBSCRIBE, strlen(UDP_SUBSCRIBE)) == 0)
+            continue;
+
+        /* pretend to lose packets */
+        if(loss > 0 && random() % 100 < loss) {
+            dropped++;
+            continue;
+        }
+
+        if(udp_receiver_packet(&r, packet, size) != 1)
+            continue;
+
+        now = usecs();
+        if(now > r.header.timestamp) {
+            latency += now - r.header.timestamp;
+            counted++;
+        }
+        if(r.header.size < 4 || r.buf[0] != 0xff || r.buf[1] != 0xd8 ||
+           r.buf[r.header.size - 2] != 0xff || r.buf[r.header.size - 1] != 0xd9)
+            broken++;
+        if(output != NULL)
+            save_frame(output, r.buf, r.header.size);
+    }
+
+    send_subscription(sd, ai, UDP_UNSUBSCRIBE, cookie);
+    printf("%lu frames, %lu lost, %lu broken, %lu fragments recovered, %lu packets dropped\n",
+           r.frames, r.lost, broken, r.recovered, dropped);
+
+    udp_receiver_free(&r);
+    freeaddrinfo(ai);
+    close(sd);
+    return 0;
+}
@@ -0,0 +1,300 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The packets of the frames pushed by output_udp, see udp_frame.h, and their
+ * reassembly. Both sides build with this file alone, so a receiver can take
+ * it along with udp_frame.h.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "udp_frame.h"
+
+/*
+ * a frame older than this many frames is taken for the first of a sender that
+ * started over, instead of one that came too late
+ */
+#define UDP_FRAME_RESTART 64
+
+static void put16(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static unsigned int get16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/******************************************************************************
+Description.: writes the header of a packet
+Input Value.: room for UDP_FRAME_HEADER_SIZE bytes and the header
+Return Value: -
+******************************************************************************/
+void udp_frame_write(unsigned char *buf, const udp_frame_header *header)
+{
+    buf[0] = 'M';
+    buf[1] = 'J';
+    buf[2] = UDP_FRAME_VERSION;
+    buf[3] = header->flags;
+    put32(buf + 4, header->frame);
+    put32(buf + 8, header->size);
+    put16(buf + 12, header->index);
+    put16(buf + 14, header->fragments);
+    buf[16] = header->group;
+    buf[17] = 0;
+    put16(buf + 18, header->fragment_size);
+    put32(buf + 20, header->timestamp >> 32);
+    put32(buf + 24, header->timestamp);
+}
+
+/******************************************************************************
+Description.: reads and checks the header of a packet
+Input Value.: the header to fill in, the packet and its size
+Return Value: 0 if OK, -1 if it is not a packet of a frame
+******************************************************************************/
+int udp_frame_read(udp_frame_header *header, const unsigned char *buf, int size)
+{
+    if(size < UDP_FRAME_HEADER_SIZE || buf[0] != 'M' || buf[1] != 'J' || buf[2] != UDP_FRAME_VERSION)
+        return -1;
+
+    header->flags = buf[3];
+    header->frame = get32(buf + 4);
+    header->size = get32(buf + 8);
+    header->index = get16(buf + 12);
+    header->fragments = get16(buf + 14);
+    header->group = buf[16];
+    header->fragment_size = get16(buf + 18);
+    header->timestamp = ((uint64_t)get32(buf + 20) << 32) | get32(buf + 24);
+
+    if(header->size == 0 || header->fragment_size == 0 ||
+       (uint32_t)header->fragments != (header->size + header->fragment_size - 1) / header->fragment_size ||
+       header->index >= header->fragments)
+        return -1;
+    if((header->flags & UDP_FRAME_PARITY) &&
+       (header->group == 0 || header->index % header->group != 0))
+        return -1;
+
+    return 0;
+}
+
+/******************************************************************************
+Description.: adds data to a parity
+Input Value.: the parity, the data and its size, which may be less than that
+              of the parity, as if the data was padded with zeros
+Return Value: -
+******************************************************************************/
+void udp_frame_xor(unsigned char *parity, const unsigned char *data, int size)
+{
+    int i;
+
+    for(i = 0; i < size; i++)
+        parity[i] ^= data[i];
+}
+
+/* the size of a fragment of the frame in progress */
+static int fragment_size(udp_receiver *r, int index)
+{
+    uint32_t offset = (uint32_t)index * r->header.fragment_size;
+
+    if(r->header.size - offset < (uint32_t)r->header.fragment_size)
+        return r->header.size - offset;
+    return r->header.fragment_size;
+}
+
+static int grow(unsigned char **p, size_t *capacity, size_t size)
+{
+    unsigned char *q;
+
+    if(size <= *capacity)
+        return 0;
+    if((q = realloc(*p, size)) == NULL)
+        return -1;
+    *p = q;
+    *capacity = size;
+    return 0;
+}
+
+/******************************************************************************
+Description.: starts the reassembly of a frame
+Input Value.: the receiver and the header of a packet of the frame
+Return Value: 0 if OK, -1 if there is not enough memory
+******************************************************************************/
+static int receiver_start(udp_receiver *r, const udp_frame_header *header)
+{
+    size_t groups = header->group ? (header->fragments + header->group - 1) / header->group : 0;
+
+    if(grow(&r->buf, &r->capacity, header->size) < 0 ||
+       grow(&r->have, &r->fragments, header->fragments) < 0 ||
+       grow(&r->parity, &r->parity_capacity, groups * header->fragment_size) < 0 ||
+       grow(&r->have_parity, &r->groups, groups) < 0)
+        return -1;
+
+    r->header = *header;
+    r->header.flags = 0;
+    r->active = 1;
+    r->complete = 0;
+    r->received = 0;
+    memset(r->have, 0, header->fragments);
+    memset(r->have_parity, 0, groups);
+    return 0;
+}
+
+/******************************************************************************
+Description.: recovers the fragment missing of a group from its parity, if
+              it is the only one
+Input Value.: the receiver and the group
+Return Value: -
+******************************************************************************/
+static void receiver_recover(udp_receiver *r, int group)
+{
+    int first = group * r->header.group, last = first + r->header.group, i, missing = -1;
+    unsigned char *parity = r->parity + (size_t)group * r->header.fragment_size;
+
+    if(!r->have_parity[group])
+        return;
+    if(last > r->header.fragments)
+        last = r->header.fragments;
+
+    for(i = first; i < last; i++) {
+        if(r->have[i])
+            continue;
+        if(missing >= 0)
+            return;
+        missing = i;
+    }
+    if(missing < 0)
+        return;
+
+    /* what is left of the parity without the others is the missing one */
+    for(i = first; i < last; i++) {
+        if(i != missing)
+            udp_frame_xor(parity, r->buf + (size_t)i * r->header.fragment_size, fragment_size(r, i));
+    }
+    memcpy(r->buf + (size_t)missing * r->header.fragment_size, parity, fragment_size(r, missing));
+    r->have[missing] = 1;
+    r->received++;
+    r->recovered++;
+}
+
+/******************************************************************************
+Description.: prepares a receiver
+Input Value.: the receiver
+Return Value: -
+******************************************************************************/
+void udp_receiver_init(udp_receiver *r)
+{
+    memset(r, 0, sizeof(udp_receiver));
+}
+
+/******************************************************************************
+Description.: takes a packet, a frame in progress is given up for a newer
+              one, and the packets of older frames are dropped
+Input Value.: the receiver, the packet and its size
+Return Value: 1 if it completed a frame, then r->buf holds r->header.size
+              bytes of it, 0 if not, -1 if it is not a packet of a frame or
+              there is not enough memory
+******************************************************************************/
+int udp_receiver_packet(udp_receiver *r, const unsigned char *packet, int size)
+{
+    udp_frame_header header;
+    const unsigned char *payload = packet + UDP_FRAME_HEADER_SIZE;
+    int length = size - UDP_FRAME_HEADER_SIZE, group;
+    int32_t age;
+
+    if(udp_frame_read(&header, packet, size) < 0)
+        return -1;
+
+    if(!r->active || header.frame != r->header.frame) {
+        age = header.frame - r->header.frame;
+        if(r->active && age < 0 && age > -UDP_FRAME_RESTART)
+            return 0;
+
+        if(r->active && !r->complete)
+            r->lost++;
+        if(r->active && age > 1)
+            r->lost += age - 1;
+        if(receiver_start(r, &header) < 0)
+            return -1;
+    }
+
+    if(r->complete)
+        return 0;
+    if(header.size != r->header.size || header.fragment_size != r->header.fragment_size ||
+       header.group != r->header.group || length != fragment_size(r, header.index))
+        return -1;
+
+    group = header.group ? header.index / header.group : 0;
+    if(header.flags & UDP_FRAME_PARITY) {
+        if(r->have_parity[group])
+            return 0;
+        memcpy(r->parity + (size_t)group * header.fragment_size, payload, length);
+        r->have_parity[group] = 1;
+    } else {
+        if(r->have[header.index])
+            return 0;
+        memcpy(r->buf + (size_t)header.index * header.fragment_size, payload, length);
+        r->have[header.index] = 1;
+        r->received++;
+    }
+
+    if(header.group)
+        receiver_recover(r, group);
+
+    if(r->received < r->header.fragments)
+        return 0;
+
+    r->complete = 1;
+    r->frames++;
+    return 1;
+}
+
+/******************************************************************************
+Description.: frees the memory of a receiver
+Input Value.: the receiver
+Return Value: -
+******************************************************************************/
+void udp_receiver_free(udp_receiver *r)
+{
+    free(r->buf);
+    free(r->have);
+    free(r->parity);
+    free(r->have_parity);
+    memset(r, 0, sizeof(udp_receiver));
+}
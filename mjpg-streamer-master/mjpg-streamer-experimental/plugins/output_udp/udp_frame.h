@@ -0,0 +1,116 @@
+/*******************************************************************************
+#                                                                              #
+#      MJPG-streamer allows to stream JPG frames from an input-plugin          #
+#      to several output plugins                                               #
+#                                                                              #
+#      Copyright (C) 2007 Tom Stöveken                                         #
+#                                                                              #
+# This program is free software; you can redistribute it and/or modify         #
+# it under the terms of the GNU General Public License as published by         #
+# the Free Software Foundation; version 2 of the License.                      #
+#                                                                              #
+# This program is distributed in the hope that it will be useful,              #
+# but WITHOUT ANY WARRANTY; without even the implied warranty of               #
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the                #
+# GNU General Public License for more details.                                 #
+#                                                                              #
+# You should have received a copy of the GNU General Public License            #
+# along with this program; if not, write to the Free Software                  #
+# Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA    #
+#                                                                              #
+*******************************************************************************/
+
+/*
+ * The frames pushed by output_udp: each JPEG is split into fragments of the
+ * same size but the last, each sent in a datagram of its own after a header.
+ * With parity, each group of fragments is followed by a parity packet, the
+ * XOR of the fragments of the group padded with zeros to the first one, so a
+ * receiver can recover one lost fragment per group.
+ *
+ * The header, all numbers big endian:
+ *
+ *     0  magic "MJ"
+ *     2  version, UDP_FRAME_VERSION
+ *     3  flags, UDP_FRAME_PARITY for a parity packet
+ *     4  number of the frame, counting up from 1
+ *     8  size of the frame
+ *    12  number of the fragment, for parity that of the first of the group
+ *    14  fragments of the frame, without parity
+ *    16  fragments per parity group, 0 without parity
+ *    17  reserved, 0
+ *    18  size of the fragments
+ *    20  capture time of the frame, microseconds since the epoch
+ */
+
+#ifndef UDP_FRAME_H
+#define UDP_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define UDP_FRAME_VERSION 1
+#define UDP_FRAME_PARITY 0x01
+#define UDP_FRAME_HEADER_SIZE 28
+
+/* bytes of a datagram at most, header included, to stay below the usual MTU */
+#define UDP_DATAGRAM_SIZE 1400
+#define UDP_FRAGMENT_SIZE (UDP_DATAGRAM_SIZE - UDP_FRAME_HEADER_SIZE)
+
+/*
+ * messages a receiver sends to the port of output_udp, each followed by a
+ * space and a cookie. UDP_SUBSCRIBE with a wrong cookie, all zeros say, is
+ * answered with UDP_COOKIE, a space and the cookie of the address of the
+ * receiver, and only messages with that cookie are acted upon and echoed
+ * back. So a sender that spoofs the address of another host cannot have the
+ * frames pushed to it.
+ */
+#define UDP_SUBSCRIBE "MJPG-SUBSCRIBE"
+#define UDP_UNSUBSCRIBE "MJPG-UNSUBSCRIBE"
+#define UDP_COOKIE "MJPG-COOKIE"
+
+/* characters of a cookie, hexadecimal */
+#define UDP_COOKIE_SIZE 16
+
+/* seconds a subscription lasts, a receiver sends UDP_SUBSCRIBE again before */
+#define UDP_SUBSCRIBE_TIMEOUT 10
+
+typedef struct {
+    int flags;
+    uint32_t frame;
+    uint32_t size;
+    int index;
+    int fragments;
+    int group;
+    int fragment_size;
+    uint64_t timestamp;
+} udp_frame_header;
+
+/* reassembles the frames from the packets, keeping the newest frame only */
+typedef struct {
+    udp_frame_header header;    /* of the frame in progress */
+    int active, complete;
+    unsigned char *buf;         /* the frame */
+    size_t capacity;
+    unsigned char *have;        /* for each fragment, if it is in buf */
+    size_t fragments;           /* room in have */
+    int received;
+    unsigned char *parity;      /* the parity of each group */
+    size_t parity_capacity;
+    unsigned char *have_parity;
+    size_t groups;              /* room in have_parity */
+
+    /* statistics */
+    unsigned long frames;       /* complete */
+    unsigned long lost;         /* incomplete or never seen */
+    unsigned long recovered;    /* fragments, from the parity */
+} udp_receiver;
+
+void udp_frame_write(unsigned char *buf, const udp_frame_header *header);
+int udp_frame_read(udp_frame_header *header, const unsigned char *buf, int size);
+void udp_frame_xor(unsigned char *parity, const unsigned char *data, int size);
+
+void udp_receiver_init(udp_receiver *r);
+int udp_receiver_packet(udp_receiver *r, const unsigned char *packet, int size);
+void udp_receiver_free(udp_receiver *r);
+
+#endif
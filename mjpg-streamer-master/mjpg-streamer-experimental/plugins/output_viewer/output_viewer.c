@@ -38,7 +38,7 @@
 
 static pthread_t worker;
 static globals *pglobal;
-static unsigned char *frame = NULL;
+static input_frame *frame = NULL;
 static int input_number = 0;
 
 /******************************************************************************
@@ -70,7 +70,10 @@ void worker_cleanup(void *arg)
     first_run = 0;
     OPRINT("cleaning up resources allocated by worker thread\n");
 
-    free(frame);
+    if(frame != NULL) {
+        input_frame_release(frame);
+        frame = NULL;
+    }
     SDL_Quit();
 }
 
@@ -252,7 +255,8 @@ Return Value:
 ******************************************************************************/
 void *worker_thread(void *arg)
 {
-    int frame_size = 0, firstrun = 1;
+    int firstrun = 1;
+    unsigned int seq = 0;
 
     SDL_Surface *screen = NULL, *image = NULL;
     decompressed_image rgbimage;
@@ -267,31 +271,26 @@ void *worker_thread(void *arg)
         exit(EXIT_FAILURE);
     }
 
-    /* just allocate a large buffer for the JPEGs */
-    if((frame = malloc(4096 * 1024)) == NULL) {
-        OPRINT("not enough memory for worker thread\n");
-        exit(EXIT_FAILURE);
-    }
-
     /* set cleanup handler to cleanup allocated resources */
     pthread_cleanup_push(worker_cleanup, NULL);
 
     while(!pglobal->stop) {
         DBG("waiting for fresh frame\n");
-        pthread_mutex_lock(&pglobal->in[input_number].db);
-        pthread_cond_wait(&pglobal->in[input_number].db_update, &pglobal->in[input_number].db);
-
-        /* read buffer */
-        frame_size = pglobal->in[input_number].size;
-        memcpy(frame, pglobal->in[input_number].buf, frame_size);
-
-        pthread_mutex_unlock(&pglobal->in[input_number].db);
+        if((frame = input_frame_wait(&pglobal->in[input_number], seq)) == NULL) {
+            OPRINT("not enough memory for worker thread\n");
+            exit(EXIT_FAILURE);
+        }
+        seq = frame->seq;
 
         /* decompress the JPEG and store results in memory */
-        if(decompress_jpeg(frame, frame_size, &rgbimage)) {
+        if(decompress_jpeg(frame->buf, frame->size, &rgbimage)) {
             DBG("could not properly decompress JPEG data\n");
+            input_frame_release(frame);
+            frame = NULL;
             continue;
         }
+        input_frame_release(frame);
+        frame = NULL;
 
         if(firstrun) {
             /* create the primary surface (the visible window) */